@@ -35,13 +35,26 @@
  *   entering pause.)
  * * After setting the pump_quit flag, signal on alsa_cond AND the poll_pipe
  *   before joining the thread.
+ *
+ * In low-latency mode ("mmap" setting) the device is opened for MMAP access
+ * and a different pump copies straight into the hardware buffer.  Audio is
+ * handed over through a single-producer, single-consumer ring without taking
+ * alsa_mutex: write_audio() only advances ring_head and the pump only
+ * advances ring_tail.  The pump sleeps in poll() when there is nothing to do
+ * and is woken through the poll_pipe; period_wait() sleeps on ring_sem and is
+ * woken by the pump.  At most one period is queued in the ring, so that the
+ * latency stays close to that of the hardware buffer.  Flush, pause and drain
+ * are rare, so they simply stop the pump (with alsa_mutex locked) while they
+ * touch the device.
  */
 
 #include <assert.h>
 #include <errno.h>
 #include <poll.h>
 #include <pthread.h>
+#include <semaphore.h>
 #include <stdint.h>
+#include <string.h>
 #include <time.h>
 #include <unistd.h>
 
@@ -87,6 +100,20 @@ static pollfd * poll_handles;
 static bool pump_quit;
 static pthread_t pump_thread;
 
+/* low-latency mode */
+static bool alsa_mmap;
+static int mmap_period, mmap_buffer; /* frames */
+static int mmap_frame_size; /* bytes */
+static int mmap_hw_delay; /* frames, as last seen by the pump */
+static int xrun_count;
+static bool pump_failed, pump_running;
+
+static Index<char> ring_data;
+static unsigned ring_frames; /* power of 2 */
+static unsigned ring_head, ring_tail; /* frames written and played, wrapping */
+static bool ring_idle, ring_waiting;
+static sem_t ring_sem;
+
 static snd_mixer_t * alsa_mixer;
 static snd_mixer_elem_t * alsa_mixer_element;
 static snd_mixer_elem_t * extra_alsa_mixer_element;
@@ -117,9 +144,10 @@ static bool poll_setup ()
     return true;
 }
 
-static void poll_sleep ()
+/* with pipe_only, sleep until poll_wake() regardless of the device */
+static void poll_sleep (bool pipe_only = false)
 {
-    if (poll (poll_handles, poll_count, -1) < 0)
+    if (poll (poll_handles, pipe_only ? 1 : poll_count, -1) < 0)
     {
         AUDERR ("Failed to poll: %s.\n", strerror (errno));
         return;
@@ -220,10 +248,15 @@ static void * pump (void *)
     return nullptr;
 }
 
-static void pump_start ()
+static bool pump_start ()
 {
     AUDDBG ("Starting pump.\n");
-    pthread_create (& pump_thread, nullptr, pump, nullptr);
+
+    int error = pthread_create (& pump_thread, nullptr, pump, nullptr);
+    if (error)
+        AUDERR ("Failed to start pump: %s.\n", strerror (error));
+
+    return ! error;
 }
 
 static void pump_stop ()
@@ -238,6 +271,256 @@ static void pump_stop ()
     pump_quit = false;
 }
 
+static int ring_used ()
+{
+    return __atomic_load_n (& ring_head, __ATOMIC_SEQ_CST) - __atomic_load_n (& ring_tail, __ATOMIC_SEQ_CST);
+}
+
+static void ring_copy_in (const char * data, unsigned head, int frames)
+{
+    int pos = head & (ring_frames - 1);
+    int part = aud::min (frames, (int) ring_frames - pos);
+
+    memcpy (& ring_data[pos * mmap_frame_size], data, part * mmap_frame_size);
+    memcpy (& ring_data[0], data + part * mmap_frame_size, (frames - part) * mmap_frame_size);
+}
+
+static void ring_copy_out (char * data, unsigned tail, int frames)
+{
+    int pos = tail & (ring_frames - 1);
+    int part = aud::min (frames, (int) ring_frames - pos);
+
+    memcpy (data, & ring_data[pos * mmap_frame_size], part * mmap_frame_size);
+    memcpy (data + part * mmap_frame_size, & ring_data[0], (frames - part) * mmap_frame_size);
+}
+
+/* wakes period_wait() or drain() if it is waiting for the pump */
+static void ring_signal ()
+{
+    if (__atomic_exchange_n (& ring_waiting, false, __ATOMIC_SEQ_CST))
+        sem_post (& ring_sem);
+}
+
+/* returns false if the device cannot be recovered */
+static bool mmap_recover (int error)
+{
+    if (error == -EPIPE)
+    {
+        xrun_count ++;
+        AUDDBG ("Underrun (%d so far).\n", xrun_count);
+    }
+
+    error = snd_pcm_recover (alsa_handle, error, 1);
+    if (error < 0)
+    {
+        AUDERR ("snd_pcm_recover failed: %s.\n", snd_strerror (error));
+        return false;
+    }
+
+    return true;
+}
+
+static void * mmap_pump (void *)
+{
+    while (! __atomic_load_n (& pump_quit, __ATOMIC_SEQ_CST))
+    {
+        unsigned tail = ring_tail;
+        int ready = __atomic_load_n (& ring_head, __ATOMIC_SEQ_CST) - tail;
+
+        /* alsa_paused only changes while the pump is stopped */
+        if (alsa_paused || ! ready)
+        {
+            __atomic_store_n (& ring_idle, true, __ATOMIC_SEQ_CST);
+
+            /* check again, in case write_audio() missed the flag */
+            if (alsa_paused || __atomic_load_n (& ring_head, __ATOMIC_SEQ_CST) == tail)
+                poll_sleep (true);
+
+            __atomic_store_n (& ring_idle, false, __ATOMIC_SEQ_CST);
+            continue;
+        }
+
+        snd_pcm_sframes_t avail = snd_pcm_avail_update (alsa_handle);
+        if (avail < 0)
+        {
+            if (! mmap_recover (avail))
+                break;
+            continue;
+        }
+
+        /* write whole periods unless that is all the audio we have */
+        if (avail < aud::min (mmap_period, ready))
+        {
+            poll_sleep ();
+            continue;
+        }
+
+        const snd_pcm_channel_area_t * areas;
+        snd_pcm_uframes_t offset, frames = aud::min ((int) avail, ready);
+
+        int error = snd_pcm_mmap_begin (alsa_handle, & areas, & offset, & frames);
+        if (error < 0)
+        {
+            if (! mmap_recover (error))
+                break;
+            continue;
+        }
+
+        char * dest = (char *) areas[0].addr + (areas[0].first + offset * areas[0].step) / 8;
+        ring_copy_out (dest, tail, frames);
+
+        snd_pcm_sframes_t committed = snd_pcm_mmap_commit (alsa_handle, offset, frames);
+        if (committed < 0 || committed != (snd_pcm_sframes_t) frames)
+        {
+            if (! mmap_recover (committed < 0 ? committed : -EPIPE))
+                break;
+            continue;
+        }
+
+        __atomic_store_n (& ring_tail, tail + frames, __ATOMIC_SEQ_CST);
+        __atomic_store_n (& mmap_hw_delay, mmap_buffer - (int) (avail - frames), __ATOMIC_RELAXED);
+
+        ring_signal ();
+    }
+
+    if (! __atomic_load_n (& pump_quit, __ATOMIC_SEQ_CST))
+    {
+        AUDERR ("Low-latency output failed, discarding audio.\n");
+        __atomic_store_n (& pump_failed, true, __ATOMIC_SEQ_CST);
+        __atomic_store_n (& ring_waiting, true, __ATOMIC_SEQ_CST);
+        ring_signal ();
+    }
+
+    return nullptr;
+}
+
+/* called with alsa_mutex locked; the mutex is not needed by the pump itself.
+ * If the thread cannot be started, the pump counts as failed, so that writes
+ * are dropped rather than blocking forever. */
+static bool mmap_pump_start ()
+{
+    AUDDBG ("Starting low-latency pump.\n");
+    pump_failed = false;
+
+    int error = pthread_create (& pump_thread, nullptr, mmap_pump, nullptr);
+    if (error)
+    {
+        AUDERR ("Failed to start low-latency pump: %s.\n", strerror (error));
+        __atomic_store_n (& pump_failed, true, __ATOMIC_SEQ_CST);
+    }
+
+    pump_running = ! error;
+    return ! error;
+}
+
+static void mmap_pump_stop ()
+{
+    if (! pump_running)
+        return;
+
+    AUDDBG ("Stopping low-latency pump.\n");
+    __atomic_store_n (& pump_quit, true, __ATOMIC_SEQ_CST);
+    poll_wake ();
+    pthread_join (pump_thread, nullptr);
+    pump_quit = false;
+    pump_running = false;
+}
+
+/* waits for the pump to play from the ring, until fewer than <frames> are left */
+static void mmap_wait_used (int frames)
+{
+    while (ring_used () > frames && ! __atomic_load_n (& pump_failed, __ATOMIC_SEQ_CST))
+    {
+        __atomic_store_n (& ring_waiting, true, __ATOMIC_SEQ_CST);
+
+        if (ring_used () > frames && ! __atomic_load_n (& pump_failed, __ATOMIC_SEQ_CST))
+            sem_wait (& ring_sem);
+
+        __atomic_store_n (& ring_waiting, false, __ATOMIC_SEQ_CST);
+    }
+}
+
+static void mmap_drain ()
+{
+    mmap_wait_used (0);
+
+    pthread_mutex_lock (& alsa_mutex);
+    mmap_pump_stop ();
+
+    /* blocks until the hardware buffer has played */
+    CHECK (snd_pcm_drain, alsa_handle);
+    CHECK (snd_pcm_prepare, alsa_handle);
+
+FAILED:
+    mmap_hw_delay = 0;
+    mmap_pump_start ();
+    pthread_mutex_unlock (& alsa_mutex);
+}
+
+/* called with alsa_mutex locked */
+static void mmap_flush ()
+{
+    mmap_pump_stop ();
+
+    CHECK (snd_pcm_drop, alsa_handle);
+    CHECK (snd_pcm_prepare, alsa_handle);
+
+FAILED:
+    ring_tail = ring_head;
+    mmap_hw_delay = 0;
+    alsa_paused_delay = 0;
+
+    /* interrupt period wait */
+    __atomic_store_n (& ring_waiting, true, __ATOMIC_SEQ_CST);
+    ring_signal ();
+
+    mmap_pump_start ();
+}
+
+static bool mmap_setup (snd_pcm_hw_params_t * params, String & error)
+{
+    snd_pcm_sw_params_t * sw_params;
+    snd_pcm_uframes_t period = aud::clamp (aud_get_int ("alsa", "mmap_period"), 16, 8192);
+    snd_pcm_uframes_t buffer = period * aud::clamp (aud_get_int ("alsa", "mmap_periods"), 2, 16);
+    int direction = 0;
+
+    CHECK_STR (error, snd_pcm_hw_params_set_period_size_near, alsa_handle, params,
+     & period, & direction);
+    CHECK_STR (error, snd_pcm_hw_params_set_buffer_size_near, alsa_handle, params, & buffer);
+    CHECK_STR (error, snd_pcm_hw_params, alsa_handle, params);
+
+    /* start as soon as there is a period to play */
+    snd_pcm_sw_params_alloca (& sw_params);
+    CHECK_STR (error, snd_pcm_sw_params_current, alsa_handle, sw_params);
+    CHECK_STR (error, snd_pcm_sw_params_set_avail_min, alsa_handle, sw_params, period);
+    CHECK_STR (error, snd_pcm_sw_params_set_start_threshold, alsa_handle, sw_params, period);
+    CHECK_STR (error, snd_pcm_sw_params, alsa_handle, sw_params);
+    CHECK_STR (error, snd_pcm_prepare, alsa_handle);
+
+    mmap_period = period;
+    mmap_buffer = buffer;
+    mmap_frame_size = snd_pcm_frames_to_bytes (alsa_handle, 1);
+    mmap_hw_delay = 0;
+    xrun_count = 0;
+    pump_failed = false;
+
+    /* the ring is only ever filled up to one period (see period_wait) */
+    for (ring_frames = 1; ring_frames < (unsigned) mmap_period; ring_frames <<= 1)
+        ;
+
+    ring_data.insert (0, ring_frames * mmap_frame_size);
+    ring_head = ring_tail = 0;
+    ring_idle = ring_waiting = false;
+
+    AUDINFO ("Low-latency mode: period %d frames, buffer %d frames (%d ms).\n",
+     mmap_period, mmap_buffer, aud::rescale (mmap_buffer, alsa_rate, 1000));
+
+    return true;
+
+FAILED:
+    return false;
+}
+
 static void start_playback ()
 {
     AUDDBG ("Starting playback.\n");
@@ -262,6 +545,7 @@ bool ALSAPlugin::init ()
     AUDDBG ("Initialize.\n");
     init_config ();
     open_mixer ();
+    sem_init (& ring_sem, 0, 0);
     return true;
 }
 
@@ -269,6 +553,7 @@ void ALSAPlugin::cleanup ()
 {
     AUDDBG ("Cleanup.\n");
     close_mixer ();
+    sem_destroy (& ring_sem);
 }
 
 static snd_pcm_format_t convert_aud_format (int aud_format)
@@ -336,8 +621,19 @@ bool ALSAPlugin::open_audio (int aud_format, int rate, int channels, String & er
     snd_pcm_hw_params_t * params;
     snd_pcm_hw_params_alloca (& params);
     CHECK_STR (error, snd_pcm_hw_params_any, alsa_handle, params);
-    CHECK_STR (error, snd_pcm_hw_params_set_access, alsa_handle, params,
-     SND_PCM_ACCESS_RW_INTERLEAVED);
+
+    alsa_mmap = aud_get_bool ("alsa", "mmap");
+    if (alsa_mmap && snd_pcm_hw_params_set_access (alsa_handle, params,
+     SND_PCM_ACCESS_MMAP_INTERLEAVED) < 0)
+    {
+        AUDERR ("w:PCM device %s does not support MMAP access, low-latency mode disabled.\n",
+         (const char *) pcm);
+        alsa_mmap = false;
+    }
+
+    if (! alsa_mmap)
+        CHECK_STR (error, snd_pcm_hw_params_set_access, alsa_handle, params,
+         SND_PCM_ACCESS_RW_INTERLEAVED);
 
     CHECK_STR (error, snd_pcm_hw_params_set_format, alsa_handle, params, format);
     CHECK_STR (error, snd_pcm_hw_params_set_channels, alsa_handle, params, channels);
@@ -347,36 +643,49 @@ bool ALSAPlugin::open_audio (int aud_format, int rate, int channels, String & er
     alsa_channels = channels;
     alsa_rate = rate;
 
-    total_buffer = aud_get_int (nullptr, "output_buffer_size");
-    useconds = 1000 * aud::min (1000, total_buffer / 2);
-    direction = 0;
-    CHECK_STR (error, snd_pcm_hw_params_set_buffer_time_near, alsa_handle,
-     params, & useconds, & direction);
-    hard_buffer = useconds / 1000;
-
-    useconds = 1000 * (hard_buffer / 4);
-    direction = 0;
-    CHECK_STR (error, snd_pcm_hw_params_set_period_time_near, alsa_handle,
-     params, & useconds, & direction);
-    alsa_period = useconds / 1000;
-
-    CHECK_STR (error, snd_pcm_hw_params, alsa_handle, params);
-
-    soft_buffer = aud::max (total_buffer / 2, total_buffer - hard_buffer);
-    AUDINFO ("Buffer: hardware %d ms, software %d ms, period %d ms.\n",
-     hard_buffer, soft_buffer, alsa_period);
-
-    buffer_frames = aud::rescale<int64_t> (soft_buffer, 1000, rate);
-    alsa_buffer.alloc (snd_pcm_frames_to_bytes (alsa_handle, buffer_frames));
-
-    alsa_prebuffer = true;
+    alsa_prebuffer = ! alsa_mmap;
     alsa_paused = false;
     alsa_paused_delay = 0;
 
+    if (alsa_mmap)
+    {
+        if (! mmap_setup (params, error))
+            goto FAILED;
+    }
+    else
+    {
+        total_buffer = aud_get_int (nullptr, "output_buffer_size");
+        useconds = 1000 * aud::min (1000, total_buffer / 2);
+        direction = 0;
+        CHECK_STR (error, snd_pcm_hw_params_set_buffer_time_near, alsa_handle,
+         params, & useconds, & direction);
+        hard_buffer = useconds / 1000;
+
+        useconds = 1000 * (hard_buffer / 4);
+        direction = 0;
+        CHECK_STR (error, snd_pcm_hw_params_set_period_time_near, alsa_handle,
+         params, & useconds, & direction);
+        alsa_period = useconds / 1000;
+
+        CHECK_STR (error, snd_pcm_hw_params, alsa_handle, params);
+
+        soft_buffer = aud::max (total_buffer / 2, total_buffer - hard_buffer);
+        AUDINFO ("Buffer: hardware %d ms, software %d ms, period %d ms.\n",
+         hard_buffer, soft_buffer, alsa_period);
+
+        buffer_frames = aud::rescale<int64_t> (soft_buffer, 1000, rate);
+        alsa_buffer.alloc (snd_pcm_frames_to_bytes (alsa_handle, buffer_frames));
+    }
+
     if (! poll_setup ())
         goto FAILED;
 
-    pump_start ();
+    if (! (alsa_mmap ? mmap_pump_start () : pump_start ()))
+    {
+        error = String ("Failed to start output thread");
+        poll_cleanup ();
+        goto FAILED;
+    }
 
     pthread_mutex_unlock (& alsa_mutex);
     return true;
@@ -388,6 +697,9 @@ FAILED:
         alsa_handle = nullptr;
     }
 
+    alsa_buffer.destroy ();
+    ring_data.clear ();
+
     pthread_mutex_unlock (& alsa_mutex);
     return false;
 }
@@ -399,11 +711,21 @@ void ALSAPlugin::close_audio ()
 
     assert (alsa_handle);
 
-    pump_stop ();
+    if (alsa_mmap)
+    {
+        mmap_pump_stop ();
+
+        AUDINFO ("Low-latency mode: %d underruns.\n", xrun_count);
+        aud_set_int ("alsa", "_xruns", xrun_count);
+    }
+    else
+        pump_stop ();
+
     CHECK (snd_pcm_drop, alsa_handle);
 
 FAILED:
     alsa_buffer.destroy ();
+    ring_data.clear ();
     poll_cleanup ();
     snd_pcm_close (alsa_handle);
     alsa_handle = nullptr;
@@ -411,8 +733,29 @@ FAILED:
     pthread_mutex_unlock (& alsa_mutex);
 }
 
+static int mmap_write_audio (const void * data, int length)
+{
+    /* keep the device fed by a dead pump from blocking playback */
+    if (__atomic_load_n (& pump_failed, __ATOMIC_SEQ_CST))
+        return length;
+
+    unsigned head = ring_head;
+    int frames = aud::min (length / mmap_frame_size, mmap_period - ring_used ());
+
+    ring_copy_in ((const char *) data, head, frames);
+    __atomic_store_n (& ring_head, head + frames, __ATOMIC_SEQ_CST);
+
+    if (__atomic_exchange_n (& ring_idle, false, __ATOMIC_SEQ_CST))
+        poll_wake ();
+
+    return frames * mmap_frame_size;
+}
+
 int ALSAPlugin::write_audio (const void * data, int length)
 {
+    if (alsa_mmap)
+        return mmap_write_audio (data, length);
+
     pthread_mutex_lock (& alsa_mutex);
 
     length = aud::min (length, alsa_buffer.space ());
@@ -427,6 +770,12 @@ int ALSAPlugin::write_audio (const void * data, int length)
 
 void ALSAPlugin::period_wait ()
 {
+    if (alsa_mmap)
+    {
+        mmap_wait_used (mmap_period - 1);
+        return;
+    }
+
     pthread_mutex_lock (& alsa_mutex);
 
     while (! alsa_buffer.space ())
@@ -448,6 +797,13 @@ void ALSAPlugin::period_wait ()
 void ALSAPlugin::drain ()
 {
     AUDDBG ("Drain.\n");
+
+    if (alsa_mmap)
+    {
+        mmap_drain ();
+        return;
+    }
+
     pthread_mutex_lock (& alsa_mutex);
 
     assert (! alsa_paused);
@@ -490,6 +846,15 @@ int ALSAPlugin::get_delay ()
 {
     pthread_mutex_lock (& alsa_mutex);
 
+    if (alsa_mmap)
+    {
+        int hw_delay = alsa_paused ? alsa_paused_delay :
+         aud::rescale (__atomic_load_n (& mmap_hw_delay, __ATOMIC_RELAXED), alsa_rate, 1000);
+
+        pthread_mutex_unlock (& alsa_mutex);
+        return aud::rescale (ring_used (), alsa_rate, 1000) + hw_delay;
+    }
+
     int buffered = snd_pcm_bytes_to_frames (alsa_handle, alsa_buffer.len ());
     int delay = aud::rescale (buffered, alsa_rate, 1000);
 
@@ -507,6 +872,13 @@ void ALSAPlugin::flush ()
     AUDDBG ("Seek requested; discarding buffer.\n");
     pthread_mutex_lock (& alsa_mutex);
 
+    if (alsa_mmap)
+    {
+        mmap_flush ();
+        pthread_mutex_unlock (& alsa_mutex);
+        return;
+    }
+
     CHECK (snd_pcm_drop, alsa_handle);
 
 FAILED:
@@ -525,6 +897,9 @@ void ALSAPlugin::pause (bool pause)
     AUDDBG ("%sause.\n", pause ? "P" : "Unp");
     pthread_mutex_lock (& alsa_mutex);
 
+    if (alsa_mmap)
+        mmap_pump_stop ();
+
     alsa_paused = pause;
 
     if (! alsa_prebuffer)
@@ -537,7 +912,9 @@ void ALSAPlugin::pause (bool pause)
     }
 
 DONE:
-    if (! alsa_prebuffer && ! pause)
+    if (alsa_mmap)
+        mmap_pump_start ();
+    else if (! alsa_prebuffer && ! pause)
         pthread_cond_broadcast (& alsa_cond);
 
     pthread_mutex_unlock (& alsa_mutex);
@@ -244,6 +244,9 @@ static void guess_element ()
 const char * const ALSAPlugin::defaults[] = {
     "pcm", "default",
     "mixer", "default",
+    "mmap", "FALSE",
+    "mmap_period", "128",
+    "mmap_periods", "3",
     nullptr
 };
 
@@ -311,7 +314,17 @@ const PreferencesWidget ALSAPlugin::widgets[] = {
         {nullptr, element_combo_fill}),
     WidgetCombo (N_("Extra Mixer element?:"),
         WidgetString ("alsa", "mixer-element-extra", element_changed, "alsa mixer changed"),
-        {nullptr, extra_element_combo_fill})
+        {nullptr, extra_element_combo_fill}),
+    WidgetCheck (N_("Low-latency mode (MMAP)"),
+        WidgetBool ("alsa", "mmap")),
+    WidgetSpin (N_("Period size:"),
+        WidgetInt ("alsa", "mmap_period"),
+        {16, 8192, 16, N_("frames")},
+        WIDGET_CHILD),
+    WidgetSpin (N_("Periods per buffer:"),
+        WidgetInt ("alsa", "mmap_periods"),
+        {2, 16, 1},
+        WIDGET_CHILD)
 };
 
 static void alsa_prefs_init ()
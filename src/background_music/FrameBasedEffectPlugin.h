@@ -23,10 +23,7 @@
 
 class FrameBasedEffectPlugin : public EffectPlugin
 {
-    Index<float> frame_in;
-    Index<float> frame_out;
-    Index<float> output;
-    int current_channels = 0, current_rate = 0, channel_last_read = 0;
+    int current_rate = 0;
     LoudnessFrameProcessor detection;
 
 public:
@@ -43,53 +40,26 @@ public:
         return true;
     }
 
-    void cleanup() final
-    {
-        output.clear();
-        frame_in.clear();
-        frame_out.clear();
-    }
+    void cleanup() final { detection.cleanup(); }
 
     void start(int & channels, int & rate) final
     {
-        current_channels = channels;
         current_rate = rate;
-        channel_last_read = 0;
 
         detection.start(channels, rate);
-        frame_in.resize(current_channels);
-        frame_out.resize(current_channels);
 
         flush(false);
     }
 
     Index<float> & process(Index<float> & data) final
     {
-        detection.update_config();
-
-        int output_samples = 0;
-        output.resize(0);
-
-        // It is assumed data always contains a multiple of channels, but we
-        // don't care.
-        for (const float sample : data)
-        {
-            frame_in[channel_last_read++] = sample;
-            if (channel_last_read == current_channels)
-            {
-                // Processing happens per frame. Because of read-ahead there is
-                // not always output available yet.
-                if (detection.process_has_output(frame_in, frame_out))
-                {
-                    output.move_from(frame_out, 0, output_samples,
-                                     current_channels, true, false);
-                    output_samples += current_channels;
-                }
-                channel_last_read = 0;
-            }
-        }
-
-        return output;
+        // Audio is always passed in whole frames. Because of read-ahead, the
+        // output lags behind and is initially shorter than the input.
+        const int channels = detection.channels();
+        const int frames =
+            detection.process(data.begin(), data.len() / channels);
+        data.remove(frames * channels, -1);
+        return data;
     }
 
     bool flush(bool force) final
@@ -22,7 +22,13 @@
 #include <algorithm>
 #include <cmath>
 #include <cstdint>
-#include <libfauxdcore/ringbuf.h>
+#include <libfauxdcore/index.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#endif
 
 /**
  * Tools to detect perceived loudness.
@@ -77,51 +83,41 @@ struct Loudness
     }
 };
 
+/**
+ * Detects perceived loudness as the maximum of weighted mean squares over a
+ * range of window sizes.
+ * Samples are processed in blocks. All windows are computed from a single
+ * history of running (prefix) sums: the sum over a window is the difference
+ * of two prefix sums, which is exact in integer arithmetic and lets each
+ * window be evaluated over a whole block with SIMD, without per-window state.
+ */
 class PerceptiveRMS
 {
+public:
+    /** Largest number of samples passed to get_mean_squared at once. */
+    static constexpr int BLOCK = 256;
+
+private:
     static constexpr int STEPS = 24;
     static constexpr float INPUT_SCALE = 4e9f;
     static constexpr float OUTPUT_SCALE = 1.0f / INPUT_SCALE;
 
-    class WindowedRMS
+    struct Window
     {
-        uint64_t window_sum_ = 0;
-        int window_size_ = 0;
-        int latency_minus_one = 0;
-        float scale_ = 0.0;
-        float output_ = 0.0;
-
-    public:
-
-        float add_and_take_and_get(uint64_t add, uint64_t take)
-        {
-            window_sum_ += add;
-            window_sum_ -= take;
-            const auto sum = static_cast<float>(window_sum_);
-            output_ = scale_ * sum;
-            return output_;
-        }
-
-        void configure(const Loudness::Metrics & metrics)
-        {
-            window_size_ = metrics.window_samples;
-            latency_minus_one = std::max(0, metrics.latency_samples - 1);
-            scale_ = metrics.weight * metrics.weight /
-                     static_cast<float>(window_size_);
-            window_sum_ = 0;
-            output_ = 0;
-        }
-
-        [[nodiscard]] int delayed_sample_index() const
-        {
-            return latency_minus_one;
-        }
+        int span = 0; // distance between the subtracted prefix sums
+        float scale = 0;
     };
 
-    RingBuf<uint64_t> buffer_;
-    WindowedRMS rms_[STEPS + 1];
+    /*
+     * prefix_[0 .. latency_) holds the last latency_ prefix sums of the
+     * previous block, followed by those of the current block.
+     */
+    Index<uint64_t> prefix_;
+    Index<float> maximum_;
+    Window windows_[STEPS + 1];
     int sample_rate_ = 0;
     int latency_ = 0;
+    float max_internal_value_ = 0;
     FastAttackSmoothRelease smooth_release_;
     const float peak_weight_ = Loudness::get_weight(0.0);
 
@@ -134,16 +130,86 @@ class PerceptiveRMS
 
         for (int step = 0; step <= STEPS; step++)
         {
-            rms_[step].configure(
-                Loudness::get_metrics(step, STEPS, sample_rate_));
+            const auto metrics =
+                Loudness::get_metrics(step, STEPS, sample_rate_);
+            /*
+             * The widest window spans the whole history, the others end one
+             * sample short of their latency.
+             */
+            windows_[step].span =
+                step ? std::max(0, metrics.latency_samples - 1) : latency_;
+            windows_[step].scale = metrics.weight * metrics.weight /
+                                   static_cast<float>(metrics.window_samples);
         }
+
+        /*
+         * Window sums are converted through double precision, which is exact
+         * below 2^52. Out-of-range input is clipped to stay below that.
+         */
+        max_internal_value_ = 4503599627370496.0f / (latency_ + 1);
     }
 
-    [[nodiscard]] uint64_t static squared_value_to_internal_value(
-        const float squared_value)
+    [[nodiscard]] uint64_t squared_value_to_internal_value(
+        const float squared_value) const
     {
         return static_cast<uint64_t>(
-            fabsf(std::round(squared_value * INPUT_SCALE)));
+            std::min(fabsf(std::round(squared_value * INPUT_SCALE)),
+                     max_internal_value_));
+    }
+
+    /**
+     * maximum[i] = max(maximum[i], scale * (now[i] - then[i])) for 0 <= i < n
+     */
+    static void window_maximum(const uint64_t * now, const uint64_t * then,
+                               const float scale, float * maximum, const int n)
+    {
+        int i = 0;
+
+#if defined(__SSE2__)
+        const __m128i exponent = _mm_set1_epi64x(0x4330000000000000);
+        const __m128d offset = _mm_set1_pd(4503599627370496.0);
+        const __m128 scale4 = _mm_set1_ps(scale);
+
+        for (; i + 4 <= n; i += 4)
+        {
+            const __m128i diff_a = _mm_sub_epi64(
+                _mm_loadu_si128((const __m128i *)(now + i)),
+                _mm_loadu_si128((const __m128i *)(then + i)));
+            const __m128i diff_b = _mm_sub_epi64(
+                _mm_loadu_si128((const __m128i *)(now + i + 2)),
+                _mm_loadu_si128((const __m128i *)(then + i + 2)));
+            const __m128d sum_a = _mm_sub_pd(
+                _mm_castsi128_pd(_mm_or_si128(diff_a, exponent)), offset);
+            const __m128d sum_b = _mm_sub_pd(
+                _mm_castsi128_pd(_mm_or_si128(diff_b, exponent)), offset);
+            const __m128 sums =
+                _mm_movelh_ps(_mm_cvtpd_ps(sum_a), _mm_cvtpd_ps(sum_b));
+            _mm_storeu_ps(maximum + i,
+                          _mm_max_ps(_mm_loadu_ps(maximum + i),
+                                     _mm_mul_ps(sums, scale4)));
+        }
+#elif defined(__aarch64__)
+        const float32x4_t scale4 = vdupq_n_f32(scale);
+
+        for (; i + 4 <= n; i += 4)
+        {
+            const uint64x2_t diff_a =
+                vsubq_u64(vld1q_u64(now + i), vld1q_u64(then + i));
+            const uint64x2_t diff_b =
+                vsubq_u64(vld1q_u64(now + i + 2), vld1q_u64(then + i + 2));
+            const float32x4_t sums =
+                vcombine_f32(vcvt_f32_f64(vcvtq_f64_u64(diff_a)),
+                             vcvt_f32_f64(vcvtq_f64_u64(diff_b)));
+            vst1q_f32(maximum + i, vmaxq_f32(vld1q_f32(maximum + i),
+                                             vmulq_f32(sums, scale4)));
+        }
+#endif
+
+        for (; i < n; i++)
+        {
+            const auto sum = static_cast<float>(now[i] - then[i]);
+            maximum[i] = std::max(maximum[i], scale * sum);
+        }
     }
 
 public:
@@ -155,39 +221,57 @@ public:
         }
         sample_rate_ = sample_rate;
         init_detection();
-        buffer_.discard();
-        buffer_.alloc(latency_);
-        buffer_.fill_with(0);
+        prefix_.resize(latency_ + BLOCK);
+        std::fill(prefix_.begin(), prefix_.begin() + latency_, 0);
+        maximum_.resize(BLOCK);
+
+        float initial[BLOCK], ignored[BLOCK];
+        std::fill(initial, initial + BLOCK, squared_initial_value);
 
-        for (int i = 0; i <= latency_; i++)
+        for (int done = 0; done <= latency_; done += BLOCK)
         {
-            get_mean_squared(squared_initial_value);
+            get_mean_squared(initial, ignored,
+                             std::min(BLOCK, latency_ + 1 - done));
         }
     }
 
     [[nodiscard]] int latency() const { return latency_; }
 
-    float get_mean_squared(const float squared_input)
+    /**
+     * Writes the detected mean square of each of the n squared input values
+     * to output, where n is at most BLOCK.
+     */
+    void get_mean_squared(const float * squared_input, float * output,
+                          const int n)
     {
-        const uint64_t internal_value =
-            squared_value_to_internal_value(squared_input);
-        const uint64_t oldest = buffer_.pop();
-        buffer_.push(internal_value);
+        uint64_t * now = prefix_.begin() + latency_;
+        float * maximum = maximum_.begin();
+
+        uint64_t sum = now[-1];
+        for (int i = 0; i < n; i++)
+        {
+            sum += squared_value_to_internal_value(squared_input[i]);
+            now[i] = sum;
+        }
 
-        float max = rms_[0].add_and_take_and_get(internal_value, oldest);
-        max = std::max(max, static_cast<float>(internal_value) * peak_weight_);
+        std::fill(maximum, maximum + n, 0.0f);
+        window_maximum(now, now - 1, peak_weight_, maximum, n);
 
-        for (int step = 1; step <= STEPS; step++)
+        for (const Window & window : windows_)
         {
-            WindowedRMS & rms = rms_[step];
-            const auto delayed_input =
-                buffer_.nth_from_last(rms.delayed_sample_index());
-            const auto step_value =
-                rms.add_and_take_and_get(internal_value, delayed_input);
-            max = std::max(max, step_value);
+            if (window.span)
+            {
+                window_maximum(now, now - window.span, window.scale, maximum,
+                               n);
+            }
         }
-        max *= OUTPUT_SCALE;
-        return smooth_release_.get_envelope(max);
+
+        for (int i = 0; i < n; i++)
+        {
+            output[i] = smooth_release_.get_envelope(maximum[i] * OUTPUT_SCALE);
+        }
+
+        std::copy(now + n - latency_, now + n, prefix_.begin());
     }
 };
 
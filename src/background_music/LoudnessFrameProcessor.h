@@ -24,8 +24,20 @@
 #include <cmath>
 #include <libfauxdcore/runtime.h>
 
+/*
+ * Set by the preference widgets, so that the configuration is only read again
+ * after it was changed instead of for every block of audio.
+ */
+static bool background_music_config_changed;
+
+static void background_music_update_config()
+{
+    __atomic_store_n(&background_music_config_changed, true, __ATOMIC_RELEASE);
+}
+
 class LoudnessFrameProcessor
 {
+    static constexpr int BLOCK = PerceptiveRMS::BLOCK;
     static constexpr float SHORT_INTEGRATION = 0.4;
     static constexpr float LONG_INTEGRATION = 6.3;
     /*
@@ -43,7 +55,13 @@ class LoudnessFrameProcessor
     float maximum_amplification = 1;
     float perception_slow_balance = 0.3;
     float minimum_detection = 1e-6;
-    RingBuf<float> read_ahead_buffer;
+    /*
+     * Interleaved input delayed by latency() frames: the frames of the
+     * previous blocks, followed by those of the current block.
+     */
+    Index<float> read_ahead_buffer;
+    float square_sums[BLOCK];
+    float gains[BLOCK];
     int channels_ = 0;
     int processed_frames = 0;
 
@@ -63,8 +81,65 @@ class LoudnessFrameProcessor
         return powf(10.0f, 0.05f * decibels);
     }
 
+    void update_config()
+    {
+        target_level = get_clamped_decibel_value(CONF_TARGET_LEVEL_VARIABLE,
+                                                 CONF_TARGET_LEVEL_MIN,
+                                                 CONF_TARGET_LEVEL_MAX);
+        maximum_amplification = get_clamped_decibel_value(
+            CONF_MAX_AMPLIFICATION_VARIABLE, CONF_MAX_AMPLIFICATION_MIN,
+            CONF_MAX_AMPLIFICATION_MAX);
+        perception_slow_balance = get_clamped_value(
+            CONF_SLOW_WEIGHT_VARIABLE, CONF_SLOW_WEIGHT_MIN,
+                              CONF_SLOW_WEIGHT_MAX);
+        minimum_detection = target_level / maximum_amplification;
+        slow_weight = 2.0f * perception_slow_balance * SLOW_VU_FUDGE_FACTOR;
+        slow_weight *= slow_weight;
+        long_integration.set_scale(slow_weight);
+    }
+
+    /*
+     * Detects the loudness of n input frames and calculates the gain for the
+     * frame that is latency() frames older than each of them.
+     */
+    void detect_gains(const float * frames, const int n)
+    {
+        for (int i = 0; i < n; i++)
+        {
+            const float * frame = frames + i * channels_;
+            float square_sum = 0.0;
+            float square_max = 0.0;
+            for (int channel = 0; channel < channels_; channel++)
+            {
+                const float square = frame[channel] * frame[channel];
+                square_max = std::max(square_max, square);
+                square_sum += square;
+            }
+            square_sum /= static_cast<float>(channels_);
+            square_sums[i] = square_sum + square_max;
+        }
+
+        perceivedLoudness.get_mean_squared(square_sums, gains, n);
+
+        for (int i = 0; i < n; i++)
+        {
+            const float square_sum = square_sums[i];
+            const float perceived = FAST_VU_FUDGE_FACTOR * gains[i];
+            const double weighted =
+                std::max(long_integration.integrate(square_sum), perceived);
+
+            const double rms = sqrt(weighted);
+
+            gains[i] = target_level /
+                       std::max(minimum_detection,
+                                static_cast<float>(
+                                    release_integration.get_envelope(rms)));
+        }
+    }
+
 public:
     [[nodiscard]] int latency() const { return perceivedLoudness.latency(); }
+    [[nodiscard]] int channels() const { return channels_; }
 
     LoudnessFrameProcessor()
     {
@@ -82,6 +157,8 @@ public:
 
     void start(const int channels, int rate)
     {
+        __atomic_store_n(&background_music_config_changed, false,
+                         __ATOMIC_RELAXED);
         update_config();
         channels_ = channels;
         processed_frames = 0;
@@ -97,88 +174,63 @@ public:
          * must therefore half the integration time.
          */
         perceivedLoudness.set_rate_and_value(rate, target_level);
-        const int alloc_size = channels_ * latency();
-
-        if (read_ahead_buffer.size() < alloc_size)
-        {
-            read_ahead_buffer.alloc(alloc_size);
-        }
-    }
-
-    void update_config()
-    {
-        target_level = get_clamped_decibel_value(CONF_TARGET_LEVEL_VARIABLE,
-                                                 CONF_TARGET_LEVEL_MIN,
-                                                 CONF_TARGET_LEVEL_MAX);
-        maximum_amplification = get_clamped_decibel_value(
-            CONF_MAX_AMPLIFICATION_VARIABLE, CONF_MAX_AMPLIFICATION_MIN,
-            CONF_MAX_AMPLIFICATION_MAX);
-        perception_slow_balance = get_clamped_value(
-            CONF_SLOW_WEIGHT_VARIABLE, CONF_SLOW_WEIGHT_MIN,
-                              CONF_SLOW_WEIGHT_MAX);
-        minimum_detection = target_level / maximum_amplification;
-        slow_weight = 2.0f * perception_slow_balance * SLOW_VU_FUDGE_FACTOR;
-        slow_weight *= slow_weight;
-        long_integration.set_scale(slow_weight);
+        read_ahead_buffer.resize(channels_ * (latency() + BLOCK));
     }
 
-    bool process_has_output(const Index<float> & frame_in,
-                            Index<float> & frame_out)
+    /**
+     * Processes the interleaved frames in data in place and returns the
+     * number of frames written back, which lag the input by latency() frames.
+     * No output is produced for the first latency() frames after a flush.
+     */
+    int process(float * data, const int frames)
     {
-        bool has_output_data = processed_frames >= latency();
-        if (has_output_data)
-        {
-            read_ahead_buffer.move_out(frame_out.begin(), channels_);
-        }
-        else
+        if (__atomic_exchange_n(&background_music_config_changed, false,
+                                __ATOMIC_ACQUIRE))
         {
-            processed_frames++;
+            update_config();
         }
-        read_ahead_buffer.copy_in(frame_in.begin(), channels_);
 
-        /*
-         * Following calculations need to happen to anticipate the (future)
-         * output.
-         */
+        const int history = latency() * channels_;
+        float * delayed = read_ahead_buffer.begin();
+        int output_frames = 0;
 
-        float square_sum = 0.0;
-        float square_max = 0.0;
-        for (const float sample : frame_in)
+        for (int offset = 0; offset < frames; offset += BLOCK)
         {
-            const float square = sample * sample;
-            square_max = std::max(square_max, square);
-            square_sum += square;
-        }
-        square_sum /= static_cast<float>(channels_);
-        square_sum += square_max;
-        const float perceived = FAST_VU_FUDGE_FACTOR *
-                                perceivedLoudness.get_mean_squared(square_sum);
-        const double weighted =
-            std::max(long_integration.integrate(square_sum), perceived);
+            const int n = std::min(BLOCK, frames - offset);
+            const int samples = n * channels_;
 
-        const double rms = sqrt(weighted);
+            std::copy(data + offset * channels_,
+                      data + offset * channels_ + samples, delayed + history);
 
-        const float gain =
-            target_level /
-            std::max(minimum_detection,
-                     static_cast<float>(release_integration.get_envelope(rms)));
+            detect_gains(delayed + history, n);
 
-        if (has_output_data)
-        {
-            for (float & sample : frame_out)
+            /*
+             * Output is never ahead of input, so it can be written back in
+             * place after the input was copied out.
+             */
+            const int skip = aud::clamp(latency() - processed_frames, 0, n);
+            processed_frames += skip;
+
+            float * out = data + output_frames * channels_;
+            for (int i = skip; i < n; i++)
             {
-                sample *= gain;
+                const float * frame = delayed + i * channels_;
+                for (int channel = 0; channel < channels_; channel++)
+                {
+                    *out++ = frame[channel] * gains[i];
+                }
             }
+            output_frames += n - skip;
+
+            std::copy(delayed + samples, delayed + samples + history, delayed);
         }
 
-        return has_output_data;
+        return output_frames;
     }
 
-    void flush()
-    {
-        processed_frames = 0;
-        read_ahead_buffer.discard();
-    }
+    void flush() { processed_frames = 0; }
+
+    void cleanup() { read_ahead_buffer.clear(); }
 };
 
 #endif // AUDACIOUS_PLUGINS_BGM_LOUDNESS_FRAME_PROCESSOR_H
@@ -0,0 +1,102 @@
+/*
+ * Background music (equal loudness) Plugin for Audacious - throughput
+ * benchmark
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions, and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions, and the following disclaimer in the documentation
+ *    provided with the distribution.
+ *
+ * This software is provided "as is" and without any warranty, express or
+ * implied. In no event shall the authors be liable for any damages arising from
+ * the use of this software.
+ */
+
+/* Not part of the plugin build.  Runs the plugin (compiled in directly) over
+ * ten seconds of synthetic audio at 48, 96 and 192 kHz for each channel
+ * count, and prints the throughput in frames per second of CPU time, on one
+ * thread.  Build it with "make bench" in the plugin directory (after configure,
+ * since it needs config.h) and run bench/frames-bench.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "../background_music.cc"
+
+#define SECONDS 10
+#define BLOCK 4096
+
+static constexpr const int rates[] = {48000, 96000, 192000};
+static constexpr const int channel_counts[] = {1, 2, 6};
+
+static double cpu_secs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Music-like input whose level swells and fades every few seconds, so that
+// the gain keeps moving.
+static void fill(Index<float> & data, int64_t frame, int channels, int rate)
+{
+    data.resize(BLOCK * channels);
+
+    for (int i = 0; i < BLOCK; i++)
+    {
+        const double t = static_cast<double>(frame + i) / rate;
+        const double level = 0.05 + 0.3 * (1 + sin(2 * M_PI * 0.2 * t));
+
+        for (int c = 0; c < channels; c++)
+            data[i * channels + c] =
+                level * (0.6 * sin(2 * M_PI * 220 * t + c) +
+                         0.4 * sin(2 * M_PI * 331 * t));
+    }
+}
+
+static double run(int channels, int rate)
+{
+    int ch = channels, r = rate;
+    aud_plugin_instance.start(ch, r);
+
+    Index<float> data;
+    double busy = 0;
+    const int64_t total = static_cast<int64_t>(SECONDS) * rate;
+
+    for (int64_t frame = 0; frame < total; frame += BLOCK)
+    {
+        fill(data, frame, channels, rate);
+
+        const double start = cpu_secs();
+        aud_plugin_instance.process(data);
+        busy += cpu_secs() - start;
+    }
+
+    data.resize(0);
+    aud_plugin_instance.finish(data, true);
+
+    return (busy > 0) ? total / busy : 0;
+}
+
+int main()
+{
+    aud_plugin_instance.init();
+
+    printf("%7s %5s %14s\n", "rate", "chans", "frames/s");
+
+    for (int rate : rates)
+    {
+        for (int channels : channel_counts)
+            printf("%7d %5d %14.0f\n", rate, channels, run(channels, rate));
+    }
+
+    aud_plugin_instance.cleanup();
+    return 0;
+}
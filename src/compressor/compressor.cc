@@ -22,6 +22,12 @@
 #include <stdlib.h>
 #include <string.h>
 
+#if defined (__SSE__)
+#include <xmmintrin.h>
+#elif defined (__ARM_NEON) || defined (__ARM_NEON__)
+#include <arm_neon.h>
+#endif
+
 #include <libfauxdcore/i18n.h>
 #include <libfauxdcore/plugin.h>
 #include <libfauxdcore/preferences.h>
@@ -33,22 +39,75 @@
 #define CHUNKS 5
 #define DECAY 0.3f
 
+/* True-peak detection for the look-ahead mode: the signal is oversampled by
+ * up to 4x (less at high sample rates) with an interpolation filter of this
+ * many taps per phase, as in ITU-R BS.1770. */
+#define TP_TAPS 12
+#define TP_MAX_OVERSAMPLE 4
+
+enum
+{
+    MODE_CLASSIC,
+    MODE_LOOKAHEAD
+};
+
+static void update_params ();
+
 /* What is a "normal" volume?  Replay Gain stuff claims to use 89 dB, but what
  * does that translate to in our PCM range? */
 static const char * const compressor_defaults[] = {
     "center", "0.5",
     "range", "0.5",
+    "mode", "0",
+    "threshold", "-12",
+    "ratio", "4",
+    "knee", "6",
+    "attack", "5",
+    "release", "200",
+    "lookahead", "5",
+    "makeup", "0",
      nullptr
 };
 
 static const PreferencesWidget compressor_widgets[] = {
+    WidgetLabel (N_("<b>Mode</b>")),
+    WidgetRadio (N_("Automatic volume (classic)"),
+        WidgetInt ("compressor", "mode", update_params),
+        {MODE_CLASSIC}),
+    WidgetRadio (N_("Look-ahead compressor/limiter"),
+        WidgetInt ("compressor", "mode", update_params),
+        {MODE_LOOKAHEAD}),
     WidgetLabel (N_("<b>Compression</b>")),
     WidgetSpin (N_("Center volume:"),
-        WidgetFloat ("compressor", "center"),
+        WidgetFloat ("compressor", "center", update_params),
         {0.1, 1, 0.1}),
     WidgetSpin (N_("Dynamic range:"),
-        WidgetFloat ("compressor", "range"),
-        {0.0, 3.0, 0.1})
+        WidgetFloat ("compressor", "range", update_params),
+        {0.0, 3.0, 0.1}),
+    WidgetLabel (N_("<b>Look-ahead</b>")),
+    WidgetSpin (N_("Threshold:"),
+        WidgetFloat ("compressor", "threshold", update_params),
+        {-40, 0, 0.5, N_("dB")}),
+    WidgetSpin (N_("Ratio:"),
+        WidgetFloat ("compressor", "ratio", update_params),
+        {1, 20, 0.5, N_(": 1")}),
+    WidgetSpin (N_("Knee:"),
+        WidgetFloat ("compressor", "knee", update_params),
+        {0, 24, 1, N_("dB")}),
+    WidgetSpin (N_("Attack:"),
+        WidgetFloat ("compressor", "attack", update_params),
+        {0.1, 50, 0.1, N_("ms")}),
+    WidgetSpin (N_("Release:"),
+        WidgetFloat ("compressor", "release", update_params),
+        {10, 2000, 10, N_("ms")}),
+    WidgetSpin (N_("Look-ahead:"),
+        WidgetFloat ("compressor", "lookahead", update_params),
+        {1, 50, 0.5, N_("ms")}),
+    WidgetSpin (N_("Makeup gain:"),
+        WidgetFloat ("compressor", "makeup", update_params),
+        {0, 24, 0.5, N_("dB")}),
+    WidgetLabel (N_("Mode and look-ahead changes take effect\n"
+                    "at the next song or seek."))
 };
 
 static const PluginPreferences compressor_prefs = {{compressor_widgets}};
@@ -92,6 +151,59 @@ static int chunk_size;
 static float current_peak;
 static int current_channels, current_rate;
 
+/* settings, cached so that they are not looked up for every block */
+static int cur_mode;
+static float cur_center, cur_range;
+static float cur_threshold, cur_ratio, cur_knee, cur_attack, cur_release,
+ cur_lookahead, cur_makeup;
+static bool params_changed;
+
+/* look-ahead mode state */
+static int mode;
+static int lookahead_frames, delay_frames, attack_frames;
+static float release_coef, makeup_gain, knee_start;
+
+static int oversample;
+static float tp_coefs[TP_MAX_OVERSAMPLE][TP_TAPS];
+static float tp_history[AUD_MAX_CHANNELS][2 * TP_TAPS];
+static int tp_pos;
+
+/* sliding-window maximum of the detected peaks over the look-ahead window,
+ * kept as a monotonic (decreasing) deque in a circular buffer */
+static Index<int64_t> window_frame;
+static Index<float> window_peak;
+static int window_head, window_len;
+static int64_t frame_count;
+
+static float last_peak, last_target, envelope;
+static Index<float> attack_ring;
+static int attack_pos;
+static double attack_sum;
+
+static Index<float> gains;
+
+/* Called from the preferences window.  The settings are only flagged as
+ * changed here; the playback thread reads them again in check_params (), so
+ * the cached copies are never written while a block is being processed. */
+static void update_params ()
+{
+    __atomic_store_n (& params_changed, true, __ATOMIC_RELEASE);
+}
+
+static void load_params ()
+{
+    cur_mode = aud_get_int ("compressor", "mode");
+    cur_center = aud_get_double ("compressor", "center");
+    cur_range = aud_get_double ("compressor", "range");
+    cur_threshold = aud_get_double ("compressor", "threshold");
+    cur_ratio = aud_get_double ("compressor", "ratio");
+    cur_knee = aud_get_double ("compressor", "knee");
+    cur_attack = aud_get_double ("compressor", "attack");
+    cur_release = aud_get_double ("compressor", "release");
+    cur_lookahead = aud_get_double ("compressor", "lookahead");
+    cur_makeup = aud_get_double ("compressor", "makeup");
+}
+
 /* I used to find the maximum sample and take that as the peak, but that doesn't
  * work well on badly clipped tracks.  Now, I use the highly sophisticated
  * method of averaging the absolute value of the samples and multiplying by 6, a
@@ -109,23 +221,314 @@ static float calc_peak (float * data, int length)
     return aud::max (0.01f, sum / length * 6);
 }
 
+/* multiplies data by a gain going linearly from a (inclusive) to b (exclusive) */
+static void apply_ramp (float * data, int length, float a, float b)
+{
+    float step = (b - a) / length;
+    int i = 0;
+
+#if defined (__SSE__)
+    __m128 gain = _mm_setr_ps (a, a + step, a + 2 * step, a + 3 * step);
+    __m128 inc = _mm_set1_ps (4 * step);
+
+    for (; i + 4 <= length; i += 4)
+    {
+        _mm_storeu_ps (data + i, _mm_mul_ps (_mm_loadu_ps (data + i), gain));
+        gain = _mm_add_ps (gain, inc);
+    }
+#elif defined (__ARM_NEON) || defined (__ARM_NEON__)
+    const float init[4] = {a, a + step, a + 2 * step, a + 3 * step};
+    float32x4_t gain = vld1q_f32 (init);
+    float32x4_t inc = vdupq_n_f32 (4 * step);
+
+    for (; i + 4 <= length; i += 4)
+    {
+        vst1q_f32 (data + i, vmulq_f32 (vld1q_f32 (data + i), gain));
+        gain = vaddq_f32 (gain, inc);
+    }
+#endif
+
+    for (; i < length; i ++)
+        data[i] *= a + step * i;
+}
+
 static void do_ramp (float * data, int length, float peak_a, float peak_b)
 {
-    float center = aud_get_double ("compressor", "center");
-    float range = aud_get_double ("compressor", "range");
-    float a = powf (peak_a / center, range - 1);
-    float b = powf (peak_b / center, range - 1);
+    float a = powf (peak_a / cur_center, cur_range - 1);
+    float b = powf (peak_b / cur_center, cur_range - 1);
+
+    apply_ramp (data, length, a, b);
+}
 
-    for (int count = 0; count < length; count ++)
+/* multiplies each frame of data by the matching entry of gain */
+static void apply_gains (float * data, const float * gain, int frames, int channels)
+{
+    int f = 0;
+
+#if defined (__SSE__)
+    if (channels == 2)
+    {
+        for (; f + 4 <= frames; f += 4)
+        {
+            __m128 g = _mm_loadu_ps (gain + f);
+            float * d = data + 2 * f;
+            _mm_storeu_ps (d, _mm_mul_ps (_mm_loadu_ps (d), _mm_unpacklo_ps (g, g)));
+            _mm_storeu_ps (d + 4, _mm_mul_ps (_mm_loadu_ps (d + 4), _mm_unpackhi_ps (g, g)));
+        }
+    }
+#elif defined (__ARM_NEON) || defined (__ARM_NEON__)
+    if (channels == 2)
     {
-        * data = (* data) * (a * (length - count) + b * count) / length;
-        data ++;
+        for (; f + 4 <= frames; f += 4)
+        {
+            float32x4x2_t g = vzipq_f32 (vld1q_f32 (gain + f), vld1q_f32 (gain + f));
+            float * d = data + 2 * f;
+            vst1q_f32 (d, vmulq_f32 (vld1q_f32 (d), g.val[0]));
+            vst1q_f32 (d + 4, vmulq_f32 (vld1q_f32 (d + 4), g.val[1]));
+        }
+    }
+#endif
+
+    for (; f < frames; f ++)
+    {
+        for (int c = 0; c < channels; c ++)
+            data[f * channels + c] *= gain[f];
     }
 }
 
+/* Designs the true-peak interpolation filter: a Blackman-windowed sinc
+ * low-pass at the original Nyquist frequency, split into one polyphase
+ * branch per oversampled position.  Coefficients are stored reversed so that
+ * they line up with the history (oldest sample first). */
+static void setup_true_peak ()
+{
+    oversample = (current_rate < 96000) ? 4 : (current_rate < 192000) ? 2 : 1;
+
+    int taps = TP_TAPS * oversample;
+    for (int p = 0; p < oversample; p ++)
+    {
+        float sum = 0;
+
+        for (int j = 0; j < TP_TAPS; j ++)
+        {
+            int k = (TP_TAPS - 1 - j) * oversample + p;
+            float t = (k - (taps - 1) * 0.5f) / oversample;
+            float x = (float) M_PI * t;
+            float sinc = (t == 0) ? 1 : sinf (x) / x;
+            float w = 0.42f - 0.5f * cosf (2 * (float) M_PI * (k + 0.5f) / taps) +
+             0.08f * cosf (4 * (float) M_PI * (k + 0.5f) / taps);
+
+            tp_coefs[p][j] = sinc * w;
+            sum += tp_coefs[p][j];
+        }
+
+        for (int j = 0; j < TP_TAPS; j ++)
+            tp_coefs[p][j] /= sum;
+    }
+
+    memset (tp_history, 0, sizeof tp_history);
+    tp_pos = 0;
+}
+
+/* returns the highest (interpolated) peak across all channels of one frame */
+static float true_peak (const float * frame)
+{
+    float peak = 0;
+
+    if (oversample == 1)
+    {
+        for (int c = 0; c < current_channels; c ++)
+            peak = aud::max (peak, fabsf (frame[c]));
+
+        return peak;
+    }
+
+    tp_pos = (tp_pos + 1) % TP_TAPS;
+
+    for (int c = 0; c < current_channels; c ++)
+    {
+        float * history = tp_history[c];
+        history[tp_pos] = history[tp_pos + TP_TAPS] = frame[c];
+
+        const float * window = history + tp_pos + 1;
+
+        for (int p = 0; p < oversample; p ++)
+        {
+            float sum = 0;
+            for (int j = 0; j < TP_TAPS; j ++)
+                sum += tp_coefs[p][j] * window[j];
+
+            peak = aud::max (peak, fabsf (sum));
+        }
+    }
+
+    return peak;
+}
+
+/* static gain curve: threshold, ratio and soft knee, all in dB */
+static float gain_for_peak (float peak)
+{
+    if (peak <= knee_start)
+        return 1;
+
+    float over = 20 * log10f (peak) - cur_threshold;
+    float slope = 1 / cur_ratio - 1;
+    float reduction;
+
+    if (cur_knee > 0 && 2 * over <= cur_knee)
+    {
+        float x = over + cur_knee / 2;
+        reduction = slope * x * x / (2 * cur_knee);
+    }
+    else
+        reduction = slope * over;
+
+    return powf (10, reduction / 20);
+}
+
+/* refills the attack averaging filter with the current envelope */
+static void reset_attack ()
+{
+    attack_ring.resize (attack_frames);
+    for (float & value : attack_ring)
+        value = envelope;
+
+    attack_pos = 0;
+    attack_sum = (double) envelope * attack_frames;
+}
+
+static void setup_params ()
+{
+    /* The gain is held at the minimum over the look-ahead window and then
+     * smoothed by a moving average over the attack time.  As long as the
+     * average is no longer than the window, the gain has fully come down by
+     * the time a peak leaves the delay line. */
+    int attack = aud::clamp ((int) (current_rate * cur_attack / 1000), 1, lookahead_frames + 1);
+
+    release_coef = expf (-1000 / (cur_release * current_rate));
+    makeup_gain = powf (10, cur_makeup / 20);
+    knee_start = powf (10, (cur_threshold - cur_knee / 2) / 20);
+    last_peak = -1;
+
+    if (attack != attack_frames)
+    {
+        attack_frames = attack;
+        reset_attack ();
+    }
+}
+
+static void reset_detector ()
+{
+    window_frame.resize (lookahead_frames + 1);
+    window_peak.resize (lookahead_frames + 1);
+    window_head = window_len = 0;
+    frame_count = 0;
+
+    memset (tp_history, 0, sizeof tp_history);
+    reset_attack ();
+}
+
+static void setup_lookahead ()
+{
+    lookahead_frames = aud::max (1, (int) (current_rate * cur_lookahead / 1000));
+    setup_true_peak ();
+
+    /* the interpolation filter delays the detected peaks by half its length */
+    delay_frames = lookahead_frames + ((oversample > 1) ? TP_TAPS / 2 : 0);
+
+    envelope = 1;
+    attack_frames = 0;
+    setup_params ();
+    reset_detector ();
+}
+
+/* runs one frame through the detector, returning the gain for the frame
+ * delay_frames earlier */
+static float next_gain (const float * frame)
+{
+    float peak = true_peak (frame);
+    int size = window_frame.len ();
+
+    /* drop the peak that has just left the window, then any smaller ones
+     * that can never be the maximum again */
+    if (window_len && window_frame[window_head] <= frame_count - size)
+    {
+        window_head = (window_head + 1) % size;
+        window_len --;
+    }
+
+    while (window_len && window_peak[(window_head + window_len - 1) % size] <= peak)
+        window_len --;
+
+    int back = (window_head + window_len ++) % size;
+    window_frame[back] = frame_count ++;
+    window_peak[back] = peak;
+
+    float max_peak = window_peak[window_head];
+    if (max_peak != last_peak)
+    {
+        last_peak = max_peak;
+        last_target = gain_for_peak (max_peak);
+    }
+
+    if (last_target < envelope)
+        envelope = last_target;
+    else
+        envelope = last_target + (envelope - last_target) * release_coef;
+
+    attack_sum += envelope - attack_ring[attack_pos];
+    attack_ring[attack_pos] = envelope;
+    attack_pos = (attack_pos + 1) % attack_frames;
+
+    return (float) (attack_sum / attack_frames) * makeup_gain;
+}
+
+/* Feeds frames frames of data (or silence, if data is null) through the
+ * look-ahead limiter, and moves whatever has passed the delay line to the
+ * output.  At the end of a song, silence is used to flush the delay line. */
+static void run_lookahead (const float * data, int frames)
+{
+    static const float silence[AUD_MAX_CHANNELS] = {};
+
+    gains.resize (frames);
+    for (int f = 0; f < frames; f ++)
+        gains[f] = next_gain (data ? data + f * current_channels : silence);
+
+    if (data)
+    {
+        int samples = frames * current_channels;
+        if (buffer.space () < samples)
+            buffer.alloc (buffer.len () + samples);
+
+        buffer.copy_in (data, samples);
+    }
+
+    int ready = buffer.len () / current_channels - (data ? delay_frames : 0);
+    if (ready <= 0)
+        return;
+
+    int start = output.len ();
+    buffer.move_out (output, -1, ready * current_channels);
+    apply_gains (& output[start], & gains[frames - ready], ready, current_channels);
+}
+
+/* picks up changed settings on the playback thread; a new mode or look-ahead
+ * time only takes effect at the next flush */
+static void check_params ()
+{
+    if (! __atomic_exchange_n (& params_changed, false, __ATOMIC_ACQUIRE))
+        return;
+
+    load_params ();
+
+    if (mode == MODE_LOOKAHEAD)
+        setup_params ();
+}
+
 bool Compressor::init ()
 {
     aud_config_set_defaults ("compressor", compressor_defaults);
+    load_params ();
     return true;
 }
 
@@ -134,6 +537,11 @@ void Compressor::cleanup ()
     buffer.destroy ();
     peaks.destroy ();
     output.clear ();
+
+    window_frame.clear ();
+    window_peak.clear ();
+    attack_ring.clear ();
+    gains.clear ();
 }
 
 void Compressor::start (int & channels, int & rate)
@@ -143,16 +551,23 @@ void Compressor::start (int & channels, int & rate)
 
     chunk_size = channels * (int) (rate * CHUNK_TIME);
 
-    buffer.alloc (chunk_size * CHUNKS);
-    peaks.alloc (CHUNKS);
+    /* the delay line is drained at the end of each song */
+    buffer.discard ();
 
     flush (true);
 }
 
 Index<float> & Compressor::process (Index<float> & data)
 {
+    check_params ();
     output.resize (0);
 
+    if (mode == MODE_LOOKAHEAD)
+    {
+        run_lookahead (data.begin (), data.len () / current_channels);
+        return output;
+    }
+
     int offset = 0;
     int remain = data.len ();
 
@@ -199,13 +614,37 @@ bool Compressor::flush (bool force)
     peaks.discard ();
 
     current_peak = 0.0f;
+
+    __atomic_store_n (& params_changed, false, __ATOMIC_RELAXED);
+    load_params ();
+    mode = cur_mode;
+
+    if (mode == MODE_LOOKAHEAD)
+        setup_lookahead ();
+    else
+    {
+        buffer.alloc (chunk_size * CHUNKS);
+        peaks.alloc (CHUNKS);
+    }
+
     return true;
 }
 
 Index<float> & Compressor::finish (Index<float> & data, bool end_of_playlist)
 {
+    check_params ();
     output.resize (0);
 
+    if (mode == MODE_LOOKAHEAD)
+    {
+        run_lookahead (data.begin (), data.len () / current_channels);
+        run_lookahead (nullptr, delay_frames);
+
+        /* the detector has run ahead of the (now empty) delay line */
+        reset_detector ();
+        return output;
+    }
+
     peaks.discard ();
 
     while (buffer.len ())
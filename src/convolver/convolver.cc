@@ -0,0 +1,969 @@
+/*
+ * Convolver Plugin for Audacious
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions, and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions, and the following disclaimer in the documentation
+ *    provided with the distribution.
+ *
+ * This software is provided "as is" and without any warranty, express or
+ * implied. In no event shall the authors be liable for any damages arising from
+ * the use of this software.
+ */
+
+#include <math.h>
+#include <pthread.h>
+#include <string.h>
+#include <sndfile.h>
+
+#include <utility>
+
+#if defined (__SSE__)
+#include <xmmintrin.h>
+#elif defined (__ARM_NEON) || defined (__ARM_NEON__)
+#include <arm_neon.h>
+#endif
+
+#define WANT_VFS_STDIO_COMPAT
+#include <libfauxdcore/audstrings.h>
+#include <libfauxdcore/i18n.h>
+#include <libfauxdcore/runtime.h>
+#include <libfauxdcore/plugin.h>
+#include <libfauxdcore/preferences.h>
+
+#define CFGSECT "convolver"
+
+/* longest impulse response used, in frames (about 22 seconds at 48 kHz) */
+#define MAX_TAPS (1 << 20)
+
+#define MIN_PARTITION 128
+#define MAX_PARTITION 4096
+
+static void update_params ();
+
+static const char convolver_about[] =
+ N_("Convolver Plugin\n\n"
+    "Applies an impulse response (for example a room correction filter or\n"
+    "the reverb of a real room) to the audio.  Any file that libsndfile can\n"
+    "read (WAV, FLAC, ...) can be used; it must have the same sample rate\n"
+    "as the audio, or a sample rate converter must be enabled.\n\n"
+    "The impulse response has either one channel, used for all channels of\n"
+    "the audio, or one channel per channel of the audio.");
+
+static const char * const convolver_defaults[] = {
+ "ir_file", "",
+ "gain", "0",
+ "partition", "1024",
+ "low_latency", "TRUE",
+ "worker", "TRUE",
+ nullptr};
+
+static const ComboItem partition_sizes[] = {
+    ComboItem ("128", 128),
+    ComboItem ("256", 256),
+    ComboItem ("512", 512),
+    ComboItem ("1024", 1024),
+    ComboItem ("2048", 2048),
+    ComboItem ("4096", 4096)
+};
+
+static const PreferencesWidget convolver_widgets[] = {
+    WidgetLabel (N_("<b>Impulse Response</b>")),
+    WidgetFileEntry (N_("File:"),
+        WidgetString (CFGSECT, "ir_file", update_params),
+        {FileSelectMode::File}),
+    WidgetSpin (N_("Gain:"),
+        WidgetFloat (CFGSECT, "gain", update_params),
+        {-30, 30, 0.5, N_("dB")}),
+    WidgetLabel (N_("<b>Processing</b>")),
+    WidgetCombo (N_("Partition size:"),
+        WidgetInt (CFGSECT, "partition", update_params),
+        {{partition_sizes}}),
+    WidgetCheck (N_("No added latency"),
+        WidgetBool (CFGSECT, "low_latency", update_params)),
+    WidgetCheck (N_("Compute the tail in a separate thread"),
+        WidgetBool (CFGSECT, "worker", update_params))
+};
+
+static const PluginPreferences convolver_prefs = {{convolver_widgets}};
+
+class Convolver : public EffectPlugin
+{
+public:
+    static constexpr PluginInfo info = {
+        N_("Convolver"),
+        PACKAGE,
+        convolver_about,
+        & convolver_prefs
+    };
+
+    /* order #3: after the resamplers, so that the rate is the one chosen
+     * there */
+    constexpr Convolver () : EffectPlugin (info, 3, true) {}
+
+    bool init ();
+    void cleanup ();
+
+    void start (int & channels, int & rate);
+    Index<float> & process (Index<float> & data);
+    bool flush (bool force);
+    Index<float> & finish (Index<float> & data, bool end_of_playlist);
+    int adjust_delay (int delay);
+};
+
+EXPORT Convolver aud_plugin_instance;
+
+/* Partitioned overlap-save convolution: the impulse response is cut into
+ * partitions of part_len taps, whose spectra (FFT size 2 * part_len) are
+ * multiplied with those of the last input blocks, kept in a frequency-domain
+ * delay line, and summed.  This is computed once per block of part_len
+ * frames, so the output of a block is only known after the whole block has
+ * come in.
+ *
+ * In low-latency mode, the first HEAD_TAPS taps are instead applied directly
+ * in the time domain, frame by frame; the taps up to part_len by a second
+ * stage with partitions (and blocks) of HEAD_TAPS; and the rest by the main
+ * stage.  Each stage then only depends on input blocks that are already
+ * complete, so there is no added latency.
+ *
+ * The main stage's partitions from split on are summed by a worker thread,
+ * one block ahead; in the meantime, the playback thread does the rest. */
+
+/* taps applied directly in low-latency mode (a multiple of 8) */
+#define HEAD_TAPS 64
+
+static int conv_channels, conv_rate;
+static bool active;
+static bool low_latency;
+
+static int ir_channels;
+static Index<float> ir_head;    /* first HEAD_TAPS taps, reversed, per IR channel */
+
+/* A spectrum is bins real parts followed by bins imaginary parts.  The input
+ * buffer holds the previous block followed by the current one. */
+struct ChannelState {
+    Index<float> input;         /* 2 * part_len */
+    Index<float> output;        /* part_len, computed by FFT */
+    Index<float> fdl;           /* n_parts spectra, newest at fdl_head */
+    Index<float> acc, worker_acc;
+};
+
+struct Stage {
+    int part_len;               /* frames per block and taps per partition */
+    int bins;                   /* part_len + 1 spectrum bins, padded for SIMD */
+    int n_parts;                /* 0 if the stage is not used */
+    int first_tap;              /* first tap of the first partition */
+    int split;                  /* first partition summed by the worker */
+
+    Index<float> ir_spectra;    /* n_parts spectra per IR channel */
+    ChannelState chans[AUD_MAX_CHANNELS];
+    int fdl_head;
+    int block_pos;              /* frames of the current block so far */
+
+    /* FFT work space and tables */
+    Index<float> fft_re, fft_im, fft_cos, fft_sin, real_cos, real_sin;
+    Index<float> time_buf;
+};
+
+static Stage short_stage, main_stage;
+
+/* Impulse response as read from the file.  It is only read on the main
+ * thread, so that playback never waits for the disk; the playback thread
+ * takes ir_mutex while cutting it into partitions. */
+struct ImpulseResponse {
+    String uri;
+    Index<float> taps;
+    int frames = 0, channels = 0, rate = 0;
+};
+
+static ImpulseResponse loaded_ir;
+static pthread_mutex_t ir_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static bool params_changed;
+
+static pthread_t worker_thread;
+static bool worker_running;
+static pthread_mutex_t worker_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t work_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t done_cond = PTHREAD_COND_INITIALIZER;
+static bool worker_quit;
+static bool job_pending;
+static int job_head;            /* main_stage.fdl_head as of the job */
+
+/* In-place radix-2 complex FFT of size part_len (unscaled either way). */
+static void fft (Stage & st, float * re, float * im, bool inverse)
+{
+    int n = st.part_len;
+
+    for (int i = 1, j = 0; i < n; i ++)
+    {
+        int bit = n >> 1;
+        for (; j & bit; bit >>= 1)
+            j ^= bit;
+        j ^= bit;
+
+        if (i < j)
+        {
+            std::swap (re[i], re[j]);
+            std::swap (im[i], im[j]);
+        }
+    }
+
+    for (int len = 2; len <= n; len <<= 1)
+    {
+        int half = len / 2;
+        int step = n / len;
+
+        for (int i = 0; i < n; i += len)
+        {
+            for (int k = 0; k < half; k ++)
+            {
+                float wr = st.fft_cos[k * step];
+                float wi = inverse ? st.fft_sin[k * step] : -st.fft_sin[k * step];
+                float * ar = re + i + k, * ai = im + i + k;
+                float * br = ar + half, * bi = ai + half;
+                float tr = * br * wr - * bi * wi;
+                float ti = * br * wi + * bi * wr;
+                * br = * ar - tr;
+                * bi = * ai - ti;
+                * ar += tr;
+                * ai += ti;
+            }
+        }
+    }
+}
+
+/* Spectrum of 2 * part_len real samples, by way of a complex FFT of half the
+ * size (the even samples as real parts, the odd ones as imaginary parts).
+ * The result is scaled by 2. */
+static void real_fft (Stage & st, const float * x, float * spec)
+{
+    int n = st.part_len, bins = st.bins;
+    float * re = st.fft_re.begin (), * im = st.fft_im.begin ();
+
+    for (int i = 0; i < n; i ++)
+    {
+        re[i] = x[2 * i];
+        im[i] = x[2 * i + 1];
+    }
+
+    fft (st, re, im, false);
+
+    for (int k = 0; k <= n; k ++)
+    {
+        int a = k & (n - 1), b = (n - k) & (n - 1);
+
+        /* even and odd parts (times 2, and odd times -i) */
+        float er = re[a] + re[b], ei = im[a] - im[b];
+        float odr = im[a] + im[b], odi = re[b] - re[a];
+
+        float c = st.real_cos[k], s = st.real_sin[k];
+        spec[k] = er + c * odr + s * odi;
+        spec[bins + k] = ei + c * odi - s * odr;
+    }
+}
+
+/* Inverse of real_fft (scaled by 2 * part_len). */
+static void real_ifft (Stage & st, const float * spec, float * x)
+{
+    int n = st.part_len, bins = st.bins;
+    float * re = st.fft_re.begin (), * im = st.fft_im.begin ();
+
+    for (int k = 0; k < n; k ++)
+    {
+        float ar = spec[k], ai = spec[bins + k];
+        float br = spec[n - k], bi = - spec[bins + n - k];
+
+        float er = ar + br, ei = ai + bi;
+        float dr = ar - br, di = ai - bi;
+
+        float c = st.real_cos[k], s = st.real_sin[k];
+        float odr = dr * c - di * s, odi = dr * s + di * c;
+
+        re[k] = er - odi;
+        im[k] = ei + odr;
+    }
+
+    fft (st, re, im, true);
+
+    for (int i = 0; i < n; i ++)
+    {
+        x[2 * i] = re[i];
+        x[2 * i + 1] = im[i];
+    }
+}
+
+/* acc += x * h for spectra of bins complex values */
+static void multiply_add (float * acc, const float * x, const float * h, int bins)
+{
+    float * acc_im = acc + bins;
+    const float * x_im = x + bins, * h_im = h + bins;
+
+#if defined (__SSE__)
+    for (int i = 0; i < bins; i += 4)
+    {
+        __m128 xr = _mm_loadu_ps (x + i), xi = _mm_loadu_ps (x_im + i);
+        __m128 hr = _mm_loadu_ps (h + i), hi = _mm_loadu_ps (h_im + i);
+        __m128 ar = _mm_loadu_ps (acc + i), ai = _mm_loadu_ps (acc_im + i);
+
+        ar = _mm_add_ps (ar, _mm_sub_ps (_mm_mul_ps (xr, hr), _mm_mul_ps (xi, hi)));
+        ai = _mm_add_ps (ai, _mm_add_ps (_mm_mul_ps (xr, hi), _mm_mul_ps (xi, hr)));
+
+        _mm_storeu_ps (acc + i, ar);
+        _mm_storeu_ps (acc_im + i, ai);
+    }
+#elif defined (__ARM_NEON) || defined (__ARM_NEON__)
+    for (int i = 0; i < bins; i += 4)
+    {
+        float32x4_t xr = vld1q_f32 (x + i), xi = vld1q_f32 (x_im + i);
+        float32x4_t hr = vld1q_f32 (h + i), hi = vld1q_f32 (h_im + i);
+        float32x4_t ar = vld1q_f32 (acc + i), ai = vld1q_f32 (acc_im + i);
+
+        ar = vmlaq_f32 (ar, xr, hr);
+        ar = vmlsq_f32 (ar, xi, hi);
+        ai = vmlaq_f32 (ai, xr, hi);
+        ai = vmlaq_f32 (ai, xi, hr);
+
+        vst1q_f32 (acc + i, ar);
+        vst1q_f32 (acc_im + i, ai);
+    }
+#else
+    for (int i = 0; i < bins; i ++)
+    {
+        acc[i] += x[i] * h[i] - x_im[i] * h_im[i];
+        acc_im[i] += x[i] * h_im[i] + x_im[i] * h[i];
+    }
+#endif
+}
+
+/* sum of a[i] * b[i] for 0 <= i < n (n a multiple of 8) */
+static float dot_product (const float * a, const float * b, int n)
+{
+#if defined (__SSE__)
+    __m128 s0 = _mm_setzero_ps (), s1 = _mm_setzero_ps ();
+
+    for (int i = 0; i < n; i += 8)
+    {
+        s0 = _mm_add_ps (s0, _mm_mul_ps (_mm_loadu_ps (a + i), _mm_loadu_ps (b + i)));
+        s1 = _mm_add_ps (s1, _mm_mul_ps (_mm_loadu_ps (a + i + 4), _mm_loadu_ps (b + i + 4)));
+    }
+
+    float sum[4];
+    _mm_storeu_ps (sum, _mm_add_ps (s0, s1));
+    return sum[0] + sum[1] + sum[2] + sum[3];
+#elif defined (__ARM_NEON) || defined (__ARM_NEON__)
+    float32x4_t s0 = vdupq_n_f32 (0), s1 = vdupq_n_f32 (0);
+
+    for (int i = 0; i < n; i += 8)
+    {
+        s0 = vmlaq_f32 (s0, vld1q_f32 (a + i), vld1q_f32 (b + i));
+        s1 = vmlaq_f32 (s1, vld1q_f32 (a + i + 4), vld1q_f32 (b + i + 4));
+    }
+
+    float sum[4];
+    vst1q_f32 (sum, vaddq_f32 (s0, s1));
+    return sum[0] + sum[1] + sum[2] + sum[3];
+#else
+    float sum = 0;
+    for (int i = 0; i < n; i ++)
+        sum += a[i] * b[i];
+    return sum;
+#endif
+}
+
+static float * fdl_slot (Stage & st, ChannelState & ch, int q)
+{
+    return ch.fdl.begin () + (size_t) ((st.fdl_head + q) % st.n_parts) * 2 * st.bins;
+}
+
+static const float * ir_spectrum (Stage & st, int channel, int part)
+{
+    int ir = channel % ir_channels;
+    return st.ir_spectra.begin () + ((size_t) ir * st.n_parts + part) * 2 * st.bins;
+}
+
+/* Sums partitions [first, last) of the main stage's output spectrum for the
+ * block after the next one, given the delay line as of head.  This is the
+ * worker's job. */
+static void sum_tail (int head, int first, int last)
+{
+    Stage & st = main_stage;
+
+    for (int c = 0; c < conv_channels; c ++)
+    {
+        ChannelState & ch = st.chans[c];
+        float * acc = ch.worker_acc.begin ();
+
+        memset (acc, 0, sizeof (float) * 2 * st.bins);
+
+        for (int q = first; q < last; q ++)
+        {
+            /* once the next spectrum is added, this one will be number q */
+            int slot = (head + q - 1) % st.n_parts;
+            multiply_add (acc, ch.fdl.begin () + (size_t) slot * 2 * st.bins,
+             ir_spectrum (st, c, q), st.bins);
+        }
+    }
+}
+
+static void * worker (void *)
+{
+    pthread_mutex_lock (& worker_mutex);
+
+    while (true)
+    {
+        while (! worker_quit && ! job_pending)
+            pthread_cond_wait (& work_cond, & worker_mutex);
+
+        if (worker_quit)
+            break;
+
+        int head = job_head;
+        pthread_mutex_unlock (& worker_mutex);
+
+        sum_tail (head, main_stage.split, main_stage.n_parts);
+
+        pthread_mutex_lock (& worker_mutex);
+        job_pending = false;
+        pthread_cond_signal (& done_cond);
+    }
+
+    pthread_mutex_unlock (& worker_mutex);
+    return nullptr;
+}
+
+static void wait_worker ()
+{
+    if (! worker_running)
+        return;
+
+    pthread_mutex_lock (& worker_mutex);
+    while (job_pending)
+        pthread_cond_wait (& done_cond, & worker_mutex);
+    pthread_mutex_unlock (& worker_mutex);
+}
+
+static void post_worker ()
+{
+    pthread_mutex_lock (& worker_mutex);
+    job_head = main_stage.fdl_head;
+    job_pending = true;
+    pthread_cond_signal (& work_cond);
+    pthread_mutex_unlock (& worker_mutex);
+}
+
+static void start_worker ()
+{
+    if (worker_running)
+        return;
+
+    worker_quit = false;
+    job_pending = false;
+    worker_running = ! pthread_create (& worker_thread, nullptr, worker, nullptr);
+
+    if (! worker_running)
+        AUDERR ("Failed to start worker thread.\n");
+}
+
+static void stop_worker ()
+{
+    if (! worker_running)
+        return;
+
+    pthread_mutex_lock (& worker_mutex);
+    worker_quit = true;
+    pthread_cond_signal (& work_cond);
+    pthread_mutex_unlock (& worker_mutex);
+
+    pthread_join (worker_thread, nullptr);
+    worker_running = false;
+}
+
+/* Virtual file access wrappers for libsndfile (from the sndfile plugin) */
+static sf_count_t sf_get_filelen (void * user_data)
+{
+    int64_t size = ((VFSFile *) user_data)->fsize ();
+    return (size < 0) ? SF_COUNT_MAX : size;
+}
+
+static sf_count_t sf_vseek (sf_count_t offset, int whence, void * user_data)
+{
+    if (((VFSFile *) user_data)->fseek (offset, to_vfs_seek_type (whence)) != 0)
+        return -1;
+
+    return ((VFSFile *) user_data)->ftell ();
+}
+
+static sf_count_t sf_vread (void * ptr, sf_count_t count, void * user_data)
+{
+    return ((VFSFile *) user_data)->fread (ptr, 1, count);
+}
+
+static sf_count_t sf_vwrite_dummy (const void * ptr, sf_count_t count, void * user_data)
+{
+    return 0;
+}
+
+static sf_count_t sf_tell (void * user_data)
+{
+    return ((VFSFile *) user_data)->ftell ();
+}
+
+static SF_VIRTUAL_IO sf_virtual_io = {
+    sf_get_filelen,
+    sf_vseek,
+    sf_vread,
+    sf_vwrite_dummy,
+    sf_tell
+};
+
+/* reads an impulse response file into ir */
+static bool read_ir (const char * uri, ImpulseResponse & ir)
+{
+    VFSFile file (uri, "r");
+    if (! file)
+    {
+        AUDERR ("Failed to open impulse response %s: %s\n", uri, file.error ());
+        return false;
+    }
+
+    SF_INFO info {}; // must be zeroed before sf_open()
+    SNDFILE * sndfile = sf_open_virtual (& sf_virtual_io, SFM_READ, & info, & file);
+
+    if (! sndfile)
+    {
+        AUDERR ("Failed to read impulse response %s: %s\n", uri, sf_strerror (nullptr));
+        return false;
+    }
+
+    if (info.frames > MAX_TAPS)
+        AUDWARN ("Impulse response %s is too long; only %d frames are used.\n", uri, MAX_TAPS);
+
+    int frames = aud::min (info.frames, (sf_count_t) MAX_TAPS);
+    ir.taps.resize (frames * info.channels);
+    ir.frames = sf_readf_float (sndfile, ir.taps.begin (), frames);
+
+    ir.channels = info.channels;
+    ir.rate = info.samplerate;
+
+    sf_close (sndfile);
+
+    if (ir.frames <= 0)
+    {
+        AUDERR ("Impulse response %s is empty.\n", uri);
+        return false;
+    }
+
+    return true;
+}
+
+/* Called on the main thread: reads the file set in the preferences, unless it
+ * is the one already loaded. */
+static void load_ir ()
+{
+    String uri = aud_get_str (CFGSECT, "ir_file");
+
+    if (loaded_ir.uri ? ! strcmp (loaded_ir.uri, uri) : ! uri[0])
+        return;
+
+    ImpulseResponse ir;
+
+    if (uri[0])
+    {
+        if (read_ir (uri, ir))
+            ir.uri = uri;
+        else
+            ir = ImpulseResponse ();
+    }
+
+    pthread_mutex_lock (& ir_mutex);
+    loaded_ir = std::move (ir);
+    pthread_mutex_unlock (& ir_mutex);
+}
+
+static void update_params ()
+{
+    load_ir ();
+    __atomic_store_n (& params_changed, true, __ATOMIC_RELEASE);
+}
+
+static void reset_stage (Stage & st)
+{
+    for (int c = 0; c < conv_channels; c ++)
+    {
+        ChannelState & ch = st.chans[c];
+        memset (ch.input.begin (), 0, sizeof (float) * ch.input.len ());
+        memset (ch.output.begin (), 0, sizeof (float) * ch.output.len ());
+        memset (ch.fdl.begin (), 0, sizeof (float) * ch.fdl.len ());
+        memset (ch.worker_acc.begin (), 0, sizeof (float) * ch.worker_acc.len ());
+    }
+
+    st.fdl_head = 0;
+    st.block_pos = 0;
+}
+
+static void reset_state ()
+{
+    reset_stage (short_stage);
+    reset_stage (main_stage);
+}
+
+static void setup_tables (Stage & st)
+{
+    int n = st.part_len;
+
+    st.fft_re.resize (n);
+    st.fft_im.resize (n);
+    st.fft_cos.resize (n / 2);
+    st.fft_sin.resize (n / 2);
+
+    for (int i = 0; i < n / 2; i ++)
+    {
+        st.fft_cos[i] = cos (2 * M_PI * i / n);
+        st.fft_sin[i] = sin (2 * M_PI * i / n);
+    }
+
+    st.real_cos.resize (n + 1);
+    st.real_sin.resize (n + 1);
+
+    for (int k = 0; k <= n; k ++)
+    {
+        st.real_cos[k] = cos (M_PI * k / n);
+        st.real_sin[k] = sin (M_PI * k / n);
+    }
+
+    st.time_buf.resize (2 * n);
+}
+
+/* keeps the first HEAD_TAPS taps, reversed, for the direct computation */
+static void setup_head (const ImpulseResponse & ir, float gain)
+{
+    ir_head.resize (ir.channels * HEAD_TAPS);
+
+    for (int c = 0; c < ir.channels; c ++)
+    {
+        float * rev = ir_head.begin () + c * HEAD_TAPS;
+
+        for (int i = 0; i < HEAD_TAPS; i ++)
+            rev[HEAD_TAPS - 1 - i] = (i < ir.frames) ? gain * ir.taps[i * ir.channels + c] : 0;
+    }
+}
+
+/* cuts n_parts partitions of part_len taps, from first_tap on, out of the
+ * impulse response for a stage */
+static void setup_stage (Stage & st, int part_len, int first_tap, int n_parts,
+ const ImpulseResponse & ir, float gain)
+{
+    st.part_len = part_len;
+    st.bins = (part_len + 1 + 3) & ~3;
+    st.n_parts = n_parts;
+    st.first_tap = first_tap;
+    st.split = n_parts;
+
+    setup_tables (st);
+    st.ir_spectra.resize ((size_t) ir.channels * n_parts * 2 * st.bins);
+
+    /* the spectra are scaled by 2 (real_fft) twice, and the inverse by
+     * 2 * part_len */
+    float spec_gain = gain / (8 * part_len);
+
+    for (int c = 0; c < ir.channels; c ++)
+    {
+        for (int p = 0; p < n_parts; p ++)
+        {
+            float * x = st.time_buf.begin ();
+            memset (x, 0, sizeof (float) * 2 * part_len);
+
+            for (int i = 0; i < part_len; i ++)
+            {
+                int tap = first_tap + p * part_len + i;
+                if (tap < ir.frames)
+                    x[i] = spec_gain * ir.taps[tap * ir.channels + c];
+            }
+
+            float * spec = st.ir_spectra.begin () + ((size_t) c * n_parts + p) * 2 * st.bins;
+            memset (spec, 0, sizeof (float) * 2 * st.bins);
+            real_fft (st, x, spec);
+        }
+    }
+
+    for (int c = 0; c < conv_channels; c ++)
+    {
+        ChannelState & ch = st.chans[c];
+        ch.input.resize (2 * part_len);
+        ch.output.resize (part_len);
+        ch.fdl.resize ((size_t) n_parts * 2 * st.bins);
+        ch.acc.resize (2 * st.bins);
+        ch.worker_acc.resize (2 * st.bins);
+    }
+}
+
+/* Rough balance between the threads: the playback thread also does the
+ * FFTs and, in low-latency mode, HEAD_TAPS multiplications per frame for the
+ * head and the short stage, which together are about as much work as
+ * HEAD_TAPS / 4 + part_len / 64 partitions of the main stage. */
+static void setup_split (bool use_worker)
+{
+    Stage & st = main_stage;
+    st.split = st.n_parts;
+
+    if (use_worker && st.n_parts >= 4)
+    {
+        int extra = low_latency ? HEAD_TAPS / 4 + st.part_len / 64 : 0;
+        st.split = aud::clamp ((st.n_parts - extra) / 2, 1, st.n_parts - 2);
+    }
+
+    if (st.split < st.n_parts)
+        start_worker ();
+    else
+        stop_worker ();
+}
+
+/* cuts the impulse response into the head and the stages */
+static bool setup_stages (const ImpulseResponse & ir, int part_len, float gain)
+{
+    /* no file, or it could not be read (reported when it was loaded) */
+    if (! ir.frames)
+        return false;
+
+    if (ir.rate != conv_rate)
+    {
+        AUDERR ("Impulse response is for %d Hz, but the audio is %d Hz; enable a "
+         "sample rate converter to use it.\n", ir.rate, conv_rate);
+        return false;
+    }
+
+    if (ir.channels != 1 && ir.channels != conv_channels)
+        AUDWARN ("Impulse response has %d channels, but the audio has %d.\n",
+         ir.channels, conv_channels);
+
+    ir_channels = ir.channels;
+
+    if (low_latency)
+    {
+        /* the short stage covers the taps from the head up to part_len */
+        setup_head (ir, gain);
+        setup_stage (short_stage, HEAD_TAPS, HEAD_TAPS, part_len / HEAD_TAPS - 1, ir, gain);
+    }
+    else
+        short_stage = Stage ();
+
+    int first_tap = low_latency ? part_len : 0;
+    int n_parts = aud::max (1, (ir.frames - first_tap + part_len - 1) / part_len);
+    setup_stage (main_stage, part_len, first_tap, n_parts, ir, gain);
+
+    return true;
+}
+
+/* Rebuilds the stages from the loaded impulse response and the current
+ * settings.  This runs on the playback thread, but never reads the file. */
+static void setup_params ()
+{
+    wait_worker ();
+
+    float gain = powf (10, aud_get_double (CFGSECT, "gain") / 20);
+    int partition = aud_get_int (CFGSECT, "partition");
+    bool use_worker = aud_get_bool (CFGSECT, "worker");
+    low_latency = aud_get_bool (CFGSECT, "low_latency");
+
+    int part_len = 1;
+    while (part_len < partition && part_len < MAX_PARTITION)
+        part_len <<= 1;
+
+    part_len = aud::max (part_len, MIN_PARTITION);
+
+    pthread_mutex_lock (& ir_mutex);
+    active = setup_stages (loaded_ir, part_len, gain);
+    pthread_mutex_unlock (& ir_mutex);
+
+    if (active)
+    {
+        setup_split (use_worker);
+        reset_state ();
+    }
+}
+
+/* called when a block of a stage is complete: adds its spectrum to the delay
+ * line and computes the FFT output for the next block */
+static void end_block (Stage & st)
+{
+    st.fdl_head = (st.fdl_head + st.n_parts - 1) % st.n_parts;
+
+    for (int c = 0; c < conv_channels; c ++)
+    {
+        ChannelState & ch = st.chans[c];
+        float * spec = fdl_slot (st, ch, 0);
+
+        memset (spec, 0, sizeof (float) * 2 * st.bins);
+        real_fft (st, ch.input.begin (), spec);
+
+        /* the current block becomes the previous one */
+        memcpy (ch.input.begin (), ch.input.begin () + st.part_len, sizeof (float) * st.part_len);
+
+        float * acc = ch.acc.begin ();
+        memset (acc, 0, sizeof (float) * 2 * st.bins);
+
+        for (int q = 0; q < st.split; q ++)
+            multiply_add (acc, fdl_slot (st, ch, q), ir_spectrum (st, c, q), st.bins);
+    }
+
+    /* only the main stage uses the worker */
+    if (st.split < st.n_parts)
+    {
+        wait_worker ();
+
+        for (int c = 0; c < conv_channels; c ++)
+        {
+            float * acc = st.chans[c].acc.begin ();
+            const float * add = st.chans[c].worker_acc.begin ();
+
+            for (int i = 0; i < 2 * st.bins; i ++)
+                acc[i] += add[i];
+        }
+
+        post_worker ();
+    }
+
+    for (int c = 0; c < conv_channels; c ++)
+    {
+        ChannelState & ch = st.chans[c];
+
+        /* overlap-save: only the second half is valid */
+        real_ifft (st, ch.acc.begin (), st.time_buf.begin ());
+        memcpy (ch.output.begin (), st.time_buf.begin () + st.part_len, sizeof (float) * st.part_len);
+    }
+}
+
+static void convolve (float * data, int frames)
+{
+    /* part_len is a multiple of HEAD_TAPS, so every block of the main stage
+     * ends together with one of the short stage */
+    Stage & first = low_latency ? short_stage : main_stage;
+
+    while (frames > 0)
+    {
+        int run = aud::min (frames, first.part_len - first.block_pos);
+
+        for (int c = 0; c < conv_channels; c ++)
+        {
+            ChannelState & ch = main_stage.chans[c];
+            float * in = ch.input.begin () + main_stage.part_len + main_stage.block_pos;
+            const float * out = ch.output.begin () + main_stage.block_pos;
+
+            for (int i = 0; i < run; i ++)
+                in[i] = data[i * conv_channels + c];
+
+            if (! low_latency)
+            {
+                for (int i = 0; i < run; i ++)
+                    data[i * conv_channels + c] = out[i];
+
+                continue;
+            }
+
+            ChannelState & sh = short_stage.chans[c];
+            float * sh_in = sh.input.begin () + HEAD_TAPS + short_stage.block_pos;
+            const float * sh_out = sh.output.begin () + short_stage.block_pos;
+            const float * head = ir_head.begin () + (c % ir_channels) * HEAD_TAPS;
+
+            memcpy (sh_in, in, sizeof (float) * run);
+
+            /* the last HEAD_TAPS input frames, oldest first */
+            for (int i = 0; i < run; i ++)
+                data[i * conv_channels + c] = out[i] + sh_out[i] +
+                 dot_product (sh_in + i + 1 - HEAD_TAPS, head, HEAD_TAPS);
+        }
+
+        data += run * conv_channels;
+        frames -= run;
+
+        if (low_latency && (short_stage.block_pos += run) == HEAD_TAPS)
+        {
+            end_block (short_stage);
+            short_stage.block_pos = 0;
+        }
+
+        if ((main_stage.block_pos += run) == main_stage.part_len)
+        {
+            end_block (main_stage);
+            main_stage.block_pos = 0;
+        }
+    }
+}
+
+bool Convolver::init ()
+{
+    aud_config_set_defaults (CFGSECT, convolver_defaults);
+    load_ir ();
+    return true;
+}
+
+void Convolver::cleanup ()
+{
+    stop_worker ();
+
+    active = false;
+    ir_head.clear ();
+    short_stage = Stage ();
+    main_stage = Stage ();
+
+    pthread_mutex_lock (& ir_mutex);
+    loaded_ir = ImpulseResponse ();
+    pthread_mutex_unlock (& ir_mutex);
+}
+
+void Convolver::start (int & channels, int & rate)
+{
+    /* the worker may still be summing for the old channels */
+    wait_worker ();
+
+    conv_channels = channels;
+    conv_rate = rate;
+
+    __atomic_store_n (& params_changed, false, __ATOMIC_RELAXED);
+    setup_params ();
+}
+
+Index<float> & Convolver::process (Index<float> & data)
+{
+    if (__atomic_exchange_n (& params_changed, false, __ATOMIC_ACQUIRE))
+        setup_params ();
+
+    if (active)
+        convolve (data.begin (), data.len () / conv_channels);
+
+    return data;
+}
+
+bool Convolver::flush (bool force)
+{
+    if (active)
+    {
+        wait_worker ();
+        reset_state ();
+    }
+
+    return true;
+}
+
+Index<float> & Convolver::finish (Index<float> & data, bool end_of_playlist)
+{
+    /* without low latency, the last block is still inside */
+    if (active && ! low_latency && end_of_playlist)
+        data.insert (-1, main_stage.part_len * conv_channels);
+
+    return process (data);
+}
+
+int Convolver::adjust_delay (int delay)
+{
+    if (! active || low_latency)
+        return delay;
+
+    return delay + aud::rescale (main_stage.part_len, conv_rate, 1000);
+}
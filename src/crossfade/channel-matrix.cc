@@ -0,0 +1 @@
+#include "../mixer/channel-matrix.cc"
@@ -18,11 +18,24 @@
  */
 
 #include <math.h>
+#include <string.h>
 #include <libfauxdcore/i18n.h>
 #include <libfauxdcore/plugin.h>
 #include <libfauxdcore/preferences.h>
 #include <libfauxdcore/runtime.h>
 
+#ifdef CROSSFADE_SAMPLERATE
+#include <samplerate.h>
+#endif
+
+#include "../mixer/channel-matrix.h"
+
+/* resolution of the S-curve lookup table */
+#define SIGMOID_STEPS 1024
+
+/* frames converted at a time after a format change */
+#define CONVERT_BLOCK 1024
+
 enum
 {
     STATE_OFF,
@@ -103,9 +116,44 @@ EXPORT Crossfade aud_plugin_instance;
 
 static char state = STATE_OFF;
 static int current_channels, current_rate;
-static Index<float> buffer, output;
+static RingBuf<float> buffer;
+static Index<float> output;
 static int fadein_point;
 
+/* S-curve lookup table, rebuilt only when the steepness setting changes */
+static float sigmoid_table[SIGMOID_STEPS + 2];
+static float sigmoid_steepness = -1;
+
+/* After a format change, the old song's audio waits in source (in its
+ * original format) and is converted into buffer only as it is needed, so
+ * that the work is spread over the following blocks. */
+static Index<float> source;
+static int source_channels, source_rate;
+static int source_pos;                   /* in source frames */
+static int convert_pos, convert_frames;  /* in output frames */
+static float matrix[AUD_MAX_CHANNELS][AUD_MAX_CHANNELS];
+static Index<float> convert_in, convert_out;
+
+#ifdef CROSSFADE_SAMPLERATE
+static SRC_STATE * src_state;
+#endif
+
+/* a fade applied while part of the buffer was still unconverted */
+static bool ramp_pending;
+static float ramp_a, ramp_b;
+static int ramp_pos, ramp_length;
+
+static void free_resampler ()
+{
+#ifdef CROSSFADE_SAMPLERATE
+    if (src_state)
+    {
+        src_delete (src_state);
+        src_state = nullptr;
+    }
+#endif
+}
+
 bool Crossfade::init ()
 {
     aud_config_set_defaults ("crossfade", crossfade_defaults);
@@ -115,67 +163,340 @@ bool Crossfade::init ()
 void Crossfade::cleanup ()
 {
     state = STATE_OFF;
-    buffer.clear ();
+    buffer.destroy ();
     output.clear ();
+
+    source.clear ();
+    convert_pos = convert_frames = 0;
+    convert_in.clear ();
+    convert_out.clear ();
+    free_resampler ();
+}
+
+static void update_sigmoid_table ()
+{
+    float steepness = aud_get_double ("crossfade", "sigmoid_steepness");
+    if (steepness == sigmoid_steepness)
+        return;
+
+    for (int i = 0; i <= SIGMOID_STEPS; i ++)
+        sigmoid_table[i] = 0.5f + 0.5f * tanhf (steepness * ((float) i / SIGMOID_STEPS - 0.5f));
+
+    /* guard entry so that interpolating at exactly 1.0 stays in bounds */
+    sigmoid_table[SIGMOID_STEPS + 1] = sigmoid_table[SIGMOID_STEPS];
+    sigmoid_steepness = steepness;
 }
 
-static void do_linear_ramp (float * data, int length, float a, float b)
+static void do_linear_ramp (float * data, int length, float a, float b, float total)
 {
+    float step = (b - a) / total;
     for (int i = 0; i < length; i ++)
-        (* data ++) *= (a * (length - i) + b * i) / length;
+        data[i] *= a + step * i;
 }
 
-static void do_sigmoid_ramp (float * data, int length, float a, float b)
+static void do_sigmoid_ramp (float * data, int length, float a, float b, float total)
 {
-    float steepness = aud_get_double ("crossfade", "sigmoid_steepness");
+    float step = (b - a) / total * SIGMOID_STEPS;
+    float pos0 = a * SIGMOID_STEPS;
+
     for (int i = 0; i < length; i ++)
     {
-        float linear = (a * (length - i) + b * i) / length;
-        (* data ++) *= 0.5f + 0.5f * tanhf (steepness * (linear - 0.5f));
+        float pos = aud::clamp (pos0 + step * i, 0.0f, (float) SIGMOID_STEPS);
+        int idx = (int) pos;
+        float frac = pos - idx;
+        data[i] *= sigmoid_table[idx] + frac * (sigmoid_table[idx + 1] - sigmoid_table[idx]);
     }
 }
 
-static void do_ramp (float * data, int length, float a, float b)
+/* applies a fade running from a to b over total samples to the first
+ * length of them; a partial ramp is used to fade ring buffer segments */
+static void do_ramp (float * data, int length, float a, float b, float total, bool sigmoid)
 {
-    if (aud_get_bool ("crossfade", "use_sigmoid"))
-        do_sigmoid_ramp (data, length, a, b);
+    if (sigmoid)
+        do_sigmoid_ramp (data, length, a, b, total);
     else
-        do_linear_ramp (data, length, a, b);
+        do_linear_ramp (data, length, a, b, total);
+}
+
+static bool use_sigmoid ()
+{
+    if (! aud_get_bool ("crossfade", "use_sigmoid"))
+        return false;
+
+    update_sigmoid_table ();
+    return true;
+}
+
+/* length of the contiguous run in buffer starting at logical position pos */
+static int buffer_run (int pos)
+{
+    int linear = buffer.linear ();
+    return (pos < linear) ? linear - pos : buffer.len () - pos;
+}
+
+/* fades length samples of buffer starting at logical position pos, the
+ * gain going from a to b */
+static void ramp_range (int pos, int length, float a, float b)
+{
+    bool sigmoid = use_sigmoid ();
+    int end = pos + length;
+
+    while (pos < end)
+    {
+        int run = aud::min (end - pos, buffer_run (pos));
+        float from = a + (b - a) * (pos + length - end) / length;
+        float to = a + (b - a) * (pos + run + length - end) / length;
+
+        do_ramp (& buffer[pos], run, from, to, run, sigmoid);
+        pos += run;
+    }
+}
+
+static int pending_samples ()
+{
+    return (convert_frames - convert_pos) * current_channels;
+}
+
+/* buffer length including audio not yet converted to the current format */
+static int buffer_total ()
+{
+    return buffer.len () + pending_samples ();
+}
+
+static void convert_to (int samples);
+
+static void ramp_buffer (float a, float b)
+{
+    /* a second fade before the first has been fully applied is rare
+     * enough (end of playlist during a fade-in) to just convert first */
+    if (ramp_pending)
+        convert_to (buffer_total ());
+
+    int length = buffer_total ();
+    if (! length)
+        return;
+
+    int converted = buffer.len ();
+    float split = a + (b - a) * converted / length;
+
+    if (converted)
+        ramp_range (0, converted, a, split);
+
+    if (pending_samples ())
+    {
+        ramp_pending = true;
+        ramp_a = a;
+        ramp_b = b;
+        ramp_pos = converted;
+        ramp_length = length;
+    }
+}
+
+static void mix (float * data, const float * add, int length)
+{
+    for (int i = 0; i < length; i ++)
+        data[i] += add[i];
+}
+
+/* mixes length samples into buffer starting at logical position pos */
+static void mix_into_buffer (int pos, const float * add, int length)
+{
+    while (length)
+    {
+        int run = aud::min (length, buffer_run (pos));
+        mix (& buffer[pos], add, run);
+
+        pos += run;
+        add += run;
+        length -= run;
+    }
+}
+
+/* makes room for at least len more samples; the buffer is only ever
+ * reallocated when the overlap length or format changes */
+static void buffer_reserve (int len)
+{
+    int needed = buffer.len () + len;
+    if (needed > buffer.size ())
+        buffer.alloc (aud::max (needed, buffer.size () * 3 / 2));
+}
+
+static void buffer_append (const float * data, int len)
+{
+    if (! len)
+        return;
+
+    /* new audio goes after the old, so any conversion has to finish first
+     * (this only happens on a format change in mid-song) */
+    convert_to (buffer_total ());
+
+    buffer_reserve (len);
+    buffer.copy_in (data, len);
 }
 
-static void mix (float * data, float * add, int length)
+static void buffer_append_silence (int len)
 {
-    while (length --)
-        (* data ++) += (* add ++);
+    static const float zeros[1024] = {};
+
+    buffer_reserve (len);
+    while (len > 0)
+    {
+        int copy = aud::min (len, (int) aud::n_elems (zeros));
+        buffer.copy_in (zeros, copy);
+        len -= copy;
+    }
+}
+
+/* returns the next frames frames of source, resampled to the current rate
+ * and padded with silence at the end */
+static const float * resample_block (int frames)
+{
+    int source_frames = source.len () / source_channels;
+    convert_in.resize (frames * source_channels);
+
+#ifdef CROSSFADE_SAMPLERATE
+    if (src_state)
+    {
+        int done = 0;
+
+        while (done < frames)
+        {
+            SRC_DATA d = SRC_DATA ();
+            d.data_in = source.begin () + source_pos * source_channels;
+            d.input_frames = source_frames - source_pos;
+            d.data_out = convert_in.begin () + done * source_channels;
+            d.output_frames = frames - done;
+            d.src_ratio = (double) current_rate / source_rate;
+            d.end_of_input = true;  /* the whole old song is in source already */
+
+            if (src_process (src_state, & d) || ! d.output_frames_gen)
+                break;
+
+            source_pos += d.input_frames_used;
+            done += d.output_frames_gen;
+        }
+
+        memset (convert_in.begin () + done * source_channels, 0,
+         sizeof (float) * (frames - done) * source_channels);
+
+        return convert_in.begin ();
+    }
+#endif
+
+    /* same rate, or no libsamplerate: take the nearest source frame */
+    for (int f = 0; f < frames; f ++)
+    {
+        int64_t s = (int64_t) (convert_pos + f) * source_rate / current_rate;
+        const float * get = & source[aud::min ((int) s, source_frames - 1) * source_channels];
+
+        for (int c = 0; c < source_channels; c ++)
+            convert_in[f * source_channels + c] = get[c];
+    }
+
+    return convert_in.begin ();
 }
 
-/* stupid simple resampling/rechanneling algorithm */
+/* converts the next frames frames of source to the current format and
+ * appends them to buffer */
+static void convert_block (int frames)
+{
+    const float * in = resample_block (frames);
+
+    convert_out.resize (frames * current_channels);
+    float * out = convert_out.begin ();
+
+    for (int f = 0; f < frames; f ++)
+    {
+        for (int c = 0; c < current_channels; c ++)
+        {
+            float sum = 0;
+            for (int i = 0; i < source_channels; i ++)
+                sum += in[i] * matrix[i][c];
+
+            out[c] = sum;
+        }
+
+        in += source_channels;
+        out += current_channels;
+    }
+
+    buffer.copy_in (convert_out.begin (), convert_out.len ());
+}
+
+/* converts pending audio until buffer holds at least samples samples */
+static void convert_to (int samples)
+{
+    int start = buffer.len ();
+
+    while (buffer.len () < samples && convert_pos < convert_frames)
+    {
+        int frames = aud::min (convert_frames - convert_pos, CONVERT_BLOCK);
+        convert_block (frames);
+        convert_pos += frames;
+    }
+
+    int converted = buffer.len () - start;
+
+    if (ramp_pending && converted)
+    {
+        float a = ramp_a + (ramp_b - ramp_a) * ramp_pos / ramp_length;
+        float b = ramp_a + (ramp_b - ramp_a) * (ramp_pos + converted) / ramp_length;
+
+        ramp_range (start, converted, a, b);
+        ramp_pos += converted;
+    }
+
+    if (convert_pos == convert_frames)
+    {
+        source.resize (0);
+        free_resampler ();
+        ramp_pending = false;
+    }
+}
+
+static void drop_pending ()
+{
+    source.resize (0);
+    free_resampler ();
+    convert_pos = convert_frames = 0;
+    ramp_pending = false;
+}
+
+/* Sets up conversion of the buffered audio to a new format.  The actual
+ * work is done by convert_to () as the audio is mixed or output. */
 static void reformat (int channels, int rate)
 {
     if (channels == current_channels && rate == current_rate)
         return;
 
-    int old_frames = buffer.len () / current_channels;
-    int new_frames = (int64_t) old_frames * rate / current_rate;
+    /* finish any earlier conversion while the old format is still current */
+    convert_to (buffer_total ());
+
+    if (! buffer.len ())
+        return;
 
-    int map[AUD_MAX_CHANNELS];
-    for (int c = 0; c < channels; c ++)
-        map[c] = c * current_channels / channels;
+    source.resize (0);
+    buffer.move_out (source, -1, buffer.len ());
 
-    Index<float> new_buffer;
-    new_buffer.resize (new_frames * channels);
+    source_channels = current_channels;
+    source_rate = current_rate;
+    source_pos = 0;
 
-    for (int f = 0; f < new_frames; f ++)
-    {
-        int f0 = (int64_t) f * current_rate / rate;
-        int s0 = f0 * current_channels;
-        int s = f * channels;
+    channel_matrix_default (source_channels, channels, matrix[0], AUD_MAX_CHANNELS);
 
-        for (int c = 0; c < channels; c ++)
-            new_buffer[s + c] = buffer[s0 + map[c]];
+#ifdef CROSSFADE_SAMPLERATE
+    if (rate != source_rate)
+    {
+        int error;
+        if (! (src_state = src_new (SRC_SINC_MEDIUM_QUALITY, source_channels, & error)))
+            AUDERR ("%s\n", src_strerror (error));
     }
+#endif
+
+    convert_pos = 0;
+    convert_frames = (int64_t) (source.len () / source_channels) * rate / source_rate;
 
-    buffer = std::move (new_buffer);
+    buffer_reserve (convert_frames * channels);
 }
 
 static int buffer_needed_for_state ()
@@ -191,13 +512,18 @@ static int buffer_needed_for_state ()
     return current_channels * (int) (current_rate * overlap);
 }
 
-static void output_data_as_ready (int buffer_needed, bool exact)
+/* anything beyond the needed overlap can go out right away; since the
+ * ring buffer never shifts its contents, there is no point in holding
+ * it back to batch up larger blocks */
+static void output_data_as_ready (int buffer_needed)
 {
-    int copy = buffer.len () - buffer_needed;
+    int copy = buffer_total () - buffer_needed;
 
-    /* if allowed, wait until we have at least 1/2 second ready to output */
-    if (exact ? (copy > 0) : (copy >= current_channels * (current_rate / 2)))
-        output.move_from (buffer, 0, -1, copy, true, true);
+    if (copy > 0)
+    {
+        convert_to (copy);
+        buffer.move_out (output, -1, copy);
+    }
 }
 
 void Crossfade::start (int & channels, int & rate)
@@ -213,42 +539,52 @@ void Crossfade::start (int & channels, int & rate)
         if (aud_get_bool ("crossfade", "manual"))
         {
             state = STATE_FLUSHED;
-            buffer.insert (0, buffer_needed_for_state ());
+            buffer_append_silence (buffer_needed_for_state ());
         }
         else
             state = STATE_RUNNING;
     }
+
+    /* size the buffer for the longest overlap plus a second of headroom
+     * up front, so that process () doesn't have to grow it */
+    double length = aud::max (aud_get_double ("crossfade", "length"),
+     aud_get_double ("crossfade", "manual_length"));
+    buffer_reserve (channels * (int) (rate * (length + 1)) - buffer.len ());
 }
 
 static void run_fadeout ()
 {
-    do_ramp (buffer.begin (), buffer.len (), 1.0, 0.0);
+    ramp_buffer (1.0, 0.0);
 
     state = STATE_FADEIN;
     fadein_point = 0;
 }
 
-static void run_fadein (Index<float> & data)
+/* returns the number of samples of data consumed */
+static int run_fadein (Index<float> & data)
 {
-    int length = buffer.len ();
+    int length = buffer_total ();
+    int copy = 0;
 
     if (fadein_point < length)
     {
-        int copy = aud::min (data.len (), length - fadein_point);
+        copy = aud::min (data.len (), length - fadein_point);
+        convert_to (fadein_point + copy);
         float a = (float) fadein_point / length;
         float b = (float) (fadein_point + copy) / length;
 
         if (! aud_get_bool ("crossfade", "no_fade_in"))
-            do_ramp (data.begin (), copy, a, b);
+            do_ramp (data.begin (), copy, a, b, copy, use_sigmoid ());
 
-        mix (& buffer[fadein_point], data.begin (), copy);
-        data.remove (0, copy);
+        mix_into_buffer (fadein_point, data.begin (), copy);
 
         fadein_point += copy;
     }
 
     if (fadein_point == length)
         state = STATE_RUNNING;
+
+    return copy;
 }
 
 Index<float> & Crossfade::process (Index<float> & data)
@@ -258,16 +594,18 @@ Index<float> & Crossfade::process (Index<float> & data)
 
     output.resize (0);
 
+    int used = 0;
+
     if (state == STATE_FINISHED || state == STATE_FLUSHED)
         run_fadeout ();
 
     if (state == STATE_FADEIN)
-        run_fadein (data);
+        used = run_fadein (data);
 
     if (state == STATE_RUNNING)
     {
-        buffer.insert (data.begin (), -1, data.len ());
-        output_data_as_ready (buffer_needed_for_state (), false);
+        buffer_append (data.begin () + used, data.len () - used);
+        output_data_as_ready (buffer_needed_for_state ());
     }
 
     return output;
@@ -282,14 +620,30 @@ bool Crossfade::flush (bool force)
     {
         state = STATE_FLUSHED;
         int buffer_needed = buffer_needed_for_state ();
-        if (buffer.len () > buffer_needed)
-            buffer.remove (buffer_needed, -1);
+        int len = buffer.len ();
+
+        /* keep the oldest part (the part to be faded out) */
+        if (buffer_total () > buffer_needed && buffer_needed >= len)
+            convert_frames = convert_pos + (buffer_needed - len) / current_channels;
+        else if (len > buffer_needed)
+            drop_pending ();
+
+        /* a ring buffer can only discard from the front, so copy the part
+         * to keep back in */
+        if (len > buffer_needed)
+        {
+            Index<float> keep;
+            buffer.move_out (keep, -1, buffer_needed);
+            buffer.discard ();
+            buffer.copy_in (keep.begin (), keep.len ());
+        }
 
         return false;
     }
 
     state = STATE_RUNNING;
-    buffer.resize (0);
+    buffer.discard ();
+    drop_pending ();
 
     return true;
 }
@@ -301,13 +655,15 @@ Index<float> & Crossfade::finish (Index<float> & data, bool end_of_playlist)
 
     output.resize (0);
 
+    int used = 0;
+
     if (state == STATE_FADEIN)
-        run_fadein (data);
+        used = run_fadein (data);
 
     if (state == STATE_RUNNING || state == STATE_FINISHED || state == STATE_FLUSHED)
     {
-        buffer.insert (data.begin (), -1, data.len ());
-        output_data_as_ready (buffer_needed_for_state (), state != STATE_RUNNING);
+        buffer_append (data.begin () + used, data.len () - used);
+        output_data_as_ready (buffer_needed_for_state ());
     }
 
     if (state == STATE_FADEIN || state == STATE_RUNNING)
@@ -315,21 +671,21 @@ Index<float> & Crossfade::finish (Index<float> & data, bool end_of_playlist)
         if (aud_get_bool ("crossfade", "automatic"))
         {
             state = STATE_FINISHED;
-            output_data_as_ready (buffer_needed_for_state (), true);
+            output_data_as_ready (buffer_needed_for_state ());
         }
         else
         {
             state = STATE_OFF;
-            output_data_as_ready (0, true);
+            output_data_as_ready (0);
         }
     }
 
     if (end_of_playlist && (state == STATE_FINISHED || state == STATE_FLUSHED))
     {
-        do_ramp (buffer.begin (), buffer.len (), 1.0, 0.0);
+        ramp_buffer (1.0, 0.0);
 
         state = STATE_OFF;
-        output_data_as_ready (0, true);
+        output_data_as_ready (0);
     }
 
     return output;
@@ -337,5 +693,5 @@ Index<float> & Crossfade::finish (Index<float> & data, bool end_of_playlist)
 
 int Crossfade::adjust_delay (int delay)
 {
-    return delay + aud::rescale<int64_t> (buffer.len () / current_channels, current_rate, 1000);
+    return delay + aud::rescale<int64_t> (buffer_total () / current_channels, current_rate, 1000);
 }
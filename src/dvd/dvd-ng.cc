@@ -50,6 +50,7 @@ extern "C" {
 // #define RAW_PACKET_BUFFER_SIZE 32768
 
 #include "../ffaudio/ffaudio-stdinc.h"
+#include "../ffaudio/ffaudio-pool.h"
 
 /* prevent libcdio from redefining PACKAGE, VERSION, etc. */
 #define EXTERNAL_LIBDVDNAV_CONFIG_H
@@ -102,25 +103,6 @@ typedef struct
 }
 CodecInfo;
 
-struct ScopedFrame
-{
-#if CHECK_LIBAVCODEC_VERSION (55, 45, 101, 55, 28, 1)
-    AVFrame * ptr = av_frame_alloc ();
-#else
-    AVFrame * ptr = avcodec_alloc_frame ();
-#endif
-
-    AVFrame * operator-> () { return ptr; }
-
-#if CHECK_LIBAVCODEC_VERSION (55, 45, 101, 55, 28, 1)
-    ~ScopedFrame () { av_frame_free (& ptr); }
-#elif CHECK_LIBAVCODEC_VERSION (54, 59, 100, 54, 28, 0)
-    ~ScopedFrame () { avcodec_free_frame (& ptr); }
-#else
-    ~ScopedFrame () { av_free (ptr); }
-#endif
-};
-
 static const char * const dvd_schemes[] = {"dvd", nullptr};
 
 class DVD : public InputPlugin
@@ -224,6 +206,7 @@ typedef enum {
 
 static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
 static pthread_mutex_t queue_mutex = PTHREAD_MUTEX_INITIALIZER;
+static DecodePool pool;         /* RECYCLED PACKETS/FRAMES (ALL GOTTEN & PUT BACK ON THE PLAY THREAD). */
 static bool playing;            /* From Audacious - TRUE WHILE DVD IS ACTIVELY PLAYING. */
 static bool play_video;  /* JWT: TRUE IF USER IS CURRENTLY PLAYING VIDEO (KILLING VID. WINDOW TURNS OFF)! */
 static bool stop_playback;      /* SIGNAL FROM USER TO STOP PLAYBACK */
@@ -711,16 +694,16 @@ bool DVD::write_videoframe (SDL_Renderer * renderer, CodecInfo * vcinfo,
     while (subframeCnt < 16)
     {
 #endif
-        ScopedFrame vframe;
+        AVFrame * vframe = pool.get_frame (pool.vframe);
 #ifdef SEND_PACKET
-        int res = avcodec_receive_frame (vcinfo->context, vframe.ptr);
+        int res = avcodec_receive_frame (vcinfo->context, vframe);
         if (res < 0)
             return false;  /* read next packet (continue past errors) */
         else if (! pkt->size)
             avcodec_flush_buffers (vcinfo->context);
 #else
         frameFinished = 0;
-        len = LOG (avcodec_decode_video2, vcinfo->context, vframe.ptr, & frameFinished, pkt);
+        len = LOG (avcodec_decode_video2, vcinfo->context, vframe, & frameFinished, pkt);
         /* Did we get a video frame? */
         if (len < 0)
         {
@@ -736,8 +719,10 @@ bool DVD::write_videoframe (SDL_Renderer * renderer, CodecInfo * vcinfo,
                     vframe->data[1], vframe->linesize[1], vframe->data[2], vframe->linesize[2]);
                 SDL_RenderCopy (renderer, bmp, nullptr, nullptr);  // USE NULL TO GET IMAGE TO FIT WINDOW!
                 (*windowIsStable) = true;
+                DecodePool::done_with_frame (vframe);
                 return true;
             }
+            DecodePool::done_with_frame (vframe);
             return false;
 #ifndef SEND_PACKET
         }
@@ -891,7 +876,7 @@ void save_window_xy (SDL_Window * sdl_window, int video_window_x, int video_wind
 void DVD::write_audioframe (CodecInfo * cinfo, AVPacket * pkt, int out_fmt, bool planar)
 {
     int size = 0;
-    Index<char> buf;
+    AVFrame * frame = pool.get_frame (pool.aframe);
 #ifdef SEND_PACKET
     if (LOG (avcodec_send_packet, cinfo->context, pkt) < 0)
         return;
@@ -908,13 +893,12 @@ void DVD::write_audioframe (CodecInfo * cinfo, AVPacket * pkt, int out_fmt, bool
 
     while (pkt->size > 0)
     {
-        ScopedFrame frame;
 #ifdef SEND_PACKET
-        if (LOG (avcodec_receive_frame, cinfo->context, frame.ptr) < 0)
+        if (LOG (avcodec_receive_frame, cinfo->context, frame) < 0)
             break;  /* read next packet (continue past errors) */
 #else
         decoded = 0;
-        len = LOG (avcodec_decode_audio4, cinfo->context, frame.ptr, & decoded, pkt);
+        len = LOG (avcodec_decode_audio4, cinfo->context, frame, & decoded, pkt);
         if (len < 0)
         {
             AUDERR ("e:decode_audio() failed, code %d\n", len);
@@ -935,15 +919,16 @@ void DVD::write_audioframe (CodecInfo * cinfo, AVPacket * pkt, int out_fmt, bool
         size = FMT_SIZEOF (out_fmt) * channels * frame->nb_samples;
         if (planar)
         {
-            if (size > buf.len ())
-                buf.resize (size);
+            char * buf = pool.get_buffer (size);
 
             audio_interlace ((const void * *) frame->data, out_fmt,
-                    channels, buf.begin (), frame->nb_samples);
-            write_audio (buf.begin (), size);
+                    channels, buf, frame->nb_samples);
+            write_audio (buf, size);
         }
         else
             write_audio (frame->data[0], size);
+
+        DecodePool::done_with_frame (frame);
     }
     return;
 }
@@ -999,7 +984,7 @@ bool Dequeue (pktQueue *Q)
         pthread_mutex_lock (& queue_mutex);  // (READER THREAD IS ENQUEUING MORE AT SAME TIME)!
 
         Q->size--;
-        av_packet_free (& Q->elements[Q->front]);
+        pool.put_packet (& Q->elements[Q->front]);
 
         Q->front++;
         /* As we fill elements in circular fashion */
@@ -1019,7 +1004,7 @@ void QFlush (pktQueue *Q)
     while (Q->size > 0)
     {
         Q->size--;
-        av_packet_free (& Q->elements[Q->front]);
+        pool.put_packet (& Q->elements[Q->front]);
 
         Q->front++;
         /* As we fill elements in circular fashion */
@@ -1819,7 +1804,7 @@ AUDDBG("---INPUT PIPE OPENED!\n");
         }
 
         /* READ AND PROCESS NEXT FRAME: */
-        if (! (pkt = av_packet_alloc ()))
+        if (! (pkt = pool.get_packet ()))
         {
             dvdnav_priv->nochannelhop = false;
             AUDERR ("s:FFMpeg error: could not allocate memory for packet, giving up.\n");
@@ -1843,7 +1828,7 @@ AUDDBG("---INPUT PIPE OPENED!\n");
                 if (pause_reading)
                     nanosleep ((const struct timespec[]){{0, 40000000L}}, NULL);  //PREVENT PROCESSOR-COOKING.
                 else
-                    av_packet_free (& pkt);
+                    pool.put_packet (& pkt);
 
                 readblock = false;
                 if (! eof)
@@ -1993,7 +1978,7 @@ AUDDBG("---INPUT PIPE OPENED!\n");
             {
                 dvdnav_priv->nochannelhop = false;
                 AUDERR ("w:av_read_frame error %d, giving up.\n", ret);
-                av_packet_free (& pkt);
+                pool.put_packet (& pkt);
                 stop_playback = true;
                 checkcodecs = false;
                 if (bmp)
@@ -2003,7 +1988,7 @@ AUDDBG("---INPUT PIPE OPENED!\n");
             else
             {
                 AUDERR ("w:Error reading packet, try again?\n");
-                av_packet_free (& pkt);
+                pool.put_packet (& pkt);
                 continue;
             }
         }
@@ -2132,28 +2117,28 @@ AUDDBG("---INPUT PIPE OPENED!\n");
                 if (codec_opened && pkt && pkt->stream_index == cinfo.stream_idx)  /* WE READ AN AUDIO PACKET: */
                 {
                     if (! Enqueue (apktQ, pkt))
-                        av_packet_free (& pkt);
+                        pool.put_packet (& pkt);
                 }
                 else
                 {
                     if (vcodec_opened)
                     {
                         if (pkt && (pkt->stream_index != vcinfo.stream_idx || ! Enqueue (pktQ, pkt)))  /* WE READ A VIDEO PACKET: */
-                            av_packet_free (& pkt);
+                            pool.put_packet (& pkt);
                     }
                     else   /* IGNORE ANY OTHER SUBSTREAMS */
                     {
                         if (pkt)
-                            av_packet_free (& pkt);
+                            pool.put_packet (& pkt);
                         continue;
                     }
                 }
             }
             else if (pkt)
-                av_packet_free (& pkt);
+                pool.put_packet (& pkt);
         }
         else if (pkt)
-            av_packet_free (& pkt);
+            pool.put_packet (& pkt);
 
         if (! myplay_video)
             continue;
@@ -2479,6 +2464,7 @@ error_exit:  /* WE END UP HERE WHEN PLAYBACK IS STOPPED: */
     if (pktQ)
         destroyQueue (pktQ);
     pktQ = nullptr;      // QUEUE FOR VIDEO-PACKET QUEUEING.
+    pool.log_stats ("DVD");
 
     /* CLOSE UP THE CODECS, ETC.: */
     if (codec_opened)
@@ -3079,6 +3065,7 @@ void DVD::cleanup ()
         avformat_network_deinit ();
         initted = false;
     }
+    pool.clear ();
     argfilename = String ();
 }
 
@@ -1,9 +1,30 @@
+#include <math.h>
+#include <string.h>
+
+#if defined (__SSE__)
+#include <xmmintrin.h>
+#elif defined (__ARM_NEON) || defined (__ARM_NEON__)
+#include <arm_neon.h>
+#endif
+
 #include <libfauxdcore/i18n.h>
 #include <libfauxdcore/runtime.h>
 #include <libfauxdcore/plugin.h>
 #include <libfauxdcore/preferences.h>
 
 #define MAX_DELAY 1000
+#define MAX_TAPS 8
+
+/* how quickly a new delay time is reached */
+#define GLIDE_MS 50
+
+enum {
+    MODE_NORMAL,
+    MODE_PING_PONG,
+    MODE_MULTITAP
+};
+
+static void update_params ();
 
 static const char echo_about[] =
  N_("Echo Plugin\n"
@@ -15,19 +36,41 @@ static const char * const echo_defaults[] = {
  "delay", "500",
  "feedback", "50",
  "volume", "50",
+ "mode", "0",
+ "taps", "4",
+ "filter", "FALSE",
+ "cutoff", "3000",
  nullptr};
 
+static const ComboItem echo_modes[] = {
+    ComboItem (N_("Normal"), MODE_NORMAL),
+    ComboItem (N_("Ping-pong"), MODE_PING_PONG),
+    ComboItem (N_("Multitap"), MODE_MULTITAP)
+};
+
 static const PreferencesWidget echo_widgets[] = {
     WidgetLabel (N_("<b>Echo</b>")),
+    WidgetCombo (N_("Mode:"),
+        WidgetInt ("echo_plugin", "mode", update_params),
+        {{echo_modes}}),
     WidgetSpin (N_("Delay:"),
-        WidgetInt ("echo_plugin", "delay"),
+        WidgetInt ("echo_plugin", "delay", update_params),
         {0, MAX_DELAY, 10, N_("ms")}),
     WidgetSpin (N_("Feedback:"),
-        WidgetInt ("echo_plugin", "feedback"),
+        WidgetInt ("echo_plugin", "feedback", update_params),
         {0, 100, 1, "%"}),
     WidgetSpin (N_("Volume:"),
-        WidgetInt ("echo_plugin", "volume"),
-        {0, 100, 1, "%"})
+        WidgetInt ("echo_plugin", "volume", update_params),
+        {0, 100, 1, "%"}),
+    WidgetSpin (N_("Taps (multitap mode):"),
+        WidgetInt ("echo_plugin", "taps", update_params),
+        {2, MAX_TAPS, 1}),
+    WidgetCheck (N_("Filter feedback (darker repeats)"),
+        WidgetBool ("echo_plugin", "filter", update_params)),
+    WidgetSpin (N_("Cutoff:"),
+        WidgetInt ("echo_plugin", "cutoff", update_params),
+        {200, 16000, 100, N_("Hz")},
+        WIDGET_CHILD)
 };
 
 static const PluginPreferences echo_prefs = {{echo_widgets}};
@@ -53,12 +96,66 @@ public:
 
 EXPORT EchoPlugin aud_plugin_instance;
 
+/* The delay line holds interleaved frames and its length is a power of two,
+ * so positions wrap with a mask instead of a modulo.  w_pos is the frame
+ * about to be written. */
 static Index<float> buffer;
-static int w_ofs;
+static int line_frames, line_mask;
+static int w_pos;
+
+static int echo_channels = 0;
+static int echo_rate = 0;
+
+/* settings, cached so that they are not looked up for every block */
+static int cur_delay, cur_feedback, cur_volume, cur_mode, cur_taps, cur_cutoff;
+static bool cur_filter;
+static bool params_changed;
+
+/* current delay in frames; while gliding to a new target, the read position
+ * is fractional and interpolated (in double precision, since the steps near
+ * the end of a glide are too small for a float at long delays) */
+static double delay, target_delay, glide_coef;
+static float feedback, volume, lp_coef;
+static int mode, taps;
+static bool filter;
+static float lp_state[AUD_MAX_CHANNELS];
+
+static void update_params ()
+{
+    cur_delay = aud_get_int ("echo_plugin", "delay");
+    cur_feedback = aud_get_int ("echo_plugin", "feedback");
+    cur_volume = aud_get_int ("echo_plugin", "volume");
+    cur_mode = aud_get_int ("echo_plugin", "mode");
+    cur_taps = aud_get_int ("echo_plugin", "taps");
+    cur_filter = aud_get_bool ("echo_plugin", "filter");
+    cur_cutoff = aud_get_int ("echo_plugin", "cutoff");
+
+    __atomic_store_n (& params_changed, true, __ATOMIC_RELEASE);
+}
+
+static void setup_params ()
+{
+    /* at least one frame, so that the read position is never the one being
+     * written */
+    int frames = aud::rescale (cur_delay, 1000, echo_rate);
+    target_delay = aud::clamp (frames, 1, line_frames - 2);
+
+    feedback = cur_feedback / 100.0f;
+    volume = cur_volume / 100.0f;
+    mode = cur_mode;
+    taps = aud::clamp (cur_taps, 2, MAX_TAPS);
+
+    if (! filter && cur_filter)
+        memset (lp_state, 0, sizeof lp_state);
+
+    filter = cur_filter;
+    lp_coef = 1 - expf (-2 * (float) M_PI * cur_cutoff / echo_rate);
+}
 
 bool EchoPlugin::init ()
 {
     aud_config_set_defaults ("echo_plugin", echo_defaults);
+    update_params ();
     return true;
 }
 
@@ -67,9 +164,6 @@ void EchoPlugin::cleanup ()
     buffer.clear ();
 }
 
-static int echo_channels = 0;
-static int echo_rate = 0;
-
 void EchoPlugin::start (int & channels, int & rate)
 {
     if (channels != echo_channels || rate != echo_rate)
@@ -77,39 +171,196 @@ void EchoPlugin::start (int & channels, int & rate)
         echo_channels = channels;
         echo_rate = rate;
 
-        buffer.resize (aud::rescale (MAX_DELAY, 1000, rate) * channels);
+        int frames = aud::rescale (MAX_DELAY, 1000, rate) + 2;
+
+        line_frames = 1;
+        while (line_frames < frames)
+            line_frames <<= 1;
+
+        line_mask = line_frames - 1;
+
+        buffer.resize (line_frames * channels);
         buffer.erase (0, -1);
 
-        w_ofs = 0;
+        w_pos = 0;
+        memset (lp_state, 0, sizeof lp_state);
     }
+
+    __atomic_store_n (& params_changed, false, __ATOMIC_RELAXED);
+    setup_params ();
+
+    delay = target_delay;
+    glide_coef = 1 - exp (-1000.0 / (GLIDE_MS * rate));
 }
 
-Index<float> & EchoPlugin::process (Index<float> & data)
+/* normal mode at a steady delay: the read and write spans are contiguous and
+ * do not overlap, so they can be processed as plain arrays */
+static void echo_span (float * data, const float * rd, float * wr, int len)
+{
+    int i = 0;
+
+#if defined (__SSE__)
+    __m128 vol = _mm_set1_ps (volume);
+    __m128 fb = _mm_set1_ps (feedback);
+
+    for (; i + 4 <= len; i += 4)
+    {
+        __m128 in = _mm_loadu_ps (data + i);
+        __m128 buf = _mm_loadu_ps (rd + i);
+        _mm_storeu_ps (data + i, _mm_add_ps (in, _mm_mul_ps (buf, vol)));
+        _mm_storeu_ps (wr + i, _mm_add_ps (in, _mm_mul_ps (buf, fb)));
+    }
+#elif defined (__ARM_NEON) || defined (__ARM_NEON__)
+    for (; i + 4 <= len; i += 4)
+    {
+        float32x4_t in = vld1q_f32 (data + i);
+        float32x4_t buf = vld1q_f32 (rd + i);
+        vst1q_f32 (data + i, vmlaq_n_f32 (in, buf, volume));
+        vst1q_f32 (wr + i, vmlaq_n_f32 (in, buf, feedback));
+    }
+#endif
+
+    for (; i < len; i ++)
+    {
+        float in = data[i];
+        float buf = rd[i];
+
+        data[i] = in + buf * volume;
+        wr[i] = in + buf * feedback;
+    }
+}
+
+static void process_spans (float * data, int frames)
+{
+    int d = (int) delay;
+
+    while (frames)
+    {
+        int r_pos = (w_pos - d) & line_mask;
+
+        /* stop at whichever end of the line comes first; limiting the span
+         * to the delay also keeps the read and write spans apart */
+        int len = aud::min (frames, d);
+        len = aud::min (len, line_frames - w_pos);
+        len = aud::min (len, line_frames - r_pos);
+
+        echo_span (data, & buffer[r_pos * echo_channels],
+         & buffer[w_pos * echo_channels], len * echo_channels);
+
+        data += len * echo_channels;
+        frames -= len;
+        w_pos = (w_pos + len) & line_mask;
+    }
+}
+
+/* reads channel c, a fractional number of frames back from w_pos */
+static inline float read_line (int c, double back)
 {
-    int delay = aud_get_int ("echo_plugin", "delay");
-    float feedback = aud_get_int ("echo_plugin", "feedback") / 100.0f;
-    float volume = aud_get_int ("echo_plugin", "volume") / 100.0f;
+    double pos = w_pos - back;
+    int i = (int) floor (pos);
+    float frac = pos - i;
 
-    int interval = aud::rescale (delay, 1000, echo_rate) * echo_channels;
-    interval = aud::clamp (interval, 0, buffer.len ());  // sanity check
+    float a = buffer[(i & line_mask) * echo_channels + c];
+    float b = buffer[((i + 1) & line_mask) * echo_channels + c];
 
-    int r_ofs = w_ofs - interval;
-    if (r_ofs < 0)
-        r_ofs += buffer.len ();
+    return a + (b - a) * frac;
+}
+
+static inline float filter_feedback (int c, float x)
+{
+    if (! filter)
+        return x;
+
+    lp_state[c] += lp_coef * (x - lp_state[c]);
+    return lp_state[c];
+}
 
-    float * end = data.end ();
+/* general case: one frame at a time, for the other modes, for the feedback
+ * filter and while gliding between delay times */
+static void process_frames (float * data, int frames)
+{
+    const int channels = echo_channels;
+    float echo[AUD_MAX_CHANNELS];
 
-    for (float * f = data.begin (); f < end; f++)
+    for (; frames --; data += channels)
     {
-        float in = * f;
-        float buf = buffer[r_ofs];
+        if (delay != target_delay)
+        {
+            delay += (target_delay - delay) * glide_coef;
+            if (fabs (target_delay - delay) < 0.01)
+                delay = target_delay;
+        }
+
+        float * wr = & buffer[w_pos * channels];
+
+        for (int c = 0; c < channels; c ++)
+            echo[c] = read_line (c, delay);
+
+        switch (mode)
+        {
+        case MODE_PING_PONG:
+        {
+            /* the input goes into the first channel only, and each repeat
+             * moves on to the next channel */
+            float mono = 0;
+            for (int c = 0; c < channels; c ++)
+                mono += data[c];
+
+            wr[0] = mono / channels + feedback * filter_feedback (0, echo[channels - 1]);
+
+            for (int c = 1; c < channels; c ++)
+                wr[c] = feedback * filter_feedback (c, echo[c - 1]);
+
+            for (int c = 0; c < channels; c ++)
+                data[c] += echo[c] * volume;
+
+            break;
+        }
+
+        case MODE_MULTITAP:
+            /* taps evenly spaced up to the delay time, fading out; only the
+             * last one is fed back */
+            for (int c = 0; c < channels; c ++)
+            {
+                float in = data[c];
+                float sum = echo[c] / taps;
+
+                for (int t = 1; t < taps; t ++)
+                    sum += read_line (c, aud::max (delay * t / taps, 1.0)) * (taps - t + 1) / taps;
 
-        * f = in + buf * volume;
-        buffer[w_ofs] = in + buf * feedback;
+                data[c] = in + sum * volume;
+                wr[c] = in + feedback * filter_feedback (c, echo[c]);
+            }
 
-        r_ofs = (r_ofs + 1) % buffer.len ();
-        w_ofs = (w_ofs + 1) % buffer.len ();
+            break;
+
+        default:
+            for (int c = 0; c < channels; c ++)
+            {
+                float in = data[c];
+
+                data[c] = in + echo[c] * volume;
+                wr[c] = in + feedback * filter_feedback (c, echo[c]);
+            }
+
+            break;
+        }
+
+        w_pos = (w_pos + 1) & line_mask;
     }
+}
+
+Index<float> & EchoPlugin::process (Index<float> & data)
+{
+    if (__atomic_exchange_n (& params_changed, false, __ATOMIC_ACQUIRE))
+        setup_params ();
+
+    int frames = data.len () / echo_channels;
+
+    if (mode == MODE_NORMAL && ! filter && delay == target_delay)
+        process_spans (data.begin (), frames);
+    else
+        process_frames (data.begin (), frames);
 
     return data;
 }
@@ -0,0 +1,126 @@
+/*
+ * Fauxdacious FFaudio Plugin - demux throughput benchmark for the AVIO backend
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions, and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions, and the following disclaimer in the documentation
+ *    provided with the distribution.
+ *
+ * This software is provided "as is" and without any warranty, express or
+ * implied. In no event shall the authors be liable for any damages arising from
+ * the use of this software.
+ */
+
+/* Not part of the plugin build.  Demuxes (without decoding) each file given on
+ * the command line through ffaudio's AVIO backend, once reading directly, once
+ * mmap'ed and once through the read-ahead ring for each block size, and prints
+ * the demux throughput in MB/s.  Build it with "make bench" in the plugin
+ * directory (after configure, since it needs config.h) and run e.g.
+ * "bench/io-bench /mnt/nfs/video.mkv http://host/video.mp4".  Live streams of
+ * unknown size are always read directly, so only the first pass means anything
+ * for them.  Drop the page cache between runs (echo 3 > /proc/sys/vm/drop_caches)
+ * to measure the storage rather than memory; the first pass over a local file
+ * warms it up.  */
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "../ffaudio-stdinc.h"
+
+#include <libfauxdcore/audstrings.h>
+#include <libfauxdcore/runtime.h>
+
+static const int block_kbs[] = {64, 128, 256, 512, 1024, 2048, 4096};
+
+static double now_secs ()
+{
+    struct timespec ts;
+    clock_gettime (CLOCK_MONOTONIC, & ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* returns MB/s of demuxed input, or -1 on error */
+static double run (const char * uri, bool readahead)
+{
+    VFSFile file (uri, "r");
+    if (! file)
+    {
+        fprintf (stderr, "%s: %s\n", uri, file.error ());
+        return -1;
+    }
+
+    AVFormatContext * c = avformat_alloc_context ();
+    AVIOContext * io = io_context_new (file, readahead);
+    c->pb = io;
+
+    double start = now_secs ();
+    double result = -1;
+
+    if (avformat_open_input (& c, uri, nullptr, nullptr) >= 0)
+    {
+        AVPacket * pkt = av_packet_alloc ();
+
+        while (av_read_frame (c, pkt) >= 0)
+            av_packet_unref (pkt);
+
+        av_packet_free (& pkt);
+
+        double secs = now_secs () - start;
+        int64_t bytes = avio_tell (io);
+        result = (secs > 0) ? bytes / secs / 1e6 : 0;
+
+        avformat_close_input (& c);
+    }
+    else
+    {
+        fprintf (stderr, "%s: cannot open input\n", uri);
+        avformat_free_context (c);
+    }
+
+    io_context_free (io);
+    return result;
+}
+
+int main (int argc, char * * argv)
+{
+    if (argc < 2)
+    {
+        fprintf (stderr, "usage: %s FILE|URI ...\n", argv[0]);
+        return 1;
+    }
+
+    av_log_set_level (AV_LOG_ERROR);
+    aud_set_int ("ffaudio", "io_readahead_blocks", 8);
+
+    for (int i = 1; i < argc; i ++)
+    {
+        StringBuf uri = strstr (argv[i], "://") ? str_copy (argv[i]) : filename_to_uri (argv[i]);
+        if (! uri)
+            continue;
+
+        printf ("%s\n", argv[i]);
+
+        aud_set_bool ("ffaudio", "io_mmap", false);
+        run (uri, false);  // (warm-up)
+        printf ("  %-20s %8.1f MB/s\n", "direct", run (uri, false));
+
+        aud_set_bool ("ffaudio", "io_mmap", true);
+        printf ("  %-20s %8.1f MB/s\n", "mmap", run (uri, false));
+        aud_set_bool ("ffaudio", "io_mmap", false);
+
+        for (int kb : block_kbs)
+        {
+            aud_set_int ("ffaudio", "io_block_kb", kb);
+            StringBuf label = str_printf ("read-ahead %d KiB", kb);
+            printf ("  %-20s %8.1f MB/s\n", (const char *) label, run (uri, true));
+        }
+    }
+
+    return 0;
+}
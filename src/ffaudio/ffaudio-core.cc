@@ -25,12 +25,14 @@
 #include <string.h>
 extern "C" {
 #include <unistd.h>
+#include <libavutil/cpu.h>
 }
 
 #undef FFAUDIO_DOUBLECHECK  /* Doublecheck probing result for debugging purposes */
 #undef FFAUDIO_NO_BLACKLIST /* Don't blacklist any recognized codecs/formats */
 
 #include "ffaudio-stdinc.h"
+#include "ffaudio-pool.h"
 
 #include <pthread.h>
 
@@ -61,16 +63,40 @@ extern "C" {
 #define SEND_PACKET 1
 #endif
 
+/* SINGLE-PRODUCER/SINGLE-CONSUMER PACKET RING:  THE READER THREAD IS THE ONLY ONE THAT
+   EVER ADVANCES head AND THE DECODING THREAD (PLAY THREAD FOR AUDIO, VIDEO-DECODER THREAD FOR
+   VIDEO) IS THE ONLY ONE THAT EVER ADVANCES tail, SO NEITHER SIDE NEEDS A LOCK TO PUSH OR POP -
+   THE MUTEX/CONDITION BELOW IS ONLY USED TO SLEEP WHEN A QUEUE IS FULL OR EMPTY. */
 typedef struct
 {
-    int capacity;
-    int size;
-    int front;
-    int rear;
+    unsigned capacity;      // ALWAYS A POWER OF 2, SO WE CAN MASK INSTEAD OF WRAPPING.
+    unsigned mask;
+    unsigned head;          // FREE-RUNNING COUNT OF PACKETS PUSHED (READER THREAD ONLY).
+    unsigned tail;          // FREE-RUNNING COUNT OF PACKETS POPPED (DECODING THREAD ONLY).
     AVPacket * * elements;
+    int pool_lane;          // DecodePool LANE THE DECODING THREAD RETURNS SPENT PACKETS TO.
+    unsigned max_depth;     // STATS: HIGH-WATER MARK (WRITTEN BY READER THREAD).
+    unsigned full_stalls;   // STATS: TIMES READER BLOCKED ON A FULL QUEUE.
+    unsigned empty_stalls;  // STATS: TIMES DECODER BLOCKED ON AN EMPTY QUEUE (DEMUXER IS THE BOTTLENECK).
+    unsigned full_drops;    // STATS: PACKETS DROPPED TO KEEP THE OTHER QUEUE FROM STARVING.
 }
 pktQueue;
 
+/* SMALL SPSC RING OF DECODED VIDEO FRAMES (VIDEO-DECODER THREAD -> VIDEO-PRESENTER THREAD, WHICH PICKS
+   EACH ONE WHEN THE AUDIO CLOCK REACHES ITS PTS AND HANDS IT TO THE PLAY THREAD, WHICH OWNS THE WINDOW AND
+   SDL RENDERER, TO SHOW).  THE AVFrames ARE ALLOCATED ONCE AND DECODED INTO IN PLACE. */
+#define FRMQ_SIZE 4  // MUST BE A POWER OF 2.
+typedef struct
+{
+    AVFrame * frames[FRMQ_SIZE];
+    int64_t pts_ms[FRMQ_SIZE];  // PRESENTATION TIME (PLAYBACK POSITION IN MS), -1 = ASAP.
+    unsigned head;          // FRAMES DECODED (VIDEO-DECODER THREAD ONLY).
+    unsigned tail;          // FRAMES PRESENTED OR DROPPED (PRESENTER THREAD, OR PLAY THREAD WHILST frame_due).
+    unsigned presented;     // STATS.
+    unsigned dropped;       // STATS: LATE FRAMES SKIPPED TO CATCH UP W/THE AUDIO.
+}
+frmQueue;
+
 typedef struct
 {
     int stream_idx;
@@ -87,6 +113,15 @@ typedef struct
     pktQueue *apktQ = nullptr; // QUEUE FOR AUDIO-PACKET QUEUEING.
     AVFormatContext * ic = nullptr;  // AVstuff.
     int errcount = 0;
+    int seek_gen = 0;  // BUMPED (UNDER read_mutex) ON EVERY SEEK SO READER CAN DROP STALE PACKETS.
+    int vseek_gen = 0; // LAST seek_gen VIDEO-DECODER THREAD HAS FLUSHED ITS QUEUE AND CODEC FOR.
+    frmQueue * vfrmQ = nullptr;  // DECODED VIDEO FRAMES AWAITING PRESENTATION.
+    int64_t start_ms = 0;        // STREAM'S STARTING TIMESTAMP (SUBTRACTED FROM FRAME PTS).
+    bool vdecoder_done = false;  // VIDEO-DECODER THREAD HAS EXITED (NO MORE FRAMES COMING).
+    bool frame_due = false;      // PRESENTER PICKED THE FRONT FRAME, PLAY THREAD SHOWS AND POPS IT, THEN CLEARS THIS.
+    bool presenter_done = false; // VIDEO-PRESENTER THREAD HAS EXITED (NO MORE FRAMES WILL COME DUE).
+    int pseek_gen = 0;           // LAST seek_gen VIDEO-PRESENTER THREAD HAS DUMPED ITS DECODED FRAMES FOR.
+    bool audio_done = false;     // PLAY THREAD HAS WRITTEN ALL THE AUDIO (CLOCK WILL STOP MOVING).
     bool videoalso;
 }
 DataShared2Thread;
@@ -98,7 +133,13 @@ static int as_decor_fudge_y = 0;
 static bool as_decor_fudge_set = false;
 #endif
 static pthread_mutex_t read_mutex = PTHREAD_MUTEX_INITIALIZER;
-static pthread_mutex_t queue_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t queue_mutex = PTHREAD_MUTEX_INITIALIZER;  // ONLY FOR SLEEPING/WAKING, NOT PUSH/POP!
+static pthread_cond_t queue_cond = PTHREAD_COND_INITIALIZER;
+static int queue_sleepers = 0;   // # THREADS (ABOUT TO BE) ASLEEP ON queue_cond.
+static DecodePool pool;          // RECYCLED PACKETS/FRAMES (READER THREAD GETS, DECODING THREADS PUT).
+#define PLAYER_WAIT_NS 10000000L  // MAX. TIME PLAY THREAD SLEEPS ON EMPTY QUEUES (STILL HAS SDL EVENTS, STOP, SEEK TO CHECK).
+#define QUEUE_MINBUFFER 12        // READER STOPS WAITING ON A FULL QUEUE ONCE THE OTHER ONE IS DOWN TO THIS MANY PACKETS.
+#define VIDEO_LATE_MS 40          // PRESENT A DUE FRAME THIS LATE, BUT DROP IT IF THE NEXT ONE IS ALSO DUE.
 
 class FFaudio : public InputPlugin
 {
@@ -128,9 +169,6 @@ public:
     bool read_tag (const char * filename, VFSFile & file, Tuple & tuple, Index<char> * image);
     bool write_tuple (const char * filename, VFSFile & file, const Tuple & tuple);
     void write_audioframe (CodecInfo * cinfo, AVPacket * pkt, int out_fmt, bool planar);
-    void write_videoframe (SDL_Renderer * renderer, CodecInfo * vcinfo, 
-            SDL_Texture * bmp, AVPacket *pkt, int video_width, 
-            int video_height, bool last_resized, bool * windowIsStable);
     bool play (const char * filename, VFSFile & file);
 };
 
@@ -140,11 +178,16 @@ const char * const FFaudio::defaults[] = {
     "play_video", "TRUE",   // TRUE: SHOW VIDEO, FALSE: PLAY AUDIO ONLY.
     "video_codec_flag_gray", "FALSE",   // PLAY VIDEO IN BLACK & WHITE (WINDOWS-ONLY, UNLESS FFMPEG COMPILED W/--enable-gray)!
     "video_qsize", "6",     // SET A PRETTY GOOD DEFAULT.
+    "video_threads", "0",   // VIDEO-DECODER (FRAME/SLICE) THREADS, 0 = ONE PER CPU CORE.
     "video_windowtitle", "Fauxdacious Video",  // APPEND TO VIDEO WINDOW-TITLE.
     "video_xmove", "1",     // RESTORE WINDOW TO PREV. SAVED POSITION.
     "video_ysize", "-1",    // ADJUST WINDOW WIDTH TO MATCH PREV. SAVED HEIGHT.
     "save_video", "FALSE",  // DUB VIDEO AS BEING PLAYED.
-    "reader_sleep_ms", "50", // TIME FOR READER THREAD TO SLEEP IN MILLISEC TO ALLOW QUEUES TO DRAIN.
+    "reader_sleep_ms", "50", // MAX. TIME FOR READER THREAD TO SLEEP ON A FULL QUEUE BEFORE RECHECKING FOR STOP (MILLISEC).
+    "io_block_kb", "256",   // READ-AHEAD BLOCK SIZE (KiB, 64-4096).
+    "io_readahead_blocks", "8", // # BLOCKS TO PREFETCH AHEAD OF THE DEMUXER.
+    "io_mmap", "FALSE",     // MAP LOCAL FILES INTO MEMORY INSTEAD OF READING THEM (CRASHES IF FILE IS TRUNCATED!).
+    "probe_cache", "TRUE",  // REMEMBER PROBED FORMATS & STREAMS OF LOCAL FILES (ffaudio-probe.cache).
     "noresize_optimizations", "FALSE", // SOME WMs (LIKE jwm) REQUIRE THIS TO BE TRUE FOR VIDEO WINDOW TO BE RESIZABLE.
 #ifdef _WIN32
     "save_video_file", "C:\\Temp\\lastvideo",
@@ -170,8 +213,19 @@ const PreferencesWidget FFaudio::widgets[] = {
     WidgetLabel (N_("<b>Advanced</b>")),
     WidgetSpin (N_("Video packet queue size"),
         WidgetInt ("ffaudio", "video_qsize"), {2, 16, 1}),
-    WidgetSpin (N_("Reader sleep interval (millisec)"),
+    WidgetSpin (N_("Video decoding threads (0 = one per CPU core)"),
+        WidgetInt ("ffaudio", "video_threads"), {0, 64, 1}),
+    WidgetSpin (N_("Reader max. wait interval (millisec)"),
         WidgetInt ("ffaudio", "reader_sleep_ms"), {1, 500, 1}),
+    WidgetSpin (N_("Read-ahead block size (KiB)"),
+        WidgetInt ("ffaudio", "io_block_kb"), {64, 4096, 64}),
+    WidgetSpin (N_("Read-ahead blocks"),
+        WidgetInt ("ffaudio", "io_readahead_blocks"), {2, 64, 1}),
+    WidgetCheck (N_("Memory-map local files (unsafe if they change during playback)"),
+        WidgetBool ("ffaudio", "io_mmap")),
+    WidgetCheck (N_("Cache probed formats of local files"),
+        WidgetBool ("ffaudio", "probe_cache")),
+    WidgetButton (N_("Clear probe cache"), {probe_cache_clear}),
     WidgetCheck (N_("Unoptimized vid. window resize (some WMs, ie. JWM may need)."),  // WE HAVE ffmpeg COMPILED W/--enable-gray IN WINDOWS!
         WidgetBool ("ffaudio", "noresize_optimizations")),
 };
@@ -181,25 +235,6 @@ const PluginPreferences FFaudio::prefs = {{widgets}};
 static bool play_video;      /* JWT: TRUE IF USER IS CURRENTLY PLAYING VIDEO (KILLING VID. WINDOW TURNS OFF)! */
 static bool initted = false; /* JWT:TRUE AFTER libav/ffaudio stuff initialized. */
 
-struct ScopedFrame
-{
-#if CHECK_LIBAVCODEC_VERSION (55, 45, 101, 55, 28, 1)
-    AVFrame * ptr = av_frame_alloc ();
-#else
-    AVFrame * ptr = avcodec_alloc_frame ();
-#endif
-
-    AVFrame * operator-> () { return ptr; }
-
-#if CHECK_LIBAVCODEC_VERSION (55, 45, 101, 55, 28, 1)
-    ~ScopedFrame () { av_frame_free (& ptr); }
-#elif CHECK_LIBAVCODEC_VERSION (54, 59, 100, 54, 28, 0)
-    ~ScopedFrame () { avcodec_free_frame (& ptr); }
-#else
-    ~ScopedFrame () { av_free (ptr); }
-#endif
-};
-
 /* 
     JWT: ADDED ALL THIS QUEUE STUFF TO SMOOTH VIDEO PERFORMANCE SO THAT VIDEO FRAMES WOULD 
     BE OUTPUT MORE INTERLACED WITH THE AUDIO FRAMES BY QUEUEING VIDEO FRAMES UNTIL AN 
@@ -216,84 +251,156 @@ struct ScopedFrame
     http://www.thelearningpoint.net/computer-science/data-structures-queues--with-c-program-source-code
 */
 
-pktQueue * createQueue (int maxElements)
+pktQueue * createQueue (int maxElements, int pool_lane)
 {
     /* Create a Queue */
     pktQueue * Q = (pktQueue *) malloc (sizeof (pktQueue));
-    /* Initialise its properties */
-    Q->elements = (AVPacket * *) malloc (sizeof (AVPacket *) * maxElements);
-    Q->size = 0;
-    Q->capacity = maxElements;
-    Q->front = 0;
-    Q->rear = -1;
+    /* Initialise its properties (ROUND CAPACITY UP TO A POWER OF 2): */
+    unsigned capacity = 2;
+    while (capacity < (unsigned) maxElements)
+        capacity <<= 1;
+
+    Q->elements = (AVPacket * *) malloc (sizeof (AVPacket *) * capacity);
+    Q->capacity = capacity;
+    Q->mask = capacity - 1;
+    Q->head = 0;
+    Q->tail = 0;
+    Q->pool_lane = pool_lane;
+    Q->max_depth = 0;
+    Q->full_stalls = 0;
+    Q->empty_stalls = 0;
+    Q->full_drops = 0;
     /* Return the pointer */
     return Q;
 }
 
+/* # PACKETS CURRENTLY IN QUEUE (SAFE TO CALL FROM EITHER THREAD): */
+static inline unsigned QSize (pktQueue * Q)
+{
+    return __atomic_load_n (& Q->head, __ATOMIC_SEQ_CST) - __atomic_load_n (& Q->tail, __ATOMIC_SEQ_CST);
+}
+
+/* OLDEST PACKET IN QUEUE (DECODING THREAD ONLY, AND ONLY AFTER CHECKING QSize ()): */
+static inline AVPacket * QFront (pktQueue * Q)
+{
+    return Q->elements[Q->tail & Q->mask];
+}
+
+/* WAKE ANY THREADS SLEEPING ON A QUEUE, BUT ONLY BOTHER WITH THE MUTEX IF THERE ARE ANY: */
+static void QWake (bool always = false)
+{
+    if (always || __atomic_load_n (& queue_sleepers, __ATOMIC_SEQ_CST))
+    {
+        pthread_mutex_lock (& queue_mutex);
+        pthread_cond_broadcast (& queue_cond);
+        pthread_mutex_unlock (& queue_mutex);
+    }
+}
+
+/* SLEEP UNTIL ready () IS TRUE (RECHECKED EACH TIME ANOTHER THREAD PUSHES/POPS), BUT NO LONGER THAN wait_ns: */
+template<class Ready>
+static void QSleep (Ready ready, long wait_ns)
+{
+    struct timespec deadline;
+    clock_gettime (CLOCK_REALTIME, & deadline);
+    deadline.tv_nsec += wait_ns;
+    deadline.tv_sec += deadline.tv_nsec / 1000000000L;
+    deadline.tv_nsec %= 1000000000L;
+
+    pthread_mutex_lock (& queue_mutex);
+    __atomic_add_fetch (& queue_sleepers, 1, __ATOMIC_SEQ_CST);
+    while (! ready ())
+    {
+        if (pthread_cond_timedwait (& queue_cond, & queue_mutex, & deadline) == ETIMEDOUT)
+            break;
+    }
+    __atomic_sub_fetch (& queue_sleepers, 1, __ATOMIC_SEQ_CST);
+    pthread_mutex_unlock (& queue_mutex);
+}
+
 bool Dequeue (pktQueue * Q)
 {
+    unsigned tail = Q->tail;
+
     /* If Queue size is zero then it is empty. So we cannot pop */
-    if (! Q->size)
+    if (__atomic_load_n (& Q->head, __ATOMIC_SEQ_CST) == tail)
         return false;
-    /* Removing an element is equivalent to incrementing index of front by one */
-    else
-    {
-        pthread_mutex_lock (& queue_mutex);  // (READER THREAD IS ENQUEUING MORE AT SAME TIME)!
-
-        Q->size--;
-        av_packet_free (& Q->elements[Q->front]);
 
-        Q->front++;
-        /* As we fill elements in circular fashion */
-        if (Q->front == Q->capacity)
-            Q->front = 0;
+    pool.put_packet (& Q->elements[tail & Q->mask], Q->pool_lane);
+    /* PUBLISH THE FREED SLOT, THEN WAKE THE READER IF IT'S WAITING FOR ONE: */
+    __atomic_store_n (& Q->tail, tail + 1, __ATOMIC_SEQ_CST);
+    QWake ();
 
-        pthread_mutex_unlock (& queue_mutex);
-    }
     return true;
 }
 
 /* JWT:FLUSH AND FREE EVERYTHING IN THE QUEUE */
+/* (DECODING THREAD, OR AFTER IT AND READER THREAD ARE JOINED) */
 void QFlush (pktQueue * Q)
 {
-    pthread_mutex_lock (& queue_mutex);  // DON'T ALLOW THREADS TO ENQUEUE OR DEQUEUE WHILST FLUSHING!
-
-    while (Q->size > 0)
-    {
-        Q->size--;
-        av_packet_free (& Q->elements[Q->front]);
-
-        Q->front++;
-        /* As we fill elements in circular fashion */
-        if (Q->front == Q->capacity)
-            Q->front = 0;
-    }
-
-    pthread_mutex_unlock (& queue_mutex);
+    while (Dequeue (Q))
+        ;
 }
 
 bool Enqueue (pktQueue * Q, AVPacket * element)
 {
+    unsigned head = Q->head;
+    unsigned depth = head - __atomic_load_n (& Q->tail, __ATOMIC_SEQ_CST);
+
     /* If the Queue is full, we cannot push an element into it as there is no space for it.*/
-    if (Q->size == Q->capacity)
+    if (depth >= Q->capacity)
         return false;
-    else
-    {
-        pthread_mutex_lock (& queue_mutex);  // (MAIN THREAD IS DEQUEUING THEM AT SAME TIME)!
 
-        Q->rear += 1;
-        /* As we fill the queue in circular fashion */
-        if (Q->rear == Q->capacity)
-            Q->rear = 0;
-        /* Insert the element in its rear side */
-        Q->elements[Q->rear] = element;
-        Q->size++;
+    /* Insert the element in its rear side, THEN PUBLISH IT TO THE DECODING THREAD: */
+    Q->elements[head & Q->mask] = element;
+    __atomic_store_n (& Q->head, head + 1, __ATOMIC_SEQ_CST);
+    if (depth + 1 > Q->max_depth)
+        Q->max_depth = depth + 1;
+
+    QWake ();
 
-        pthread_mutex_unlock (& queue_mutex);
-    }
     return true;
 }
 
+/* READER THREAD:  BLOCK UNTIL THE DECODER FREES A SLOT IN Q (INSTEAD OF POLLING W/nanosleep).
+   wait_ns IS ONLY A SAFETY NET - WE NORMALLY GET WOKEN BY Dequeue ().  RETURNS FALSE IF STOPPED.
+   IF other IS GIVEN, ALSO STOP WAITING ONCE IT RUNS DOWN TO QUEUE_MINBUFFER PACKETS:  ITS DECODER IS
+   STARVING AND MAY BE WHAT'S HOLDING UP Q'S (IE. THE VIDEO PRESENTER WAITING FOR AN AUDIO CLOCK THAT
+   STOPPED FOR LACK OF AUDIO PACKETS), SO THE CALLER DROPS ITS PACKET INSTEAD IF Q IS STILL FULL. */
+static bool QWaitForRoom (pktQueue * Q, pktQueue * other, long wait_ns)
+{
+    auto room = [Q, other] () {
+        return QSize (Q) < Q->capacity || (other && QSize (other) <= QUEUE_MINBUFFER);
+    };
+
+    if (room ())
+        return true;
+
+    Q->full_stalls ++;
+    while (thread_exit < 2 && ! room ())
+        QSleep ([& room] () { return thread_exit >= 2 || room (); }, wait_ns);
+
+    return (thread_exit < 2);
+}
+
+/* PLAY THREAD:  BLOCK UNTIL THE READER QUEUES AN AUDIO PACKET (OR EOF/ERROR) OR THE VIDEO-PRESENTER THREAD
+   SAYS A FRAME IS DUE, BUT NO LONGER THAN wait_ns SO WE CAN STILL SERVICE SDL EVENTS, STOP AND SEEK. */
+static void QWaitForData (pktQueue * aQ, bool * frame_due, long wait_ns)
+{
+    if (QSize (aQ) || __atomic_load_n (frame_due, __ATOMIC_SEQ_CST))
+        return;
+
+    aQ->empty_stalls ++;
+    QSleep ([aQ, frame_due] () { return thread_exit != 0 || QSize (aQ) > 0
+            || __atomic_load_n (frame_due, __ATOMIC_SEQ_CST); }, wait_ns);
+}
+
+static void QLogStats (const char * name, pktQueue * Q)
+{
+    AUDINFO ("i:%s packet queue: capacity %u, max depth %u, reader stalls (full) %u, decoder stalls (empty) %u, dropped %u\n",
+            name, Q->capacity, Q->max_depth, Q->full_stalls, Q->empty_stalls, Q->full_drops);
+}
+
 void destroyQueue (pktQueue * Q)
 {
     QFlush (Q);
@@ -302,6 +409,66 @@ void destroyQueue (pktQueue * Q)
     Q = nullptr;
 }
 
+/* DECODED VIDEO-FRAME QUEUE (SEE frmQueue ABOVE): */
+frmQueue * createFrameQueue ()
+{
+    frmQueue * F = (frmQueue *) malloc (sizeof (frmQueue));
+    for (int i = 0; i < FRMQ_SIZE; i ++)
+    {
+        F->frames[i] = nullptr;
+        pool.get_frame (F->frames[i]);
+        F->pts_ms[i] = -1;
+    }
+    F->head = 0;
+    F->tail = 0;
+    F->presented = 0;
+    F->dropped = 0;
+    return F;
+}
+
+static inline unsigned FSize (frmQueue * F)
+{
+    return __atomic_load_n (& F->head, __ATOMIC_SEQ_CST) - __atomic_load_n (& F->tail, __ATOMIC_SEQ_CST);
+}
+
+/* VIDEO-DECODER THREAD:  NEXT FREE FRAME TO DECODE INTO (ONLY AFTER CHECKING FSize () < FRMQ_SIZE): */
+static inline AVFrame * FBack (frmQueue * F)
+{
+    return F->frames[F->head & (FRMQ_SIZE - 1)];
+}
+
+/* VIDEO-DECODER THREAD:  PUBLISH THE FRAME JUST DECODED INTO FBack (): */
+static void FPush (frmQueue * F, int64_t pts_ms)
+{
+    F->pts_ms[F->head & (FRMQ_SIZE - 1)] = pts_ms;
+    __atomic_store_n (& F->head, F->head + 1, __ATOMIC_SEQ_CST);
+    QWake ();
+}
+
+/* VIDEO-PRESENTER THREAD (OR PLAY THREAD WHILST frame_due):  RELEASE THE OLDEST FRAME (PRESENTED OR DROPPED)
+   BACK TO THE DECODER: */
+static void FPop (frmQueue * F)
+{
+    DecodePool::done_with_frame (F->frames[F->tail & (FRMQ_SIZE - 1)]);
+    __atomic_store_n (& F->tail, F->tail + 1, __ATOMIC_SEQ_CST);
+    QWake ();
+}
+
+static void FFlush (frmQueue * F)
+{
+    while (FSize (F))
+        FPop (F);
+}
+
+void destroyFrameQueue (frmQueue * F)
+{
+    FFlush (F);
+    AUDINFO ("i:Video frame queue: presented %u, dropped (late) %u\n", F->presented, F->dropped);
+    for (int i = 0; i < FRMQ_SIZE; i ++)
+        DecodePool::free_frame (F->frames[i]);
+    free (F);
+}
+
 /* JWT:END OF ADDED VIDEO PACKET QUEUEING FUNCTIONS */
 
 static SimpleHash<String, AVInputFormat *> extension_dict;
@@ -385,6 +552,7 @@ bool FFaudio::init ()
 #endif
 
     create_extension_dict ();
+    probe_cache_load ();
 
     av_log_set_callback (ffaudio_log_cb);
 
@@ -403,6 +571,8 @@ void FFaudio::cleanup ()
 
     aud_set_bool ("ffaudio", "save_video", false);  // JWT:MAKE SURE WE DON'T LEAVE VIDEO RECORDING ON!
     extension_dict.clear ();
+    probe_cache_save ();
+    pool.clear ();
 #if ! CHECK_LIBAVCODEC_VERSION (58, 9, 100, 255, 255, 255)
     av_lockmgr_register (nullptr);
 #endif
@@ -507,13 +677,48 @@ static AVInputFormat * get_format_by_content (const char * name, VFSFile & file)
     return f;
 }
 
+static AVInputFormat * get_format_by_name (const char * fmtname)
+{
+    AVInputFormat * f;
+#if CHECK_LIBAVFORMAT_VERSION (58, 9, 100, 255, 255, 255)
+    void * iter = nullptr;
+    while ((f = const_cast<AVInputFormat *> (av_demuxer_iterate (& iter))))
+#else
+    for (f = av_iformat_next (nullptr); f; f = av_iformat_next (f))
+#endif
+    {
+        if (! strcmp (f->name, fmtname))
+            return f;
+    }
+
+    return nullptr;
+}
+
+/* EXTENSION FIRST (NO I/O), THEN WHAT WE PROBED LAST TIME (IF FILE'S UNCHANGED), THEN PROBE: */
 static AVInputFormat * get_format (const char * name, VFSFile & file)
 {
     AVInputFormat * f = get_format_by_extension (name);
-    return f ? f : get_format_by_content (name, file);
+    if (f)
+        return f;
+
+    String cached = probe_cache_get_format (name);
+    if (cached && cached[0] && (f = get_format_by_name (cached)))
+    {
+        AUDINFO ("Matched format %s from probe cache.\n", f->name);
+        return f;
+    }
+
+    f = get_format_by_content (name, file);
+    if (f)
+        probe_cache_set_format (name, f->name);
+
+    return f;
 }
 
-static AVFormatContext * open_input_file (const char * name, VFSFile & file)
+/* readahead:  PREFETCH FROM file IN THE BACKGROUND (ONLY IF CALLER WON'T ACCESS file ITSELF WHILST
+   THE CONTEXT IS OPEN, IE. PLAYBACK).  NEVER FOR http STREAMS, SINCE play () STILL FETCHES THEIR
+   SONG-INFO FROM file WHILST PLAYING: */
+static AVFormatContext * open_input_file (const char * name, VFSFile & file, bool readahead = false)
 {
     AVFormatContext * c = nullptr;
 
@@ -545,7 +750,7 @@ static AVFormatContext * open_input_file (const char * name, VFSFile & file)
             return nullptr;
         }
         c = avformat_alloc_context ();
-        AVIOContext * io = io_context_new (file);
+        AVIOContext * io = io_context_new (file, readahead && strncmp (name, "http", 4));
         if (c)
             c->pb = io;
         if (LOG (avformat_open_input, & c, xname, f, nullptr) < 0)
@@ -587,17 +792,69 @@ static void close_input_file (AVFormatContext * c)
     }
 }
 
-static bool find_codec (AVFormatContext * c, CodecInfo * cinfo, CodecInfo * vcinfo)
+#ifndef ALLOC_CONTEXT
+#define codecpar codec
+#endif
+/* CAN WE TRUST THE STREAMS THE PROBE CACHE REMEMBERED W/O avformat_find_stream_info ()?  ONLY IF
+   THE CONTAINER HEADER ALONE ALREADY GAVE US THE DURATION AND THE STREAMS' CODEC PARAMETERS: */
+static bool cached_streams_usable (AVFormatContext * c, int audioStream, int videoStream, bool want_video)
 {
-    if (avformat_find_stream_info (c, nullptr) < 0)
+    if (audioStream < 0 || audioStream >= (int) c->nb_streams || c->duration == AV_NOPTS_VALUE)
         return false;
 
-    int audioStream = av_find_best_stream (c, AVMEDIA_TYPE_AUDIO, -1, -1, nullptr, 0);
-    int videoStream = (vcinfo && play_video) ? av_find_best_stream (c, AVMEDIA_TYPE_VIDEO, -1, -1, nullptr, 0) : -1;
-
-#ifndef ALLOC_CONTEXT
-#define codecpar codec
+    auto par = c->streams[audioStream]->codecpar;
+#if CHECK_LIBAVCODEC_VERSION(59, 37, 100, 59, 37, 100)
+    int channels = par->ch_layout.nb_channels;
+#else
+    int channels = par->channels;
 #endif
+    if (par->codec_type != AVMEDIA_TYPE_AUDIO || par->codec_id == AV_CODEC_ID_NONE
+            || par->sample_rate <= 0 || channels <= 0)
+        return false;
+
+    if (want_video && videoStream != -1)
+    {
+        if (videoStream < 0 || videoStream >= (int) c->nb_streams)
+            return false;  // (INCLUDING PROBE_UNKNOWN:  ONLY TAGS WERE READ BEFORE, NEVER LOOKED FOR VIDEO)
+
+        auto vpar = c->streams[videoStream]->codecpar;
+        if (vpar->codec_type != AVMEDIA_TYPE_VIDEO || vpar->codec_id == AV_CODEC_ID_NONE
+                || vpar->width <= 0 || vpar->height <= 0)
+            return false;
+    }
+
+    return true;
+}
+
+/* name (LOCAL FILES ONLY) IS FOR THE PROBE CACHE, WHICH REMEMBERS WHICH STREAMS WE PICKED: */
+static bool find_codec (AVFormatContext * c, CodecInfo * cinfo, CodecInfo * vcinfo, const char * name = nullptr)
+{
+    bool want_video = (vcinfo && play_video);
+    int audioStream = -1;
+    int videoStream = -1;
+
+    if (name && probe_cache_get_streams (name, audioStream, videoStream)
+            && cached_streams_usable (c, audioStream, videoStream, want_video))
+    {
+        probe_cache_count_streams (name, true);
+        if (! want_video)
+            videoStream = -1;
+    }
+    else
+    {
+        if (name)
+            probe_cache_count_streams (name, false);
+
+        if (avformat_find_stream_info (c, nullptr) < 0)
+            return false;
+
+        audioStream = av_find_best_stream (c, AVMEDIA_TYPE_AUDIO, -1, -1, nullptr, 0);
+        videoStream = want_video ? av_find_best_stream (c, AVMEDIA_TYPE_VIDEO, -1, -1, nullptr, 0) : -1;
+        if (name)
+            probe_cache_set_streams (name, (audioStream < 0) ? -1 : audioStream,
+                    want_video ? ((videoStream < 0) ? -1 : videoStream) : PROBE_UNKNOWN);
+    }
+
     if (audioStream < 0)   /* PUNT IF NO AUDIO SINCE AUDACIOUS IS AN *AUDIO* PLAYER! */
     {
         if (videoStream >= 0)
@@ -654,6 +911,12 @@ static bool find_codec (AVFormatContext * c, CodecInfo * cinfo, CodecInfo * vcin
 #endif
                 if (aud_get_bool ("ffaudio", "video_codec_flag_gray"))
                     vcinfo->context->flags |= AV_CODEC_FLAG_GRAY; /* output in monochrome (REQUIRES FFMPEG COMPILED W/--enable-gray!) */
+
+                /* LET THE CODEC DECODE W/FRAME AND SLICE THREADS (ON TOP OF OUR OWN VIDEO-DECODER THREAD): */
+                int video_threads = aud_get_int ("ffaudio", "video_threads");
+                vcinfo->context->thread_count = (video_threads > 0) ? video_threads
+                        : ((av_cpu_count () < 16) ? av_cpu_count () : 16);
+                vcinfo->context->thread_type = FF_THREAD_FRAME | FF_THREAD_SLICE;
             }
             else
                 play_video = false;  /* TURN OFF VIDEO PLAYBACK, SINCE NO VIDEO CODEC! */
@@ -722,13 +985,16 @@ bool FFaudio::read_tag (const char * filename, VFSFile & file, Tuple & tuple, In
 
         CodecInfo cinfo;
 
-        if (! find_codec (ic.get (), & cinfo, nullptr))   //CAN CHANGE play_video!
+        if (! find_codec (ic.get (), & cinfo, nullptr, filename))   //CAN CHANGE play_video!
             return false;
 
         if ((int)ic->duration != 0)
             tuple.set_int (Tuple::Length, ic->duration / 1000);
 
-        tuple.set_int (Tuple::Bitrate, ic->bit_rate / 1000);
+        int64_t bit_rate = ic->bit_rate;
+        if (bit_rate <= 0 && ic->duration > 0 && file.fsize () > 0)  // (NOT FILLED IN IF PROBE CACHE SKIPPED find_stream_info)
+            bit_rate = file.fsize () * 8 * AV_TIME_BASE / ic->duration;
+        tuple.set_int (Tuple::Bitrate, bit_rate / 1000);
 #if CHECK_LIBAVCODEC_VERSION(59, 37, 100, 59, 37, 100)
         tuple.set_int (Tuple::Channels, cinfo.context->ch_layout.nb_channels);
 #else
@@ -810,7 +1076,7 @@ static bool convert_format (int ff_fmt, int & aud_fmt, bool & planar)
 void FFaudio::write_audioframe (CodecInfo * cinfo, AVPacket * pkt, int out_fmt, bool planar)
 {
     int size = 0;
-    Index<char> buf;
+    AVFrame * frame = pool.get_frame (pool.aframe);
 #ifdef SEND_PACKET
     if (LOG (avcodec_send_packet, cinfo->context, pkt) < 0)
         return;
@@ -827,13 +1093,12 @@ void FFaudio::write_audioframe (CodecInfo * cinfo, AVPacket * pkt, int out_fmt,
 
     while (pkt->size > 0)
     {
-        ScopedFrame frame;
 #ifdef SEND_PACKET
-        if (LOG (avcodec_receive_frame, cinfo->context, frame.ptr) < 0)
+        if (LOG (avcodec_receive_frame, cinfo->context, frame) < 0)
             break; /* read next packet (continue past errors) */
 #else
         decoded = 0;
-        len = LOG (avcodec_decode_audio4, cinfo->context, frame.ptr, & decoded, pkt);
+        len = LOG (avcodec_decode_audio4, cinfo->context, frame, & decoded, pkt);
         if (len < 0)
         {
             AUDERR ("decode_audio() failed, code %d\n", len);
@@ -855,76 +1120,205 @@ void FFaudio::write_audioframe (CodecInfo * cinfo, AVPacket * pkt, int out_fmt,
 
         if (planar)
         {
-            if (size > buf.len ())
-                buf.resize (size);
+            char * buf = pool.get_buffer (size);
 
             audio_interlace ((const void * *) frame->data, out_fmt,
-                    channels, buf.begin (), frame->nb_samples);
-            write_audio (buf.begin (), size);
+                    channels, buf, frame->nb_samples);
+            write_audio (buf, size);
         }
         else
             write_audio (frame->data[0], size);
+
+        DecodePool::done_with_frame (frame);
     }
     return;
 }
 
-/* JWT: NEW FUNCTION TO WRITE VIDEO FRAMES TO THE POPUP WINDOW: */
-void FFaudio::write_videoframe (SDL_Renderer * renderer, CodecInfo * vcinfo, 
-    SDL_Texture * bmp, AVPacket *pkt, int video_width, 
-    int video_height, bool last_resized, bool * windowIsStable)
+/* CONVERT A DECODED VIDEO FRAME'S TIMESTAMP TO PLAYBACK POSITION (MS) FOR SCHEDULING, -1 IF IT HAS NONE: */
+static int64_t frame_pts_ms (DataShared2Thread * TD, AVFrame * vframe)
+{
+    AVRational ms = {1, 1000};
+    int64_t pts = vframe->best_effort_timestamp;
+
+    if (pts == AV_NOPTS_VALUE)
+        return -1;
+
+    pts = av_rescale_q (pts, TD->vcinfo.stream->time_base, ms) - TD->start_ms;
+    return (pts < 0) ? 0 : pts;
+}
+
+/* DECODE ONE VIDEO PACKET (nullptr = DRAIN THE CODEC AT EOF) INTO THE DECODED-FRAME QUEUE.
+   RETURNS FALSE IF WE GOT INTERRUPTED BY A STOP OR SEEK WHILST WAITING FOR A FREE FRAME SLOT. */
+static bool vdecode_packet (DataShared2Thread * TD, AVPacket * pkt, int my_seek_gen)
 {
+    frmQueue * F = TD->vfrmQ;
+    AVCodecContext * context = TD->vcinfo.context;
+    auto interrupted = [TD, my_seek_gen] () {
+        return thread_exit < 0 || thread_exit >= 2
+                || __atomic_load_n (& TD->seek_gen, __ATOMIC_SEQ_CST) != my_seek_gen;
+    };
+
 #ifdef SEND_PACKET
-    if (LOG (avcodec_send_packet, vcinfo->context, pkt) < 0)
-        return;
+    if (LOG (avcodec_send_packet, context, pkt) < 0)
+        return true;  /* skip this packet (continue past errors) */
 #else
+    AVPacket flushpkt;
     int subframeCnt = 0;
-    int frameFinished = 0;
-    int len = 0;
-    while (subframeCnt < 16)
+    if (! pkt)
     {
+        av_init_packet (& flushpkt);
+        flushpkt.data = nullptr;
+        flushpkt.size = 0;
+        pkt = & flushpkt;
+    }
 #endif
-        ScopedFrame vframe;
+
+    while (1)
+    {
+        /* WAIT FOR THE VIDEO-PRESENTER THREAD TO PRESENT (FREE UP) A FRAME SLOT: */
+        while (FSize (F) >= FRMQ_SIZE)
+        {
+            if (interrupted ())
+                return false;
+            QSleep ([F, & interrupted] () { return FSize (F) < FRMQ_SIZE || interrupted (); }, 5 * PLAYER_WAIT_NS);
+        }
+
+        AVFrame * vframe = FBack (F);
 #ifdef SEND_PACKET
-        if (LOG (avcodec_receive_frame, vcinfo->context, vframe.ptr) < 0)
-            return; /* read next packet (continue past errors) */
+        if (LOG (avcodec_receive_frame, context, vframe) < 0)
+            return true; /* read next packet (or codec fully drained) */
 #else
-        frameFinished = 0;
-        len = LOG (avcodec_decode_video2, vcinfo->context, vframe.ptr, & frameFinished, pkt);
+        int frameFinished = 0;
+        int len = LOG (avcodec_decode_video2, context, vframe, & frameFinished, pkt);
         /* Did we get a video frame? */
         if (len < 0)
         {
             AUDERR ("decode_video() failed, code %d\n", len);
-            return;
+            return true;
         }
-        if (frameFinished)
+        if (! frameFinished)
         {
-#endif
-            if (last_resized)  /* BLIT THE FRAME, BUT ONLY IF WE'RE NOT CURRENTLY RESIZING THE WINDOW! */
+            if (pkt->size <= 0 || pkt->data < 0)
+                return true;
+            pkt->size -= len;
+            pkt->data += len;
+            if (pkt->size <= 0)
+                return true;
+            if (++ subframeCnt >= 16)
             {
-                //SDL_RenderClear (renderer);
-                SDL_UpdateYUVTexture (bmp, nullptr, vframe->data[0], vframe->linesize[0], 
-                    vframe->data[1], vframe->linesize[1], vframe->data[2], vframe->linesize[2]);
-                SDL_RenderCopy (renderer, bmp, nullptr, nullptr);  // USE NULL TO GET IMAGE TO FIT WINDOW!
-                SDL_RenderPresent (renderer);  // JWT:NOTE, WILL SEGFAULT HERE IF SQL IS ALREADY SHUT DOWN!
-                (*windowIsStable) = true;
+                AUDERR ("w:vdecode_packet: runaway frame skipped (more than 16 parts)\n");
+                return true;
             }
-            return;
+            continue;
+        }
+#endif
+        FPush (F, frame_pts_ms (TD, vframe));
 #ifndef SEND_PACKET
+        if (pkt->size > 0)
+            return true;  /* ONE FRAME PER PACKET, BUT KEEP GOING WHEN DRAINING */
+#endif
+    }
+}
+
+/* VIDEO-DECODER THREAD:  DECODES (W/THE CODEC'S OWN FRAME/SLICE THREADS) THE QUEUED VIDEO PACKETS
+   INTO THE DECODED-FRAME QUEUE, SO SLOW VIDEO DECODING NO LONGER HOLDS UP THE AUDIO ON THE PLAY THREAD. */
+static void * vdecoder_thread_fn (void * data)
+{
+    DataShared2Thread * TD = (DataShared2Thread *) data;
+    int my_seek_gen = __atomic_load_n (& TD->seek_gen, __ATOMIC_SEQ_CST);
+    AVPacket * pkt;
+
+    while (thread_exit >= 0 && thread_exit < 2)
+    {
+        /* PLAY THREAD IS SEEKING:  DUMP EVERYTHING QUEUED AND BUFFERED IN THE CODEC, THEN LET IT KNOW: */
+        int seek_gen = __atomic_load_n (& TD->seek_gen, __ATOMIC_SEQ_CST);
+        if (seek_gen != my_seek_gen)
+        {
+            QFlush (TD->pktQ);
+            avcodec_flush_buffers (TD->vcinfo.context);
+            my_seek_gen = seek_gen;
+            __atomic_store_n (& TD->vseek_gen, seek_gen, __ATOMIC_SEQ_CST);
+            QWake (true);
+            continue;
+        }
+
+        if (QSize (TD->pktQ))
+            pkt = QFront (TD->pktQ);
+        else if (thread_exit == 1)  /* READER HIT EOF AND WE'VE DECODED ALL IT QUEUED, SO DRAIN THE CODEC: */
+        {
+            vdecode_packet (TD, nullptr, my_seek_gen);
+            break;
         }
         else
         {
-            if (pkt->size <= 0 || pkt->data < 0)
-                return;
-            pkt->size -= len;
-            pkt->data += len;
-            if (pkt->size <= 0)
-                return;
+            TD->pktQ->empty_stalls ++;
+            QSleep ([TD, my_seek_gen] () { return thread_exit != 0 || QSize (TD->pktQ) > 0
+                    || __atomic_load_n (& TD->seek_gen, __ATOMIC_SEQ_CST) != my_seek_gen; }, 5 * PLAYER_WAIT_NS);
+            continue;
         }
-        ++subframeCnt;
+
+        if (vdecode_packet (TD, pkt, my_seek_gen))
+            Dequeue (TD->pktQ);
     }
-    AUDERR ("w:write_videoframe: runaway frame skipped (more than 16 parts)\n");
-    return;
-#endif
+
+    __atomic_store_n (& TD->vdecoder_done, true, __ATOMIC_SEQ_CST);
+    QWake (true);
+
+    pthread_exit (nullptr);
+
+    return nullptr;
+}
+
+/* VIDEO-PRESENTER THREAD:  PICK THE DECODED VIDEO FRAME DUE BY THE AUDIO CLOCK (now_ms), SKIPPING A LATE ONE
+   IF THE NEXT IS ALREADY DUE TOO.  RETURNS 0 IF THE FRONT FRAME IS DUE NOW, ELSE MS UNTIL IT IS, OR -1 IF NONE
+   QUEUED. */
+static int pick_videoframe (frmQueue * F, int64_t now_ms)
+{
+    while (FSize (F))
+    {
+        int64_t pts = F->pts_ms[F->tail & (FRMQ_SIZE - 1)];
+
+        /* NOT DUE YET (BUT DON'T HANG THE VIDEO ON A BOGUS TIMESTAMP WAY IN THE FUTURE): */
+        if (pts > now_ms && pts - now_ms < 5000)
+            return (int) (pts - now_ms);
+
+        if (pts >= 0 && now_ms - pts > VIDEO_LATE_MS && FSize (F) > 1)
+        {
+            int64_t next_pts = F->pts_ms[(F->tail + 1) & (FRMQ_SIZE - 1)];
+            if (next_pts >= 0 && next_pts <= now_ms)
+            {
+                F->dropped ++;
+                FPop (F);
+                continue;
+            }
+        }
+
+        return 0;
+    }
+
+    return -1;
+}
+
+/* PLAY THREAD:  SHOW THE FRAME THE VIDEO-PRESENTER THREAD PICKED AND HAND ITS SLOT BACK: */
+static void present_videoframe (DataShared2Thread * TD, SDL_Renderer * renderer, SDL_Texture * bmp,
+        bool last_resized, bool * windowIsStable)
+{
+    frmQueue * F = TD->vfrmQ;
+
+    if (last_resized)  /* BLIT THE FRAME, BUT ONLY IF WE'RE NOT CURRENTLY RESIZING THE WINDOW! */
+    {
+        AVFrame * vframe = F->frames[F->tail & (FRMQ_SIZE - 1)];
+        //SDL_RenderClear (renderer);
+        SDL_UpdateYUVTexture (bmp, nullptr, vframe->data[0], vframe->linesize[0], 
+            vframe->data[1], vframe->linesize[1], vframe->data[2], vframe->linesize[2]);
+        SDL_RenderCopy (renderer, bmp, nullptr, nullptr);  // USE NULL TO GET IMAGE TO FIT WINDOW!
+        SDL_RenderPresent (renderer);  // JWT:NOTE, WILL SEGFAULT HERE IF SQL IS ALREADY SHUT DOWN!
+        (*windowIsStable) = true;
+    }
+    F->presented ++;
+    FPop (F);
+    __atomic_store_n (& TD->frame_due, false, __ATOMIC_SEQ_CST);
+    QWake (true);
 }
 
 static SDL_Renderer * createSDL2Renderer (SDL_Window * sdl_window, bool myplay_video)
@@ -936,7 +1330,7 @@ static SDL_Renderer * createSDL2Renderer (SDL_Window * sdl_window, bool myplay_v
     return renderer;
 }
 
-static SDL_Texture * createSDL2Texture (SDL_Window * sdl_window, SDL_Renderer * renderer, bool myplay_video, int width, int height)
+static SDL_Texture * createSDL2Texture (SDL_Renderer * renderer, bool myplay_video, int width, int height)
 {
     SDL_Texture * texture = nullptr;
     if (myplay_video && renderer)
@@ -948,17 +1342,93 @@ static SDL_Texture * createSDL2Texture (SDL_Window * sdl_window, SDL_Renderer *
         {
             SDL_SetRenderDrawColor(renderer, 255, 0, 0, 255);
             SDL_RenderPresent (renderer);
-            if (aud_get_bool ("audacious", "video_display"))
-                SDL_ShowWindow (sdl_window);  // ONLY SHOW WINDOW IF video_display VISUALIZATION PLUGIN ON!
-
-            /* NOTIFY video_display VISUALIZATION PLUGIN WE'RE NOW DEMUXING VIDEO. */
-            aud_set_bool ("audacious", "_video_playing", true);
         }
     }
 
     return texture;
 }
 
+/* VIDEO-PRESENTER THREAD:  KEEPS TIME FOR THE DECODED FRAMES, DROPPING LATE ONES AND TELLING THE PLAY THREAD
+   (frame_due) WHEN THE AUDIO CLOCK REACHES THE NEXT ONE, SO THE PLAY THREAD NO LONGER POLLS THE CLOCK.  ALL SDL
+   CALLS STAY ON THE PLAY THREAD, WHICH OWNS THE WINDOW, ITS EVENTS AND THE RENDERER.  WHILST frame_due IS SET,
+   THE FRONT FRAME (AND THE QUEUE'S TAIL) BELONGS TO THE PLAY THREAD, SO WE DON'T TOUCH THE QUEUE UNTIL IT'S
+   CLEARED AGAIN. */
+static void * vpresenter_thread_fn (void * data)
+{
+    DataShared2Thread * TD = (DataShared2Thread *) data;
+    frmQueue * F = TD->vfrmQ;
+
+    int my_seek_gen = 0;
+    int64_t last_time = -1;
+    int stuck = 0;
+    while (thread_exit >= 0 && thread_exit < 2)
+    {
+        if (__atomic_load_n (& TD->frame_due, __ATOMIC_SEQ_CST))
+        {
+            QSleep ([TD] () { return thread_exit < 0 || thread_exit >= 2
+                    || ! __atomic_load_n (& TD->frame_due, __ATOMIC_SEQ_CST); }, PLAYER_WAIT_NS);
+            continue;
+        }
+
+        /* PLAY THREAD IS SEEKING:  ONCE THE DECODER HAS FLUSHED (OR IS GONE), DUMP THE FRAMES IT ALREADY DECODED: */
+        int seek_gen = __atomic_load_n (& TD->seek_gen, __ATOMIC_SEQ_CST);
+        if (seek_gen != my_seek_gen)
+        {
+            if (__atomic_load_n (& TD->vseek_gen, __ATOMIC_SEQ_CST) == seek_gen
+                    || __atomic_load_n (& TD->vdecoder_done, __ATOMIC_SEQ_CST))
+            {
+                FFlush (F);
+                my_seek_gen = seek_gen;
+                last_time = -1;
+                __atomic_store_n (& TD->pseek_gen, seek_gen, __ATOMIC_SEQ_CST);
+                QWake (true);
+            }
+            else
+                QSleep ([TD, seek_gen] () { return thread_exit < 0 || thread_exit >= 2
+                        || __atomic_load_n (& TD->vseek_gen, __ATOMIC_SEQ_CST) == seek_gen
+                        || __atomic_load_n (& TD->vdecoder_done, __ATOMIC_SEQ_CST); }, PLAYER_WAIT_NS);
+            continue;
+        }
+
+        if (__atomic_load_n (& TD->vdecoder_done, __ATOMIC_SEQ_CST) && FSize (F) == 0)
+            break;  // ALL FRAMES PRESENTED.
+
+        int64_t now = aud_drct_get_time ();
+        if (__atomic_load_n (& TD->audio_done, __ATOMIC_SEQ_CST))
+        {
+            /* AUDIO ALL WRITTEN:  IF THE CLOCK STOPS MOVING (OUTPUT DRAINED?), JUST STEP THROUGH THE FRAMES: */
+            stuck = (now == last_time) ? stuck + 1 : 0;
+            last_time = now;
+            if (stuck > 20 && FSize (F))
+                now = F->pts_ms[F->tail & (FRMQ_SIZE - 1)];
+        }
+
+        int next_frame_ms = pick_videoframe (F, now);
+        if (! next_frame_ms)  // FRONT FRAME IS DUE, HAND IT TO THE PLAY THREAD:
+        {
+            __atomic_store_n (& TD->frame_due, true, __ATOMIC_SEQ_CST);
+            QWake (true);
+            continue;
+        }
+
+        /* SLEEP UNTIL THE NEXT FRAME IS DUE, OR SOMETHING CHANGES: */
+        unsigned queued = FSize (F);
+        QSleep ([TD, F, queued, my_seek_gen] () { return thread_exit < 0 || thread_exit >= 2
+                || FSize (F) != queued
+                || __atomic_load_n (& TD->seek_gen, __ATOMIC_SEQ_CST) != my_seek_gen
+                || __atomic_load_n (& TD->vdecoder_done, __ATOMIC_SEQ_CST); },
+                (next_frame_ms > 0 && next_frame_ms < PLAYER_WAIT_NS / 1000000L)
+                ? next_frame_ms * 1000000L : PLAYER_WAIT_NS);
+    }
+
+    __atomic_store_n (& TD->presenter_done, true, __ATOMIC_SEQ_CST);
+    QWake (true);
+
+    pthread_exit (nullptr);
+
+    return nullptr;
+}
+
 /* WHEN EXITING PLAY, WE SAVE THE WINDOW-POSITION & SIZE SO WINDOW CAN POP UP IN SAME POSITION NEXT TIME! */
 void save_window_xy (SDL_Window * sdl_window, int video_window_x, int video_window_y,
         int init_window_x, int init_window_y, bool video_display_at_startup)
@@ -1028,21 +1498,20 @@ void save_window_xy (SDL_Window * sdl_window, int video_window_x, int video_wind
 static void * reader_thread_fn (void * data)
 {
     int ret;
-    int minbuffer = 12;
-    AVPacket * pkt;
+    int seek_gen;
+    AVPacket * pkt = nullptr;  // KEPT AND REUSED WHEN DISCARDED, SINCE ONLY THE PLAY THREAD MAY PUT BACK TO POOL.
+    pktQueue * Q;
     DataShared2Thread * TD = (DataShared2Thread *) data;
     TD->errcount = 0;
-    long reader_sleep_ms = (long) aud_get_int ("ffaudio", "reader_sleep_ms") * 1000000L;
-    struct timespec sleeptime;
-
-    sleeptime.tv_sec = 0;
-    sleeptime.tv_nsec = reader_sleep_ms;
+    /* NOW JUST THE LONGEST WE'LL SLEEP ON A FULL QUEUE BEFORE RECHECKING FOR STOP, SINCE
+       THE PLAY THREAD WAKES US AS SOON AS IT FREES UP A SLOT: */
+    long reader_wait_ns = (long) aud_get_int ("ffaudio", "reader_sleep_ms") * 1000000L;
 
     /* OUTER LOOP TO READ, QUEUE AND PROCESS AUDIO & VIDEO PACKETS FROM THE STREAM: */
     while (thread_exit < 2)
     {
         /* READ NEXT FRAME (OR MORE) OF DATA */
-        if (! (pkt = av_packet_alloc ()))
+        if (! pkt && ! (pkt = pool.get_packet ()))
         {
             AUDERR ("FFMpeg error: could not allocate memory for packet, giving up.\n");
             thread_exit = -1;  // ERROR
@@ -1051,6 +1520,7 @@ static void * reader_thread_fn (void * data)
 
         pthread_mutex_lock (& read_mutex);  // BLOCK READING WHILST SEEKING (CHANGING POSITION)!
         ret = LOG (av_read_frame, TD->ic, pkt);
+        seek_gen = TD->seek_gen;
         pthread_mutex_unlock (& read_mutex);
 
         if (ret < 0)  // CHECK FOR EOF OR ERRORS:
@@ -1072,7 +1542,7 @@ static void * reader_thread_fn (void * data)
             }
             else
             {
-                av_packet_free (& pkt);
+                av_packet_unref (pkt);
                 continue;
             }
         }
@@ -1081,48 +1551,40 @@ static void * reader_thread_fn (void * data)
 
         /* NOW PROCESS THE CURRENTLY-READ PACKET: */
         if (pkt->stream_index == TD->cinfo.stream_idx)  /* WE READ AN AUDIO PACKET: */
+            Q = TD->apktQ;
+        else if (TD->videoalso && pkt->stream_index == TD->vcinfo.stream_idx)  /* WE READ A VIDEO PACKET: */
+            Q = TD->pktQ;
+        else
         {
-            if (TD->apktQ->size == TD->apktQ->capacity)
-            {
-                do
-                {
-                    nanosleep (& sleeptime, NULL);
-                    if (thread_exit == 2)
-                    {
-                        av_packet_free (& pkt);
-                        goto THREAD_EXIT;
-                    }
-                }
-                while (TD->pktQ->size > minbuffer && TD->apktQ->size > minbuffer);
-            }
-            if (! Enqueue (TD->apktQ, pkt))
-                av_packet_free (& pkt);
+            av_packet_unref (pkt);
+            continue;
         }
-        else if (TD->videoalso && pkt->stream_index == TD->vcinfo.stream_idx)  /* WE READ A VIDEO PACKET: */
+
+        /* SLEEP UNTIL THERE'S ROOM IN ITS QUEUE.  THE AUDIO QUEUE ALWAYS DRAINS (THE PLAY THREAD NEVER
+           WAITS ON VIDEO), BUT THE VIDEO ONE MAY NOT WHILST AUDIO IS STARVING, SO GIVE UP ON A VIDEO
+           PACKET RATHER THAN WAIT FOR A SLOT THAT WON'T COME: */
+        if (! QWaitForRoom (Q, (Q == TD->pktQ) ? TD->apktQ : nullptr, reader_wait_ns))
         {
-            if (TD->pktQ->size == TD->pktQ->capacity)
-            {
-                do
-                {
-                    nanosleep (& sleeptime, NULL);
-                    if (thread_exit == 2)
-                    {
-                        av_packet_free (& pkt);
-                        goto THREAD_EXIT;
-                    }
-                }
-                while (TD->apktQ->size > minbuffer && TD->pktQ->size > minbuffer);
-            }
-            if (! Enqueue (TD->pktQ, pkt))
-                av_packet_free (& pkt);
+            av_packet_free (& pkt);
+            goto THREAD_EXIT;
         }
+
+        /* DROP IT IF USER SEEKED WHILST WE WERE WAITING (PLAYER HAS ALREADY FLUSHED THE QUEUES),
+           OR IF ITS QUEUE IS STILL FULL: */
+        pthread_mutex_lock (& read_mutex);
+        if (seek_gen == TD->seek_gen && Enqueue (Q, pkt))
+            pkt = nullptr;  // PLAY THREAD OWNS IT NOW.
         else
-            av_packet_free (& pkt);
+        {
+            if (seek_gen == TD->seek_gen)
+                Q->full_drops ++;
+            av_packet_unref (pkt);
+        }
+        pthread_mutex_unlock (& read_mutex);
     }
 
 THREAD_EXIT:
-    pthread_mutex_unlock (& queue_mutex);
-    pthread_mutex_unlock (& read_mutex);
+    QWake (true);  // MAKE SURE PLAY AND VIDEO-DECODER THREADS NOTICE EOF/ERROR RIGHT AWAY.
 
     pthread_exit (nullptr);
 
@@ -1171,7 +1633,7 @@ bool FFaudio::play (const char * filename, VFSFile & file)
 
     DataShared2Thread TD;
 
-    TD.ic = open_input_file (filename, file);
+    TD.ic = open_input_file (filename, file, true);
     if (! TD.ic)
         return false;
 
@@ -1184,7 +1646,7 @@ bool FFaudio::play (const char * filename, VFSFile & file)
    AFTER HERE, WE GO TO error_exit (AND FREE STUFF)! */
 
     AVPacket * pkt;
-    if (! find_codec (TD.ic, & TD.cinfo, & TD.vcinfo))   //CAN CHANGE play_video!
+    if (! find_codec (TD.ic, & TD.cinfo, & TD.vcinfo, filename))   //CAN CHANGE play_video!
     {
         AUDERR ("No codec found for %s, can't play.\n", filename);
         goto error_exit;
@@ -1370,12 +1832,12 @@ breakout1:
         video_qsize = 8;
 
     /* TYPICALLY THERE'S TWICE AS MANY AUDIO PACKETS AS VIDEO, SO THIS IS COUNTER-INTUITIVE, BUT IT WORKS BEST! */
-    TD.pktQ = createQueue (12 * video_qsize);  // ALLOW FOR A BUNCH OF VIDEO PACKETS (USUALLY AT STARTUP),
-    TD.apktQ = createQueue (12 * video_qsize); // BUT, GENERALLY THE AUDIO QUEUE WILL FILL FIRST FORCING OUTPUT:
+    TD.pktQ = createQueue (12 * video_qsize, 1);  // ALLOW FOR A BUNCH OF VIDEO PACKETS (USUALLY AT STARTUP),
+    TD.apktQ = createQueue (12 * video_qsize, 0); // BUT, GENERALLY THE AUDIO QUEUE WILL FILL FIRST FORCING OUTPUT:
     returnok = true;
     AUDDBG ("i:video queue size %d\n", video_qsize);
 
-    {   // SUBSCOPE FOR DECLARING SDL2 TEXTURE AS SCOPED SMARTPOINTER:
+    {   // SUBSCOPE FOR DECLARING SDL2 TEXTURE AS SCOPED SMARTPOINTER (AND THE VIDEO THREADS):
     bool windowIsStable = false;    // JWT:SAVING AND RECREATING WINDOW CAUSES POSN. TO DIFFER BY THE WINDOW DECORATION SIZES, SO WE HAVE TO FUDGE FOR THAT!
     bool windowNowExposed = false;  // JWT:NEEDED TO PREVENT RESIZING WINDOW BEFORE EXPOSING ON MS-WINDOWS?!
     SmartPtr<SDL_Renderer, SDL_DestroyRenderer> renderer (createSDL2Renderer (sdl_window, myplay_video));
@@ -1388,20 +1850,60 @@ breakout1:
 #ifdef _WIN32
 #define bmpptr bmp
     else  // CAN'T SMARTPTR THIS IN WINBLOWS SINCE FATAL ERROR (ON renderer.get IF NO RENDERER) IF VIDEO-PLAY TURNED OFF (COMPILER DIFFERENCE)!
-        bmp = createSDL2Texture (sdl_window, renderer.get (), myplay_video,
+        bmp = createSDL2Texture (renderer.get (), myplay_video,
                 TD.vcinfo.context->width, TD.vcinfo.context->height);
 #else
 #define bmpptr bmp.get ()
-    SmartPtr<SDL_Texture, SDL_DestroyTexture> bmp (createSDL2Texture (sdl_window, renderer.get (),
+    SmartPtr<SDL_Texture, SDL_DestroyTexture> bmp (createSDL2Texture (renderer.get (),
             myplay_video, TD.vcinfo.context->width, TD.vcinfo.context->height));
 #endif
     if (! bmp)
         myplay_video = false;
 
-    TD.videoalso = myplay_video;
-    /* START UP READER THREAD: */
     pthread_attr_t thread_attrs;
     pthread_t helper_thread;
+    pthread_t vdecoder_thread;
+    pthread_t vpresenter_thread;
+    bool vdecoder_running = false;
+    bool vpresenter_running = false;
+
+    thread_exit = 0;
+    if (myplay_video)  /* START UP VIDEO-PRESENTER THREAD, THEN VIDEO-DECODER THREAD (WE ONLY SHOW THE FRAMES): */
+    {
+        TD.vfrmQ = createFrameQueue ();
+        TD.start_ms = (TD.ic->start_time != AV_NOPTS_VALUE) ? TD.ic->start_time / 1000 : 0;
+        if (pthread_create (& vpresenter_thread, nullptr, vpresenter_thread_fn, & TD))
+            AUDERR ("s:Error creating video-presenter thread: %s - no video play!\n", strerror (errno));
+        else
+            vpresenter_running = true;
+        if (vpresenter_running)
+        {
+            if (pthread_create (& vdecoder_thread, nullptr, vdecoder_thread_fn, & TD))
+                AUDERR ("s:Error creating video-decoder thread: %s - no video play!\n", strerror (errno));
+            else
+                vdecoder_running = true;
+        }
+        if (vpresenter_running && ! vdecoder_running)
+        {
+            thread_exit = 2;  // (NOTHING TO PRESENT, SO STOP THE PRESENTER AGAIN)
+            QWake (true);
+            pthread_join (vpresenter_thread, NULL);
+            vpresenter_running = false;
+            thread_exit = 0;
+        }
+    }
+    myplay_video = vdecoder_running;
+    if (myplay_video)
+    {
+        if (aud_get_bool ("audacious", "video_display"))
+            SDL_ShowWindow (sdl_window);  // ONLY SHOW WINDOW IF video_display VISUALIZATION PLUGIN ON!
+
+        /* NOTIFY video_display VISUALIZATION PLUGIN WE'RE NOW DEMUXING VIDEO. */
+        aud_set_bool ("audacious", "_video_playing", true);
+    }
+    TD.videoalso = myplay_video;  // (READER ONLY QUEUES VIDEO PACKETS IF SOMEONE'S THERE TO DECODE THEM)
+
+    /* START UP READER THREAD: */
 
     if (! pthread_attr_init (& thread_attrs))
     {
@@ -1421,6 +1923,12 @@ breakout1:
     else
     {
         AUDERR ("s:Error initializing helper thread attributes: %s!\n", strerror (errno));
+        thread_exit = 2;  // STOP THE VIDEO THREADS (IF ANY) BEFORE BAILING:
+        QWake (true);
+        if (vpresenter_running)
+            pthread_join (vpresenter_thread, NULL);
+        if (vdecoder_running)
+            pthread_join (vdecoder_thread, NULL);
         goto error_exit;
     }
 
@@ -1445,56 +1953,22 @@ breakout1:
     /* LOOP TO PROCESS QUEUED AUDIO & VIDEO PACKETS FROM THE STREAM, INTERLACE AND OUTPUT THEM: */
     while (! thread_exit)
     {
+        /* SLEEP (BRIEFLY) IF READER HASN'T QUEUED ANYTHING YET, INSTEAD OF SPINNING: */
+        QWaitForData (TD.apktQ, & TD.frame_due, PLAYER_WAIT_NS);
+
         if (myplay_video)
         {
-            if (TD.apktQ->size > 0)
-            {   // PROCESS NEXT AUDIO FRAME(S) IN QUEUE:
-                write_audioframe (& TD.cinfo, TD.apktQ->elements[TD.apktQ->front], out_fmt, planar);
+            if (QSize (TD.apktQ) > 0)
+            {   // PROCESS NEXT AUDIO FRAME IN QUEUE:
+                write_audioframe (& TD.cinfo, QFront (TD.apktQ), out_fmt, planar);
                 Dequeue (TD.apktQ);
-                /* NOTE:THE HARDCODED MULTIPLES STAGGERED B/C AFTER 2X, WE HESITATE A BIT TO ADD MORE: */
-                /* (MAINTAIN THE A/V RATIO AS CLOSE TO 1:1-ISH OR THE VIDEO'S OVERALL RATIO AS POSSIBLE) */
-                if (TD.apktQ->size > int(1.1 * TD.pktQ->size))  // CLOSER TO 2X AUDIOS QUEUED THAN VIDEOS, PROCESS AN EXTRA ONE!
-                {
-                    write_audioframe (& TD.cinfo, TD.apktQ->elements[TD.apktQ->front], out_fmt, planar);
-                    Dequeue (TD.apktQ);
-                    if (TD.apktQ->size > int(2.7 * TD.pktQ->size))  // CLOSER TO 3X AUDIOS QUEUED THAN VIDEOS, PROCESS ANOTHER EXTRA ONE!
-                    {
-                        write_audioframe (& TD.cinfo, TD.apktQ->elements[TD.apktQ->front], out_fmt, planar);
-                        Dequeue (TD.apktQ);
-                        if (TD.apktQ->size > int(4.3 * TD.pktQ->size))  // CLOSER TO 4X AUDIOS QUEUED THAN VIDEOS, PROCESS ANOTHER EXTRA ONE!
-                        {
-                            write_audioframe (& TD.cinfo, TD.apktQ->elements[TD.apktQ->front], out_fmt, planar);
-                            Dequeue (TD.apktQ);
-                        }
-                    }
-                }
             }
             if (thread_exit == 2)  //abUser MAY HAVE KILLED FAUXDACIOUS (& SDL) WHILST WRITING AUDIO-FRAMES!:
                 break;             //IF SO, WE BREAK HERE B4 WRITING VIDEO FRAMES LEST WE SEGFAULT!
-            else if (TD.pktQ->size > 0)
-            {   // PROCESS NEXT VIDEO FRAME(S) IN QUEUE:
-                write_videoframe (renderer.get (), & TD.vcinfo, bmpptr, TD.pktQ->elements[TD.pktQ->front],
-                        video_width, video_height, last_resized, & windowIsStable);
-                Dequeue (TD.pktQ);
-                if (TD.pktQ->size > int(1.4 * TD.apktQ->size))  // CLOSER TO 2X VIDEOS QUEUED THAN AUDIOS, PROCESS AN EXTRA ONE!
-                {
-                    write_videoframe (renderer.get (), & TD.vcinfo, bmpptr, TD.pktQ->elements[TD.pktQ->front],
-                            video_width, video_height, last_resized, & windowIsStable);
-                    Dequeue (TD.pktQ);
-                    if (TD.pktQ->size > int(2.8 * TD.apktQ->size))  // CLOSER TO 3X VIDEOS QUEUED THAN AUDIOS, PROCESS ANOTHER EXTRA ONE!
-                    {
-                        write_videoframe (renderer.get (), & TD.vcinfo, bmpptr, TD.pktQ->elements[TD.pktQ->front],
-                                video_width, video_height, last_resized, & windowIsStable);
-                        Dequeue (TD.pktQ);
-                        if (TD.pktQ->size > int(4.2 * TD.apktQ->size))  // CLOSER TO 4X VIDEOS QUEUED THAN AUDIOS, PROCESS ANOTHER EXTRA ONE!
-                        {
-                            write_videoframe (renderer.get (), & TD.vcinfo, bmpptr, TD.pktQ->elements[TD.pktQ->front],
-                                    video_width, video_height, last_resized, & windowIsStable);
-                            Dequeue (TD.pktQ);
-                        }
-                    }
-                }
-            }
+
+            /* PRESENT THE DECODED VIDEO FRAME THE VIDEO-PRESENTER THREAD SAYS IS DUE: */
+            if (__atomic_load_n (& TD.frame_due, __ATOMIC_SEQ_CST))
+                present_videoframe (& TD, renderer.get (), bmpptr, last_resized, & windowIsStable);
             if (SDL_PollEvent (& event))
             {
                 do {
@@ -1705,9 +2179,9 @@ breakout1:
                 needWinSzFudge = false;  // WE HAVE OUR DECORATION FUDGE-FACTOR (IF ANY)!
             }
         }
-        else if (TD.apktQ->size > 0)
+        else if (QSize (TD.apktQ) > 0)
         {   // WE'RE JUST DOING AUDIO, SO JUST PROCESS NEXT AUDIO FRAME IN QUEUE:
-            write_audioframe (& TD.cinfo, TD.apktQ->elements[TD.apktQ->front], out_fmt, planar);
+            write_audioframe (& TD.cinfo, QFront (TD.apktQ), out_fmt, planar);
             Dequeue (TD.apktQ);
         }
 
@@ -1722,14 +2196,31 @@ breakout1:
         seek_value = check_seek ();
         if (seek_value >= 0)
         {
+            pthread_mutex_lock (& read_mutex);  // BLOCK READING WHILST SEEKING (CHANGING POSITION)!
+
             /* JWT:FIRST, FLUSH ANY PACKETS SITTING IN THE QUEUES TO CLEAR THE QUEUES! */
+            /* (AND TELL READER TO DISCARD ANY PACKET IT'S STILL HOLDING FROM BEFORE THE SEEK) */
+            __atomic_add_fetch (& TD.seek_gen, 1, __ATOMIC_SEQ_CST);
             QFlush (TD.apktQ);
-            QFlush (TD.pktQ);
+            if (vdecoder_running)
+            {
+                /* VIDEO-DECODER THREAD OWNS THE VIDEO QUEUE AND CODEC, SO WAIT FOR IT TO FLUSH THOSE,
+                   AND THE VIDEO-PRESENTER THREAD TO DUMP THE FRAMES ALREADY DECODED (A FRAME IT HANDED
+                   US IN THE MEANTIME IS STALE NOW, SO JUST GIVE IT BACK UNSHOWN): */
+                QWake (true);
+                while (__atomic_load_n (& TD.pseek_gen, __ATOMIC_SEQ_CST) != TD.seek_gen
+                        && ! __atomic_load_n (& TD.presenter_done, __ATOMIC_SEQ_CST))
+                {
+                    if (__atomic_load_n (& TD.frame_due, __ATOMIC_SEQ_CST))
+                        present_videoframe (& TD, renderer.get (), bmpptr, false, & windowIsStable);
+                    QSleep ([& TD] () { return __atomic_load_n (& TD.pseek_gen, __ATOMIC_SEQ_CST) == TD.seek_gen
+                            || __atomic_load_n (& TD.presenter_done, __ATOMIC_SEQ_CST)
+                            || __atomic_load_n (& TD.frame_due, __ATOMIC_SEQ_CST); }, PLAYER_WAIT_NS);
+                }
+            }
             /* JWT: HAD TO CHANGE THIS FROM "AVSEEK_FLAG_ANY" TO AVSEEK_FLAG_BACKWARD
                 TO GET SEEK TO NOT RANDOMLY BRICK?! */
 
-            pthread_mutex_lock (& read_mutex);  // BLOCK READING WHILST SEEKING (CHANGING POSITION)!
-
             if (LOG (av_seek_frame, TD.ic, -1, (int64_t) seek_value *
                     AV_TIME_BASE / 1000, AVSEEK_FLAG_BACKWARD) >= 0)
                 TD.errcount = 0;
@@ -1747,6 +2238,7 @@ breakout1:
         }
     }  // END PACKET-PROCESSING LOOP.
 
+    QWake (true);  // READER MAY BE ASLEEP ON A FULL QUEUE, WAKE IT SO IT SEES thread_exit.
     if (pthread_join (helper_thread, NULL))
         AUDERR ("Error joining thread\n");
 
@@ -1754,49 +2246,65 @@ breakout1:
         returnok = false;
     else if (thread_exit < 2)  // OUTPUT ANYTHING LEFT IN THE QUEUES (UNLESS USER HIT STOP-BUTTON):
     {
-        while (TD.apktQ->size > 0 || TD.pktQ->size > 0)
-        {
-            if (TD.apktQ->size > 0)
-            {   // PROCESS NEXT AUDIO FRAME IN QUEUE:
-                write_audioframe (& TD.cinfo, TD.apktQ->elements[TD.apktQ->front], out_fmt, planar);
-                Dequeue (TD.apktQ);
-            }
-            if (myplay_video && TD.pktQ->size > 0)
-            {   // PROCESS NEXT VIDEO FRAME IN QUEUE:
-                write_videoframe (renderer.get (), & TD.vcinfo, bmpptr, TD.pktQ->elements[TD.pktQ->front],
-                        video_width, video_height, last_resized, & windowIsStable);
-                Dequeue (TD.pktQ);
-            }
+        while (QSize (TD.apktQ) > 0)
+        {   // PROCESS NEXT AUDIO FRAME IN QUEUE:
+            write_audioframe (& TD.cinfo, QFront (TD.apktQ), out_fmt, planar);
+            Dequeue (TD.apktQ);
         }
-        if ((pkt = av_packet_alloc ()))
+        if ((pkt = pool.get_packet ()))  // (SAFE, READER THREAD IS GONE NOW)
         {
             pkt->data=nullptr; pkt->size=0;
             write_audioframe (& TD.cinfo, pkt, out_fmt, planar);
-            if (myplay_video)  /* IF VIDEO-WINDOW STILL INTACT (NOT CLOSED BY USER PRESSING WINDOW'S CORNER [X]): */
-                write_videoframe (renderer.get (), & TD.vcinfo, bmpptr, pkt,
-                        video_width, video_height, last_resized, & windowIsStable);
-
-            av_packet_free (& pkt);
+            pool.put_packet (& pkt);
+        }
+        /* LET THE VIDEO THREADS FINISH UP (THE DECODER DRAINS THE CODEC AT EOF, THE PRESENTER HANDS US THE
+           REST OF THE FRAMES AS THEY COME DUE, OR JUST STEPS THROUGH THEM ONCE THE AUDIO CLOCK STOPS MOVING): */
+        __atomic_store_n (& TD.audio_done, true, __ATOMIC_SEQ_CST);
+        QWake (true);
+        while (vpresenter_running && ! __atomic_load_n (& TD.presenter_done, __ATOMIC_SEQ_CST))
+        {
+            if (check_stop ())
+            {
+                thread_exit = 2;
+                break;
+            }
+            if (__atomic_load_n (& TD.frame_due, __ATOMIC_SEQ_CST))
+                present_videoframe (& TD, renderer.get (), bmpptr, last_resized, & windowIsStable);
+            QSleep ([& TD] () { return __atomic_load_n (& TD.presenter_done, __ATOMIC_SEQ_CST)
+                    || __atomic_load_n (& TD.frame_due, __ATOMIC_SEQ_CST); }, PLAYER_WAIT_NS);
         }
     }
-
-#ifdef _WIN32
-    if (bmp)  // GOTTA FREE THIS BEFORE WE LEAVE SCOPE!
+    if (vpresenter_running)
     {
-        SDL_DestroyTexture (bmp);
-        SDL_Delay (50);
-        bmp = nullptr;
+        QWake (true);
+        if (pthread_join (vpresenter_thread, NULL))
+            AUDERR ("Error joining video-presenter thread\n");
+    }
+    if (vdecoder_running)
+    {
+        QWake (true);
+        if (pthread_join (vdecoder_thread, NULL))
+            AUDERR ("Error joining video-decoder thread\n");
     }
-#endif
     }  // END OF SUBSCOPE FOR DECLARING SDL2 TEXTURE AS SCOPED SMARTPOINTER.
 
 error_exit:  /* WE END UP HERE WHEN PLAYBACK IS STOPPED: */
 
     AUDDBG ("end of playback.\n");
+    if (TD.vfrmQ)
+        destroyFrameQueue (TD.vfrmQ);
     if (TD.pktQ)
+    {
+        if (myplay_video)
+            QLogStats ("Video", TD.pktQ);
         destroyQueue (TD.pktQ);
+    }
     if (TD.apktQ)
+    {
+        QLogStats ("Audio", TD.apktQ);
         destroyQueue (TD.apktQ);
+    }
+    pool.log_stats ("FFaudio");
 
     if (myplay_video && sdl_window)
     {
@@ -19,50 +19,337 @@
 #define WANT_VFS_STDIO_COMPAT
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
 #include "ffaudio-stdinc.h"
+#include <libfauxdcore/audstrings.h>
 #include <libfauxdcore/runtime.h>
 
 #define IOBUF 4096
+#define MIN_BLOCK_KB 64
+#define MAX_BLOCK_KB 4096
 
 static FILE * m_savefile = NULL;    /* File to echo video stream out to (optional). */
 
-static int read_cb (void * file, unsigned char * buf, int size)
+/* READ-AHEAD STATE FOR ONE AVIOContext (ITS opaque).  EITHER THE WHOLE (LOCAL) FILE IS mmap'ED
+   AND WE JUST COPY OUT OF THAT (OPT-IN, SEE map_local_file ()), OR A BACKGROUND THREAD KEEPS A RING OF nblocks BLOCKS FILLED FROM THE
+   VFSFile AHEAD OF WHERE THE DEMUXER IS READING, OR (NEITHER) WE READ THE VFSFile DIRECTLY AS BEFORE.
+   THE DEMUXER SIDE (read_cb/seek_cb) IS ONLY EVER CALLED BY ONE THREAD AT A TIME (ffaudio's read_mutex). */
+struct IOBlock
+{
+    unsigned char * data;
+    int len;
+    int64_t offset;         // FILE OFFSET OF data[0].
+};
+
+struct IOState
 {
-    int res = ((VFSFile *) file)->fread (buf, 1, size);
-    if (m_savefile && res > 0)
+    VFSFile * file;
+    int64_t size;           // FILE SIZE (-1 IF UNKNOWN, IE. A LIVE STREAM).
+    int64_t pos;            // DEMUXER'S CURRENT FILE POSITION.
+
+    /* mmap PATH: */
+    const unsigned char * map = nullptr;
+    int64_t map_size = 0;
+    int map_fd = -1;        // KEPT OPEN TO NOTICE THE FILE SHRINKING UNDER US.
+
+    /* READ-AHEAD PATH (ALL BELOW ONLY CHANGED UNDER mutex): */
+    bool threaded = false;
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    IOBlock * blocks = nullptr;
+    int nblocks = 0;
+    int block_size = 0;
+    unsigned head = 0;      // BLOCKS FILLED (FETCH THREAD).
+    unsigned tail = 0;      // BLOCKS CONSUMED (DEMUXER).
+    int tail_used = 0;      // BYTES OF BLOCK AT tail ALREADY CONSUMED.
+    int64_t fetch_pos = 0;  // FILE OFFSET THE NEXT BLOCK WILL BE FETCHED FROM.
+    bool eof = false;
+    bool stop = false;
+    int64_t seek_to = -1;   // PENDING OUT-OF-RING SEEK FOR THE FETCH THREAD (-1 = NONE).
+    int seek_result = 0;
+
+    /* STATS (io_* ARE ONLY UPDATED BY THE THREAD DOING THE ACTUAL FILE I/O): */
+    int64_t bytes_read = 0;     // BYTES HANDED TO THE DEMUXER.
+    int64_t io_bytes = 0;       // BYTES READ FROM THE FILE (OR COPIED OUT OF THE MAP).
+    int64_t io_ns = 0;          // TIME SPENT DOING THAT, FOR THE THROUGHPUT FIGURE.
+    unsigned fetches = 0;
+    unsigned stalls = 0;        // TIMES DEMUXER HAD TO WAIT FOR THE FETCH THREAD.
+    unsigned ring_seeks = 0;    // SEEKS SATISFIED FROM THE PREFETCHED BLOCKS.
+    unsigned file_seeks = 0;    // SEEKS THAT HAD TO DUMP THE RING AND REFETCH.
+};
+
+static int64_t now_ns ()
+{
+    struct timespec ts;
+    clock_gettime (CLOCK_MONOTONIC, & ts);
+    return ts.tv_sec * (int64_t) 1000000000 + ts.tv_nsec;
+}
+
+/* TIME ONE FILE READ (OR COPY OUT OF THE MAP) FOR THE STATS: */
+template<class Read>
+static int64_t timed_io (IOState * st, Read read)
+{
+    int64_t start = now_ns ();
+    int64_t len = read ();
+    st->io_ns += now_ns () - start;
+    if (len > 0)
+        st->io_bytes += len;
+    return len;
+}
+
+/* BACKGROUND THREAD:  KEEP THE RING FULL, AND DO ANY OUT-OF-RING SEEK THE DEMUXER ASKS FOR: */
+static void * fetch_thread_fn (void * data)
+{
+    IOState * st = (IOState *) data;
+
+    pthread_mutex_lock (& st->mutex);
+    while (! st->stop)
+    {
+        if (st->seek_to >= 0)
+        {
+            int64_t target = st->seek_to;
+            pthread_mutex_unlock (& st->mutex);
+            int res = st->file->fseek (target, VFS_SEEK_SET);
+            pthread_mutex_lock (& st->mutex);
+            if (! res)  /* ONLY DUMP THE RING IF WE REALLY GOT THERE, ELSE WE KEEP READING WHERE WE WERE: */
+            {
+                st->head = st->tail = 0;
+                st->tail_used = 0;
+                st->fetch_pos = target;
+                st->eof = false;
+            }
+            st->seek_result = res;
+            st->seek_to = -1;
+            pthread_cond_broadcast (& st->cond);
+            continue;
+        }
+
+        if (st->eof || st->head - st->tail >= (unsigned) st->nblocks)
+        {
+            pthread_cond_wait (& st->cond, & st->mutex);
+            continue;
+        }
+
+        /* BLOCK AT head IS OURS UNTIL WE PUBLISH IT, SO READ INTO IT W/O HOLDING THE LOCK: */
+        IOBlock * b = & st->blocks[st->head % st->nblocks];
+        pthread_mutex_unlock (& st->mutex);
+        int64_t len = timed_io (st, [st, b] () { return st->file->fread (b->data, 1, st->block_size); });
+        pthread_mutex_lock (& st->mutex);
+
+        if (st->seek_to >= 0)
+            continue;  // (JUST READ FROM WHERE WE'RE ABOUT TO LEAVE ANYWAY, SO THROW IT AWAY)
+
+        if (len > 0)
+        {
+            b->len = (int) len;
+            b->offset = st->fetch_pos;
+            st->fetch_pos += len;
+            st->head ++;
+            st->fetches ++;
+        }
+        else
+            st->eof = true;
+
+        pthread_cond_broadcast (& st->cond);
+    }
+    pthread_mutex_unlock (& st->mutex);
+
+    return nullptr;
+}
+
+static int read_cb (void * opaque, unsigned char * buf, int size)
+{
+    IOState * st = (IOState *) opaque;
+    int res = 0;
+
+    if (st->map)
+    {
+#ifndef _WIN32
+        /* TOUCHING PAGES PAST THE END OF A FILE THAT GOT TRUNCATED (IE. TAGS REWRITTEN) WHILST MAPPED IS
+           A SIGBUS, SO ONLY COPY WHAT'S STILL IN THE FILE (THE OPTION WARNS THAT THIS ISN'T WATERTIGHT): */
+        struct stat sb;
+        int64_t avail = (! fstat (st->map_fd, & sb)) ? aud::min ((int64_t) sb.st_size, st->map_size) : 0;
+        if (st->pos < avail)
+        {
+            res = (int) aud::min ((int64_t) size, avail - st->pos);
+            timed_io (st, [st, buf, res] () { memcpy (buf, st->map + st->pos, res); return (int64_t) res; });
+        }
+#endif
+    }
+    else if (st->threaded)
+    {
+        pthread_mutex_lock (& st->mutex);
+        if (st->head == st->tail && ! st->eof)
+        {
+            st->stalls ++;
+            while (st->head == st->tail && ! st->eof)
+                pthread_cond_wait (& st->cond, & st->mutex);
+        }
+
+        if (st->head != st->tail)
+        {
+            /* BLOCK AT tail IS OURS UNTIL WE HAND IT BACK, SO COPY OUT OF IT W/O HOLDING THE LOCK: */
+            IOBlock * b = & st->blocks[st->tail % st->nblocks];
+            int used = st->tail_used;
+            pthread_mutex_unlock (& st->mutex);
+
+            res = aud::min (size, b->len - used);
+            memcpy (buf, b->data + used, res);
+
+            pthread_mutex_lock (& st->mutex);
+            st->tail_used += res;
+            if (st->tail_used >= b->len)
+            {
+                st->tail ++;
+                st->tail_used = 0;
+                pthread_cond_broadcast (& st->cond);
+            }
+        }
+        pthread_mutex_unlock (& st->mutex);
+    }
+    else
+        res = (int) timed_io (st, [st, buf, size] () { return st->file->fread (buf, 1, size); });
+
+    if (res <= 0)
+        return AVERROR_EOF;
+
+    st->pos += res;
+    st->bytes_read += res;
+    if (m_savefile)
         ::fwrite (buf, res, 1, m_savefile);
-    return (res > 0) ? res : AVERROR_EOF;
+    return res;
 }
 
-static int64_t seek_cb (void * file, int64_t offset, int whence)
+static int64_t seek_cb (void * opaque, int64_t offset, int whence)
 {
+    IOState * st = (IOState *) opaque;
+
+    whence &= ~(int) AVSEEK_FORCE;
     if (whence == AVSEEK_SIZE)
-        return ((VFSFile *) file)->fsize ();
-    if (m_savefile || ((VFSFile *) file)->fseek (offset, to_vfs_seek_type (whence & ~(int) AVSEEK_FORCE)))
+        return st->size;
+    if (m_savefile)
+        return -1;
+
+    if (! st->map && ! st->threaded)
+    {
+        if (st->file->fseek (offset, to_vfs_seek_type (whence)))
+            return -1;
+        return (st->pos = st->file->ftell ());
+    }
+
+    int64_t target = (whence == SEEK_SET) ? offset
+            : (whence == SEEK_CUR) ? st->pos + offset
+            : (whence == SEEK_END && st->size >= 0) ? st->size + offset : -1;
+    if (target < 0)
         return -1;
-    return ((VFSFile *) file)->ftell ();
+
+    if (st->map)
+        return (st->pos = aud::min (target, st->map_size));
+
+    pthread_mutex_lock (& st->mutex);
+    if (st->head != st->tail && target >= st->blocks[st->tail % st->nblocks].offset
+            && target < st->fetch_pos)
+    {
+        /* ALREADY PREFETCHED, JUST SKIP AHEAD (OR BACK WITHIN THE CURRENT BLOCK): */
+        while (target >= st->blocks[st->tail % st->nblocks].offset + st->blocks[st->tail % st->nblocks].len)
+            st->tail ++;
+        st->tail_used = (int) (target - st->blocks[st->tail % st->nblocks].offset);
+        st->ring_seeks ++;
+        pthread_cond_broadcast (& st->cond);
+    }
+    else if (target != st->fetch_pos || st->head != st->tail)
+    {
+        /* OUTSIDE THE RING, SO HAVE THE FETCH THREAD MOVE THE FILE AND START OVER FROM THERE: */
+        st->seek_to = target;
+        pthread_cond_broadcast (& st->cond);
+        while (st->seek_to >= 0)
+            pthread_cond_wait (& st->cond, & st->mutex);
+        st->file_seeks ++;
+        if (st->seek_result)
+            target = -1;
+    }
+    pthread_mutex_unlock (& st->mutex);
+
+    return (target < 0) ? -1 : (st->pos = target);
 }
 
-AVIOContext * io_context_new (VFSFile & file)
+#ifndef _WIN32
+/* MAP THE WHOLE FILE IF IT'S A LOCAL, REGULAR FILE (NO read () CALLS AT ALL AFTER THIS).  OFF BY
+   DEFAULT ("io_mmap"):  IF ANOTHER PROGRAM (OR OUR OWN TAG WRITER) TRUNCATES THE FILE WHILST IT'S MAPPED,
+   READING THE LOST PAGES KILLS US W/SIGBUS, AND read_cb () CAN ONLY NARROW THAT WINDOW, NOT CLOSE IT: */
+static bool map_local_file (IOState * st)
 {
-    void * buf = av_malloc (IOBUF);
-    if (aud_get_bool ("ffaudio", "save_video"))
+    StringBuf path = uri_to_filename (st->file->filename ());
+    if (! path)
+        return false;
+
+    int fd = ::open (path, O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    struct stat sb;
+    void * map = MAP_FAILED;
+    if (! fstat (fd, & sb) && S_ISREG (sb.st_mode) && sb.st_size > 0)
+        map = mmap (nullptr, sb.st_size, PROT_READ, MAP_SHARED, fd, 0);
+
+    if (map == MAP_FAILED)
     {
-        String save_video_file = aud_get_str ("ffaudio", "save_video_file");
-        if (! save_video_file[0])
-#ifdef _WIN32
-            save_video_file = String ("C:\\Temp\\lastvideo");
-#else
-            save_video_file = String ("/tmp/lastvideo");
+        ::close (fd);
+        return false;
+    }
+
+    madvise (map, sb.st_size, MADV_SEQUENTIAL);
+    st->map_fd = fd;
+    st->map = (const unsigned char *) map;
+    st->map_size = sb.st_size;
+    st->size = sb.st_size;
+    return true;
+}
 #endif
-        m_savefile = ::fopen ((const char *)save_video_file, "w");
+
+/* SET UP THE FETCH THREAD AND ITS RING (readahead_kb TOTAL, IN block_kb BLOCKS): */
+static bool start_fetch_thread (IOState * st)
+{
+    int block_kb = aud::clamp (aud_get_int ("ffaudio", "io_block_kb"), MIN_BLOCK_KB, MAX_BLOCK_KB);
+    int nblocks = aud::clamp (aud_get_int ("ffaudio", "io_readahead_blocks"), 2, 64);
+
+    st->block_size = block_kb * 1024;
+
+    st->blocks = new IOBlock[nblocks];
+    st->nblocks = nblocks;
+    for (int i = 0; i < nblocks; i ++)
+    {
+        st->blocks[i].data = (unsigned char *) malloc (st->block_size);
+        st->blocks[i].len = 0;
+        st->blocks[i].offset = 0;
+    }
+
+    int64_t pos = st->file->ftell ();
+    st->fetch_pos = st->pos = (pos > 0) ? pos : 0;
+    pthread_mutex_init (& st->mutex, nullptr);
+    pthread_cond_init (& st->cond, nullptr);
+    if (pthread_create (& st->thread, nullptr, fetch_thread_fn, st))
+    {
+        AUDERR ("s:Error creating read-ahead thread: %s - reading directly!\n", strerror (errno));
+        pthread_cond_destroy (& st->cond);
+        pthread_mutex_destroy (& st->mutex);
+        return false;
     }
-    return avio_alloc_context ((unsigned char *) buf, IOBUF, 0, & file, read_cb, nullptr, seek_cb);
+
+    return true;
 }
 
-AVIOContext * io_context_new2 (VFSFile & file)
+static void open_savefile ()
 {
-    void * buf = av_malloc (IOBUF);
     if (aud_get_bool ("ffaudio", "save_video"))
     {
         String save_video_file = aud_get_str ("ffaudio", "save_video_file");
@@ -74,16 +361,96 @@ AVIOContext * io_context_new2 (VFSFile & file)
 #endif
         m_savefile = ::fopen ((const char *)save_video_file, "w");
     }
-    return avio_alloc_context ((unsigned char *) buf, IOBUF, 0, & file, read_cb, nullptr, nullptr);
+}
+
+/* readahead:  CALLER PROMISES NOT TO TOUCH THE VFSFile ITSELF WHILST THE CONTEXT EXISTS, SO WE MAY
+   READ IT FROM A BACKGROUND THREAD (PLAYBACK); OTHERWISE (IE. TAG READING) WE ONLY mmap OR READ DIRECTLY.
+   LIVE STREAMS (UNKNOWN SIZE) ARE ALWAYS READ DIRECTLY, SINCE WE CAN'T SEEK IN THEM ANYWAY AND THE PLAY
+   THREAD STILL READS THEIR METADATA FROM THE VFSFile (fetch_stream_info ()) WHILST PLAYING.
+   THE AVIO BUFFER ITSELF IS ALSO A BLOCK (NOT IOBUF) BIG, SO LIBAVFORMAT CALLS US FAR LESS OFTEN: */
+static AVIOContext * new_context (VFSFile & file, bool readahead, bool seekable)
+{
+    IOState * st = new IOState;
+    st->file = & file;
+    st->size = file.fsize ();
+    st->pos = 0;
+
+    int bufsize = IOBUF;
+#ifndef _WIN32
+    if (aud_get_bool ("ffaudio", "io_mmap") && map_local_file (st))
+        bufsize = MIN_BLOCK_KB * 1024;
+    else
+#endif
+    if (readahead && st->size >= 0 && (st->threaded = start_fetch_thread (st)))
+        bufsize = aud::min (st->block_size, MIN_BLOCK_KB * 1024);
+    else
+        st->pos = aud::max (file.ftell (), (int64_t) 0);
+
+    void * buf = av_malloc (bufsize);
+    open_savefile ();
+    return avio_alloc_context ((unsigned char *) buf, bufsize, 0, st, read_cb, nullptr,
+            seekable ? seek_cb : nullptr);
+}
+
+AVIOContext * io_context_new (VFSFile & file, bool readahead)
+{
+    return new_context (file, readahead, true);
+}
+
+AVIOContext * io_context_new2 (VFSFile & file)
+{
+    return new_context (file, false, false);
 }
 
 void io_context_free (AVIOContext * io)
 {
+    IOState * st = (IOState *) io->opaque;
+
     if (m_savefile)
     {
         ::fclose (m_savefile);
         m_savefile = nullptr;
     }
+
+    if (st)
+    {
+        /* THROUGHPUT OF THE FILE I/O ITSELF (NOT BYTES OVER PLAYBACK TIME, WHICH WOULD JUST BE THE BITRATE): */
+        double io_mbs = (st->io_ns > 0) ? st->io_bytes * 1e3 / st->io_ns : 0.0;
+        if (st->threaded)
+        {
+            pthread_mutex_lock (& st->mutex);
+            st->stop = true;
+            pthread_cond_broadcast (& st->cond);
+            pthread_mutex_unlock (& st->mutex);
+            pthread_join (st->thread, nullptr);
+            pthread_cond_destroy (& st->cond);
+            pthread_mutex_destroy (& st->mutex);
+
+            AUDINFO ("i:FFaudio read-ahead: %d x %d KiB blocks, %lld bytes demuxed, %lld read (%.1f MB/s), "
+                    "%u fetches, %u stalls, seeks: %u in ring, %u refetched\n",
+                    st->nblocks, st->block_size / 1024, (long long) st->bytes_read,
+                    (long long) st->io_bytes, io_mbs,
+                    st->fetches, st->stalls, st->ring_seeks, st->file_seeks);
+        }
+        else if (st->map)
+            AUDINFO ("i:FFaudio mmap: %lld bytes demuxed (%.1f MB/s)\n", (long long) st->bytes_read, io_mbs);
+
+        if (st->blocks)
+        {
+            for (int i = 0; i < st->nblocks; i ++)
+                free (st->blocks[i].data);
+            delete[] st->blocks;
+        }
+#ifndef _WIN32
+        if (st->map)
+        {
+            munmap ((void *) st->map, st->map_size);
+            ::close (st->map_fd);
+        }
+#endif
+        delete st;
+    }
+
     av_free (io->buffer);
     av_free (io);
 }
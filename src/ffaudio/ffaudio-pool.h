@@ -0,0 +1,173 @@
+/*
+ * Fauxdacious FFaudio Plugin - packet/frame recycling (shared with the DVD plugin)
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions, and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions, and the following disclaimer in the documentation
+ *    provided with the distribution.
+ *
+ * This software is provided "as is" and without any warranty, express or
+ * implied. In no event shall the authors be liable for any damages arising from
+ * the use of this software.
+ */
+
+#ifndef __FFAUDIO_POOL_H__GUARD
+#define __FFAUDIO_POOL_H__GUARD
+
+#include "ffaudio-stdinc.h"
+
+#include <libfauxdcore/runtime.h>
+
+/* MAX. # OF SPENT AVPackets KEPT FOR REUSE PER LANE (MUST BE A POWER OF 2 AND SHOULD BE AT LEAST AS
+   BIG AS BOTH PACKET QUEUES TOGETHER, SO STEADY-STATE PLAYBACK NEVER HAS TO ALLOCATE ONE): */
+#define PKTPOOL_SIZE 512
+/* ONE RETURN LANE PER THREAD THAT PUTS PACKETS BACK (IE. AUDIO AND VIDEO DECODING THREADS): */
+#define PKTPOOL_LANES 2
+
+/* BOUNDED RECYCLING POOL FOR THE DECODE LOOPS:  SPENT AVPackets GO BACK INTO A SINGLE-PRODUCER/
+   SINGLE-CONSUMER RING PER "LANE" (THE THREAD FINISHED WITH A PACKET PUTS TO ITS OWN LANE, THE
+   THREAD READING THE STREAM GETS FROM ANY LANE, AND MAY BE THE SAME THREAD), AND THE DECODED-FRAME
+   AND PLANAR-INTERLEAVE BUFFERS ARE KEPT AROUND INSTEAD OF BEING REALLOCATED FOR EVERY PACKET.
+   THE *_allocs COUNTERS ONLY GO UP WHEN WE REALLY HIT THE HEAP, SO THEY SHOULD STOP CLIMBING ONCE
+   PLAYBACK HAS WARMED UP.
+   NOTE:  THE PACKET *PAYLOAD* IS STILL ALLOCATED BY libavformat ITSELF! */
+struct DecodePool
+{
+    struct
+    {
+        AVPacket * pkts[PKTPOOL_SIZE];
+        unsigned head = 0;   // SPENT PACKETS RETURNED (PUTTING THREAD ONLY).
+        unsigned tail = 0;   // PACKETS HANDED OUT AGAIN (GETTING THREAD ONLY).
+    }
+    lanes[PKTPOOL_LANES];
+
+    AVFrame * aframe = nullptr;  // REUSED DECODED AUDIO FRAME.
+    AVFrame * vframe = nullptr;  // REUSED DECODED VIDEO FRAME.
+    Index<char> ibuf;            // REUSED BUFFER FOR INTERLEAVING PLANAR AUDIO.
+
+    /* ALLOCATION COUNTERS: */
+    unsigned pkt_allocs = 0;
+    unsigned pkt_reuses = 0;
+    unsigned frame_allocs = 0;
+    unsigned buf_allocs = 0;
+
+    ~DecodePool () { clear (); }
+
+    /* REPLACES av_packet_alloc () (CALL FROM THE STREAM-READING THREAD): */
+    AVPacket * get_packet ()
+    {
+        for (auto & lane : lanes)
+        {
+            unsigned tail = lane.tail;
+            if (__atomic_load_n (& lane.head, __ATOMIC_ACQUIRE) != tail)
+            {
+                AVPacket * pkt = lane.pkts[tail & (PKTPOOL_SIZE - 1)];
+                __atomic_store_n (& lane.tail, tail + 1, __ATOMIC_RELEASE);
+                pkt_reuses ++;
+                return pkt;
+            }
+        }
+
+        pkt_allocs ++;
+        return av_packet_alloc ();
+    }
+
+    /* REPLACES av_packet_free (& pkt) (CALL FROM THE THREAD THAT'S DONE WITH THE PACKET,
+       EACH SUCH THREAD USING ITS OWN lane): */
+    void put_packet (AVPacket * * pkt, int lane = 0)
+    {
+        if (! * pkt)
+            return;
+
+        av_packet_unref (* pkt);
+
+        auto & l = lanes[lane];
+        unsigned head = l.head;
+        if (head - __atomic_load_n (& l.tail, __ATOMIC_ACQUIRE) < PKTPOOL_SIZE)
+        {
+            l.pkts[head & (PKTPOOL_SIZE - 1)] = * pkt;
+            __atomic_store_n (& l.head, head + 1, __ATOMIC_RELEASE);
+            * pkt = nullptr;
+        }
+        else
+            av_packet_free (pkt);  // POOL FULL, JUST FREE IT.
+    }
+
+    /* RETURNS THE REUSED FRAME IN SLOT (aframe OR vframe), ALLOCATING IT THE FIRST TIME.
+       CALLER SHOULD done_with_frame () IT WHEN DONE SO THE DECODER GETS ITS BUFFERS BACK: */
+    AVFrame * get_frame (AVFrame * & slot)
+    {
+        if (! slot)
+        {
+            frame_allocs ++;
+#if CHECK_LIBAVCODEC_VERSION (55, 45, 101, 55, 28, 1)
+            slot = av_frame_alloc ();
+#else
+            slot = avcodec_alloc_frame ();
+#endif
+        }
+        return slot;
+    }
+
+    /* RELEASE THE DECODER'S BUFFERS HELD BY A REUSED FRAME (FRAME ITSELF STAYS IN THE POOL): */
+    static void done_with_frame (AVFrame * frame)
+    {
+#if CHECK_LIBAVCODEC_VERSION (55, 45, 101, 55, 28, 1)
+        av_frame_unref (frame);
+#else
+        avcodec_get_frame_defaults (frame);
+#endif
+    }
+
+    /* RETURNS THE INTERLEAVE BUFFER, GROWN TO AT LEAST size BYTES: */
+    char * get_buffer (int size)
+    {
+        if (size > ibuf.len ())
+        {
+            buf_allocs ++;
+            ibuf.resize (size);
+        }
+        return ibuf.begin ();
+    }
+
+    void log_stats (const char * name)
+    {
+        AUDINFO ("i:%s decode pool: packet allocs %u (reused %u), frame allocs %u, interleave buffer allocs %u\n",
+                name, pkt_allocs, pkt_reuses, frame_allocs, buf_allocs);
+    }
+
+    /* FREE EVERYTHING (ONLY WHEN NO OTHER THREAD IS USING THE POOL): */
+    void clear ()
+    {
+        for (auto & lane : lanes)
+        {
+            while (lane.tail != lane.head)
+                av_packet_free (& lane.pkts[lane.tail ++ & (PKTPOOL_SIZE - 1)]);
+        }
+
+        free_frame (aframe);
+        free_frame (vframe);
+        ibuf.clear ();
+    }
+
+    static void free_frame (AVFrame * & frame)
+    {
+        if (! frame)
+            return;
+#if CHECK_LIBAVCODEC_VERSION (55, 45, 101, 55, 28, 1)
+        av_frame_free (& frame);
+#elif CHECK_LIBAVCODEC_VERSION (54, 59, 100, 54, 28, 0)
+        avcodec_free_frame (& frame);
+#else
+        av_free (frame);
+        frame = nullptr;
+#endif
+    }
+};
+
+#endif
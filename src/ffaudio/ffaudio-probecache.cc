@@ -0,0 +1,316 @@
+/*
+ * Fauxdacious FFaudio Plugin - persistent format-probe cache
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions, and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions, and the following disclaimer in the documentation
+ *    provided with the distribution.
+ *
+ * This software is provided "as is" and without any warranty, express or
+ * implied. In no event shall the authors be liable for any damages arising from
+ * the use of this software.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "ffaudio-stdinc.h"
+
+#include <libfauxdcore/audstrings.h>
+#include <libfauxdcore/index.h>
+#include <libfauxdcore/multihash.h>
+#include <libfauxdcore/runtime.h>
+
+/* WHAT WE REMEMBER ABOUT A LOCAL FILE, SO RESCANNING A BIG LIBRARY DOESN'T HAVE TO PROBE AND
+   avformat_find_stream_info () EVERY FILE AGAIN.  AN ENTRY IS ONLY VALID WHILST THE FILE'S SIZE AND
+   MTIME ARE UNCHANGED.  SAVED (ONE FILE PER LINE, LEAST RECENTLY USED FIRST) TO ffaudio-probe.cache
+   IN THE USER'S CONFIG DIR. */
+struct ProbeEntry
+{
+    int64_t size;
+    int64_t mtime;
+    String format;      // AVInputFormat name ("" = NOT PROBED YET).
+    int audio_idx;      // PROBE_UNKNOWN UNTIL find_codec () HAS RUN ONCE.
+    int video_idx;      // (-1 = NO VIDEO STREAM)
+    unsigned used;      // probe_clock WHEN LAST LOOKED UP OR ADDED.
+};
+
+/* MAX. ENTRIES KEPT (ROUGHLY 100 BYTES EACH):  PAST THIS, THE LEAST RECENTLY USED ONES ARE DROPPED,
+   SO FILES THAT HAVE LONG SINCE BEEN DELETED OR MOVED DON'T PILE UP IN MEMORY AND IN THE FILE FOREVER: */
+#define PROBE_CACHE_MAX 50000
+
+static SimpleHash<String, ProbeEntry> probe_cache;
+static pthread_mutex_t probe_mutex = PTHREAD_MUTEX_INITIALIZER;
+static bool probe_cache_loaded = false;
+static bool probe_cache_dirty = false;
+static unsigned probe_clock;
+
+/* STATS: */
+static unsigned format_hits, format_misses, stream_hits, stream_misses;
+
+static StringBuf cache_path ()
+{
+    return str_concat ({aud_get_path (AudPath::UserDir), "/ffaudio-probe.cache"});
+}
+
+/* ONLY LOCAL FILES ARE CACHEABLE (STREAMS HAVE NO MTIME AND MAY CHANGE FORMAT ANYWAY): */
+static bool file_stamp (const char * name, int64_t & size, int64_t & mtime)
+{
+    if (! aud_get_bool ("ffaudio", "probe_cache"))
+        return false;
+
+    StringBuf path = uri_to_filename (name);
+    struct stat sb;
+    if (! path || stat (path, & sb) || ! S_ISREG (sb.st_mode))
+        return false;
+
+    size = sb.st_size;
+    mtime = sb.st_mtime;
+    return true;
+}
+
+struct ProbeRef
+{
+    String uri;
+    const ProbeEntry * e;
+
+    ProbeRef (const String & uri, const ProbeEntry * e) : uri (uri), e (e) {}
+};
+
+/* CALLER HOLDS probe_mutex:  ALL ENTRIES, LEAST RECENTLY USED FIRST: */
+static Index<ProbeRef> entries_by_age_locked ()
+{
+    Index<ProbeRef> refs;
+    probe_cache.iterate ([& refs] (const String & uri, ProbeEntry & e) {
+        refs.append (uri, & e);
+    });
+    refs.sort ([] (const ProbeRef & a, const ProbeRef & b)
+        { return (a.e->used > b.e->used) - (a.e->used < b.e->used); });
+
+    return refs;
+}
+
+/* CALLER HOLDS probe_mutex:  ONCE FULL, DROP THE LEAST RECENTLY USED TENTH OF THE CACHE AT A TIME (SO
+   SCANNING A BIG NEW LIBRARY DOESN'T SORT THE WHOLE CACHE FOR EVERY NEW FILE): */
+static void trim_locked ()
+{
+    if (probe_cache.n_items () < PROBE_CACHE_MAX)
+        return;
+
+    Index<ProbeRef> refs = entries_by_age_locked ();
+    int drop = refs.len () - PROBE_CACHE_MAX * 9 / 10;
+    for (int i = 0; i < drop; i ++)
+        probe_cache.remove (refs[i].uri);
+
+    probe_cache_dirty = true;
+    AUDINFO ("i:FFaudio probe cache: full, dropped the %d least recently used entries.\n", drop);
+}
+
+/* CALLER HOLDS probe_mutex: */
+static ProbeEntry * lookup_locked (const char * name, int64_t size, int64_t mtime)
+{
+    ProbeEntry * e = probe_cache.lookup (String (name));
+    if (! e || e->size != size || e->mtime != mtime)
+        return nullptr;
+
+    e->used = ++ probe_clock;
+    return e;
+}
+
+static ProbeEntry * add_locked (const char * name, int64_t size, int64_t mtime)
+{
+    ProbeEntry * e = lookup_locked (name, size, mtime);
+    if (! e)
+    {
+        trim_locked ();
+        e = probe_cache.add (String (name), {size, mtime, String (""), PROBE_UNKNOWN, PROBE_UNKNOWN,
+                ++ probe_clock});
+    }
+
+    probe_cache_dirty = true;
+    return e;
+}
+
+static void log_stats_locked ()
+{
+    unsigned formats = format_hits + format_misses;
+    unsigned streams = stream_hits + stream_misses;
+    AUDINFO ("i:FFaudio probe cache: %d entries, format hits %u/%u (%.1f%%), stream-info hits %u/%u (%.1f%%)\n",
+            probe_cache.n_items (), format_hits, formats, formats ? 100.0 * format_hits / formats : 0.0,
+            stream_hits, streams, streams ? 100.0 * stream_hits / streams : 0.0);
+}
+
+static void count_stat (unsigned & counter)
+{
+    counter ++;
+    if (! ((format_hits + format_misses + stream_hits + stream_misses) % 1000))
+        log_stats_locked ();
+}
+
+void probe_cache_load ()
+{
+    pthread_mutex_lock (& probe_mutex);
+    if (! probe_cache_loaded)
+    {
+        probe_cache_loaded = true;
+        FILE * f = fopen (cache_path (), "r");
+        if (f)
+        {
+            char line[4096];
+            while (fgets (line, sizeof line, f))
+            {
+                /* size mtime audio_idx video_idx format uri */
+                long long size, mtime;
+                int audio_idx, video_idx, n = 0;
+                char format[64];
+                if (sscanf (line, "%lld %lld %d %d %63s %n", & size, & mtime, & audio_idx,
+                        & video_idx, format, & n) < 5 || ! n)
+                    continue;
+
+                char * uri = line + n;
+                uri[strcspn (uri, "\r\n")] = 0;
+                if (uri[0])
+                    probe_cache.add (String (uri), {size, mtime,
+                            String (strcmp (format, "-") ? format : ""), audio_idx, video_idx,
+                            ++ probe_clock});
+            }
+            fclose (f);
+            AUDINFO ("i:FFaudio probe cache: loaded %d entries.\n", probe_cache.n_items ());
+            if (probe_cache.n_items () > PROBE_CACHE_MAX)
+                trim_locked ();
+        }
+    }
+    pthread_mutex_unlock (& probe_mutex);
+}
+
+void probe_cache_save ()
+{
+    pthread_mutex_lock (& probe_mutex);
+    if (probe_cache_loaded)
+        log_stats_locked ();
+
+    if (probe_cache_dirty)
+    {
+        StringBuf path = cache_path ();
+        StringBuf tmppath = str_concat ({path, ".tmp"});
+        FILE * f = fopen (tmppath, "w");
+        if (f)
+        {
+            for (const ProbeRef & ref : entries_by_age_locked ())
+                fprintf (f, "%lld %lld %d %d %s %s\n", (long long) ref.e->size, (long long) ref.e->mtime,
+                        ref.e->audio_idx, ref.e->video_idx, ref.e->format[0] ? (const char *) ref.e->format : "-",
+                        (const char *) ref.uri);
+            if (fclose (f) || rename (tmppath, path))
+                AUDERR ("e:Could not save FFaudio probe cache (%s): %s\n", (const char *) path, strerror (errno));
+        }
+        probe_cache_dirty = false;
+    }
+
+    probe_cache.clear ();
+    probe_cache_loaded = false;
+    probe_clock = 0;
+    format_hits = format_misses = stream_hits = stream_misses = 0;
+    pthread_mutex_unlock (& probe_mutex);
+}
+
+void probe_cache_clear ()
+{
+    pthread_mutex_lock (& probe_mutex);
+    probe_cache.clear ();
+    probe_cache_dirty = true;
+    pthread_mutex_unlock (& probe_mutex);
+}
+
+/* RETURNS THE CACHED FORMAT NAME FOR name, OR AN EMPTY String (MISS): */
+String probe_cache_get_format (const char * name)
+{
+    int64_t size, mtime;
+    String format;
+
+    if (! file_stamp (name, size, mtime))
+        return format;
+
+    pthread_mutex_lock (& probe_mutex);
+    ProbeEntry * e = lookup_locked (name, size, mtime);
+    if (e && e->format[0])
+    {
+        format = e->format;
+        count_stat (format_hits);
+    }
+    else
+        count_stat (format_misses);
+    pthread_mutex_unlock (& probe_mutex);
+
+    return format;
+}
+
+void probe_cache_set_format (const char * name, const char * format)
+{
+    int64_t size, mtime;
+
+    if (! format || ! file_stamp (name, size, mtime))
+        return;
+
+    pthread_mutex_lock (& probe_mutex);
+    add_locked (name, size, mtime)->format = String (format);
+    pthread_mutex_unlock (& probe_mutex);
+}
+
+/* RETURNS TRUE AND THE CACHED STREAM INDICES IF WE HAVE THEM (video_idx MAY STILL BE PROBE_UNKNOWN
+   IF ONLY TAGS WERE READ BEFORE, IE. THE VIDEO STREAM WASN'T LOOKED FOR): */
+bool probe_cache_get_streams (const char * name, int & audio_idx, int & video_idx)
+{
+    int64_t size, mtime;
+    bool found = false;
+
+    if (! file_stamp (name, size, mtime))
+        return false;
+
+    pthread_mutex_lock (& probe_mutex);
+    ProbeEntry * e = lookup_locked (name, size, mtime);
+    if (e && e->audio_idx != PROBE_UNKNOWN)
+    {
+        audio_idx = e->audio_idx;
+        video_idx = e->video_idx;
+        found = true;
+    }
+    pthread_mutex_unlock (& probe_mutex);
+
+    return found;
+}
+
+/* COUNT A find_codec () LOOKUP AS A HIT (CACHED STREAMS WERE USABLE, NO avformat_find_stream_info ())
+   OR MISS (HAD TO DO IT THE SLOW WAY): */
+void probe_cache_count_streams (const char * name, bool hit)
+{
+    if (strncmp (name, "file://", 7) || ! aud_get_bool ("ffaudio", "probe_cache"))
+        return;
+
+    pthread_mutex_lock (& probe_mutex);
+    count_stat (hit ? stream_hits : stream_misses);
+    pthread_mutex_unlock (& probe_mutex);
+}
+
+void probe_cache_set_streams (const char * name, int audio_idx, int video_idx)
+{
+    int64_t size, mtime;
+
+    if (! file_stamp (name, size, mtime))
+        return;
+
+    pthread_mutex_lock (& probe_mutex);
+    ProbeEntry * e = add_locked (name, size, mtime);
+    e->audio_idx = audio_idx;
+    if (video_idx != PROBE_UNKNOWN || e->video_idx == PROBE_UNKNOWN)
+        e->video_idx = video_idx;
+    pthread_mutex_unlock (& probe_mutex);
+}
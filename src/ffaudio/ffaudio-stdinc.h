@@ -42,8 +42,19 @@ extern "C" {
 #error Please define either HAVE_FFMPEG or HAVE_LIBAV
 #endif
 
-AVIOContext * io_context_new (VFSFile & file);
+AVIOContext * io_context_new (VFSFile & file, bool readahead = false);
 AVIOContext * io_context_new2 (VFSFile & file);
 void io_context_free (AVIOContext * context);
 
+/* ffaudio-probecache.cc: */
+#define PROBE_UNKNOWN (-2)  // STREAM INDEX NOT LOOKED UP YET.
+void probe_cache_load ();
+void probe_cache_save ();
+void probe_cache_clear ();
+String probe_cache_get_format (const char * name);
+void probe_cache_set_format (const char * name, const char * format);
+bool probe_cache_get_streams (const char * name, int & audio_idx, int & video_idx);
+void probe_cache_count_streams (const char * name, bool hit);
+void probe_cache_set_streams (const char * name, int audio_idx, int video_idx);
+
 #endif
@@ -21,18 +21,28 @@
  */
 
 #include <glib.h>
+#include <pthread.h>
 #include <string.h>
 
 #include <libfauxdcore/audstrings.h>
+#include <libfauxdcore/drct.h>
+#include <libfauxdcore/hook.h>
 #include <libfauxdcore/i18n.h>
+#include <libfauxdcore/interface.h>
+#include <libfauxdcore/playlist.h>
 #include <libfauxdcore/plugin.h>
 #include <libfauxdcore/preferences.h>
+#include <libfauxdcore/ringbuf.h>
 #include <libfauxdcore/runtime.h>
 
 #ifdef FILEWRITER_MP3
 #include <lame/lame.h>
 #endif
 
+#ifdef FILEWRITER_FLAC
+#include <FLAC/format.h>
+#endif
+
 #include "filewriter.h"
 #include "convert.h"
 
@@ -63,12 +73,11 @@ public:
     bool open_audio (int fmt, int rate, int nch, String & error);
     void close_audio ();
 
-    void period_wait () {}
+    void period_wait ();
     int write_audio (const void * ptr, int length);
-    void drain () {}
+    void drain ();
 
-    int get_delay ()
-        { return 0; }
+    int get_delay ();
 
     void pause (bool pause) {}
     void flush () {}
@@ -135,6 +144,34 @@ static const char *fileext_str[FILEEXT_MAX] =
 static FileWriterImpl *plugin;
 static VFSFile output_file;
 
+/* Audio is handed from the playback thread to an encoder thread through a
+ * bounded queue, so that neither the encoder nor slow disk writes hold up
+ * the player.  The encoder thread runs from open_audio () to close_audio (). */
+#define QUEUE_SECS 4
+
+static pthread_mutex_t queue_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queue_cond = PTHREAD_COND_INITIALIZER;
+static RingBuf<char> queue;
+static pthread_t encoder_thread;
+static bool encoder_running, encoder_quit, encoder_busy;
+static int queue_frame_size, queue_bytes_per_sec;
+static int queue_stalls;
+
+static void encoder_start (int fmt, int rate, int nch);
+static void encoder_stop ();
+
+/* "Render Playlist to Files" plays the active playlist once from the top,
+ * through the effect chain, as fast as decoding and encoding allow (nothing
+ * here paces the output).  Repeat, shuffle and stop-after-song are switched
+ * off for the run and restored when playback stops. */
+static bool render_active;
+static bool render_repeat, render_shuffle, render_stop_after;
+static int render_tracks;
+static int64_t render_start_time, render_track_bytes, render_audio_ms;
+
+static void render_playlist ();
+static void render_finish ();
+
 FileWriterImpl *plugins[FILEEXT_MAX] = {
     &wav_plugin,
 #ifdef FILEWRITER_MP3
@@ -194,6 +231,9 @@ bool FileWriter::init ()
             p->init ();
     }
 
+    aud_plugin_menu_add (AudMenuID::Main, render_playlist, _("Render Playlist to Files"), "document-save");
+    aud_plugin_menu_add (AudMenuID::Playlist, render_playlist, _("Render Playlist to Files"), "document-save");
+
 #ifdef FILEWRITER_MP3
     mp3_enforce_iso = aud_get_int ("filewriter_mp3", "enforce_iso_val");
     mp3_error_protect = aud_get_int ("filewriter_mp3", "error_protect_val");
@@ -216,6 +256,12 @@ bool FileWriter::init ()
 void FileWriter::cleanup ()
 {
     AUDDBG ("--FILEWRITER CLEANUP\n");
+    encoder_stop ();
+
+    aud_plugin_menu_remove (AudMenuID::Main, render_playlist);
+    aud_plugin_menu_remove (AudMenuID::Playlist, render_playlist);
+    render_finish ();
+
     if (output_file && plugin && filename_mode == FILENAME_STDOUT 
             && (aud_get_stdout_fmt () || aud_get_bool ("filewriter", "stdout_recclose")))  // CLOSE UP ANY DANGLING OPEN OUTPUT STREAM (INCLUDING stdout!):
     {
@@ -385,6 +431,7 @@ bool FileWriter::open_audio (int fmt, int rate, int nch, String & error)
     {   /* JWT: IF WRITING TO STDOUT, ONLY OPEN EVERYTHING UP THE *FIRST* TIME!
            JUST SET THE CONVERSION TYPE (IT MAY'VE CHANGED) AND RETURN */
         convert_init (fmt, plugin->format_required (fmt));
+        encoder_start (fmt, rate, nch);
         return true;
     }
     int ext = aud_get_int ("filewriter", "fileext");
@@ -416,7 +463,10 @@ bool FileWriter::open_audio (int fmt, int rate, int nch, String & error)
     if (output_file)
     {
         if (plugin->open (output_file, {out_fmt, rate, nch}, in_tuple))
+        {
+            encoder_start (fmt, rate, nch);
             return true;
+        }
         else
             aud_set_str ("filewriter", "_record_fid", "");
     }
@@ -433,17 +483,144 @@ bool FileWriter::open_audio (int fmt, int rate, int nch, String & error)
     return false;
 }
 
+static void * encoder_loop (void *)
+{
+    pthread_mutex_lock (& queue_mutex);
+
+    while (1)
+    {
+        /* whole frames only, in case the ring buffer wraps mid-frame */
+        int len = queue.linear () / queue_frame_size * queue_frame_size;
+
+        if (! len)
+        {
+            if (encoder_quit)
+                break;
+
+            pthread_cond_wait (& queue_cond, & queue_mutex);
+            continue;
+        }
+
+        /* the playback thread only ever adds to the queue, so this part of it
+         * stays put while we encode it without holding the lock */
+        const char * data = & queue[0];
+        encoder_busy = true;
+        pthread_mutex_unlock (& queue_mutex);
+
+        auto & buf = convert_process (data, len);
+        plugin->write (output_file, buf.begin (), buf.len ());
+
+        pthread_mutex_lock (& queue_mutex);
+        queue.discard (len);
+        encoder_busy = false;
+        pthread_cond_broadcast (& queue_cond);
+    }
+
+    pthread_mutex_unlock (& queue_mutex);
+    return nullptr;
+}
+
+static void encoder_start (int fmt, int rate, int nch)
+{
+    queue_frame_size = FMT_SIZEOF (fmt) * nch;
+    queue_bytes_per_sec = queue_frame_size * rate;
+    queue_stalls = 0;
+
+    queue.alloc (queue_bytes_per_sec * QUEUE_SECS);
+
+    encoder_quit = false;
+    encoder_running = ! pthread_create (& encoder_thread, nullptr, encoder_loop, nullptr);
+
+    if (! encoder_running)
+        AUDERR ("Failed to start encoder thread, encoding on the playback thread.\n");
+}
+
+/* encodes whatever is still queued, then stops the encoder thread */
+static void encoder_stop ()
+{
+    if (! encoder_running)
+        return;
+
+    pthread_mutex_lock (& queue_mutex);
+    encoder_quit = true;
+    pthread_cond_broadcast (& queue_cond);
+    pthread_mutex_unlock (& queue_mutex);
+
+    pthread_join (encoder_thread, nullptr);
+    encoder_running = false;
+
+    AUDDBG ("Encoder queue was full %d times.\n", queue_stalls);
+    queue.destroy ();
+}
+
 int FileWriter::write_audio (const void * ptr, int length)
 {
-    auto & buf = convert_process (ptr, length);
-    plugin->write (output_file, buf.begin (), buf.len ());
+    if (! encoder_running)
+    {
+        auto & buf = convert_process (ptr, length);
+        plugin->write (output_file, buf.begin (), buf.len ());
+        render_track_bytes += length;
+        return length;
+    }
+
+    pthread_mutex_lock (& queue_mutex);
+
+    length = aud::min (length, queue.space ()) / queue_frame_size * queue_frame_size;
+    queue.copy_in ((const char *) ptr, length);
+
+    if (! length)
+        queue_stalls ++;
+
+    render_track_bytes += length;
+
+    pthread_cond_broadcast (& queue_cond);
+    pthread_mutex_unlock (& queue_mutex);
 
     return length;
 }
 
+void FileWriter::period_wait ()
+{
+    pthread_mutex_lock (& queue_mutex);
+
+    while (encoder_running && queue.space () < queue_frame_size)
+        pthread_cond_wait (& queue_cond, & queue_mutex);
+
+    pthread_mutex_unlock (& queue_mutex);
+}
+
+void FileWriter::drain ()
+{
+    pthread_mutex_lock (& queue_mutex);
+
+    while (encoder_running && (queue.len () || encoder_busy))
+        pthread_cond_wait (& queue_cond, & queue_mutex);
+
+    pthread_mutex_unlock (& queue_mutex);
+}
+
+int FileWriter::get_delay ()
+{
+    pthread_mutex_lock (& queue_mutex);
+    int delay = encoder_running ? aud::rescale (queue.len (), queue_bytes_per_sec, 1000) : 0;
+    pthread_mutex_unlock (& queue_mutex);
+
+    return delay;
+}
+
 void FileWriter::close_audio ()
 {
     AUDDBG ("--FILEWRITER:CLOSE AUDIO\n");
+    encoder_stop ();
+
+    if (render_active && queue_bytes_per_sec)
+    {
+        render_tracks ++;
+        render_audio_ms += aud::rescale<int64_t> (render_track_bytes, queue_bytes_per_sec, 1000);
+    }
+
+    render_track_bytes = 0;
+
     if (output_file && plugin)
     {
         if (filename_mode == FILENAME_STDOUT && 
@@ -468,6 +645,75 @@ void FileWriter::close_audio ()
     }
 }
 
+static void render_stopped (void *, void *)
+{
+    render_finish ();
+}
+
+static void render_playlist ()
+{
+    if (render_active)
+        return;
+
+    if (filename_mode == FILENAME_STDOUT)
+    {
+        aud_ui_show_error (_("Cannot render a playlist to separate files while writing to stdout."));
+        return;
+    }
+
+    int playlist = aud_playlist_get_active ();
+    if (! aud_playlist_entry_count (playlist))
+        return;
+
+    /* stop first, so that our hook doesn't see the current song being stopped */
+    if (aud_drct_get_playing ())
+        aud_drct_stop ();
+
+    render_repeat = aud_get_bool (nullptr, "repeat");
+    render_shuffle = aud_get_bool (nullptr, "shuffle");
+    render_stop_after = aud_get_bool (nullptr, "stop_after_current_song");
+
+    aud_set_bool (nullptr, "repeat", false);
+    aud_set_bool (nullptr, "shuffle", false);
+    aud_set_bool (nullptr, "stop_after_current_song", false);
+
+    render_active = true;
+    render_tracks = 0;
+    render_track_bytes = 0;
+    render_audio_ms = 0;
+    render_start_time = g_get_monotonic_time ();
+
+    hook_associate ("playback stop", render_stopped, nullptr);
+
+    AUDINFO ("Rendering %d entries of playlist %d to files.\n",
+     aud_playlist_entry_count (playlist), playlist + 1);
+
+    aud_playlist_set_position (playlist, 0);
+    aud_playlist_play (playlist);
+}
+
+/* called at the end of the playlist, or if the user stops playback */
+static void render_finish ()
+{
+    if (! render_active)
+        return;
+
+    hook_dissociate ("playback stop", render_stopped);
+
+    aud_set_bool (nullptr, "repeat", render_repeat);
+    aud_set_bool (nullptr, "shuffle", render_shuffle);
+    aud_set_bool (nullptr, "stop_after_current_song", render_stop_after);
+
+    int64_t elapsed_ms = (g_get_monotonic_time () - render_start_time) / 1000;
+
+    AUDINFO ("Rendered %d files, %d:%02d of audio in %d:%02d (%.1fx real time).\n",
+     render_tracks, (int) (render_audio_ms / 60000), (int) (render_audio_ms / 1000 % 60),
+     (int) (elapsed_ms / 60000), (int) (elapsed_ms / 1000 % 60),
+     (double) render_audio_ms / aud::max (elapsed_ms, (int64_t) 1));
+
+    render_active = false;
+}
+
 static void save_original_cb ()
 {
     aud_set_bool ("filewriter", "save_original", save_original);
@@ -707,6 +953,44 @@ static const PreferencesWidget vorbis_widgets[] = {
 };
 #endif
 
+#ifdef FILEWRITER_FLAC
+static const ComboItem flac_blocksizes[] = {
+    ComboItem(N_("Auto"), 0),
+    ComboItem("1152", 1152),
+    ComboItem("2304", 2304),
+    ComboItem("4096", 4096),
+    ComboItem("4608", 4608),
+    ComboItem("8192", 8192),
+    ComboItem("16384", 16384)
+};
+
+static const ComboItem flac_bitdepths[] = {
+    ComboItem(N_("Same as source"), 0),
+    ComboItem(N_("16 bit"), 16),
+    ComboItem(N_("24 bit"), 24)
+#if FLAC__REFERENCE_CODEC_MAX_BITS_PER_SAMPLE >= 32
+    ,ComboItem(N_("32 bit"), 32)
+#endif
+};
+
+static const PreferencesWidget flac_widgets[] = {
+    WidgetSpin(N_("Compression level:"),
+        WidgetInt("filewriter_flac", "compression_level"),
+        {0, 8, 1}),
+    WidgetCombo(N_("Block size:"),
+        WidgetInt("filewriter_flac", "blocksize"),
+        {{flac_blocksizes}}),
+    WidgetCombo(N_("Bit depth:"),
+        WidgetInt("filewriter_flac", "bitdepth"),
+        {{flac_bitdepths}})
+#ifdef HAVE_FLAC__STREAM_ENCODER_SET_NUM_THREADS
+    ,WidgetSpin(N_("Encoder threads:"),
+        WidgetInt("filewriter_flac", "threads"),
+        {0, 64, 1, N_("(0 = one per CPU)")})
+#endif
+};
+#endif
+
 static const NotebookTab tabs[] = {
     {N_("General"), {main_widgets}}
 #ifdef FILEWRITER_MP3
@@ -715,6 +999,9 @@ static const NotebookTab tabs[] = {
 #ifdef FILEWRITER_VORBIS
     ,{"Vorbis", {vorbis_widgets}}
 #endif
+#ifdef FILEWRITER_FLAC
+    ,{"FLAC", {flac_widgets}}
+#endif
 };
 
 const PreferencesWidget FileWriter::widgets[] = {
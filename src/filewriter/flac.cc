@@ -23,14 +23,40 @@
 
 #ifdef FILEWRITER_FLAC
 
+#include <unistd.h>
 #include <FLAC/all.h>
 
 #include <libfauxdcore/audstrings.h>
+#include <libfauxdcore/index.h>
+#include <libfauxdcore/runtime.h>
 
-static int channels;
+/* libFLAC 1.4.0 and later can encode 32-bit samples */
+#if FLAC__REFERENCE_CODEC_MAX_BITS_PER_SAMPLE >= 32
+#define FLAC_HAVE_32BIT 1
+#endif
+
+/* libFLAC's own limit on encoder threads */
+#define FLAC_MAX_THREADS 64
+
+static const char * const flac_defaults[] = {
+ "compression_level", "5",
+ "blocksize", "0",
+ "bitdepth", "0",
+ "threads", "1",
+ nullptr};
+
+static int channels, bits_per_sample;
 static FLAC__StreamEncoder *flac_encoder;
 static FLAC__StreamMetadata *flac_metadata;
 
+/* reused for widening 16-bit input (24- and 32-bit input is passed as is) */
+static Index<FLAC__int32> flac_buffer;
+
+static void flac_init ()
+{
+    aud_config_set_defaults ("filewriter_flac", flac_defaults);
+}
+
 static FLAC__StreamEncoderWriteStatus flac_write_cb(const FLAC__StreamEncoder *encoder,
     const FLAC__byte buffer[], size_t bytes, unsigned samples, unsigned current_frame, void * data)
 {
@@ -98,13 +124,65 @@ static void insert_vorbis_comment (FLAC__StreamMetadata * meta,
      meta->data.vorbis_comment.num_comments, comment, true);
 }
 
+static void flac_cleanup ()
+{
+    if (flac_encoder)
+    {
+        FLAC__stream_encoder_delete(flac_encoder);
+        flac_encoder = nullptr;
+    }
+
+    if (flac_metadata)
+    {
+        FLAC__metadata_object_delete(flac_metadata);
+        flac_metadata = nullptr;
+    }
+
+    flac_buffer.clear ();
+}
+
 static bool flac_open (VFSFile & file, const format_info & info, const Tuple & tuple)
 {
+    if (info.channels > (int) FLAC__MAX_CHANNELS)
+    {
+        AUDERR ("FLAC supports at most %d channels.\n", (int) FLAC__MAX_CHANNELS);
+        return false;
+    }
+
+    channels = info.channels;
+    bits_per_sample = (info.format == FMT_S16_NE) ? 16 : (info.format == FMT_S24_NE) ? 24 : 32;
+
     flac_encoder = FLAC__stream_encoder_new();
 
-    FLAC__stream_encoder_set_channels(flac_encoder, info.channels);
+    FLAC__stream_encoder_set_channels(flac_encoder, channels);
+    FLAC__stream_encoder_set_bits_per_sample(flac_encoder, bits_per_sample);
     FLAC__stream_encoder_set_sample_rate(flac_encoder, info.frequency);
 
+    /* the block size has to be set after the compression level, which
+     * otherwise overrides it */
+    FLAC__stream_encoder_set_compression_level(flac_encoder,
+     aud::clamp (aud_get_int ("filewriter_flac", "compression_level"), 0, 8));
+
+    int blocksize = aud_get_int ("filewriter_flac", "blocksize");
+    if (blocksize > 0)
+        FLAC__stream_encoder_set_blocksize(flac_encoder, blocksize);
+
+    /* the streamable subset allows blocks of at most 4608 samples up to
+     * 48 kHz and at most 24 bits per sample; libFLAC refuses to initialize
+     * with larger settings unless it is told to leave the subset */
+    if (blocksize > ((info.frequency <= 48000) ? 4608 : 16384) || bits_per_sample > 24)
+        FLAC__stream_encoder_set_streamable_subset(flac_encoder, false);
+
+#ifdef HAVE_FLAC__STREAM_ENCODER_SET_NUM_THREADS
+    int threads = aud_get_int ("filewriter_flac", "threads");
+    if (threads <= 0)
+        threads = sysconf (_SC_NPROCESSORS_ONLN);
+
+    threads = aud::clamp (threads, 1, FLAC_MAX_THREADS);
+    if (FLAC__stream_encoder_set_num_threads(flac_encoder, threads) != FLAC__STREAM_ENCODER_SET_NUM_THREADS_OK)
+        AUDINFO ("libFLAC was built without multithreading, encoding on a single thread.\n");
+#endif
+
     flac_metadata = FLAC__metadata_object_new(FLAC__METADATA_TYPE_VORBIS_COMMENT);
 
     insert_vorbis_comment (flac_metadata, "TITLE", tuple, Tuple::Title);
@@ -119,84 +197,89 @@ static bool flac_open (VFSFile & file, const format_info & info, const Tuple & t
 
     FLAC__stream_encoder_set_metadata(flac_encoder, &flac_metadata, 1);
 
-    FLAC__stream_encoder_init_stream(flac_encoder, flac_write_cb, flac_seek_cb,
-     flac_tell_cb, nullptr, &file);
+    FLAC__StreamEncoderInitStatus status = FLAC__stream_encoder_init_stream(flac_encoder,
+     flac_write_cb, flac_seek_cb, flac_tell_cb, nullptr, &file);
+
+    if (status != FLAC__STREAM_ENCODER_INIT_STATUS_OK)
+    {
+        AUDERR ("Failed to initialize FLAC encoder: %s\n",
+         FLAC__StreamEncoderInitStatusString[status]);
+        flac_cleanup ();
+        return false;
+    }
 
-    channels = info.channels;
     return true;
 }
 
 static void flac_write (VFSFile & file, const void * data, int length)
 {
-#if 1
-    FLAC__int32 *encbuffer[2];
-    int16_t *tmpdata = (int16_t *) data;
-    int i;
+    if (bits_per_sample == 16)
+    {
+        int samples = length / sizeof (int16_t);
+        const int16_t * from = (const int16_t *) data;
 
-    encbuffer[0] = new FLAC__int32[length / channels];
-    encbuffer[1] = new FLAC__int32[length / channels];
+        if (flac_buffer.len () < samples)
+            flac_buffer.resize (samples);
 
-    if (channels == 1)
-    {
-        for (i = 0; i < (length / 2); i++)
-        {
-            encbuffer[0][i] = tmpdata[i];
-            encbuffer[1][i] = tmpdata[i];
-        }
+        for (int i = 0; i < samples; i ++)
+            flac_buffer[i] = from[i];
+
+        FLAC__stream_encoder_process_interleaved(flac_encoder, flac_buffer.begin (), samples / channels);
     }
     else
     {
-        for (i = 0; i < (length / 4); i++)
-        {
-            encbuffer[0][i] = tmpdata[2 * i];
-            encbuffer[1][i] = tmpdata[2 * i + 1];
-        }
+        /* FMT_S24_NE and FMT_S32_NE are already 32-bit integers */
+        int samples = length / sizeof (FLAC__int32);
+        FLAC__stream_encoder_process_interleaved(flac_encoder, (const FLAC__int32 *) data, samples / channels);
     }
-
-    FLAC__stream_encoder_process(flac_encoder, (const FLAC__int32 **)encbuffer, length / (channels * 2));
-
-    delete[] encbuffer[0];
-    delete[] encbuffer[1];
-#else
-    FLAC__int32 *encbuffer;
-    int16_t *tmpdata = (int16_t *) data;
-    int i;
-
-    encbuffer = new FLAC__int32[length];
-
-    for (i=0; i < length; i++) {
-        encbuffer[i] = tmpdata[i];
-    }
-
-    FLAC__stream_encoder_process_interleaved(flac_encoder, encbuffer, length);
-
-    delete[] encbuffer;
-#endif
 }
 
 static void flac_close (VFSFile & file)
 {
     if (flac_encoder)
-    {
         FLAC__stream_encoder_finish(flac_encoder);
-        FLAC__stream_encoder_delete(flac_encoder);
-        flac_encoder = nullptr;
-    }
 
-    if (flac_metadata)
-    {
-        FLAC__metadata_object_delete(flac_metadata);
-        flac_metadata = nullptr;
-    }
+    flac_cleanup ();
 }
 
+/* picks 16, 24 or 32 bits, either as configured or to match the source */
 static int flac_format_required (int fmt)
 {
-    return FMT_S16_NE;
+    int depth = aud_get_int ("filewriter_flac", "bitdepth");
+
+    if (! depth)
+    {
+        switch (fmt)
+        {
+        case FMT_S8:
+        case FMT_U8:
+        case FMT_S16_LE:
+        case FMT_S16_BE:
+        case FMT_U16_LE:
+        case FMT_U16_BE:
+            depth = 16;
+            break;
+        case FMT_S32_LE:
+        case FMT_S32_BE:
+        case FMT_U32_LE:
+        case FMT_U32_BE:
+            depth = 32;
+            break;
+        default:  /* 24-bit and floating point */
+            depth = 24;
+            break;
+        }
+    }
+
+#ifndef FLAC_HAVE_32BIT
+    depth = aud::min (depth, 24);
+#endif
+
+    return (depth <= 16) ? FMT_S16_NE : (depth <= 24) ? FMT_S24_NE : FMT_S32_NE;
 }
 
 FileWriterImpl flac_plugin = {
-    nullptr,  // init
+    flac_init,
     flac_open,
     flac_write,
     flac_close,
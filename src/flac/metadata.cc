@@ -19,6 +19,7 @@
  *
  */
 
+#include <math.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -28,6 +29,7 @@
 #include <libfauxdcore/audstrings.h>
 
 #include "flacng.h"
+#include "../vorbis/replaygain.h"
 
 static size_t read_cb(void *ptr, size_t size, size_t nmemb, FLAC__IOHandle handle)
 {
@@ -138,6 +140,42 @@ static void insert_int_tuple_to_vc (FLAC__StreamMetadata * vc_block,
         vc_block->data.vorbis_comment.num_comments, entry, true);
 }
 
+/* ReplayGain values are only replaced when the tuple has different ones (e.g.
+ * after a loudness scan), never removed. */
+static void insert_gain_tuple_to_vc (FLAC__StreamMetadata * vc_block,
+ const Tuple & tuple, Tuple::Field field, Tuple::Field unit_field,
+ const char * field_name)
+{
+    FLAC__StreamMetadata_VorbisComment_Entry entry;
+    int unit = tuple.get_int (unit_field);
+    bool is_gain = (unit_field == Tuple::GainDivisor);
+
+    if (! tuple.is_set (field) || unit <= 0)
+        return;
+
+    int i = FLAC__metadata_object_vorbiscomment_find_entry_from (vc_block, 0, field_name);
+    if (i >= 0)
+    {
+        const FLAC__StreamMetadata_VorbisComment_Entry & cur =
+         vc_block->data.vorbis_comment.comments[i];
+        const char * eq = (const char *) memchr (cur.entry, '=', cur.length);
+
+        if (eq && gain_str_matches (str_copy (eq + 1, (const char *) cur.entry +
+         cur.length - (eq + 1)), tuple.get_int (field), unit, is_gain))
+            return;
+    }
+
+    FLAC__metadata_object_vorbiscomment_remove_entries_matching (vc_block,
+        field_name);
+
+    StringBuf str = str_printf ("%s=%s", field_name, (const char *) gain_to_str
+     (tuple.get_int (field), unit, is_gain));
+    entry.entry = (FLAC__byte *) (char *) str;
+    entry.length = strlen(str);
+    FLAC__metadata_object_vorbiscomment_insert_comment(vc_block,
+        vc_block->data.vorbis_comment.num_comments, entry, true);
+}
+
 bool FLACng::write_tuple(const char *filename, VFSFile &file, const Tuple &tuple)
 {
     AUDDBG ("Update song tuple.\n");
@@ -197,6 +235,11 @@ bool FLACng::write_tuple(const char *filename, VFSFile &file, const Tuple &tuple
     insert_str_tuple_to_vc(vc_block, tuple, Tuple::CatalogNum, "CATALOGNUMBER");
     insert_str_tuple_to_vc(vc_block, tuple, Tuple::Performer, "PERFORMER");
 
+    insert_gain_tuple_to_vc(vc_block, tuple, Tuple::TrackGain, Tuple::GainDivisor, "REPLAYGAIN_TRACK_GAIN");
+    insert_gain_tuple_to_vc(vc_block, tuple, Tuple::TrackPeak, Tuple::PeakDivisor, "REPLAYGAIN_TRACK_PEAK");
+    insert_gain_tuple_to_vc(vc_block, tuple, Tuple::AlbumGain, Tuple::GainDivisor, "REPLAYGAIN_ALBUM_GAIN");
+    insert_gain_tuple_to_vc(vc_block, tuple, Tuple::AlbumPeak, Tuple::PeakDivisor, "REPLAYGAIN_ALBUM_PEAK");
+
     FLAC__metadata_iterator_delete(iter);
     FLAC__metadata_chain_sort_padding(chain);
 
@@ -24,24 +24,48 @@
 #include <libfauxdcore/interface.h>
 #include <libfauxdcore/plugin.h>
 #include <libfauxdcore/preferences.h>
-#include <libfauxdcore/ringbuf.h>
 #include <libfauxdcore/runtime.h>
 
 #include <algorithm>
 #include <iterator>
 
 #include <assert.h>
-#include <pthread.h>
-#include <sys/time.h>
+#include <semaphore.h>
+#include <string.h>
 
 /* jack/types.h uses "register" as a parameter name :( */
 #define register register_
 #include <jack/jack.h>
 #undef register
 
+#ifdef JACK_SAMPLERATE
+#include <samplerate.h>
+#endif
+
 static_assert(std::is_same<jack_default_audio_sample_t, float>::value,
  "JACK must be compiled to use float samples");
 
+/*
+ * Nothing in the JACK process callback (generate) may block, so audio is
+ * handed over through a single-producer, single-consumer ring: write_audio()
+ * only advances m_head and generate() only advances m_tail.  When the player
+ * thread has to wait for room, it sets m_waiting and sleeps on s_wait_sem,
+ * which generate() posts at the end of the next cycle.  A flush is passed to
+ * generate() as a position to skip to (m_flush_to) and a serial number.
+ *
+ * If the JACK server runs at a different rate, generate() resamples with
+ * libsamplerate (if available).  The same resampler can also correct clock
+ * drift for live sources: when the ring runs low, the ratio is raised
+ * slightly so that it is drained more slowly.  A full ring is left alone,
+ * since that just means the player is ahead of us.
+ */
+
+/* frames resampled per pass in generate() */
+#define RESAMPLE_FRAMES 1024
+
+/* largest speed correction for clock drift */
+#define MAX_DRIFT 0.005
+
 class JACKOutput : public OutputPlugin
 {
 public:
@@ -57,11 +81,13 @@ public:
         & prefs
     };
 
-    constexpr JACKOutput (RingBuf<float> & buffer) :
+    constexpr JACKOutput (Index<float> & ring, Index<float> & resampled) :
         OutputPlugin (info, 0),
-        m_buffer (buffer) {}
+        m_ring (ring),
+        m_resampled (resampled) {}
 
     bool init ();
+    void cleanup ();
 
     StereoVolume get_volume ();
     void set_volume (StereoVolume v);
@@ -82,37 +108,59 @@ private:
     bool connect_ports (int channels, String & error);
     void generate (jack_nframes_t frames);
 
+    int ring_used () const;
+    void wait_cycle (bool (JACKOutput::* done) () const);
+    bool ring_has_space () const
+        { return ring_used () < (int) m_ring_frames; }
+    bool ring_played () const
+        { return ! ring_used () && ! __atomic_load_n (& m_last_write_frames, __ATOMIC_SEQ_CST); }
+
+    int copy_out (float * * out, int frames, StereoVolume volume);
+    int resample_out (float * * out, int frames, StereoVolume volume);
+
     static void error_cb (const char * error)
         { AUDWARN ("%s\n", error); }
     static int generate_cb (jack_nframes_t frames, void * obj)
         { ((JACKOutput *) obj)->generate (frames); return 0; }
 
-    int m_rate = 0, m_channels = 0;
+    int m_rate = 0, m_channels = 0, m_jack_rate = 0;
     bool m_paused = false, m_prebuffer = false;
+    int m_volume_left = 0, m_volume_right = 0;
 
+    /* frames of our audio written in the last JACK cycle */
     int m_last_write_frames = 0;
-    timeval m_last_write_time = timeval ();
-    bool m_rate_mismatch = false;
 
-    RingBuf<float> & m_buffer;
+    Index<float> & m_ring;
+    unsigned m_ring_frames = 0; /* power of 2 */
+    unsigned m_head = 0, m_tail = 0; /* frames written and played, wrapping */
+    bool m_waiting = false;
+
+    unsigned m_flush_serial = 0, m_flush_seen = 0;
+    unsigned m_flush_to = 0;
+
+    bool m_resampling = false, m_drift_correction = false;
+    double m_drift = 1.0;
+    Index<float> & m_resampled;
+#ifdef JACK_SAMPLERATE
+    SRC_STATE * m_src = nullptr;
+#endif
 
     jack_client_t * m_client = nullptr;
     jack_port_t * m_ports[AUD_MAX_CHANNELS] = {};
-
-    pthread_mutex_t m_mutex = PTHREAD_MUTEX_INITIALIZER;
-    pthread_cond_t m_cond = PTHREAD_COND_INITIALIZER;
 };
 
 // must be separate in order for JACKOutput() to be constexpr
-static RingBuf<float> s_buffer;
+static Index<float> s_ring, s_resampled;
+static sem_t s_wait_sem;
 
-EXPORT JACKOutput aud_plugin_instance (s_buffer);
+EXPORT JACKOutput aud_plugin_instance (s_ring, s_resampled);
 
 const char JACKOutput::client_name_default[] = "fauxdacious";
 
 const char * const JACKOutput::defaults[] = {
     "auto_connect", "TRUE",
     "client_name", JACKOutput::client_name_default,
+    "drift_correction", "FALSE",
     "volume_left", "100",
     "volume_right", "100",
     nullptr
@@ -123,6 +171,10 @@ const PreferencesWidget JACKOutput::widgets[] = {
         WidgetString ("jack", "client_name")),
     WidgetCheck (N_("Automatically connect to output ports"),
         WidgetBool ("jack", "auto_connect"))
+#ifdef JACK_SAMPLERATE
+    ,WidgetCheck (N_("Correct clock drift (for live streams)"),
+        WidgetBool ("jack", "drift_correction"))
+#endif
 };
 
 const PluginPreferences JACKOutput::prefs = {{widgets}};
@@ -130,13 +182,23 @@ const PluginPreferences JACKOutput::prefs = {{widgets}};
 bool JACKOutput::init ()
 {
     aud_config_set_defaults ("jack", defaults);
+    sem_init (& s_wait_sem, 0, 0);
     return true;
 }
 
+void JACKOutput::cleanup ()
+{
+    sem_destroy (& s_wait_sem);
+}
+
+/* the process callback can't read the config, so keep a copy */
 void JACKOutput::set_volume (StereoVolume v)
 {
     aud_set_int ("jack", "volume_left", v.left);
     aud_set_int ("jack", "volume_right", v.right);
+
+    __atomic_store_n (& m_volume_left, v.left, __ATOMIC_RELAXED);
+    __atomic_store_n (& m_volume_right, v.right, __ATOMIC_RELAXED);
 }
 
 StereoVolume JACKOutput::get_volume ()
@@ -218,6 +280,37 @@ bool JACKOutput::open_audio (int format, int rate, int channels, String & error)
         goto fail;
     }
 
+    m_jack_rate = jack_get_sample_rate (m_client);
+
+#ifdef JACK_SAMPLERATE
+    m_drift_correction = aud_get_bool ("jack", "drift_correction");
+    m_resampling = (m_jack_rate != rate || m_drift_correction);
+
+    if (m_resampling)
+    {
+        int src_error;
+        if (! (m_src = src_new (SRC_SINC_FASTEST, channels, & src_error)))
+        {
+            AUDERR ("src_new() failed: %s\n", src_strerror (src_error));
+            goto fail;
+        }
+
+        m_resampled.insert (0, RESAMPLE_FRAMES * channels);
+
+        if (m_jack_rate != rate)
+            AUDINFO ("Resampling from %d Hz to %d Hz.\n", rate, m_jack_rate);
+    }
+#else
+    if (m_jack_rate != rate)
+    {
+        error = String (str_printf (_("The JACK server requires a "
+         "sample rate of %d Hz, but Fauxdacious is playing at %d Hz.  Please "
+         "use the Sample Rate Converter effect to correct the mismatch."),
+         m_jack_rate, rate));
+        goto fail;
+    }
+#endif
+
     for (int i = 0; i < channels; i ++)
     {
         StringBuf name = str_printf ("out_%d", i);
@@ -230,16 +323,24 @@ bool JACKOutput::open_audio (int format, int rate, int channels, String & error)
     }
 
     buffer_time = aud_get_int (nullptr, "output_buffer_size");
-    m_buffer.alloc (aud::rescale (buffer_time, 1000, rate) * channels);
+
+    for (m_ring_frames = 1; m_ring_frames < (unsigned) aud::rescale (buffer_time, 1000, rate); )
+        m_ring_frames <<= 1;
+
+    m_ring.insert (0, m_ring_frames * channels);
+    m_head = m_tail = 0;
+    m_waiting = false;
+    m_flush_serial = m_flush_seen = m_flush_to = 0;
+    m_drift = 1.0;
 
     m_rate = rate;
     m_channels = channels;
     m_paused = false;
     m_prebuffer = true;
-
     m_last_write_frames = 0;
-    m_last_write_time = timeval ();
-    m_rate_mismatch = false;
+
+    m_volume_left = aud_get_int ("jack", "volume_left");
+    m_volume_right = aud_get_int ("jack", "volume_right");
 
     jack_set_process_callback (m_client, generate_cb, this);
 
@@ -264,159 +365,257 @@ fail:
 
 void JACKOutput::close_audio ()
 {
+    /* stops the process callback */
     if (m_client)
         jack_client_close (m_client);
 
-    m_buffer.destroy ();
+    m_ring.clear ();
+    m_resampled.clear ();
+
+#ifdef JACK_SAMPLERATE
+    if (m_src)
+    {
+        src_delete (m_src);
+        m_src = nullptr;
+    }
+#endif
 
     std::fill (m_ports, std::end (m_ports), nullptr);
     m_client = nullptr;
 }
 
-void JACKOutput::generate (jack_nframes_t frames)
+int JACKOutput::ring_used () const
 {
-    pthread_mutex_lock (& m_mutex);
+    return __atomic_load_n (& m_head, __ATOMIC_SEQ_CST) - __atomic_load_n (& m_tail, __ATOMIC_SEQ_CST);
+}
 
-    m_last_write_frames = 0;
-    gettimeofday (& m_last_write_time, nullptr);
+/* plays straight from the ring; returns the number of frames written */
+int JACKOutput::copy_out (float * * out, int frames, StereoVolume volume)
+{
+    unsigned tail = m_tail;
+    int count = aud::min (frames, (int) (__atomic_load_n (& m_head, __ATOMIC_SEQ_CST) - tail));
+    int done = 0;
 
-    float * out[AUD_MAX_CHANNELS];
-    for (int i = 0; i < m_channels; i ++)
-        out[i] = (float *) jack_port_get_buffer (m_ports[i], frames);
+    while (done < count)
+    {
+        int pos = (tail + done) & (m_ring_frames - 1);
+        int part = aud::min (count - done, (int) m_ring_frames - pos);
+        float * data = & m_ring[pos * m_channels];
 
-    int jack_rate = jack_get_sample_rate (m_client);
+        float * dest[AUD_MAX_CHANNELS];
+        for (int i = 0; i < m_channels; i ++)
+            dest[i] = out[i] + done;
 
-    if (jack_rate != m_rate)
-    {
-        if (! m_rate_mismatch)
-        {
-            aud_ui_show_error (str_printf (_("The JACK server requires a "
-             "sample rate of %d Hz, but Fauxdacious is playing at %d Hz.  Please "
-             "use the Sample Rate Converter effect to correct the mismatch."),
-             jack_rate, m_rate));
-            m_rate_mismatch = true;
-        }
+        audio_amplify (data, m_channels, part, volume);
+        audio_deinterlace (data, FMT_FLOAT, m_channels, (void * const *) dest, part);
 
-        goto silence;
+        done += part;
     }
 
-    m_rate_mismatch = false;
+    __atomic_store_n (& m_tail, tail + count, __ATOMIC_SEQ_CST);
+    return count;
+}
 
-    if (m_paused || m_prebuffer)
-        goto silence;
+/* plays from the ring through libsamplerate; returns the number of frames written */
+int JACKOutput::resample_out (float * * out, int frames, StereoVolume volume)
+{
+    int done = 0;
 
-    while (frames && m_buffer.len ())
+#ifdef JACK_SAMPLERATE
+    if (m_drift_correction && ! m_prebuffer)
     {
-        int linear_samples = m_buffer.linear ();
-        assert (linear_samples % m_channels == 0);
+        /* below half full, stretch by up to MAX_DRIFT, easing in over many cycles */
+        double fill = (double) ring_used () / m_ring_frames;
+        double target = 1.0 + MAX_DRIFT * aud::clamp (1.0 - 2.0 * fill, 0.0, 1.0);
+        m_drift += (target - m_drift) * 0.01;
+    }
+
+    double ratio = (double) m_jack_rate / m_rate * m_drift;
+
+    while (done < frames)
+    {
+        unsigned tail = m_tail;
+        int avail = __atomic_load_n (& m_head, __ATOMIC_SEQ_CST) - tail;
+        int pos = tail & (m_ring_frames - 1);
 
-        int frames_to_copy = aud::min (frames, (jack_nframes_t) linear_samples / m_channels);
+        SRC_DATA data = SRC_DATA ();
+        data.data_in = & m_ring[pos * m_channels];
+        data.input_frames = aud::min (avail, (int) m_ring_frames - pos);
+        data.data_out = m_resampled.begin ();
+        data.output_frames = aud::min (frames - done, RESAMPLE_FRAMES);
+        data.src_ratio = ratio;
 
-        audio_amplify (& m_buffer[0], m_channels, frames_to_copy, get_volume ());
-        audio_deinterlace (& m_buffer[0], FMT_FLOAT, m_channels,
-         (void * const *) out, frames_to_copy);
+        if (src_process (m_src, & data))
+            break;
 
-        m_last_write_frames += frames_to_copy;
-        m_buffer.discard (frames_to_copy * m_channels);
+        __atomic_store_n (& m_tail, tail + (unsigned) data.input_frames_used, __ATOMIC_SEQ_CST);
 
+        if (! data.output_frames_gen)
+        {
+            if (! data.input_frames_used)
+                break; /* need more input */
+
+            continue;
+        }
+
+        float * dest[AUD_MAX_CHANNELS];
         for (int i = 0; i < m_channels; i ++)
-            out[i] += frames_to_copy;
+            dest[i] = out[i] + done;
+
+        audio_amplify (m_resampled.begin (), m_channels, data.output_frames_gen, volume);
+        audio_deinterlace (m_resampled.begin (), FMT_FLOAT, m_channels,
+         (void * const *) dest, data.output_frames_gen);
+
+        done += data.output_frames_gen;
+    }
+#endif
+
+    return done;
+}
+
+/* runs in the JACK realtime thread: no locks, no allocation, no system calls
+ * (except for waking the player thread when it is waiting for us) */
+void JACKOutput::generate (jack_nframes_t frames)
+{
+    float * out[AUD_MAX_CHANNELS];
+    for (int i = 0; i < m_channels; i ++)
+        out[i] = (float *) jack_port_get_buffer (m_ports[i], frames);
+
+    unsigned serial = __atomic_load_n (& m_flush_serial, __ATOMIC_SEQ_CST);
+    if (serial != m_flush_seen)
+    {
+        /* never go backwards, in case we played past m_flush_to in the
+         * cycle in which the flush happened */
+        unsigned flush_to = __atomic_load_n (& m_flush_to, __ATOMIC_SEQ_CST);
+        if ((int) (flush_to - m_tail) > 0)
+            __atomic_store_n (& m_tail, flush_to, __ATOMIC_SEQ_CST);
+
+        m_flush_seen = serial;
+#ifdef JACK_SAMPLERATE
+        if (m_src)
+            src_reset (m_src);
+#endif
+    }
+
+    int written = 0;
+
+    if (! __atomic_load_n (& m_paused, __ATOMIC_SEQ_CST) &&
+     ! __atomic_load_n (& m_prebuffer, __ATOMIC_SEQ_CST))
+    {
+        StereoVolume volume = {__atomic_load_n (& m_volume_left, __ATOMIC_RELAXED),
+         __atomic_load_n (& m_volume_right, __ATOMIC_RELAXED)};
 
-        frames -= frames_to_copy;
+        if (m_resampling)
+            written = resample_out (out, frames, volume);
+        else
+            written = copy_out (out, frames, volume);
     }
 
-silence:
     for (int i = 0; i < m_channels; i ++)
-        std::fill (out[i], out[i] + frames, 0.0);
+        std::fill (out[i] + written, out[i] + frames, 0.0);
 
-    pthread_cond_broadcast (& m_cond);
-    pthread_mutex_unlock (& m_mutex);
+    __atomic_store_n (& m_last_write_frames, written, __ATOMIC_SEQ_CST);
+
+    if (__atomic_exchange_n (& m_waiting, false, __ATOMIC_SEQ_CST))
+        sem_post (& s_wait_sem);
 }
 
-void JACKOutput::period_wait ()
+/* sleeps through JACK cycles until (this->*done) () */
+void JACKOutput::wait_cycle (bool (JACKOutput::* done) () const)
 {
-    pthread_mutex_lock (& m_mutex);
-
-    while (! m_buffer.space ())
+    while (! (this->*done) ())
     {
-        m_prebuffer = false;
-        pthread_cond_wait (& m_cond, & m_mutex);
+        __atomic_store_n (& m_waiting, true, __ATOMIC_SEQ_CST);
+
+        /* check again, in case generate() missed the flag */
+        if (! (this->*done) ())
+            sem_wait (& s_wait_sem);
+
+        __atomic_store_n (& m_waiting, false, __ATOMIC_SEQ_CST);
     }
+}
 
-    pthread_mutex_unlock (& m_mutex);
+void JACKOutput::period_wait ()
+{
+    if (! ring_has_space ())
+    {
+        __atomic_store_n (& m_prebuffer, false, __ATOMIC_SEQ_CST);
+        wait_cycle (& JACKOutput::ring_has_space);
+    }
 }
 
 int JACKOutput::write_audio (const void * data, int size)
 {
-    pthread_mutex_lock (& m_mutex);
-
     int samples = size / sizeof (float);
     assert (samples % m_channels == 0);
 
-    samples = aud::min (samples, m_buffer.space ());
+    unsigned head = m_head;
+    int frames = aud::min (samples / m_channels, (int) m_ring_frames - ring_used ());
+    int pos = head & (m_ring_frames - 1);
+    int part = aud::min (frames, (int) m_ring_frames - pos);
+
+    memcpy (& m_ring[pos * m_channels], data, sizeof (float) * part * m_channels);
+    memcpy (& m_ring[0], (const float *) data + part * m_channels,
+     sizeof (float) * (frames - part) * m_channels);
 
-    m_buffer.copy_in ((const float *) data, samples);
+    __atomic_store_n (& m_head, head + frames, __ATOMIC_SEQ_CST);
 
-    if (m_buffer.len () >= m_buffer.size () / 4)
-        m_prebuffer = false;
+    if (ring_used () >= (int) m_ring_frames / 4)
+        __atomic_store_n (& m_prebuffer, false, __ATOMIC_SEQ_CST);
 
-    pthread_mutex_unlock (& m_mutex);
-    return samples * sizeof (float);
+    return frames * m_channels * sizeof (float);
 }
 
 void JACKOutput::drain ()
 {
-    pthread_mutex_lock (& m_mutex);
-
-    m_prebuffer = false;
+    /* push the last of the audio out of the resampler's filter */
+    if (m_resampling)
+    {
+        static const float silence[256] = {};
+        int remain = m_rate / 50 * m_channels;
 
-    while (m_buffer.len () || m_last_write_frames)
-        pthread_cond_wait (& m_cond, & m_mutex);
+        while (remain > 0)
+        {
+            int size = aud::min (remain, (int) aud::n_elems (silence)) / m_channels * m_channels;
+            remain -= write_audio (silence, sizeof (float) * aud::max (size, m_channels)) / sizeof (float);
+            period_wait ();
+        }
+    }
 
-    pthread_mutex_unlock (& m_mutex);
+    __atomic_store_n (& m_prebuffer, false, __ATOMIC_SEQ_CST);
+    wait_cycle (& JACKOutput::ring_played);
 }
 
 int JACKOutput::get_delay ()
 {
-    auto timediff = [] (const timeval & a, const timeval & b) -> int64_t
-        { return 1000 * (int64_t) (b.tv_sec - a.tv_sec) + (b.tv_usec - a.tv_usec) / 1000; };
-
-    pthread_mutex_lock (& m_mutex);
+    int delay = aud::rescale (ring_used (), m_rate, 1000);
+    int last_write = __atomic_load_n (& m_last_write_frames, __ATOMIC_SEQ_CST);
 
-    int delay = aud::rescale (m_buffer.len (), m_channels * m_rate, 1000);
-
-    if (m_last_write_frames)
+    /* part of the last cycle may still be playing */
+    if (last_write)
     {
-        timeval now;
-        gettimeofday (& now, nullptr);
-
-        int written = aud::rescale (m_last_write_frames, m_rate, 1000);
-        delay += aud::max (written - timediff (m_last_write_time, now), (int64_t) 0);
+        int playing = last_write - (int) jack_frames_since_cycle_start (m_client);
+        delay += aud::rescale (aud::max (playing, 0), m_jack_rate, 1000);
     }
 
-    pthread_mutex_unlock (& m_mutex);
     return delay;
 }
 
 void JACKOutput::pause (bool pause)
 {
-    pthread_mutex_lock (& m_mutex);
-    m_paused = pause;
-    pthread_cond_broadcast (& m_cond);
-    pthread_mutex_unlock (& m_mutex);
+    __atomic_store_n (& m_paused, pause, __ATOMIC_SEQ_CST);
 }
 
+/* the core doesn't call write_audio() during a flush, so m_head stays put */
 void JACKOutput::flush ()
 {
-    pthread_mutex_lock (& m_mutex);
-
-    m_buffer.discard ();
+    __atomic_store_n (& m_flush_to, m_head, __ATOMIC_SEQ_CST);
+    __atomic_store_n (& m_flush_serial, m_flush_serial + 1, __ATOMIC_SEQ_CST);
 
-    m_prebuffer = true;
-
-    m_last_write_frames = 0;
-    m_last_write_time = timeval ();
+    __atomic_store_n (& m_prebuffer, true, __ATOMIC_SEQ_CST);
+    __atomic_store_n (& m_last_write_frames, 0, __ATOMIC_SEQ_CST);
 
-    pthread_cond_broadcast (& m_cond);
-    pthread_mutex_unlock (& m_mutex);
+    /* interrupt period wait */
+    __atomic_store_n (& m_waiting, true, __ATOMIC_SEQ_CST);
+    sem_post (& s_wait_sem);
 }
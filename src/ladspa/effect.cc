@@ -17,14 +17,47 @@
  * the use of this software.
  */
 
-#include <assert.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
 
 #include "ladspa.h"
 #include "plugin.h"
 
 #include <libfauxdcore/runtime.h>
 
+bool chain_changed;
+
 static int ladspa_channels, ladspa_rate;
+static int ladspa_threads;
+
+/* The audio is kept planar while it passes through the chain: each channel
+ * has LADSPA_BUFLEN frames in each of two buffers.  Plugins that can run in
+ * place read and write the same buffer; the others write to the second
+ * buffer, after which the two are swapped. */
+static Index<float> chain_bufs[2];
+
+/* The channels are split into lanes which no plugin instance crosses; for
+ * example, with mono plugins only, every channel is a lane of its own.  Each
+ * lane runs through the whole chain independently of the others, so lanes
+ * can be processed in parallel. */
+static int lane_channels, n_lanes;
+static int chain_latency;  /* frames */
+
+static pthread_t workers[LADSPA_MAX_THREADS - 1];
+static int n_workers;
+
+static pthread_mutex_t pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t work_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t done_cond = PTHREAD_COND_INITIALIZER;
+static bool pool_quit;
+static int job_generation;
+static int job_pending;
+
+/* current job, written by the effect thread before job_generation changes */
+static float * job_data;
+static int job_frames;
+static int next_lane;
 
 static void start_plugin (LoadedPlugin & loaded)
 {
@@ -52,91 +85,261 @@ static void start_plugin (LoadedPlugin & loaded)
     }
 
     int instances = ladspa_channels / ports;
+    int controls = plugin.controls.len ();
 
-    loaded.in_bufs.insert (0, ladspa_channels);
-    loaded.out_bufs.insert (0, ladspa_channels);
+    loaded.extra_outputs.insert (0, (instances - 1) * controls);
 
     for (int i = 0; i < instances; i ++)
     {
         LADSPA_Handle handle = desc.instantiate (& desc, ladspa_rate);
         loaded.instances.append (handle);
 
-        int controls = plugin.controls.len ();
+        /* instances may run at the same time, so only the first one writes
+         * its output controls where they can be seen */
         for (int c = 0; c < controls; c ++)
-            desc.connect_port (handle, plugin.controls[c].port, & loaded.values[c]);
-
-        for (int p = 0; p < ports; p ++)
         {
-            int channel = ports * i + p;
+            float * value = & loaded.values[c];
+            if (i > 0 && plugin.controls[c].is_output)
+                value = & loaded.extra_outputs[(i - 1) * controls + c];
 
-            Index<float> & in = loaded.in_bufs[channel];
-            in.insert (0, LADSPA_BUFLEN);
-            desc.connect_port (handle, plugin.in_ports[p], in.begin ());
-
-            Index<float> & out = loaded.out_bufs[channel];
-            out.insert (0, LADSPA_BUFLEN);
-            desc.connect_port (handle, plugin.out_ports[p], out.begin ());
+            desc.connect_port (handle, plugin.controls[c].port, value);
         }
 
+        /* audio ports are connected for each block */
+
         if (desc.activate)
             desc.activate (handle);
     }
 }
 
-static void run_plugin (LoadedPlugin & loaded, float * data, int samples)
+/* runs frames frames of lane through the chain, starting and ending in
+ * interleaved data */
+static void run_lane (int lane, float * data, int frames)
 {
-    if (! loaded.instances.len ())
-        return;
+    int first = lane * lane_channels;
 
-    PluginData & plugin = loaded.plugin;
-    const LADSPA_Descriptor & desc = plugin.desc;
+    while (frames > 0)
+    {
+        int block = aud::min (frames, LADSPA_BUFLEN);
+        float * cur = chain_bufs[0].begin ();
+        float * other = chain_bufs[1].begin ();
 
-    int ports = plugin.in_ports.len ();
-    int instances = loaded.instances.len ();
-    assert (ports * instances == ladspa_channels);
+        for (int c = first; c < first + lane_channels; c ++)
+        {
+            const float * get = data + c;
+            float * set = cur + c * LADSPA_BUFLEN;
+            float * end = set + block;
 
-    while (samples / ladspa_channels > 0)
-    {
-        int frames = aud::min (samples / ladspa_channels, LADSPA_BUFLEN);
+            while (set < end)
+            {
+                * set ++ = * get;
+                get += ladspa_channels;
+            }
+        }
 
-        for (int i = 0; i < instances; i ++)
+        for (auto & loaded : loadeds)
         {
-            LADSPA_Handle handle = loaded.instances[i];
+            if (! loaded->instances.len ())
+                continue;
+
+            PluginData & plugin = loaded->plugin;
+            const LADSPA_Descriptor & desc = plugin.desc;
+
+            int ports = plugin.in_ports.len ();
+            bool in_place = ! LADSPA_IS_INPLACE_BROKEN (desc.Properties);
+            float * out = in_place ? cur : other;
 
-            for (int p = 0; p < ports; p ++)
+            for (int i = first / ports; i < (first + lane_channels) / ports; i ++)
             {
-                int channel = ports * i + p;
-                float * get = data + channel;
-                float * in = loaded.in_bufs[channel].begin ();
-                float * in_end = in + frames;
+                LADSPA_Handle handle = loaded->instances[i];
 
-                while (in < in_end)
+                for (int p = 0; p < ports; p ++)
                 {
-                    * in ++ = * get;
-                    get += ladspa_channels;
+                    int channel = ports * i + p;
+                    desc.connect_port (handle, plugin.in_ports[p], cur + channel * LADSPA_BUFLEN);
+                    desc.connect_port (handle, plugin.out_ports[p], out + channel * LADSPA_BUFLEN);
                 }
-            }
 
-            desc.run (handle, frames);
+                desc.run (handle, block);
+            }
 
-            for (int p = 0; p < ports; p ++)
+            if (! in_place)
             {
-                int channel = ports * i + p;
-                float * set = data + channel;
-                float * out = loaded.out_bufs[channel].begin ();
-                float * out_end = out + frames;
+                other = cur;
+                cur = out;
+            }
+        }
 
-                while (out < out_end)
-                {
-                    * set = * out ++;
-                    set += ladspa_channels;
-                }
+        for (int c = first; c < first + lane_channels; c ++)
+        {
+            const float * get = cur + c * LADSPA_BUFLEN;
+            const float * end = get + block;
+            float * set = data + c;
+
+            while (get < end)
+            {
+                * set = * get ++;
+                set += ladspa_channels;
             }
         }
 
-        data += ladspa_channels * frames;
-        samples -= ladspa_channels * frames;
+        data += ladspa_channels * block;
+        frames -= block;
+    }
+}
+
+static void run_lanes ()
+{
+    int lane;
+    while ((lane = __atomic_fetch_add (& next_lane, 1, __ATOMIC_RELAXED)) < n_lanes)
+        run_lane (lane, job_data, job_frames);
+}
+
+static void * worker (void * arg)
+{
+    int generation = (int) (intptr_t) arg;
+
+    pthread_mutex_lock (& pool_mutex);
+
+    while (true)
+    {
+        while (! pool_quit && generation == job_generation)
+            pthread_cond_wait (& work_cond, & pool_mutex);
+
+        if (pool_quit)
+            break;
+
+        generation = job_generation;
+        pthread_mutex_unlock (& pool_mutex);
+
+        run_lanes ();
+
+        pthread_mutex_lock (& pool_mutex);
+        if (! (-- job_pending))
+            pthread_cond_signal (& done_cond);
+    }
+
+    pthread_mutex_unlock (& pool_mutex);
+    return nullptr;
+}
+
+void stop_workers ()
+{
+    pthread_mutex_lock (& pool_mutex);
+    pool_quit = true;
+    pthread_cond_broadcast (& work_cond);
+    pthread_mutex_unlock (& pool_mutex);
+
+    for (int i = 0; i < n_workers; i ++)
+        pthread_join (workers[i], nullptr);
+
+    n_workers = 0;
+    pool_quit = false;
+}
+
+static void start_workers (int count)
+{
+    if (count == n_workers)
+        return;
+
+    stop_workers ();
+
+    /* workers wait for the job after the current one, even if they do not
+     * get to run until it has been posted */
+    for (int i = 0; i < count; i ++)
+    {
+        int error = pthread_create (& workers[i], nullptr, worker, (void *) (intptr_t) job_generation);
+        if (error)
+        {
+            /* run_chain () waits for n_workers replies, so only count the
+             * threads actually running; the effect thread does the rest */
+            AUDERR ("Failed to start LADSPA worker thread: %s.\n", strerror (error));
+            break;
+        }
+
+        n_workers ++;
+    }
+}
+
+static int gcd (int a, int b)
+{
+    while (b)
+    {
+        int t = a % b;
+        a = b;
+        b = t;
+    }
+
+    return a;
+}
+
+/* called with the mutex locked after plugins are added or removed */
+static void setup_chain ()
+{
+    lane_channels = 1;
+
+    for (auto & loaded : loadeds)
+    {
+        start_plugin (* loaded);
+
+        if (loaded->instances.len ())
+        {
+            int ports = loaded->plugin.in_ports.len ();
+            lane_channels = lane_channels / gcd (lane_channels, ports) * ports;
+        }
+    }
+
+    n_lanes = ladspa_channels / lane_channels;
+
+    for (auto & buf : chain_bufs)
+        buf.resize (ladspa_channels * LADSPA_BUFLEN);
+
+    int threads = ladspa_threads;
+    if (threads <= 0)
+        threads = sysconf (_SC_NPROCESSORS_ONLN);
+
+    start_workers (aud::clamp (aud::min (threads, n_lanes), 1, LADSPA_MAX_THREADS) - 1);
+
+    chain_changed = false;
+}
+
+static void run_chain (float * data, int samples)
+{
+    if (chain_changed)
+        setup_chain ();
+
+    job_data = data;
+    job_frames = samples / ladspa_channels;
+    next_lane = 0;
+
+    if (n_workers && n_lanes > 1)
+    {
+        pthread_mutex_lock (& pool_mutex);
+        job_generation ++;
+        job_pending = n_workers;
+        pthread_cond_broadcast (& work_cond);
+        pthread_mutex_unlock (& pool_mutex);
+
+        run_lanes ();
+
+        pthread_mutex_lock (& pool_mutex);
+        while (job_pending)
+            pthread_cond_wait (& done_cond, & pool_mutex);
+        pthread_mutex_unlock (& pool_mutex);
+    }
+    else
+        run_lanes ();
+
+    float latency = 0;
+
+    for (auto & loaded : loadeds)
+    {
+        int control = loaded->plugin.latency_control;
+        if (control >= 0 && loaded->instances.len ())
+            latency += loaded->values[control];
     }
+
+    __atomic_store_n (& chain_latency, (int) latency, __ATOMIC_RELAXED);
 }
 
 static void flush_plugin (LoadedPlugin & loaded)
@@ -162,6 +365,7 @@ static void flush_plugin (LoadedPlugin & loaded)
 void shutdown_plugin_locked (LoadedPlugin & loaded)
 {
     loaded.active = 0;
+    chain_changed = true;
 
     if (! loaded.instances.len ())
         return;
@@ -181,8 +385,7 @@ void shutdown_plugin_locked (LoadedPlugin & loaded)
     }
 
     loaded.instances.clear ();
-    loaded.in_bufs.clear ();
-    loaded.out_bufs.clear ();
+    loaded.extra_outputs.clear ();
 }
 
 void LADSPAHost::start (int & channels, int & rate)
@@ -194,6 +397,8 @@ void LADSPAHost::start (int & channels, int & rate)
 
     ladspa_channels = channels;
     ladspa_rate = rate;
+    ladspa_threads = aud_get_int ("ladspa", "threads");
+    chain_changed = true;
 
     pthread_mutex_unlock (& mutex);
 }
@@ -201,14 +406,9 @@ void LADSPAHost::start (int & channels, int & rate)
 Index<float> & LADSPAHost::process (Index<float> & data)
 {
     pthread_mutex_lock (& mutex);
-
-    for (auto & loaded : loadeds)
-    {
-        start_plugin (* loaded);
-        run_plugin (* loaded, data.begin (), data.len ());
-    }
-
+    run_chain (data.begin (), data.len ());
     pthread_mutex_unlock (& mutex);
+
     return data;
 }
 
@@ -227,15 +427,23 @@ Index<float> & LADSPAHost::finish (Index<float> & data, bool end_of_playlist)
 {
     pthread_mutex_lock (& mutex);
 
-    for (auto & loaded : loadeds)
-    {
-        start_plugin (* loaded);
-        run_plugin (* loaded, data.begin (), data.len ());
+    run_chain (data.begin (), data.len ());
 
-        if (end_of_playlist)
+    if (end_of_playlist)
+    {
+        for (auto & loaded : loadeds)
             shutdown_plugin_locked (* loaded);
     }
 
     pthread_mutex_unlock (& mutex);
     return data;
 }
+
+int LADSPAHost::adjust_delay (int delay)
+{
+    int latency = __atomic_load_n (& chain_latency, __ATOMIC_RELAXED);
+    if (! latency)
+        return delay;
+
+    return delay + aud::rescale (latency, ladspa_rate, 1000);
+}
@@ -17,55 +17,16 @@
  * the use of this software.
  */
 
-#include <libfauxdgui/list.h>
-
 #include "plugin.h"
+#include "plugin-lists.h"
 
-static void get_value (void * user, int row, int column, GValue * value)
-{
-    g_return_if_fail (row >= 0 && row < plugins.len ());
-    g_return_if_fail (column == 0);
-
-    g_value_set_string (value, plugins[row]->desc.Name);
-}
-
-static bool get_selected (void * user, int row)
-{
-    g_return_val_if_fail (row >= 0 && row < plugins.len (), 0);
-
-    return plugins[row]->selected;
-}
-
-static void set_selected (void * user, int row, bool selected)
-{
-    g_return_if_fail (row >= 0 && row < plugins.len ());
-
-    plugins[row]->selected = selected;
-}
-
-static void select_all (void * user, bool selected)
-{
-    for (auto & plugin : plugins)
-        plugin->selected = selected;
-}
+static const char * plugin_name (const PluginData & plugin)
+    { return plugin.desc.Name; }
 
-static const AudguiListCallbacks callbacks = {
-    get_value,
-    get_selected,
-    set_selected,
-    select_all
-};
+typedef AvailableList<PluginData, plugins, plugin_name> List;
 
 GtkWidget * create_plugin_list ()
-{
-    GtkWidget * list = audgui_list_new (& callbacks, nullptr, plugins.len ());
-    audgui_list_add_column (list, nullptr, 0, G_TYPE_STRING, -1);
-    gtk_tree_view_set_headers_visible ((GtkTreeView *) list, 0);
-    return list;
-}
+    { return List::create (); }
 
 void update_plugin_list (GtkWidget * list)
-{
-    audgui_list_delete_rows (list, 0, audgui_list_row_count (list));
-    audgui_list_insert_rows (list, 0, plugins.len ());
-}
+    { List::update (list); }
@@ -0,0 +1,177 @@
+/*
+ * LADSPA Host for Audacious
+ * Copyright 2011 John Lindgren
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions, and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions, and the following disclaimer in the documentation
+ *    provided with the distribution.
+ *
+ * This software is provided "as is" and without any warranty, express or
+ * implied. In no event shall the authors be liable for any damages arising from
+ * the use of this software.
+ */
+
+#ifndef AUD_LADSPA_PLUGIN_LISTS_H
+#define AUD_LADSPA_PLUGIN_LISTS_H
+
+/* The lists of available and enabled plugins, shared by the LADSPA and LV2
+ * hosts.  Each list shows the entries of items, which need a "selected"
+ * flag; name () gives the text to show for an entry. */
+
+#include <pthread.h>
+#include <gtk/gtk.h>
+
+#include <libfauxdcore/index.h>
+#include <libfauxdcore/objects.h>
+#include <libfauxdgui/list.h>
+
+template<class Item, Index<SmartPtr<Item>> & items, const char * (* name) (const Item &)>
+struct PluginList
+{
+    static void get_value (void * user, int row, int column, GValue * value)
+    {
+        g_return_if_fail (row >= 0 && row < items.len ());
+        g_return_if_fail (column == 0);
+
+        g_value_set_string (value, name (* items[row]));
+    }
+
+    static bool get_selected (void * user, int row)
+    {
+        g_return_val_if_fail (row >= 0 && row < items.len (), 0);
+
+        return items[row]->selected;
+    }
+
+    static void set_selected (void * user, int row, bool selected)
+    {
+        g_return_if_fail (row >= 0 && row < items.len ());
+
+        items[row]->selected = selected;
+    }
+
+    static void select_all (void * user, bool selected)
+    {
+        for (auto & item : items)
+            item->selected = selected;
+    }
+
+    static GtkWidget * create (const AudguiListCallbacks * callbacks)
+    {
+        GtkWidget * list = audgui_list_new (callbacks, nullptr, items.len ());
+        audgui_list_add_column (list, nullptr, 0, G_TYPE_STRING, -1);
+        gtk_tree_view_set_headers_visible ((GtkTreeView *) list, 0);
+        return list;
+    }
+
+    static void update (GtkWidget * list)
+    {
+        audgui_list_delete_rows (list, 0, audgui_list_row_count (list));
+        audgui_list_insert_rows (list, 0, items.len ());
+    }
+};
+
+/* the available plugins */
+template<class Item, Index<SmartPtr<Item>> & items, const char * (* name) (const Item &)>
+struct AvailableList : PluginList<Item, items, name>
+{
+    typedef PluginList<Item, items, name> Base;
+
+    static constexpr AudguiListCallbacks callbacks = {
+        Base::get_value,
+        Base::get_selected,
+        Base::set_selected,
+        Base::select_all
+    };
+
+    static GtkWidget * create ()
+        { return Base::create (& callbacks); }
+};
+
+template<class Item, Index<SmartPtr<Item>> & items, const char * (* name) (const Item &)>
+constexpr AudguiListCallbacks AvailableList<Item, items, name>::callbacks;
+
+/* the enabled plugins, which can be reordered by dragging; widget is the
+ * list shown in the settings, if any, and mutex protects items */
+template<class Item, Index<SmartPtr<Item>> & items, const char * (* name) (const Item &),
+ pthread_mutex_t & mutex, GtkWidget * & widget>
+struct EnabledList : PluginList<Item, items, name>
+{
+    typedef PluginList<Item, items, name> Base;
+
+    static void shift_rows (void * user, int row, int before)
+    {
+        int rows = items.len ();
+        g_return_if_fail (row >= 0 && row < rows);
+        g_return_if_fail (before >= 0 && before <= rows);
+
+        if (before == row)
+            return;
+
+        pthread_mutex_lock (& mutex);
+
+        Index<SmartPtr<Item>> move;
+        Index<SmartPtr<Item>> others;
+
+        int begin, end;
+        if (before < row)
+        {
+            begin = before;
+            end = row + 1;
+            while (end < rows && items[end]->selected)
+                end ++;
+        }
+        else
+        {
+            begin = row;
+            while (begin > 0 && items[begin - 1]->selected)
+                begin --;
+            end = before;
+        }
+
+        for (int i = begin; i < end; i ++)
+        {
+            if (items[i]->selected)
+                move.append (std::move (items[i]));
+            else
+                others.append (std::move (items[i]));
+        }
+
+        if (before < row)
+            move.move_from (others, 0, -1, -1, true, true);
+        else
+            move.move_from (others, 0, 0, -1, true, true);
+
+        items.move_from (move, 0, begin, end - begin, false, true);
+
+        pthread_mutex_unlock (& mutex);
+
+        if (widget)
+            Base::update (widget);
+    }
+
+    static constexpr AudguiListCallbacks callbacks = {
+        Base::get_value,
+        Base::get_selected,
+        Base::set_selected,
+        Base::select_all,
+        nullptr,  // activate_row
+        nullptr,  // right_click
+        shift_rows
+    };
+
+    static GtkWidget * create ()
+        { return Base::create (& callbacks); }
+};
+
+template<class Item, Index<SmartPtr<Item>> & items, const char * (* name) (const Item &),
+ pthread_mutex_t & mutex, GtkWidget * & widget>
+constexpr AudguiListCallbacks EnabledList<Item, items, name, mutex, widget>::callbacks;
+
+#endif
@@ -37,6 +37,7 @@
 
 const char * const LADSPAHost::defaults[] = {
  "plugin_count", "0",
+ "threads", "1",
  nullptr};
 
 pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
@@ -56,6 +57,7 @@ static ControlData parse_control (const LADSPA_Descriptor & desc, int port)
     control.port = port;
     control.name = String (desc.PortNames[port]);
     control.is_toggle = LADSPA_IS_HINT_TOGGLED (hint.HintDescriptor) ? 1 : 0;
+    control.is_output = LADSPA_IS_PORT_OUTPUT (desc.PortDescriptors[port]) ? 1 : 0;
 
     control.min = LADSPA_IS_HINT_BOUNDED_BELOW (hint.HintDescriptor) ? hint.LowerBound :
      LADSPA_IS_HINT_BOUNDED_ABOVE (hint.HintDescriptor) ? hint.UpperBound - 100 : -100;
@@ -116,7 +118,15 @@ static void open_plugin (const char * path, const LADSPA_Descriptor & desc)
     for (unsigned i = 0; i < desc.PortCount; i ++)
     {
         if (LADSPA_IS_PORT_CONTROL (desc.PortDescriptors[i]))
+        {
+            /* by convention, an output control named "latency" reports the
+             * plugin's delay in frames */
+            if (LADSPA_IS_PORT_OUTPUT (desc.PortDescriptors[i]) &&
+             ! strcmp_nocase (desc.PortNames[i], "latency"))
+                plugin.latency_control = plugin.controls.len ();
+
             plugin.controls.append (parse_control (desc, i));
+        }
         else if (LADSPA_IS_PORT_AUDIO (desc.PortDescriptors[i]) &&
          LADSPA_IS_PORT_INPUT (desc.PortDescriptors[i]))
             plugin.in_ports.append (i);
@@ -210,6 +220,7 @@ LoadedPlugin & enable_plugin_locked (PluginData & plugin)
     for (auto & control : plugin.controls)
         loaded.values.append (control.def);
 
+    chain_changed = true;
     return loaded;
 }
 
@@ -330,6 +341,8 @@ void LADSPAHost::cleanup ()
     module_path = String ();
 
     pthread_mutex_unlock (& mutex);
+
+    stop_workers ();
 }
 
 static void set_module_path (GtkEntry * entry)
@@ -561,7 +574,10 @@ const char LADSPAHost::about[] =
     "Copyright 2011 John Lindgren");
 
 const PreferencesWidget LADSPAHost::widgets[] = {
-    WidgetCustomGTK (make_config_widget)
+    WidgetCustomGTK (make_config_widget),
+    WidgetSpin (N_("Threads:"),
+        WidgetInt ("ladspa", "threads"),
+        {0, LADSPA_MAX_THREADS, 1, N_("(0 = automatic)")})
 };
 
 const PluginPreferences LADSPAHost::prefs = {{widgets}};
@@ -29,6 +29,7 @@
 #include "ladspa.h"
 
 #define LADSPA_BUFLEN 1024
+#define LADSPA_MAX_THREADS 8
 
 struct PreferencesWidget;
 
@@ -36,6 +37,7 @@ struct ControlData {
     int port;
     String name;
     bool is_toggle;
+    bool is_output;
     float min, max, def;
 };
 
@@ -45,6 +47,7 @@ struct PluginData
     const LADSPA_Descriptor & desc;
     Index<ControlData> controls;
     Index<int> in_ports, out_ports;
+    int latency_control = -1;  /* output control reporting latency in frames */
     bool selected = false;
 
     PluginData (const char * path, const LADSPA_Descriptor & desc) :
@@ -59,7 +62,7 @@ struct LoadedPlugin
     bool selected = false;
     bool active = false;
     Index<LADSPA_Handle> instances;
-    Index<Index<float>> in_bufs, out_bufs;
+    Index<float> extra_outputs;  /* output controls of instances after the first */
     GtkWidget * settings_win = nullptr;
 
     LoadedPlugin (PluginData & plugin) :
@@ -90,6 +93,7 @@ public:
     Index<float> & process (Index<float> & data);
     bool flush (bool force);
     Index<float> & finish (Index<float> & data, bool end_of_playlist);
+    int adjust_delay (int delay);
 };
 
 /* plugin.c */
@@ -112,7 +116,11 @@ void disable_plugin_locked (LoadedPlugin & loaded);
 
 /* effect.c */
 
+/* set (with the mutex locked) whenever plugins are added or removed */
+extern bool chain_changed;
+
 void shutdown_plugin_locked (LoadedPlugin & loaded);
+void stop_workers ();
 
 /* plugin-list.c */
 
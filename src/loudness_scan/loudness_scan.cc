@@ -0,0 +1,554 @@
+/*
+ * Loudness Scanner Plugin for Audacious
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions, and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions, and the following disclaimer in the documentation
+ *    provided with the distribution.
+ *
+ * This software is provided "as is" and without any warranty, express or
+ * implied. In no event shall the authors be liable for any damages arising from
+ * the use of this software.
+ */
+
+#include <math.h>
+#include <pthread.h>
+#include <string.h>
+#include <unistd.h>
+#include <glib.h>
+#include <sndfile.h>
+
+#define WANT_VFS_STDIO_COMPAT
+#include <libfauxdcore/audstrings.h>
+#include <libfauxdcore/i18n.h>
+#include <libfauxdcore/interface.h>
+#include <libfauxdcore/mainloop.h>
+#include <libfauxdcore/playlist.h>
+#include <libfauxdcore/plugin.h>
+#include <libfauxdcore/preferences.h>
+#include <libfauxdcore/probe.h>
+#include <libfauxdcore/runtime.h>
+
+#include "meter.h"
+
+#define CFGSECT "loudness_scan"
+#define MAX_THREADS 16
+
+/* ReplayGain 2.0 reference level */
+#define REFERENCE_LUFS -18.0
+
+#define READ_FRAMES 4096
+
+class LoudnessScan : public GeneralPlugin
+{
+public:
+    static const char about[];
+    static const char * const defaults[];
+    static const PreferencesWidget widgets[];
+    static const PluginPreferences prefs;
+
+    static constexpr PluginInfo info = {
+        N_("Loudness Scanner"),
+        PACKAGE,
+        about,
+        & prefs
+    };
+
+    constexpr LoudnessScan () : GeneralPlugin (info, false) {}
+
+    bool init ();
+    void cleanup ();
+};
+
+EXPORT LoudnessScan aud_plugin_instance;
+
+const char LoudnessScan::about[] =
+ N_("Measures the loudness of the selected playlist entries according to "
+    "EBU R128 and writes ReplayGain 2.0 tags (track and album gain and true "
+    "peak) to the files.\n\n"
+    "Files are decoded with libsndfile, several at a time.  Tags are written "
+    "through the input plugin of each file, if it supports editing tags, as "
+    "soon as the file (or, for album gain, the whole album) is measured.");
+
+const char * const LoudnessScan::defaults[] = {
+ "threads", "0",
+ "album_gain", "TRUE",
+ nullptr};
+
+static constexpr AudMenuID menus[] = {
+    AudMenuID::Main,
+    AudMenuID::Playlist
+};
+
+/* One job per file, set up by the main thread before the workers start.
+ * While the scan runs, the workers only write the results of the job they
+ * claimed; album results are merged under the mutex.  Jobs whose tags can be
+ * written are added to ready, from which the main thread writes them one at
+ * a time. */
+struct ScanJob {
+    String filename;
+    Tuple tuple;
+    int album;  /* index into albums, or -1 */
+    bool measured;
+    double loudness, range;
+    float peak;
+};
+
+static Index<ScanJob> jobs;
+static Index<LoudnessResult> albums;
+static Index<int> album_left;   /* files of each album not measured yet */
+static Index<int> ready;
+static int next_ready;
+static int files_written;       /* only used by the main thread */
+
+static pthread_mutex_t scan_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t threads[MAX_THREADS];
+static int n_threads;
+static int next_job, jobs_done;
+static bool scan_quit;
+static bool scanning;
+static int64_t scan_start_time;
+
+static QueuedFunc write_func;
+
+static void write_next (void * = nullptr);
+
+/* libsndfile I/O through VFS (as in the sndfile input plugin) */
+static sf_count_t sf_get_filelen (void * user_data)
+{
+    int64_t size = ((VFSFile *) user_data)->fsize ();
+    return (size < 0) ? SF_COUNT_MAX : size;
+}
+
+static sf_count_t sf_vseek (sf_count_t offset, int whence, void * user_data)
+{
+    if (((VFSFile *) user_data)->fseek (offset, to_vfs_seek_type (whence)) != 0)
+        return -1;
+
+    return ((VFSFile *) user_data)->ftell ();
+}
+
+static sf_count_t sf_vread (void * ptr, sf_count_t count, void * user_data)
+{
+    return ((VFSFile *) user_data)->fread (ptr, 1, count);
+}
+
+static sf_count_t sf_vwrite_dummy (const void * ptr, sf_count_t count, void * user_data)
+{
+    return 0;
+}
+
+static sf_count_t sf_tell (void * user_data)
+{
+    return ((VFSFile *) user_data)->ftell ();
+}
+
+static SF_VIRTUAL_IO sf_virtual_io = {
+    sf_get_filelen,
+    sf_vseek,
+    sf_vread,
+    sf_vwrite_dummy,
+    sf_tell
+};
+
+static bool measure_file (const char * filename, LoudnessMeter & meter, Index<float> & buffer)
+{
+    VFSFile file (filename, "r");
+    if (! file)
+    {
+        AUDERR ("Error opening %s: %s.\n", filename, file.error ());
+        return false;
+    }
+
+    SF_INFO info = SF_INFO ();
+    SNDFILE * sf = sf_open_virtual (& sf_virtual_io, SFM_READ, & info, & file);
+
+    if (! sf)
+    {
+        AUDWARN ("Cannot decode %s: %s.\n", filename, sf_strerror (nullptr));
+        return false;
+    }
+
+    bool success = meter.start (info.channels, info.samplerate);
+
+    if (success)
+    {
+        buffer.resize (READ_FRAMES * info.channels);
+
+        sf_count_t frames;
+        while ((frames = sf_readf_float (sf, buffer.begin (), READ_FRAMES)) > 0)
+        {
+            if (__atomic_load_n (& scan_quit, __ATOMIC_RELAXED))
+            {
+                success = false;
+                break;
+            }
+
+            meter.process (buffer.begin (), frames);
+        }
+    }
+    else
+        AUDWARN ("Unsupported format in %s: %d channels at %d Hz.\n",
+         filename, info.channels, info.samplerate);
+
+    sf_close (sf);
+    return success;
+}
+
+static void * scan_worker (void *)
+{
+    LoudnessMeter meter;
+    Index<float> buffer;
+
+    pthread_mutex_lock (& scan_mutex);
+
+    while (! scan_quit && next_job < jobs.len ())
+    {
+        int index = next_job ++;
+        ScanJob & job = jobs[index];
+
+        pthread_mutex_unlock (& scan_mutex);
+
+        job.measured = measure_file (job.filename, meter, buffer);
+
+        if (job.measured)
+        {
+            const LoudnessResult & result = meter.result ();
+
+            job.loudness = result.integrated ();
+            job.range = result.range ();
+            job.peak = result.peak;
+
+            AUDINFO ("%s: %.1f LUFS, range %.1f LU, peak %.1f dBTP.\n",
+             (const char *) job.filename, job.loudness, job.range,
+             20 * log10f (aud::max (job.peak, 1e-10f)));
+        }
+
+        pthread_mutex_lock (& scan_mutex);
+
+        if (job.album >= 0)
+        {
+            if (job.measured)
+                albums[job.album].add (meter.result ());
+
+            /* the album gain is known once the last file is measured */
+            if (! -- album_left[job.album])
+            {
+                for (int i = 0; i < jobs.len (); i ++)
+                {
+                    if (jobs[i].album == job.album && jobs[i].measured)
+                        ready.append (i);
+                }
+            }
+        }
+        else if (job.measured)
+            ready.append (index);
+
+        jobs_done ++;
+        write_func.queue (write_next, nullptr);
+    }
+
+    pthread_mutex_unlock (& scan_mutex);
+    return nullptr;
+}
+
+static void stop_workers ()
+{
+    for (int i = 0; i < n_threads; i ++)
+        pthread_join (threads[i], nullptr);
+
+    n_threads = 0;
+}
+
+/* sets gain/peak fields, keeping any existing divisor so that other values
+ * sharing it stay correct */
+static void set_gain (Tuple & tuple, Tuple::Field field, Tuple::Field unit_field,
+ int default_unit, double value)
+{
+    int unit = tuple.get_int (unit_field);
+    if (unit <= 0)
+    {
+        unit = default_unit;
+        tuple.set_int (unit_field, unit);
+    }
+
+    tuple.set_int (field, lround (value * unit));
+}
+
+static bool write_job (ScanJob & job)
+{
+    if (job.loudness == -HUGE_VAL)
+    {
+        AUDWARN ("%s is silent, not tagged.\n", (const char *) job.filename);
+        return false;
+    }
+
+    Tuple tuple = job.tuple.ref ();
+
+    set_gain (tuple, Tuple::TrackGain, Tuple::GainDivisor, 100, REFERENCE_LUFS - job.loudness);
+    set_gain (tuple, Tuple::TrackPeak, Tuple::PeakDivisor, 1000000, job.peak);
+
+    if (job.album >= 0)
+    {
+        const LoudnessResult & album = albums[job.album];
+        double loudness = album.integrated ();
+
+        if (loudness != -HUGE_VAL)
+        {
+            set_gain (tuple, Tuple::AlbumGain, Tuple::GainDivisor, 100, REFERENCE_LUFS - loudness);
+            set_gain (tuple, Tuple::AlbumPeak, Tuple::PeakDivisor, 1000000, album.peak);
+        }
+    }
+
+    PluginHandle * decoder;
+
+    {
+        VFSFile file (job.filename, "r");
+        if (! file)
+            return false;
+
+        String error;
+        decoder = aud_file_find_decoder (job.filename, true, file, & error);
+    }
+
+    if (! decoder || ! aud_file_can_write_tuple (job.filename, decoder))
+    {
+        AUDWARN ("Cannot write tags to %s.\n", (const char *) job.filename);
+        return false;
+    }
+
+    if (! aud_file_write_tuple (job.filename, decoder, tuple))
+    {
+        AUDERR ("Error writing tags to %s.\n", (const char *) job.filename);
+        return false;
+    }
+
+    return true;
+}
+
+static void cancel_scan ();
+
+static void finish_scan ()
+{
+    if (! scanning)
+        return;
+
+    bool cancelled = scan_quit;
+
+    stop_workers ();
+    scanning = false;
+    write_func.stop ();
+
+    for (AudMenuID menu : menus)
+        aud_plugin_menu_remove (menu, cancel_scan);
+
+    if (cancelled)
+        AUDINFO ("Loudness scan cancelled: %d files tagged.\n", files_written);
+    else
+    {
+        int measured = 0;
+        for (const ScanJob & job : jobs)
+        {
+            if (job.measured)
+                measured ++;
+        }
+
+        for (int a = 0; a < albums.len (); a ++)
+            AUDINFO ("Album %d: %.1f LUFS, range %.1f LU.\n", a + 1,
+             albums[a].integrated (), albums[a].range ());
+
+        double elapsed = (g_get_monotonic_time () - scan_start_time) / 1000000.0;
+
+        AUDINFO ("Loudness scan: %d of %d files measured, %d tagged, %.1f s.\n",
+         measured, jobs.len (), files_written, elapsed);
+
+        if (measured < jobs.len () || files_written < measured)
+            aud_ui_show_error (str_printf (_("Loudness scan finished: %d of %d "
+             "files were measured and %d tagged.  See the log for details."),
+             measured, jobs.len (), files_written));
+    }
+
+    jobs.clear ();
+    albums.clear ();
+    album_left.clear ();
+    ready.clear ();
+}
+
+/* Writes the tags of one ready file, so that the main loop gets a turn
+ * between files, and finishes the scan after the last one. */
+static void write_next (void *)
+{
+    if (! scanning)
+        return;
+
+    pthread_mutex_lock (& scan_mutex);
+
+    int index = (next_ready < ready.len ()) ? ready[next_ready ++] : -1;
+    bool more = (next_ready < ready.len ());
+    bool done = (! more && jobs_done == jobs.len ());
+
+    pthread_mutex_unlock (& scan_mutex);
+
+    if (index >= 0 && write_job (jobs[index]))
+        files_written ++;
+
+    if (more)
+        write_func.queue (write_next, nullptr);
+    else if (done)
+        finish_scan ();
+}
+
+static void cancel_scan ()
+{
+    if (! scanning)
+        return;
+
+    pthread_mutex_lock (& scan_mutex);
+    __atomic_store_n (& scan_quit, true, __ATOMIC_RELAXED);
+    pthread_mutex_unlock (& scan_mutex);
+
+    finish_scan ();
+}
+
+/* entries that share a folder and an album title form an album */
+static int find_album (Index<String> & album_keys, const ScanJob & job)
+{
+    String album = job.tuple.get_str (Tuple::Album);
+    if (! album || ! album[0])
+        return -1;
+
+    const char * slash = strrchr (job.filename, '/');
+    int dir_len = slash ? slash - job.filename : 0;
+
+    StringBuf key = str_printf ("%.*s/%s", dir_len, (const char *) job.filename,
+     (const char *) album);
+
+    for (int a = 0; a < album_keys.len (); a ++)
+    {
+        if (! strcmp (album_keys[a], key))
+            return a;
+    }
+
+    album_keys.append (String (key));
+    return album_keys.len () - 1;
+}
+
+static void start_scan ()
+{
+    if (scanning)
+    {
+        AUDINFO ("A loudness scan is already running.\n");
+        return;
+    }
+
+    int playlist = aud_playlist_get_active ();
+    int entries = aud_playlist_entry_count (playlist);
+    int selected = aud_playlist_selected_count (playlist);
+
+    bool album_gain = aud_get_bool (CFGSECT, "album_gain");
+    Index<String> album_keys;
+
+    for (int i = 0; i < entries; i ++)
+    {
+        if (selected && ! aud_playlist_entry_get_selected (playlist, i))
+            continue;
+
+        Tuple tuple = aud_playlist_entry_get_tuple (playlist, i);
+
+        /* skip streams and entries that are only part of a file, like
+         * tracks of a cue sheet */
+        if (tuple.get_int (Tuple::Length) <= 0 ||
+            tuple.is_set (Tuple::StartTime) || tuple.is_set (Tuple::Subtune))
+            continue;
+
+        ScanJob & job = jobs.append ();
+        job.filename = aud_playlist_entry_get_filename (playlist, i);
+        job.tuple = std::move (tuple);
+        job.album = album_gain ? find_album (album_keys, job) : -1;
+        job.measured = false;
+    }
+
+    if (! jobs.len ())
+        return;
+
+    albums.insert (0, album_keys.len ());
+    for (LoudnessResult & album : albums)
+        album.clear ();
+
+    album_left.insert (0, album_keys.len ());
+    for (const ScanJob & job : jobs)
+    {
+        if (job.album >= 0)
+            album_left[job.album] ++;
+    }
+
+    int count = aud_get_int (CFGSECT, "threads");
+    if (count <= 0)
+        count = sysconf (_SC_NPROCESSORS_ONLN);
+
+    count = aud::clamp (aud::min (count, jobs.len ()), 1, MAX_THREADS);
+
+    next_job = jobs_done = 0;
+    next_ready = files_written = 0;
+    scan_quit = false;
+    scanning = true;
+    scan_start_time = g_get_monotonic_time ();
+
+    for (n_threads = 0; n_threads < count; n_threads ++)
+    {
+        if (pthread_create (& threads[n_threads], nullptr, scan_worker, nullptr))
+            break;
+    }
+
+    if (! n_threads)
+    {
+        AUDERR ("Failed to start loudness scan threads.\n");
+        scanning = false;
+        jobs.clear ();
+        albums.clear ();
+        album_left.clear ();
+        return;
+    }
+
+    for (AudMenuID menu : menus)
+        aud_plugin_menu_add (menu, cancel_scan, _("Cancel Loudness Scan"), "process-stop");
+
+    AUDINFO ("Loudness scan of %d files started on %d threads.\n",
+     jobs.len (), n_threads);
+}
+
+bool LoudnessScan::init ()
+{
+    aud_config_set_defaults (CFGSECT, defaults);
+
+    for (AudMenuID menu : menus)
+        aud_plugin_menu_add (menu, start_scan, _("Scan Loudness (ReplayGain)"), "audio-volume-high");
+
+    return true;
+}
+
+void LoudnessScan::cleanup ()
+{
+    for (AudMenuID menu : menus)
+        aud_plugin_menu_remove (menu, start_scan);
+
+    cancel_scan ();
+}
+
+const PreferencesWidget LoudnessScan::widgets[] = {
+    WidgetLabel (N_("<b>Scan</b>")),
+    WidgetSpin (N_("Threads:"),
+        WidgetInt (CFGSECT, "threads"),
+        {0, MAX_THREADS, 1, N_("(0 = automatic)")}),
+    WidgetCheck (N_("Calculate album gain"),
+        WidgetBool (CFGSECT, "album_gain")),
+    WidgetLabel (N_("Entries in the same folder with the same album title\n"
+                    "are treated as one album."))
+};
+
+const PluginPreferences LoudnessScan::prefs = {{widgets}};
@@ -0,0 +1,494 @@
+/*
+ * Loudness Scanner Plugin for Audacious
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions, and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions, and the following disclaimer in the documentation
+ *    provided with the distribution.
+ *
+ * This software is provided "as is" and without any warranty, express or
+ * implied. In no event shall the authors be liable for any damages arising from
+ * the use of this software.
+ */
+
+#include <math.h>
+#include <string.h>
+
+#if defined (__SSE2__)
+#include <emmintrin.h>
+#elif defined (__ARM_NEON) || defined (__ARM_NEON__)
+#include <arm_neon.h>
+#endif
+
+#include "meter.h"
+
+#define BLOCK 1024
+#define TAPS 12  /* per phase of the true-peak interpolator */
+
+#define HIST_MIN -70.0
+#define HIST_STEP 0.1
+
+static double bin_loudness (int bin)
+{
+    return HIST_MIN + (bin + 0.5) * HIST_STEP;
+}
+
+static double bin_energy (int bin)
+{
+    return pow (10, (bin_loudness (bin) + 0.691) / 10);
+}
+
+/* returns the histogram bin, or -1 if the block is below the absolute gate */
+static int block_bin (double energy)
+{
+    if (energy <= 0)
+        return -1;
+
+    int bin = (int) floor ((-0.691 + 10 * log10 (energy) - HIST_MIN) / HIST_STEP);
+    return (bin < 0) ? -1 : aud::min (bin, HIST_BINS - 1);
+}
+
+void LoudnessResult::clear ()
+{
+    memset (blocks, 0, sizeof blocks);
+    memset (energy, 0, sizeof energy);
+    memset (short_term, 0, sizeof short_term);
+    peak = 0;
+}
+
+void LoudnessResult::add (const LoudnessResult & other)
+{
+    for (int b = 0; b < HIST_BINS; b ++)
+    {
+        blocks[b] += other.blocks[b];
+        energy[b] += other.energy[b];
+        short_term[b] += other.short_term[b];
+    }
+
+    peak = aud::max (peak, other.peak);
+}
+
+double LoudnessResult::integrated () const
+{
+    double sum = 0;
+    double count = 0;
+
+    for (int b = 0; b < HIST_BINS; b ++)
+    {
+        sum += energy[b];
+        count += blocks[b];
+    }
+
+    if (! count)
+        return -HUGE_VAL;
+
+    /* relative gate at -10 LU */
+    double gate = 0.1 * sum / count;
+
+    sum = count = 0;
+
+    for (int b = 0; b < HIST_BINS; b ++)
+    {
+        if (bin_energy (b) >= gate)
+        {
+            sum += energy[b];
+            count += blocks[b];
+        }
+    }
+
+    return -0.691 + 10 * log10 (sum / count);
+}
+
+double LoudnessResult::range () const
+{
+    double sum = 0;
+    double count = 0;
+
+    for (int b = 0; b < HIST_BINS; b ++)
+    {
+        sum += short_term[b] * bin_energy (b);
+        count += short_term[b];
+    }
+
+    if (! count)
+        return 0;
+
+    /* relative gate at -20 LU */
+    double gate = 0.01 * sum / count;
+
+    int first = 0;
+    while (bin_energy (first) < gate)
+        first ++;
+
+    unsigned total = 0;
+    for (int b = first; b < HIST_BINS; b ++)
+        total += short_term[b];
+
+    auto percentile = [&] (double p) {
+        unsigned target = (unsigned) ((total - 1) * p);
+        unsigned seen = 0;
+
+        for (int b = first; b < HIST_BINS; b ++)
+        {
+            seen += short_term[b];
+            if (seen > target)
+                return bin_loudness (b);
+        }
+
+        return bin_loudness (HIST_BINS - 1);
+    };
+
+    return percentile (0.95) - percentile (0.10);
+}
+
+bool LoudnessMeter::start (int channels, int rate)
+{
+    if (channels < 1 || rate < 8000)
+        return false;
+
+    m_channels = channels;
+    m_lanes = (channels + 1) & ~1;
+
+    /* K-weighting: a high shelf modelling the head, then a high pass (the
+     * revised low-frequency B-curve), recalculated for the sample rate */
+    double K = tan (M_PI * 1681.974450955533 / rate);
+    double Q = 0.7071752369554196;
+    double Vh = pow (10, 3.999843853973347 / 20);
+    double Vb = pow (Vh, 0.4996667741545416);
+    double a0 = 1 + K / Q + K * K;
+
+    m_shelf.b0 = (Vh + Vb * K / Q + K * K) / a0;
+    m_shelf.b1 = 2 * (K * K - Vh) / a0;
+    m_shelf.b2 = (Vh - Vb * K / Q + K * K) / a0;
+    m_shelf.a1 = 2 * (K * K - 1) / a0;
+    m_shelf.a2 = (1 - K / Q + K * K) / a0;
+
+    K = tan (M_PI * 38.13547087602444 / rate);
+    Q = 0.5003270373238773;
+    a0 = 1 + K / Q + K * K;
+
+    m_highpass.b0 = 1;
+    m_highpass.b1 = -2;
+    m_highpass.b2 = 1;
+    m_highpass.a1 = 2 * (K * K - 1) / a0;
+    m_highpass.a2 = (1 - K / Q + K * K) / a0;
+
+    m_block.resize (BLOCK * m_lanes);
+    m_state.resize (4 * m_lanes);
+    m_energy.resize (m_lanes);
+    m_weights.resize (m_lanes);
+
+    memset (m_block.begin (), 0, sizeof (double) * m_block.len ());
+    memset (m_state.begin (), 0, sizeof (double) * m_state.len ());
+    memset (m_energy.begin (), 0, sizeof (double) * m_energy.len ());
+
+    /* channels are in the usual WAV order: surround channels get +1.5 dB and
+     * the LFE channel of a 5.1 or larger layout is ignored */
+    for (int lane = 0; lane < m_lanes; lane ++)
+    {
+        double weight = (lane < channels) ? 1 : 0;
+
+        if (channels == 5 && lane >= 3)
+            weight = 1.41;
+        else if (channels >= 6 && lane == 3)
+            weight = 0;
+        else if (channels >= 6 && lane > 3 && lane < channels)
+            weight = 1.41;
+
+        m_weights[lane] = weight;
+    }
+
+    m_sub_len = (rate + 5) / 10;
+    m_sub_pos = 0;
+    m_sub_count = 0;
+
+    /* oversample to at least 192 kHz for true peak */
+    m_factor = (rate < 96000) ? 4 : (rate < 192000) ? 2 : 1;
+
+    /* Hann-windowed sinc, split into phases and stored in reverse so that
+     * phase p of output frame i is the dot product with history[i ... i +
+     * TAPS - 1] */
+    m_phases.resize (m_factor * TAPS);
+
+    for (int p = 0; p < m_factor; p ++)
+    {
+        for (int k = 0; k < TAPS; k ++)
+        {
+            int n = p + (TAPS - 1 - k) * m_factor;
+            double t = (n - (m_factor * TAPS - 1) / 2.0) / m_factor;
+            double window = 0.5 * (1 + cos (M_PI * t / (TAPS / 2)));
+
+            m_phases[p * TAPS + k] = (t == 0) ? 1 :
+             sin (M_PI * t) / (M_PI * t) * window;
+        }
+    }
+
+    m_history.resize (m_channels * (TAPS - 1 + BLOCK));
+    memset (m_history.begin (), 0, sizeof (float) * m_history.len ());
+
+    m_result.clear ();
+    return true;
+}
+
+/* Runs both K-weighting stages (transposed direct form II) and sums the
+ * squared output per lane.  Each iteration filters one frame of a pair of
+ * channels. */
+void LoudnessMeter::filter (int frames)
+{
+    const Biquad & s = m_shelf, & h = m_highpass;
+
+    for (int lane = 0; lane < m_lanes; lane += 2)
+    {
+        const double * x = m_block.begin () + lane;
+        double * z = m_state.begin () + 4 * lane;
+        double * e = m_energy.begin () + lane;
+
+#if defined (__SSE2__)
+        __m128d sb0 = _mm_set1_pd (s.b0), sb1 = _mm_set1_pd (s.b1),
+         sb2 = _mm_set1_pd (s.b2), sa1 = _mm_set1_pd (s.a1), sa2 = _mm_set1_pd (s.a2);
+        __m128d hb0 = _mm_set1_pd (h.b0), hb1 = _mm_set1_pd (h.b1),
+         hb2 = _mm_set1_pd (h.b2), ha1 = _mm_set1_pd (h.a1), ha2 = _mm_set1_pd (h.a2);
+
+        __m128d s1 = _mm_loadu_pd (z), s2 = _mm_loadu_pd (z + 2);
+        __m128d h1 = _mm_loadu_pd (z + 4), h2 = _mm_loadu_pd (z + 6);
+        __m128d sum = _mm_loadu_pd (e);
+
+        for (int i = 0; i < frames; i ++)
+        {
+            __m128d in = _mm_loadu_pd (x + i * m_lanes);
+
+            __m128d y = _mm_add_pd (_mm_mul_pd (sb0, in), s1);
+            s1 = _mm_sub_pd (_mm_add_pd (_mm_mul_pd (sb1, in), s2), _mm_mul_pd (sa1, y));
+            s2 = _mm_sub_pd (_mm_mul_pd (sb2, in), _mm_mul_pd (sa2, y));
+
+            __m128d out = _mm_add_pd (_mm_mul_pd (hb0, y), h1);
+            h1 = _mm_sub_pd (_mm_add_pd (_mm_mul_pd (hb1, y), h2), _mm_mul_pd (ha1, out));
+            h2 = _mm_sub_pd (_mm_mul_pd (hb2, y), _mm_mul_pd (ha2, out));
+
+            sum = _mm_add_pd (sum, _mm_mul_pd (out, out));
+        }
+
+        _mm_storeu_pd (z, s1);
+        _mm_storeu_pd (z + 2, s2);
+        _mm_storeu_pd (z + 4, h1);
+        _mm_storeu_pd (z + 6, h2);
+        _mm_storeu_pd (e, sum);
+#elif defined (__aarch64__)
+        float64x2_t sb0 = vdupq_n_f64 (s.b0), sb1 = vdupq_n_f64 (s.b1),
+         sb2 = vdupq_n_f64 (s.b2), sa1 = vdupq_n_f64 (s.a1), sa2 = vdupq_n_f64 (s.a2);
+        float64x2_t hb0 = vdupq_n_f64 (h.b0), hb1 = vdupq_n_f64 (h.b1),
+         hb2 = vdupq_n_f64 (h.b2), ha1 = vdupq_n_f64 (h.a1), ha2 = vdupq_n_f64 (h.a2);
+
+        float64x2_t s1 = vld1q_f64 (z), s2 = vld1q_f64 (z + 2);
+        float64x2_t h1 = vld1q_f64 (z + 4), h2 = vld1q_f64 (z + 6);
+        float64x2_t sum = vld1q_f64 (e);
+
+        for (int i = 0; i < frames; i ++)
+        {
+            float64x2_t in = vld1q_f64 (x + i * m_lanes);
+
+            float64x2_t y = vaddq_f64 (vmulq_f64 (sb0, in), s1);
+            s1 = vsubq_f64 (vaddq_f64 (vmulq_f64 (sb1, in), s2), vmulq_f64 (sa1, y));
+            s2 = vsubq_f64 (vmulq_f64 (sb2, in), vmulq_f64 (sa2, y));
+
+            float64x2_t out = vaddq_f64 (vmulq_f64 (hb0, y), h1);
+            h1 = vsubq_f64 (vaddq_f64 (vmulq_f64 (hb1, y), h2), vmulq_f64 (ha1, out));
+            h2 = vsubq_f64 (vmulq_f64 (hb2, y), vmulq_f64 (ha2, out));
+
+            sum = vaddq_f64 (sum, vmulq_f64 (out, out));
+        }
+
+        vst1q_f64 (z, s1);
+        vst1q_f64 (z + 2, s2);
+        vst1q_f64 (z + 4, h1);
+        vst1q_f64 (z + 6, h2);
+        vst1q_f64 (e, sum);
+#else
+        for (int l = 0; l < 2; l ++)
+        {
+            double s1 = z[l], s2 = z[2 + l], h1 = z[4 + l], h2 = z[6 + l];
+            double sum = e[l];
+
+            for (int i = 0; i < frames; i ++)
+            {
+                double in = x[i * m_lanes + l];
+
+                double y = s.b0 * in + s1;
+                s1 = s.b1 * in + s2 - s.a1 * y;
+                s2 = s.b2 * in - s.a2 * y;
+
+                double out = h.b0 * y + h1;
+                h1 = h.b1 * y + h2 - h.a1 * out;
+                h2 = h.b2 * y - h.a2 * out;
+
+                sum += out * out;
+            }
+
+            z[l] = s1;
+            z[2 + l] = s2;
+            z[4 + l] = h1;
+            z[6 + l] = h2;
+            e[l] = sum;
+        }
+#endif
+
+        /* keep the decaying filter state out of the denormal range */
+        for (int k = 0; k < 8; k ++)
+        {
+            if (fabs (z[k]) < 1e-30)
+                z[k] = 0;
+        }
+    }
+}
+
+void LoudnessMeter::true_peak (int frames)
+{
+    float peak = m_result.peak;
+
+    for (int c = 0; c < m_channels; c ++)
+    {
+        float * history = m_history.begin () + c * (TAPS - 1 + BLOCK);
+
+        for (int p = 0; p < m_factor; p ++)
+        {
+            const float * h = m_phases.begin () + p * TAPS;
+            int i = 0;
+
+#if defined (__SSE2__)
+            __m128 coefs[TAPS];
+            for (int k = 0; k < TAPS; k ++)
+                coefs[k] = _mm_set1_ps (h[k]);
+
+            __m128 sign = _mm_set1_ps (-0.0f);
+            __m128 max = _mm_setzero_ps ();
+
+            for (; i + 4 <= frames; i += 4)
+            {
+                __m128 acc = _mm_setzero_ps ();
+                for (int k = 0; k < TAPS; k ++)
+                    acc = _mm_add_ps (acc, _mm_mul_ps (coefs[k], _mm_loadu_ps (history + i + k)));
+
+                max = _mm_max_ps (max, _mm_andnot_ps (sign, acc));
+            }
+
+            max = _mm_max_ps (max, _mm_movehl_ps (max, max));
+            max = _mm_max_ss (max, _mm_shuffle_ps (max, max, 1));
+            peak = aud::max (peak, _mm_cvtss_f32 (max));
+#elif defined (__ARM_NEON) || defined (__ARM_NEON__)
+            float32x4_t max = vdupq_n_f32 (0);
+
+            for (; i + 4 <= frames; i += 4)
+            {
+                float32x4_t acc = vdupq_n_f32 (0);
+                for (int k = 0; k < TAPS; k ++)
+                    acc = vmlaq_n_f32 (acc, vld1q_f32 (history + i + k), h[k]);
+
+                max = vmaxq_f32 (max, vabsq_f32 (acc));
+            }
+
+            float32x2_t max2 = vpmax_f32 (vget_low_f32 (max), vget_high_f32 (max));
+            max2 = vpmax_f32 (max2, max2);
+            peak = aud::max (peak, vget_lane_f32 (max2, 0));
+#endif
+
+            for (; i < frames; i ++)
+            {
+                float acc = 0;
+                for (int k = 0; k < TAPS; k ++)
+                    acc += h[k] * history[i + k];
+
+                peak = aud::max (peak, fabsf (acc));
+            }
+        }
+
+        memmove (history, history + frames, sizeof (float) * (TAPS - 1));
+    }
+
+    m_result.peak = peak;
+}
+
+/* Every 100 ms, a 400 ms momentary block (75% overlap) is gated into the
+ * histogram for integrated loudness; every second, a 3 s short-term block is
+ * gated into the one for loudness range. */
+void LoudnessMeter::end_sub_block ()
+{
+    double sum = 0;
+
+    for (int lane = 0; lane < m_lanes; lane ++)
+    {
+        sum += m_weights[lane] * m_energy[lane];
+        m_energy[lane] = 0;
+    }
+
+    m_sub_blocks[m_sub_count % 30] = sum;
+    m_sub_count ++;
+    m_sub_pos = 0;
+
+    if (m_sub_count >= 4)
+    {
+        double energy = 0;
+        for (int j = 1; j <= 4; j ++)
+            energy += m_sub_blocks[(m_sub_count - j) % 30];
+
+        energy /= 4.0 * m_sub_len;
+
+        int bin = block_bin (energy);
+        if (bin >= 0)
+        {
+            m_result.blocks[bin] ++;
+            m_result.energy[bin] += energy;
+        }
+    }
+
+    if (m_sub_count >= 30 && (m_sub_count - 30) % 10 == 0)
+    {
+        double energy = 0;
+        for (double sub_block : m_sub_blocks)
+            energy += sub_block;
+
+        int bin = block_bin (energy / (30.0 * m_sub_len));
+        if (bin >= 0)
+            m_result.short_term[bin] ++;
+    }
+}
+
+void LoudnessMeter::process (const float * data, int frames)
+{
+    while (frames > 0)
+    {
+        int n = aud::min (frames, aud::min (BLOCK, m_sub_len - m_sub_pos));
+        float peak = m_result.peak;
+
+        for (int c = 0; c < m_channels; c ++)
+        {
+            const float * src = data + c;
+            double * block = m_block.begin () + c;
+            float * history = m_history.begin () + c * (TAPS - 1 + BLOCK) + TAPS - 1;
+
+            for (int i = 0; i < n; i ++)
+            {
+                float x = src[i * m_channels];
+                block[i * m_lanes] = x;
+                history[i] = x;
+                peak = aud::max (peak, fabsf (x));
+            }
+        }
+
+        m_result.peak = peak;
+
+        filter (n);
+        if (m_factor > 1)
+            true_peak (n);
+
+        data += n * m_channels;
+        frames -= n;
+
+        if ((m_sub_pos += n) == m_sub_len)
+            end_sub_block ();
+    }
+}
@@ -0,0 +1,94 @@
+/*
+ * Loudness Scanner Plugin for Audacious
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions, and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions, and the following disclaimer in the documentation
+ *    provided with the distribution.
+ *
+ * This software is provided "as is" and without any warranty, express or
+ * implied. In no event shall the authors be liable for any damages arising from
+ * the use of this software.
+ */
+
+#ifndef LOUDNESS_SCAN_METER_H
+#define LOUDNESS_SCAN_METER_H
+
+#include <libfauxdcore/index.h>
+
+/* Loudness meter after ITU-R BS.1770-4 and EBU Tech 3341/3342: K-weighted,
+ * gated integrated loudness, loudness range and true peak. */
+
+/* Gating blocks are collected in histograms of 0.1 LU bins from -70 LUFS
+ * (the absolute gate) up to +30 LUFS.  This bounds the memory needed for
+ * tracks of any length and lets the results of several tracks be merged to
+ * get album values. */
+#define HIST_BINS 1000
+
+struct LoudnessResult
+{
+    unsigned blocks[HIST_BINS];      /* 400 ms momentary blocks */
+    double energy[HIST_BINS];        /* summed energy of those blocks */
+    unsigned short_term[HIST_BINS];  /* 3 s short-term blocks */
+    float peak;                      /* true peak, linear */
+
+    void clear ();
+    void add (const LoudnessResult & other);
+
+    /* integrated loudness in LUFS, or -HUGE_VAL if everything was gated */
+    double integrated () const;
+    /* loudness range in LU */
+    double range () const;
+};
+
+class LoudnessMeter
+{
+public:
+    bool start (int channels, int rate);
+    /* data is interleaved */
+    void process (const float * data, int frames);
+
+    const LoudnessResult & result () const
+        { return m_result; }
+
+private:
+    struct Biquad {
+        double b0, b1, b2, a1, a2;
+    };
+
+    void filter (int frames);
+    void true_peak (int frames);
+    void end_sub_block ();
+
+    int m_channels = 0, m_lanes = 0;
+    Biquad m_shelf, m_highpass;
+
+    /* K-weighting runs on frame-major blocks of doubles, with the channels
+     * padded to an even number of lanes so that two channels are filtered
+     * at once.  The filter state and the energy sums are kept per lane. */
+    Index<double> m_block;
+    Index<double> m_state;   /* 4 per lane */
+    Index<double> m_energy;
+    Index<double> m_weights;
+
+    /* the last 30 sub-blocks of 100 ms, for the gating blocks */
+    double m_sub_blocks[30];
+    int m_sub_count = 0;
+    int m_sub_len = 0, m_sub_pos = 0;
+
+    /* true peak is measured by oversampling each channel with a polyphase
+     * interpolator; m_history holds, per channel, the last taps - 1 samples
+     * followed by the current block */
+    int m_factor = 1;
+    Index<float> m_phases;
+    Index<float> m_history;
+
+    LoudnessResult m_result;
+};
+
+#endif
@@ -0,0 +1,492 @@
+/*
+ * LV2 Host for Audacious
+ *
+ * Based on LADSPA Host for Audacious:
+ * Copyright 2011 John Lindgren
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions, and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions, and the following disclaimer in the documentation
+ *    provided with the distribution.
+ *
+ * This software is provided "as is" and without any warranty, express or
+ * implied. In no event shall the authors be liable for any damages arising from
+ * the use of this software.
+ */
+
+#include <lv2/atom/atom.h>
+#include <lv2/buf-size/buf-size.h>
+#include <lv2/options/options.h>
+
+#include "plugin.h"
+
+#include <libfauxdcore/runtime.h>
+
+bool chain_changed;
+int lv2_rate;
+
+static int lv2_channels;
+
+/* The audio is kept planar while it passes through the chain: each channel
+ * has LV2_BLOCK frames in each of two buffers.  Plugins that can run in
+ * place read and write the same buffer; the others write to the second
+ * buffer, after which the two are swapped. */
+static Index<float> chain_bufs[2];
+
+/* If any plugin in the chain requires a fixed block length, the whole chain
+ * runs in blocks of exactly LV2_BLOCK frames.  Input that does not fill a
+ * block is held back in the FIFO until the next call. */
+static bool chain_fixed;
+static Index<float> fifo;
+static int chain_latency;  /* frames */
+
+/* bufsz: options; the values are mapped in start() */
+static const int32_t min_block_any = 1;
+static const int32_t min_block_fixed = LV2_BLOCK;
+static const int32_t max_block = LV2_BLOCK;
+static const int32_t sequence_size = ATOM_BUFSIZE;
+
+static LV2_Options_Option options_any[5], options_fixed[5];
+static const LV2_Feature options_any_feature = {LV2_OPTIONS__options, options_any};
+static const LV2_Feature options_fixed_feature = {LV2_OPTIONS__options, options_fixed};
+
+static const LV2_Feature bounded_feature = {LV2_BUF_SIZE__boundedBlockLength, nullptr};
+static const LV2_Feature fixed_feature = {LV2_BUF_SIZE__fixedBlockLength, nullptr};
+static const LV2_Feature pow2_feature = {LV2_BUF_SIZE__powerOf2BlockLength, nullptr};
+
+static void set_option (LV2_Options_Option & option, LV2_URID key,
+ LV2_URID type, const int32_t * value)
+{
+    option.context = LV2_OPTIONS_INSTANCE;
+    option.subject = 0;
+    option.key = key;
+    option.size = sizeof (int32_t);
+    option.type = type;
+    option.value = value;
+}
+
+static void set_options (LV2_Options_Option * options, const int32_t * min_block)
+{
+    set_option (options[0], urids.bufsz_minBlockLength, urids.atom_Int, min_block);
+    set_option (options[1], urids.bufsz_maxBlockLength, urids.atom_Int, & max_block);
+    set_option (options[2], urids.bufsz_nominalBlockLength, urids.atom_Int, & max_block);
+    set_option (options[3], urids.bufsz_sequenceSize, urids.atom_Int, & sequence_size);
+    options[4] = LV2_Options_Option ();
+}
+
+static void free_instance (const PluginData & plugin, InstanceData & instance)
+{
+    lilv_instance_deactivate (instance.lilv);
+
+    if (plugin.has_worker)
+        worker_remove (instance);
+
+    lilv_instance_free (instance.lilv);
+    instance.lilv = nullptr;
+}
+
+static InstanceData * create_instance (LoadedPlugin & loaded, bool first)
+{
+    PluginData & plugin = loaded.plugin;
+    auto instance = new InstanceData;
+
+    const LV2_Feature * features[8];
+    int n_features = 0;
+
+    features[n_features ++] = & urid_map_feature;
+    features[n_features ++] = & urid_unmap_feature;
+    features[n_features ++] = & bounded_feature;
+
+    if (plugin.fixed_block)
+    {
+        features[n_features ++] = & options_fixed_feature;
+        features[n_features ++] = & fixed_feature;
+        features[n_features ++] = & pow2_feature;
+    }
+    else
+        features[n_features ++] = & options_any_feature;
+
+    if (plugin.has_worker)
+    {
+        worker_add (* instance);
+        features[n_features ++] = & instance->schedule_feature;
+    }
+
+    features[n_features] = nullptr;
+
+    instance->lilv = lilv_plugin_instantiate (plugin.lilv, lv2_rate, features);
+
+    if (! instance->lilv)
+    {
+        AUDERR ("Failed to instantiate plugin: %s\n", (const char *) plugin.name);
+
+        if (plugin.has_worker)
+            worker_remove (* instance);
+
+        delete instance;
+        return nullptr;
+    }
+
+    if (plugin.has_worker)
+        instance->worker = (const LV2_Worker_Interface *)
+         lilv_instance_get_extension_data (instance->lilv, LV2_WORKER__interface);
+
+    /* only the first instance writes its output controls where they can be
+     * seen; the others would just overwrite them */
+    int controls = plugin.controls.len ();
+    instance->outputs.insert (0, controls);
+
+    for (int c = 0; c < controls; c ++)
+    {
+        float * value = & loaded.values[c];
+        if (! first && plugin.controls[c].is_output)
+            value = & instance->outputs[c];
+
+        lilv_instance_connect_port (instance->lilv, plugin.controls[c].port, value);
+    }
+
+    int atom_ports = plugin.atom_in_ports.len () + plugin.atom_out_ports.len ();
+    instance->atom_bufs.insert (0, atom_ports * (ATOM_BUFSIZE / sizeof (uint64_t)));
+
+    uint64_t * buf = instance->atom_bufs.begin ();
+    for (int port : plugin.atom_in_ports)
+    {
+        lilv_instance_connect_port (instance->lilv, port, buf);
+        buf += ATOM_BUFSIZE / sizeof (uint64_t);
+    }
+    for (int port : plugin.atom_out_ports)
+    {
+        lilv_instance_connect_port (instance->lilv, port, buf);
+        buf += ATOM_BUFSIZE / sizeof (uint64_t);
+    }
+
+    for (int port : plugin.optional_ports)
+        lilv_instance_connect_port (instance->lilv, port, nullptr);
+
+    /* audio ports are connected for each block */
+
+    /* the control values were already taken from the state */
+    if (loaded.state)
+        lilv_state_restore (loaded.state, instance->lilv, nullptr, nullptr, 0, features);
+
+    lilv_instance_activate (instance->lilv);
+    return instance;
+}
+
+static void start_plugin (LoadedPlugin & loaded)
+{
+    if (loaded.active)
+        return;
+
+    loaded.active = true;
+
+    PluginData & plugin = loaded.plugin;
+    int ports = plugin.in_ports.len ();
+
+    if (lv2_channels % ports != 0)
+    {
+        AUDERR ("Plugin cannot be used with %d channels: %s\n",
+         lv2_channels, (const char *) plugin.name);
+        return;
+    }
+
+    int instances = lv2_channels / ports;
+
+    for (int i = 0; i < instances; i ++)
+    {
+        InstanceData * instance = create_instance (loaded, i == 0);
+
+        if (! instance)
+        {
+            for (auto & created : loaded.instances)
+                free_instance (plugin, * created);
+
+            loaded.instances.clear ();
+            return;
+        }
+
+        loaded.instances.append (instance);
+    }
+}
+
+/* called with the mutex locked after plugins are added or removed */
+static void setup_chain ()
+{
+    chain_fixed = false;
+
+    for (auto & loaded : loadeds)
+    {
+        start_plugin (* loaded);
+
+        if (loaded->instances.len () && loaded->plugin.fixed_block)
+            chain_fixed = true;
+    }
+
+    for (auto & buf : chain_bufs)
+        buf.resize (lv2_channels * LV2_BLOCK);
+
+    chain_changed = false;
+}
+
+static void reset_atom_ports (const PluginData & plugin, InstanceData & instance)
+{
+    uint64_t * buf = instance.atom_bufs.begin ();
+
+    /* empty sequences for input */
+    for (int i = 0; i < plugin.atom_in_ports.len (); i ++)
+    {
+        auto seq = (LV2_Atom_Sequence *) buf;
+        seq->atom.size = sizeof (LV2_Atom_Sequence_Body);
+        seq->atom.type = urids.atom_Sequence;
+        seq->body.unit = 0;
+        seq->body.pad = 0;
+
+        buf += ATOM_BUFSIZE / sizeof (uint64_t);
+    }
+
+    /* the available space for output */
+    for (int i = 0; i < plugin.atom_out_ports.len (); i ++)
+    {
+        auto atom = (LV2_Atom *) buf;
+        atom->size = ATOM_BUFSIZE - sizeof (LV2_Atom);
+        atom->type = urids.atom_Chunk;
+
+        buf += ATOM_BUFSIZE / sizeof (uint64_t);
+    }
+}
+
+/* runs frames frames through the chain, starting and ending in interleaved
+ * data */
+static void run_chain (float * data, int frames)
+{
+    while (frames > 0)
+    {
+        int block = aud::min (frames, LV2_BLOCK);
+        float * cur = chain_bufs[0].begin ();
+        float * other = chain_bufs[1].begin ();
+
+        for (int c = 0; c < lv2_channels; c ++)
+        {
+            const float * get = data + c;
+            float * set = cur + c * LV2_BLOCK;
+            float * end = set + block;
+
+            while (set < end)
+            {
+                * set ++ = * get;
+                get += lv2_channels;
+            }
+        }
+
+        for (auto & loaded : loadeds)
+        {
+            if (! loaded->instances.len ())
+                continue;
+
+            PluginData & plugin = loaded->plugin;
+
+            int ports = plugin.in_ports.len ();
+            float * out = plugin.in_place_broken ? other : cur;
+
+            for (int i = 0; i < loaded->instances.len (); i ++)
+            {
+                InstanceData & instance = * loaded->instances[i];
+
+                for (int p = 0; p < ports; p ++)
+                {
+                    int channel = ports * i + p;
+                    lilv_instance_connect_port (instance.lilv, plugin.in_ports[p], cur + channel * LV2_BLOCK);
+                    lilv_instance_connect_port (instance.lilv, plugin.out_ports[p], out + channel * LV2_BLOCK);
+                }
+
+                reset_atom_ports (plugin, instance);
+                lilv_instance_run (instance.lilv, block);
+                worker_deliver (instance);
+            }
+
+            if (plugin.in_place_broken)
+            {
+                other = cur;
+                cur = out;
+            }
+        }
+
+        for (int c = 0; c < lv2_channels; c ++)
+        {
+            const float * get = cur + c * LV2_BLOCK;
+            const float * end = get + block;
+            float * set = data + c;
+
+            while (get < end)
+            {
+                * set = * get ++;
+                set += lv2_channels;
+            }
+        }
+
+        data += lv2_channels * block;
+        frames -= block;
+    }
+}
+
+static void update_latency ()
+{
+    float latency = fifo.len () / lv2_channels;
+
+    for (auto & loaded : loadeds)
+    {
+        int control = loaded->plugin.latency_control;
+        if (control >= 0 && loaded->instances.len ())
+            latency += loaded->values[control];
+    }
+
+    __atomic_store_n (& chain_latency, (int) latency, __ATOMIC_RELAXED);
+}
+
+/* runs the data through the chain in fixed blocks, by way of the FIFO; at
+ * the end of a song, the last block is padded with silence */
+static void run_fixed (Index<float> & data, bool pad)
+{
+    fifo.insert (data.begin (), -1, data.len ());
+
+    int real = fifo.len () / lv2_channels;
+    int frames = real;
+
+    if (pad)
+    {
+        frames += (LV2_BLOCK - frames % LV2_BLOCK) % LV2_BLOCK;
+        fifo.insert (-1, (frames - real) * lv2_channels);
+    }
+    else
+        frames -= frames % LV2_BLOCK;
+
+    run_chain (fifo.begin (), frames);
+
+    data.resize (0);
+    data.move_from (fifo, 0, 0, aud::min (frames, real) * lv2_channels, true, true);
+
+    if (pad)
+        fifo.resize (0);
+}
+
+static void process_locked (Index<float> & data, bool end_of_song)
+{
+    if (chain_changed)
+        setup_chain ();
+
+    if (chain_fixed)
+        run_fixed (data, end_of_song);
+    else
+    {
+        /* anything left in the FIFO after leaving fixed mode goes out first */
+        if (fifo.len ())
+            data.move_from (fifo, 0, 0, -1, true, true);
+
+        run_chain (data.begin (), data.len () / lv2_channels);
+    }
+
+    update_latency ();
+}
+
+static void flush_plugin (LoadedPlugin & loaded)
+{
+    for (auto & instance : loaded.instances)
+    {
+        lilv_instance_deactivate (instance->lilv);
+        lilv_instance_activate (instance->lilv);
+    }
+}
+
+void shutdown_plugin_locked (LoadedPlugin & loaded)
+{
+    loaded.active = false;
+    chain_changed = true;
+
+    for (auto & instance : loaded.instances)
+        free_instance (loaded.plugin, * instance);
+
+    loaded.instances.clear ();
+}
+
+/* applies a new state (for example, a preset) to the running instances */
+void restore_state_locked (LoadedPlugin & loaded)
+{
+    if (! loaded.state)
+        return;
+
+    for (auto & instance : loaded.instances)
+        lilv_state_restore (loaded.state, instance->lilv, nullptr, nullptr, 0, state_features);
+}
+
+void LV2Host::start (int & channels, int & rate)
+{
+    pthread_mutex_lock (& mutex);
+
+    for (auto & loaded : loadeds)
+        shutdown_plugin_locked (* loaded);
+
+    lv2_channels = channels;
+    lv2_rate = rate;
+
+    set_options (options_any, & min_block_any);
+    set_options (options_fixed, & min_block_fixed);
+
+    fifo.resize (0);
+    chain_latency = 0;
+    chain_changed = true;
+
+    pthread_mutex_unlock (& mutex);
+}
+
+Index<float> & LV2Host::process (Index<float> & data)
+{
+    pthread_mutex_lock (& mutex);
+    process_locked (data, false);
+    pthread_mutex_unlock (& mutex);
+
+    return data;
+}
+
+bool LV2Host::flush (bool force)
+{
+    pthread_mutex_lock (& mutex);
+
+    for (auto & loaded : loadeds)
+        flush_plugin (* loaded);
+
+    fifo.resize (0);
+    update_latency ();
+
+    pthread_mutex_unlock (& mutex);
+    return true;
+}
+
+Index<float> & LV2Host::finish (Index<float> & data, bool end_of_playlist)
+{
+    pthread_mutex_lock (& mutex);
+
+    process_locked (data, true);
+
+    if (end_of_playlist)
+    {
+        for (auto & loaded : loadeds)
+            shutdown_plugin_locked (* loaded);
+    }
+
+    pthread_mutex_unlock (& mutex);
+    return data;
+}
+
+int LV2Host::adjust_delay (int delay)
+{
+    int latency = __atomic_load_n (& chain_latency, __ATOMIC_RELAXED);
+    if (! latency)
+        return delay;
+
+    return delay + aud::rescale (latency, lv2_rate, 1000);
+}
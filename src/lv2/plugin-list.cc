@@ -0,0 +1,34 @@
+/*
+ * LV2 Host for Audacious
+ *
+ * Based on LADSPA Host for Audacious:
+ * Copyright 2011 John Lindgren
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions, and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions, and the following disclaimer in the documentation
+ *    provided with the distribution.
+ *
+ * This software is provided "as is" and without any warranty, express or
+ * implied. In no event shall the authors be liable for any damages arising from
+ * the use of this software.
+ */
+
+#include "plugin.h"
+#include "../ladspa/plugin-lists.h"
+
+static const char * plugin_name (const PluginData & plugin)
+    { return plugin.name; }
+
+typedef AvailableList<PluginData, plugins, plugin_name> List;
+
+GtkWidget * create_plugin_list ()
+    { return List::create (); }
+
+void update_plugin_list (GtkWidget * list)
+    { List::update (list); }
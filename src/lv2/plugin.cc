@@ -0,0 +1,766 @@
+/*
+ * LV2 Host for Audacious
+ *
+ * Based on LADSPA Host for Audacious:
+ * Copyright 2011 John Lindgren
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions, and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions, and the following disclaimer in the documentation
+ *    provided with the distribution.
+ *
+ * This software is provided "as is" and without any warranty, express or
+ * implied. In no event shall the authors be liable for any damages arising from
+ * the use of this software.
+ */
+
+#include <string.h>
+
+#include <algorithm>
+
+#include <gtk/gtk.h>
+
+#include <lv2/atom/atom.h>
+#include <lv2/buf-size/buf-size.h>
+#include <lv2/core/lv2.h>
+#include <lv2/options/options.h>
+#include <lv2/presets/presets.h>
+#include <lv2/state/state.h>
+
+#include <libfauxdcore/audstrings.h>
+#include <libfauxdcore/preferences.h>
+#include <libfauxdcore/runtime.h>
+#include <libfauxdgui/gtk-compat.h>
+#include <libfauxdgui/libfauxdgui-gtk.h>
+
+#include "plugin.h"
+
+/* URI given to saved states; it is not resolved */
+#define STATE_URI "urn:fauxdacious:lv2-state"
+
+const char * const LV2Host::defaults[] = {
+ "plugin_count", "0",
+ nullptr};
+
+pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+LilvWorld * world;
+Index<SmartPtr<PluginData>> plugins;
+Index<SmartPtr<LoadedPlugin>> loadeds;
+
+GtkWidget * plugin_list;
+GtkWidget * loaded_list;
+
+static struct {
+    LilvNode * audio_port, * control_port, * atom_port;
+    LilvNode * input_port, * output_port;
+    LilvNode * toggled, * sample_rate, * reports_latency, * connection_optional;
+    LilvNode * worker_schedule, * worker_interface, * state_interface;
+    LilvNode * preset, * label;
+} lv2_nodes;
+
+/* features that plugins may require */
+static const char * const supported_features[] = {
+    LV2_URID__map,
+    LV2_URID__unmap,
+    LV2_OPTIONS__options,
+    LV2_BUF_SIZE__boundedBlockLength,
+    LV2_BUF_SIZE__fixedBlockLength,
+    LV2_BUF_SIZE__powerOf2BlockLength,
+    LV2_WORKER__schedule,
+    LV2_CORE__inPlaceBroken,
+    LV2_CORE__isLive,
+    LV2_CORE__hardRTCapable
+};
+
+static void create_nodes ()
+{
+    lv2_nodes.audio_port = lilv_new_uri (world, LV2_CORE__AudioPort);
+    lv2_nodes.control_port = lilv_new_uri (world, LV2_CORE__ControlPort);
+    lv2_nodes.atom_port = lilv_new_uri (world, LV2_ATOM__AtomPort);
+    lv2_nodes.input_port = lilv_new_uri (world, LV2_CORE__InputPort);
+    lv2_nodes.output_port = lilv_new_uri (world, LV2_CORE__OutputPort);
+    lv2_nodes.toggled = lilv_new_uri (world, LV2_CORE__toggled);
+    lv2_nodes.sample_rate = lilv_new_uri (world, LV2_CORE__sampleRate);
+    lv2_nodes.reports_latency = lilv_new_uri (world, LV2_CORE__reportsLatency);
+    lv2_nodes.connection_optional = lilv_new_uri (world, LV2_CORE__connectionOptional);
+    lv2_nodes.worker_schedule = lilv_new_uri (world, LV2_WORKER__schedule);
+    lv2_nodes.worker_interface = lilv_new_uri (world, LV2_WORKER__interface);
+    lv2_nodes.state_interface = lilv_new_uri (world, LV2_STATE__interface);
+    lv2_nodes.preset = lilv_new_uri (world, LV2_PRESETS__Preset);
+    lv2_nodes.label = lilv_new_uri (world, LILV_NS_RDFS "label");
+}
+
+static void free_nodes ()
+{
+    for (LilvNode * node : {lv2_nodes.audio_port, lv2_nodes.control_port,
+     lv2_nodes.atom_port, lv2_nodes.input_port, lv2_nodes.output_port, lv2_nodes.toggled,
+     lv2_nodes.sample_rate, lv2_nodes.reports_latency, lv2_nodes.connection_optional,
+     lv2_nodes.worker_schedule, lv2_nodes.worker_interface, lv2_nodes.state_interface,
+     lv2_nodes.preset, lv2_nodes.label})
+        lilv_node_free (node);
+
+    lv2_nodes = decltype (lv2_nodes) ();
+}
+
+static float node_to_float (const LilvNode * node, float fallback)
+{
+    if (node && (lilv_node_is_float (node) || lilv_node_is_int (node)))
+        return lilv_node_as_float (node);
+
+    return fallback;
+}
+
+static ControlData parse_control (const LilvPlugin * lilv, const LilvPort * port, int index)
+{
+    ControlData control;
+    control.port = index;
+
+    LilvNode * name = lilv_port_get_name (lilv, port);
+    control.name = String (name ? lilv_node_as_string (name) : "");
+    lilv_node_free (name);
+
+    control.symbol = String (lilv_node_as_string (lilv_port_get_symbol (lilv, port)));
+    control.is_toggle = lilv_port_has_property (lilv, port, lv2_nodes.toggled);
+    control.is_output = lilv_port_is_a (lilv, port, lv2_nodes.output_port);
+
+    LilvNode * def, * min, * max;
+    lilv_port_get_range (lilv, port, & def, & min, & max);
+
+    bool has_min = min && (lilv_node_is_float (min) || lilv_node_is_int (min));
+    bool has_max = max && (lilv_node_is_float (max) || lilv_node_is_int (max));
+
+    control.min = has_min ? node_to_float (min, 0) :
+     has_max ? node_to_float (max, 0) - 100 : -100;
+    control.max = has_max ? node_to_float (max, 0) :
+     has_min ? node_to_float (min, 0) + 100 : 100;
+
+    if (lilv_port_has_property (lilv, port, lv2_nodes.sample_rate))
+    {
+        control.min *= 96000;
+        control.max *= 96000;
+    }
+
+    control.def = aud::clamp (node_to_float (def, control.min), control.min, control.max);
+
+    lilv_node_free (def);
+    lilv_node_free (min);
+    lilv_node_free (max);
+
+    return control;
+}
+
+static bool check_features (const LilvPlugin * lilv, PluginData & plugin)
+{
+    LilvNodes * required = lilv_plugin_get_required_features (lilv);
+    bool usable = true;
+
+    LILV_FOREACH (nodes, i, required)
+    {
+        const char * uri = lilv_node_as_uri (lilv_nodes_get (required, i));
+
+        if (! strcmp (uri, LV2_BUF_SIZE__fixedBlockLength) ||
+         ! strcmp (uri, LV2_BUF_SIZE__powerOf2BlockLength))
+            plugin.fixed_block = true;
+        else if (! strcmp (uri, LV2_CORE__inPlaceBroken))
+            plugin.in_place_broken = true;
+
+        auto is_uri = [uri] (const char * s) { return ! strcmp (s, uri); };
+
+        if (std::none_of (std::begin (supported_features),
+         std::end (supported_features), is_uri))
+        {
+            AUDDBG ("Plugin %s requires unsupported feature %s\n",
+             (const char *) plugin.uri, uri);
+            usable = false;
+        }
+    }
+
+    lilv_nodes_free (required);
+    return usable;
+}
+
+static void open_plugin (const LilvPlugin * lilv)
+{
+    const char * uri = lilv_node_as_uri (lilv_plugin_get_uri (lilv));
+    LilvNode * name = lilv_plugin_get_name (lilv);
+    SmartPtr<PluginData> plugin (new PluginData (lilv, uri,
+     name ? lilv_node_as_string (name) : uri));
+    lilv_node_free (name);
+
+    if (! check_features (lilv, * plugin))
+        return;
+
+    /* scheduling work is no use without the interface to do it */
+    plugin->has_worker = lilv_plugin_has_feature (lilv, lv2_nodes.worker_schedule) &&
+     lilv_plugin_has_extension_data (lilv, lv2_nodes.worker_interface);
+    plugin->has_state = lilv_plugin_has_extension_data (lilv, lv2_nodes.state_interface);
+
+    int ports = lilv_plugin_get_num_ports (lilv);
+
+    for (int i = 0; i < ports; i ++)
+    {
+        const LilvPort * port = lilv_plugin_get_port_by_index (lilv, i);
+        bool is_output = lilv_port_is_a (lilv, port, lv2_nodes.output_port);
+
+        if (lilv_port_is_a (lilv, port, lv2_nodes.control_port))
+        {
+            if (is_output && lilv_port_has_property (lilv, port, lv2_nodes.reports_latency))
+                plugin->latency_control = plugin->controls.len ();
+
+            plugin->controls.append (parse_control (lilv, port, i));
+        }
+        else if (lilv_port_is_a (lilv, port, lv2_nodes.audio_port))
+            (is_output ? plugin->out_ports : plugin->in_ports).append (i);
+        else if (lilv_port_is_a (lilv, port, lv2_nodes.atom_port))
+            (is_output ? plugin->atom_out_ports : plugin->atom_in_ports).append (i);
+        else if (lilv_port_has_property (lilv, port, lv2_nodes.connection_optional))
+            plugin->optional_ports.append (i);
+        else
+        {
+            AUDDBG ("Plugin %s has unsupported port %d\n", uri, i);
+            return;
+        }
+    }
+
+    if (! plugin->in_ports.len () || plugin->in_ports.len () != plugin->out_ports.len ())
+    {
+        AUDDBG ("Plugin %s has unusable port configuration\n", uri);
+        return;
+    }
+
+    plugins.append (std::move (plugin));
+}
+
+static void open_world ()
+{
+    world = lilv_world_new ();
+    lilv_world_load_all (world);
+
+    create_nodes ();
+
+    const LilvPlugins * all = lilv_world_get_all_plugins (world);
+
+    LILV_FOREACH (plugins, i, all)
+        open_plugin (lilv_plugins_get (all, i));
+}
+
+static void close_world ()
+{
+    plugins.clear ();
+    free_nodes ();
+
+    lilv_world_free (world);
+    world = nullptr;
+}
+
+/* presets are only looked up when the settings are first shown */
+static void load_presets (PluginData & plugin)
+{
+    if (plugin.presets_loaded)
+        return;
+
+    LilvNodes * presets = lilv_plugin_get_related (plugin.lilv, lv2_nodes.preset);
+
+    LILV_FOREACH (nodes, i, presets)
+    {
+        const LilvNode * node = lilv_nodes_get (presets, i);
+        lilv_world_load_resource (world, node);
+
+        LilvNodes * labels = lilv_world_find_nodes (world, node, lv2_nodes.label, nullptr);
+        const LilvNode * label = labels ? lilv_nodes_get_first (labels) : nullptr;
+
+        PresetData & preset = plugin.presets.append ();
+        preset.uri = String (lilv_node_as_uri (node));
+        preset.label = String (label ? lilv_node_as_string (label) : lilv_node_as_uri (node));
+
+        lilv_nodes_free (labels);
+    }
+
+    lilv_nodes_free (presets);
+
+    plugin.presets.sort ([] (const PresetData & a, const PresetData & b)
+        { return str_compare (a.label, b.label); });
+
+    plugin.presets_loaded = true;
+}
+
+static int find_control (const PluginData & plugin, const char * symbol)
+{
+    for (int i = 0; i < plugin.controls.len (); i ++)
+    {
+        if (! strcmp (plugin.controls[i].symbol, symbol))
+            return i;
+    }
+
+    return -1;
+}
+
+static void set_port_value (const char * symbol, void * user, const void * value,
+ uint32_t size, uint32_t type)
+{
+    auto loaded = (LoadedPlugin *) user;
+    int control = find_control (loaded->plugin, symbol);
+    if (control < 0)
+        return;
+
+    if (type == urids.atom_Float && size == sizeof (float))
+        loaded->values[control] = * (const float *) value;
+    else if (type == urids.atom_Double && size == sizeof (double))
+        loaded->values[control] = * (const double *) value;
+    else if (type == urids.atom_Int && size == sizeof (int32_t))
+        loaded->values[control] = * (const int32_t *) value;
+}
+
+static const void * get_port_value (const char * symbol, void * user,
+ uint32_t * size, uint32_t * type)
+{
+    auto loaded = (LoadedPlugin *) user;
+    int control = find_control (loaded->plugin, symbol);
+    if (control < 0)
+        return nullptr;
+
+    * size = sizeof (float);
+    * type = urids.atom_Float;
+    return & loaded->values[control];
+}
+
+LoadedPlugin & enable_plugin_locked (PluginData & plugin)
+{
+    LoadedPlugin & loaded = * loadeds.append (new LoadedPlugin (plugin));
+
+    for (auto & control : plugin.controls)
+        loaded.values.append (control.def);
+
+    chain_changed = true;
+    return loaded;
+}
+
+void disable_plugin_locked (LoadedPlugin & loaded)
+{
+    if (loaded.settings_win)
+        gtk_widget_destroy (loaded.settings_win);
+
+    shutdown_plugin_locked (loaded);
+}
+
+static PluginData * find_plugin (const char * uri)
+{
+    for (auto & plugin : plugins)
+    {
+        if (! strcmp (plugin->uri, uri))
+            return plugin.get ();
+    }
+
+    return nullptr;
+}
+
+/* Only plugins with internal state (state:interface) need more than their
+ * control values saved.  The state is taken from the running plugin if
+ * there is one, otherwise the last one loaded is kept. */
+static String save_state (LoadedPlugin & loaded)
+{
+    PluginData & plugin = loaded.plugin;
+    if (! plugin.has_state)
+        return String ();
+
+    LilvState * state = loaded.state;
+
+    if (loaded.instances.len ())
+        state = lilv_state_new_from_instance (plugin.lilv, loaded.instances[0]->lilv,
+         & urid_map, nullptr, nullptr, nullptr, nullptr, get_port_value, & loaded,
+         LV2_STATE_IS_POD | LV2_STATE_IS_PORTABLE, state_features);
+
+    if (! state)
+        return String ();
+
+    char * str = lilv_state_to_string (world, & urid_map, & urid_unmap, state,
+     STATE_URI, nullptr);
+
+    if (state != loaded.state)
+        lilv_state_free (state);
+
+    if (! str)
+        return String ();
+
+    /* Turtle spans several lines */
+    String encoded (str_encode_percent (str));
+    lilv_free (str);
+
+    return encoded;
+}
+
+static void load_state (LoadedPlugin & loaded, const char * encoded)
+{
+    if (! encoded[0])
+        return;
+
+    loaded.state = lilv_state_new_from_string (world, & urid_map,
+     str_decode_percent (encoded));
+
+    if (! loaded.state)
+        AUDERR ("Failed to load saved state of %s\n", (const char *) loaded.plugin.name);
+}
+
+static void save_enabled_to_config ()
+{
+    int count = loadeds.len ();
+    int old_count = aud_get_int ("lv2", "plugin_count");
+    aud_set_int ("lv2", "plugin_count", count);
+
+    for (int i = 0; i < count; i ++)
+    {
+        LoadedPlugin & loaded = * loadeds[i];
+
+        aud_set_str ("lv2", str_printf ("plugin%d_uri", i), loaded.plugin.uri);
+
+        Index<double> temp;
+        temp.insert (0, loaded.values.len ());
+        std::copy (loaded.values.begin (), loaded.values.end (), temp.begin ());
+
+        aud_set_str ("lv2", str_printf ("plugin%d_controls", i),
+         double_array_to_str (temp.begin (), temp.len ()));
+
+        String state = save_state (loaded);
+        aud_set_str ("lv2", str_printf ("plugin%d_state", i), state ? state : "");
+
+        disable_plugin_locked (loaded);
+    }
+
+    loadeds.clear ();
+
+    for (int i = count; i < old_count; i ++)
+    {
+        aud_set_str ("lv2", str_printf ("plugin%d_uri", i), "");
+        aud_set_str ("lv2", str_printf ("plugin%d_controls", i), "");
+        aud_set_str ("lv2", str_printf ("plugin%d_state", i), "");
+    }
+}
+
+static void load_enabled_from_config ()
+{
+    int count = aud_get_int ("lv2", "plugin_count");
+
+    for (int i = 0; i < count; i ++)
+    {
+        String uri = aud_get_str ("lv2", str_printf ("plugin%d_uri", i));
+
+        PluginData * plugin = find_plugin (uri);
+        if (! plugin)
+            continue;
+
+        LoadedPlugin & loaded = enable_plugin_locked (* plugin);
+
+        String controls = aud_get_str ("lv2", str_printf ("plugin%d_controls", i));
+
+        Index<double> temp;
+        temp.insert (0, loaded.values.len ());
+
+        if (str_to_double_array (controls, temp.begin (), temp.len ()))
+            std::copy (temp.begin (), temp.end (), loaded.values.begin ());
+
+        load_state (loaded, aud_get_str ("lv2", str_printf ("plugin%d_state", i)));
+    }
+}
+
+bool LV2Host::init ()
+{
+    pthread_mutex_lock (& mutex);
+
+    aud_config_set_defaults ("lv2", defaults);
+
+    urid_init ();
+    open_world ();
+    load_enabled_from_config ();
+
+    pthread_mutex_unlock (& mutex);
+
+    worker_start ();
+    return true;
+}
+
+void LV2Host::cleanup ()
+{
+    pthread_mutex_lock (& mutex);
+
+    save_enabled_to_config ();
+    close_world ();
+
+    plugins.clear ();
+    loadeds.clear ();
+
+    urid_cleanup ();
+
+    pthread_mutex_unlock (& mutex);
+
+    worker_stop ();
+}
+
+static void enable_selected ()
+{
+    pthread_mutex_lock (& mutex);
+
+    for (auto & plugin : plugins)
+    {
+        if (plugin->selected)
+            enable_plugin_locked (* plugin);
+    }
+
+    pthread_mutex_unlock (& mutex);
+
+    if (loaded_list)
+        update_loaded_list (loaded_list);
+}
+
+static void disable_selected ()
+{
+    pthread_mutex_lock (& mutex);
+
+    for (int i = 0; i < loadeds.len ();)
+    {
+        if (loadeds[i]->selected)
+        {
+            disable_plugin_locked (* loadeds[i]);
+            loadeds.remove (i, 1);
+        }
+        else
+            i ++;
+    }
+
+    pthread_mutex_unlock (& mutex);
+
+    if (loaded_list)
+        update_loaded_list (loaded_list);
+}
+
+static void control_toggled (GtkToggleButton * toggle, float * value)
+{
+    pthread_mutex_lock (& mutex);
+    * value = gtk_toggle_button_get_active (toggle) ? 1 : 0;
+    pthread_mutex_unlock (& mutex);
+}
+
+static void control_changed (GtkSpinButton * spin, float * value)
+{
+    pthread_mutex_lock (& mutex);
+    * value = gtk_spin_button_get_value (spin);
+    pthread_mutex_unlock (& mutex);
+}
+
+/* Switching presets does not create new instances: the control values are
+ * taken from the preset, and its internal state (if any) is restored into
+ * the running instances between two blocks. */
+static void preset_changed (GtkComboBox * combo, LoadedPlugin * loaded)
+{
+    int row = gtk_combo_box_get_active (combo);
+    if (row < 0 || row >= loaded->plugin.presets.len ())
+        return;
+
+    const PresetData & preset = loaded->plugin.presets[row];
+
+    LilvNode * node = lilv_new_uri (world, preset.uri);
+    LilvState * state = lilv_state_new_from_world (world, & urid_map, node);
+    lilv_node_free (node);
+
+    if (! state)
+    {
+        AUDERR ("Failed to load preset %s\n", (const char *) preset.uri);
+        return;
+    }
+
+    pthread_mutex_lock (& mutex);
+
+    lilv_state_emit_port_values (state, set_port_value, loaded);
+
+    if (loaded->state)
+        lilv_state_free (loaded->state);
+
+    loaded->state = state;
+    restore_state_locked (* loaded);
+
+    pthread_mutex_unlock (& mutex);
+
+    /* show the new values */
+    for (int i = 0; i < loaded->control_widgets.len (); i ++)
+    {
+        GtkWidget * widget = loaded->control_widgets[i];
+
+        if (! widget)
+            continue;
+
+        if (loaded->plugin.controls[i].is_toggle)
+            gtk_toggle_button_set_active ((GtkToggleButton *) widget, loaded->values[i] > 0);
+        else
+            gtk_spin_button_set_value ((GtkSpinButton *) widget, loaded->values[i]);
+    }
+}
+
+static void configure_plugin (LoadedPlugin & loaded)
+{
+    if (loaded.settings_win)
+    {
+        gtk_window_present ((GtkWindow *) loaded.settings_win);
+        return;
+    }
+
+    PluginData & plugin = loaded.plugin;
+
+    StringBuf title = str_printf (_("%s Settings"), (const char *) plugin.name);
+    loaded.settings_win = gtk_dialog_new_with_buttons (title, nullptr,
+     (GtkDialogFlags) 0, _("_Close"), GTK_RESPONSE_CLOSE, nullptr);
+    gtk_window_set_resizable ((GtkWindow *) loaded.settings_win, 0);
+
+    GtkWidget * vbox = gtk_dialog_get_content_area ((GtkDialog *) loaded.settings_win);
+
+    load_presets (plugin);
+
+    if (plugin.presets.len ())
+    {
+        GtkWidget * hbox = audgui_hbox_new (6);
+        gtk_box_pack_start ((GtkBox *) vbox, hbox, 0, 0, 0);
+
+        GtkWidget * label = gtk_label_new (_("Preset:"));
+        gtk_box_pack_start ((GtkBox *) hbox, label, 0, 0, 0);
+
+        GtkWidget * combo = gtk_combo_box_text_new ();
+        for (auto & preset : plugin.presets)
+            gtk_combo_box_text_append_text ((GtkComboBoxText *) combo, preset.label);
+
+        gtk_box_pack_start ((GtkBox *) hbox, combo, 0, 0, 0);
+
+        g_signal_connect (combo, "changed", (GCallback) preset_changed, & loaded);
+    }
+
+    int count = plugin.controls.len ();
+    loaded.control_widgets.clear ();
+    loaded.control_widgets.insert (0, count);
+
+    for (int i = 0; i < count; i ++)
+    {
+        ControlData & control = plugin.controls[i];
+
+        if (control.is_output)
+            continue;
+
+        GtkWidget * hbox = audgui_hbox_new (6);
+        gtk_box_pack_start ((GtkBox *) vbox, hbox, 0, 0, 0);
+
+        if (control.is_toggle)
+        {
+            GtkWidget * toggle = gtk_check_button_new_with_label (control.name);
+            gtk_toggle_button_set_active ((GtkToggleButton *) toggle, (loaded.values[i] > 0) ? 1 : 0);
+            gtk_box_pack_start ((GtkBox *) hbox, toggle, 0, 0, 0);
+
+            g_signal_connect (toggle, "toggled", (GCallback) control_toggled, & loaded.values[i]);
+            loaded.control_widgets[i] = toggle;
+        }
+        else
+        {
+            GtkWidget * label = gtk_label_new (str_printf ("%s:", (const char *) control.name));
+            gtk_box_pack_start ((GtkBox *) hbox, label, 0, 0, 0);
+
+            GtkWidget * spin = gtk_spin_button_new_with_range (control.min, control.max, 0.01);
+            gtk_spin_button_set_value ((GtkSpinButton *) spin, loaded.values[i]);
+            gtk_box_pack_start ((GtkBox *) hbox, spin, 0, 0, 0);
+
+            g_signal_connect (spin, "value-changed", (GCallback) control_changed, & loaded.values[i]);
+            loaded.control_widgets[i] = spin;
+        }
+    }
+
+    g_signal_connect (loaded.settings_win, "response", (GCallback) gtk_widget_destroy, nullptr);
+    g_signal_connect (loaded.settings_win, "destroy", (GCallback)
+     gtk_widget_destroyed, & loaded.settings_win);
+
+    gtk_widget_show_all (loaded.settings_win);
+}
+
+static void configure_selected ()
+{
+    pthread_mutex_lock (& mutex);
+
+    for (auto & loaded : loadeds)
+    {
+        if (loaded->selected)
+            configure_plugin (* loaded);
+    }
+
+    pthread_mutex_unlock (& mutex);
+}
+
+static void * make_config_widget ()
+{
+    int dpi = audgui_get_dpi ();
+
+    GtkWidget * vbox = audgui_vbox_new (6);
+    gtk_widget_set_size_request (vbox, 5 * dpi, 4 * dpi);
+
+    GtkWidget * hbox = audgui_hbox_new (6);
+    gtk_box_pack_start ((GtkBox *) vbox, hbox, 1, 1, 0);
+
+    GtkWidget * vbox2 = audgui_vbox_new (6);
+    gtk_box_pack_start ((GtkBox *) hbox, vbox2, 1, 1, 0);
+
+    GtkWidget * label = gtk_label_new (_("Available plugins:"));
+    gtk_box_pack_start ((GtkBox *) vbox2, label, 0, 0, 0);
+
+    GtkWidget * scrolled = gtk_scrolled_window_new (nullptr, nullptr);
+    gtk_scrolled_window_set_shadow_type ((GtkScrolledWindow *) scrolled, GTK_SHADOW_IN);
+    gtk_box_pack_start ((GtkBox *) vbox2, scrolled, 1, 1, 0);
+
+    plugin_list = create_plugin_list ();
+    gtk_container_add ((GtkContainer *) scrolled, plugin_list);
+
+    GtkWidget * hbox2 = audgui_hbox_new (6);
+    gtk_box_pack_start ((GtkBox *) vbox2, hbox2, 0, 0, 0);
+
+    GtkWidget * enable_button = gtk_button_new_with_label (_("Enable"));
+    gtk_box_pack_end ((GtkBox *) hbox2, enable_button, 0, 0, 0);
+
+    vbox2 = audgui_vbox_new (6);
+    gtk_box_pack_start ((GtkBox *) hbox, vbox2, 1, 1, 0);
+
+    label = gtk_label_new (_("Enabled plugins:"));
+    gtk_box_pack_start ((GtkBox *) vbox2, label, 0, 0, 0);
+
+    scrolled = gtk_scrolled_window_new (nullptr, nullptr);
+    gtk_scrolled_window_set_shadow_type ((GtkScrolledWindow *) scrolled, GTK_SHADOW_IN);
+    gtk_box_pack_start ((GtkBox *) vbox2, scrolled, 1, 1, 0);
+
+    loaded_list = create_loaded_list ();
+    gtk_container_add ((GtkContainer *) scrolled, loaded_list);
+
+    hbox2 = audgui_hbox_new (6);
+    gtk_box_pack_start ((GtkBox *) vbox2, hbox2, 0, 0, 0);
+
+    GtkWidget * disable_button = gtk_button_new_with_label (_("Disable"));
+    gtk_box_pack_end ((GtkBox *) hbox2, disable_button, 0, 0, 0);
+
+    GtkWidget * settings_button = gtk_button_new_with_label (_("Settings"));
+    gtk_box_pack_end ((GtkBox *) hbox2, settings_button, 0, 0, 0);
+
+    g_signal_connect (plugin_list, "destroy", (GCallback) gtk_widget_destroyed, & plugin_list);
+    g_signal_connect (enable_button, "clicked", (GCallback) enable_selected, nullptr);
+    g_signal_connect (loaded_list, "destroy", (GCallback) gtk_widget_destroyed, & loaded_list);
+    g_signal_connect (disable_button, "clicked", (GCallback) disable_selected, nullptr);
+    g_signal_connect (settings_button, "clicked", (GCallback) configure_selected, nullptr);
+
+    return vbox;
+}
+
+const char LV2Host::about[] =
+ N_("LV2 Host for Audacious\n\n"
+    "Based on LADSPA Host for Audacious:\n"
+    "Copyright 2011 John Lindgren");
+
+const PreferencesWidget LV2Host::widgets[] = {
+    WidgetCustomGTK (make_config_widget)
+};
+
+const PluginPreferences LV2Host::prefs = {{widgets}};
+
+EXPORT LV2Host aud_plugin_instance;
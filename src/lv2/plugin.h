@@ -0,0 +1,223 @@
+/*
+ * LV2 Host for Audacious
+ *
+ * Based on LADSPA Host for Audacious:
+ * Copyright 2011 John Lindgren
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions, and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions, and the following disclaimer in the documentation
+ *    provided with the distribution.
+ *
+ * This software is provided "as is" and without any warranty, express or
+ * implied. In no event shall the authors be liable for any damages arising from
+ * the use of this software.
+ */
+
+#ifndef AUD_LV2_PLUGIN_H
+#define AUD_LV2_PLUGIN_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include <gtk/gtk.h>
+
+#include <lilv/lilv.h>
+#include <lv2/urid/urid.h>
+#include <lv2/worker/worker.h>
+
+#include <libfauxdcore/i18n.h>
+#include <libfauxdcore/plugin.h>
+
+/* Largest number of frames passed to run().  It is a power of two, so the
+ * chain can also run in fixed blocks of this size for plugins that require
+ * a fixed or power-of-two block length (bufsz: extension). */
+#define LV2_BLOCK 1024
+
+/* capacity of atom sequence ports and worker message rings, in bytes */
+#define ATOM_BUFSIZE 8192
+#define WORKER_RINGSIZE 8192
+
+struct PreferencesWidget;
+
+struct ControlData {
+    int port;
+    String name, symbol;
+    bool is_toggle;
+    bool is_output;
+    float min, max, def;
+};
+
+struct PresetData {
+    String uri, label;
+};
+
+struct PluginData
+{
+    const LilvPlugin * lilv;
+    String uri, name;
+    Index<ControlData> controls;
+    Index<int> in_ports, out_ports;
+    Index<int> atom_in_ports, atom_out_ports;
+    Index<int> optional_ports;  /* connected to nullptr */
+    int latency_control = -1;  /* output control reporting latency in frames */
+    bool fixed_block = false;  /* requires runs of exactly LV2_BLOCK frames */
+    bool in_place_broken = false;
+    bool has_worker = false;
+    bool has_state = false;  /* keeps internal state beyond its controls */
+    bool presets_loaded = false;
+    Index<PresetData> presets;
+    bool selected = false;
+
+    PluginData (const LilvPlugin * lilv, const char * uri, const char * name) :
+        lilv (lilv),
+        uri (uri),
+        name (name) {}
+};
+
+/* Single-producer, single-consumer queue of variable-size messages, used to
+ * pass worker requests and responses between the audio thread and the
+ * worker thread without locking. */
+class MessageRing
+{
+public:
+    void alloc (int size);
+    void clear ()
+        { m_head = m_tail = 0; }
+
+    bool write (const void * data, uint32_t size);
+    /* size of the next message, or 0 if there is none */
+    uint32_t peek ();
+    void read (void * data, uint32_t size);
+
+private:
+    void copy_in (unsigned pos, const void * data, uint32_t size);
+    void copy_out (unsigned pos, void * data, uint32_t size);
+
+    Index<char> m_buf;
+    unsigned m_head = 0, m_tail = 0;
+};
+
+struct InstanceData
+{
+    LilvInstance * lilv = nullptr;
+    const LV2_Worker_Interface * worker = nullptr;
+    MessageRing requests, responses;
+    Index<uint64_t> atom_bufs;  /* one ATOM_BUFSIZE buffer per atom port */
+    Index<float> outputs;       /* output controls of instances after the first */
+    LV2_Worker_Schedule schedule;
+    LV2_Feature schedule_feature;
+};
+
+struct LoadedPlugin
+{
+    PluginData & plugin;
+    Index<float> values;
+    bool selected = false;
+    bool active = false;
+    Index<SmartPtr<InstanceData>> instances;
+    LilvState * state = nullptr;  /* restored into each new instance */
+    GtkWidget * settings_win = nullptr;
+    Index<GtkWidget *> control_widgets;  /* in settings_win, per control */
+
+    LoadedPlugin (PluginData & plugin) :
+        plugin (plugin) {}
+
+    ~LoadedPlugin ()
+        { if (state) lilv_state_free (state); }
+};
+
+class LV2Host : public EffectPlugin
+{
+public:
+    static const char about[];
+    static const char * const defaults[];
+    static const PreferencesWidget widgets[];
+    static const PluginPreferences prefs;
+
+    static constexpr PluginInfo info = {
+        N_("LV2 Host"),
+        PACKAGE,
+        about,
+        & prefs
+    };
+
+    constexpr LV2Host () : EffectPlugin (info, 0, true) {}
+
+    bool init ();
+    void cleanup ();
+
+    void start (int & channels, int & rate);
+    Index<float> & process (Index<float> & data);
+    bool flush (bool force);
+    Index<float> & finish (Index<float> & data, bool end_of_playlist);
+    int adjust_delay (int delay);
+};
+
+/* plugin.cc */
+
+/* The mutex needs to be locked when the main thread is writing to the data
+ * structures below (but not when it is only reading from them) and when the
+ * audio thread is reading from them. */
+
+extern pthread_mutex_t mutex;
+extern LilvWorld * world;
+extern Index<SmartPtr<PluginData>> plugins;
+extern Index<SmartPtr<LoadedPlugin>> loadeds;
+
+extern GtkWidget * plugin_list;
+extern GtkWidget * loaded_list;
+
+LoadedPlugin & enable_plugin_locked (PluginData & plugin);
+void disable_plugin_locked (LoadedPlugin & loaded);
+
+/* urid.cc */
+
+extern LV2_URID_Map urid_map;
+extern LV2_URID_Unmap urid_unmap;
+extern const LV2_Feature urid_map_feature, urid_unmap_feature;
+extern const LV2_Feature * const state_features[];
+
+struct URIDs {
+    LV2_URID atom_Chunk, atom_Sequence, atom_Float, atom_Double, atom_Int;
+    LV2_URID bufsz_minBlockLength, bufsz_maxBlockLength,
+     bufsz_nominalBlockLength, bufsz_sequenceSize;
+};
+
+extern URIDs urids;
+
+void urid_init ();
+void urid_cleanup ();
+
+/* effect.cc */
+
+/* set (with the mutex locked) whenever plugins are added or removed */
+extern bool chain_changed;
+extern int lv2_rate;
+
+void shutdown_plugin_locked (LoadedPlugin & loaded);
+void restore_state_locked (LoadedPlugin & loaded);
+
+/* worker.cc */
+
+void worker_start ();
+void worker_stop ();
+void worker_add (InstanceData & instance);
+void worker_remove (InstanceData & instance);
+void worker_deliver (InstanceData & instance);
+
+/* plugin-list.cc */
+
+GtkWidget * create_plugin_list ();
+void update_plugin_list (GtkWidget * list);
+
+/* loaded-list.cc */
+
+GtkWidget * create_loaded_list ();
+void update_loaded_list (GtkWidget * list);
+
+#endif
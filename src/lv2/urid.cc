@@ -0,0 +1,98 @@
+/*
+ * LV2 Host for Audacious
+ *
+ * Based on LADSPA Host for Audacious:
+ * Copyright 2011 John Lindgren
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions, and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions, and the following disclaimer in the documentation
+ *    provided with the distribution.
+ *
+ * This software is provided "as is" and without any warranty, express or
+ * implied. In no event shall the authors be liable for any damages arising from
+ * the use of this software.
+ */
+
+#include <lv2/atom/atom.h>
+#include <lv2/buf-size/buf-size.h>
+
+#include <libfauxdcore/multihash.h>
+
+#include "plugin.h"
+
+/* URIDs are handed out in order, starting at 1; unmapping is a lookup by
+ * position.  Plugins may map URIs from any thread, hence the lock. */
+static pthread_mutex_t urid_mutex = PTHREAD_MUTEX_INITIALIZER;
+static SimpleHash<String, LV2_URID> urid_table;
+static Index<String> urid_list;
+
+static LV2_URID map_uri (LV2_URID_Map_Handle, const char * uri)
+{
+    pthread_mutex_lock (& urid_mutex);
+
+    String key (uri);
+    LV2_URID * found = urid_table.lookup (key);
+    LV2_URID urid;
+
+    if (found)
+        urid = * found;
+    else
+    {
+        urid_list.append (key);
+        urid = urid_list.len ();
+        urid_table.add (key, std::move (urid));
+    }
+
+    pthread_mutex_unlock (& urid_mutex);
+    return urid;
+}
+
+static const char * unmap_uri (LV2_URID_Unmap_Handle, LV2_URID urid)
+{
+    pthread_mutex_lock (& urid_mutex);
+    const char * uri = (urid > 0 && (int) urid <= urid_list.len ()) ?
+     (const char *) urid_list[urid - 1] : nullptr;
+    pthread_mutex_unlock (& urid_mutex);
+
+    return uri;
+}
+
+LV2_URID_Map urid_map = {nullptr, map_uri};
+LV2_URID_Unmap urid_unmap = {nullptr, unmap_uri};
+
+const LV2_Feature urid_map_feature = {LV2_URID__map, & urid_map};
+const LV2_Feature urid_unmap_feature = {LV2_URID__unmap, & urid_unmap};
+
+/* passed when saving and restoring plugin state */
+const LV2_Feature * const state_features[] = {
+    & urid_map_feature,
+    & urid_unmap_feature,
+    nullptr
+};
+
+URIDs urids;
+
+void urid_init ()
+{
+    urids.atom_Chunk = map_uri (nullptr, LV2_ATOM__Chunk);
+    urids.atom_Sequence = map_uri (nullptr, LV2_ATOM__Sequence);
+    urids.atom_Float = map_uri (nullptr, LV2_ATOM__Float);
+    urids.atom_Double = map_uri (nullptr, LV2_ATOM__Double);
+    urids.atom_Int = map_uri (nullptr, LV2_ATOM__Int);
+    urids.bufsz_minBlockLength = map_uri (nullptr, LV2_BUF_SIZE__minBlockLength);
+    urids.bufsz_maxBlockLength = map_uri (nullptr, LV2_BUF_SIZE__maxBlockLength);
+    urids.bufsz_nominalBlockLength = map_uri (nullptr, LV2_BUF_SIZE__nominalBlockLength);
+    urids.bufsz_sequenceSize = map_uri (nullptr, LV2_BUF_SIZE__sequenceSize);
+}
+
+void urid_cleanup ()
+{
+    urid_table.clear ();
+    urid_list.clear ();
+}
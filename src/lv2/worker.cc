@@ -0,0 +1,237 @@
+/*
+ * LV2 Host for Audacious
+ *
+ * Based on LADSPA Host for Audacious:
+ * Copyright 2011 John Lindgren
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions, and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions, and the following disclaimer in the documentation
+ *    provided with the distribution.
+ *
+ * This software is provided "as is" and without any warranty, express or
+ * implied. In no event shall the authors be liable for any damages arising from
+ * the use of this software.
+ */
+
+#include <semaphore.h>
+#include <string.h>
+
+#include "plugin.h"
+
+/* Plugins using the worker extension (worker:) schedule non-real-time work
+ * (loading files, building tables) from run().  The request is queued and
+ * the worker thread is woken with a semaphore, which is safe to post from
+ * the audio thread.  Responses are queued in the other direction and handed
+ * back to the plugin right after its next run(). */
+
+static pthread_t worker_thread;
+static bool worker_running;
+static bool worker_quit;
+static sem_t worker_sem;
+
+/* held by the worker thread while it calls work(), so that an instance is
+ * never destroyed under it */
+static pthread_mutex_t worker_mutex = PTHREAD_MUTEX_INITIALIZER;
+static Index<InstanceData *> worker_instances;
+
+void MessageRing::alloc (int size)
+{
+    m_buf.resize (size);
+    clear ();
+}
+
+void MessageRing::copy_in (unsigned pos, const void * data, uint32_t size)
+{
+    unsigned len = m_buf.len ();
+    unsigned offset = pos & (len - 1);
+    unsigned part = aud::min (size, len - offset);
+
+    memcpy (& m_buf[offset], data, part);
+    memcpy (& m_buf[0], (const char *) data + part, size - part);
+}
+
+void MessageRing::copy_out (unsigned pos, void * data, uint32_t size)
+{
+    unsigned len = m_buf.len ();
+    unsigned offset = pos & (len - 1);
+    unsigned part = aud::min (size, len - offset);
+
+    memcpy (data, & m_buf[offset], part);
+    memcpy ((char *) data + part, & m_buf[0], size - part);
+}
+
+bool MessageRing::write (const void * data, uint32_t size)
+{
+    unsigned tail = __atomic_load_n (& m_tail, __ATOMIC_ACQUIRE);
+
+    if (sizeof size + size > m_buf.len () - (m_head - tail))
+        return false;
+
+    copy_in (m_head, & size, sizeof size);
+    copy_in (m_head + sizeof size, data, size);
+
+    __atomic_store_n (& m_head, m_head + sizeof size + size, __ATOMIC_RELEASE);
+    return true;
+}
+
+uint32_t MessageRing::peek ()
+{
+    unsigned head = __atomic_load_n (& m_head, __ATOMIC_ACQUIRE);
+    if (head == m_tail)
+        return 0;
+
+    uint32_t size;
+    copy_out (m_tail, & size, sizeof size);
+    return size;
+}
+
+void MessageRing::read (void * data, uint32_t size)
+{
+    copy_out (m_tail + sizeof size, data, size);
+    __atomic_store_n (& m_tail, m_tail + sizeof size + size, __ATOMIC_RELEASE);
+}
+
+/* called by the plugin from run() */
+static LV2_Worker_Status schedule_work (LV2_Worker_Schedule_Handle handle,
+ uint32_t size, const void * data)
+{
+    auto instance = (InstanceData *) handle;
+
+    if (! instance->requests.write (data, size))
+        return LV2_WORKER_ERR_NO_SPACE;
+
+    sem_post (& worker_sem);
+    return LV2_WORKER_SUCCESS;
+}
+
+/* called by the plugin from work() */
+static LV2_Worker_Status respond (LV2_Worker_Respond_Handle handle,
+ uint32_t size, const void * data)
+{
+    auto instance = (InstanceData *) handle;
+
+    if (! instance->responses.write (data, size))
+        return LV2_WORKER_ERR_NO_SPACE;
+
+    return LV2_WORKER_SUCCESS;
+}
+
+static void * worker (void *)
+{
+    /* messages are often atoms, which are 64-bit aligned */
+    Index<uint64_t> message;
+    message.resize (WORKER_RINGSIZE / sizeof (uint64_t));
+
+    while (true)
+    {
+        sem_wait (& worker_sem);
+
+        if (__atomic_load_n (& worker_quit, __ATOMIC_ACQUIRE))
+            break;
+
+        pthread_mutex_lock (& worker_mutex);
+
+        for (InstanceData * instance : worker_instances)
+        {
+            if (! instance->worker)
+                continue;
+
+            uint32_t size;
+            while ((size = instance->requests.peek ()))
+            {
+                instance->requests.read (message.begin (), size);
+                instance->worker->work (lilv_instance_get_handle (instance->lilv),
+                 respond, instance, size, message.begin ());
+            }
+        }
+
+        pthread_mutex_unlock (& worker_mutex);
+    }
+
+    return nullptr;
+}
+
+void worker_start ()
+{
+    if (worker_running)
+        return;
+
+    sem_init (& worker_sem, 0, 0);
+    worker_quit = false;
+    worker_running = ! pthread_create (& worker_thread, nullptr, worker, nullptr);
+
+    if (! worker_running)
+        AUDERR ("Failed to start worker thread.\n");
+}
+
+void worker_stop ()
+{
+    if (! worker_running)
+        return;
+
+    __atomic_store_n (& worker_quit, true, __ATOMIC_RELEASE);
+    sem_post (& worker_sem);
+    pthread_join (worker_thread, nullptr);
+
+    sem_destroy (& worker_sem);
+    worker_running = false;
+}
+
+/* sets up the schedule feature; must be called before the instance is
+ * created, and the instance must be removed again before it is freed */
+void worker_add (InstanceData & instance)
+{
+    instance.requests.alloc (WORKER_RINGSIZE);
+    instance.responses.alloc (WORKER_RINGSIZE);
+
+    instance.schedule.handle = & instance;
+    instance.schedule.schedule_work = schedule_work;
+    instance.schedule_feature.URI = LV2_WORKER__schedule;
+    instance.schedule_feature.data = & instance.schedule;
+
+    pthread_mutex_lock (& worker_mutex);
+    worker_instances.append (& instance);
+    pthread_mutex_unlock (& worker_mutex);
+}
+
+void worker_remove (InstanceData & instance)
+{
+    pthread_mutex_lock (& worker_mutex);
+
+    for (int i = 0; i < worker_instances.len (); i ++)
+    {
+        if (worker_instances[i] == & instance)
+        {
+            worker_instances.remove (i, 1);
+            break;
+        }
+    }
+
+    pthread_mutex_unlock (& worker_mutex);
+}
+
+/* called from the audio thread after each run() */
+void worker_deliver (InstanceData & instance)
+{
+    if (! instance.worker)
+        return;
+
+    static uint64_t message[WORKER_RINGSIZE / sizeof (uint64_t)];
+    LV2_Handle handle = lilv_instance_get_handle (instance.lilv);
+
+    uint32_t size;
+    while ((size = instance.responses.peek ()))
+    {
+        instance.responses.read (message, size);
+        instance.worker->work_response (handle, size, message);
+    }
+
+    if (instance.worker->end_run)
+        instance.worker->end_run (handle);
+}
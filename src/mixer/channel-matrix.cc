@@ -0,0 +1,188 @@
+/*
+ * channel-matrix.cc
+ * Copyright 2011-2012 John Lindgren and Michał Lipski
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions, and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions, and the following disclaimer in the documentation
+ *    provided with the distribution.
+ *
+ * This software is provided "as is" and without any warranty, express or
+ * implied. In no event shall the authors be liable for any damages arising from
+ * the use of this software.
+ */
+
+#include <math.h>
+#include <string.h>
+
+#include "channel-matrix.h"
+
+/* Speaker positions, in the order in which they appear in the default
+ * layout for each channel count (the same order FFmpeg uses). */
+enum Speaker {
+    FL, FR, FC, LFE, BL, BR, BC, SL, SR, OTHER
+};
+
+static const Speaker layouts[9][8] = {
+    {},
+    {FC},                                /* mono */
+    {FL, FR},                            /* stereo */
+    {FL, FR, FC},                        /* 3.0 */
+    {FL, FR, BL, BR},                    /* quadro */
+    {FL, FR, FC, BL, BR},                /* 5.0 */
+    {FL, FR, FC, LFE, BL, BR},           /* 5.1 */
+    {FL, FR, FC, LFE, BC, SL, SR},       /* 6.1 */
+    {FL, FR, FC, LFE, BL, BR, SL, SR}    /* 7.1 */
+};
+
+static Speaker speaker_at (int channels, int i)
+{
+    if (channels <= 8)
+        return layouts[channels][i];
+
+    /* anything beyond 7.1 is passed through by channel number */
+    return (i < 8) ? layouts[8][i] : OTHER;
+}
+
+struct Matrix {
+    float * gains;
+    int stride;
+    int in_channels, out_channels;
+};
+
+static int find_output (const Matrix & m, Speaker speaker)
+{
+    for (int o = 0; o < m.out_channels; o ++)
+    {
+        if (speaker_at (m.out_channels, o) == speaker)
+            return o;
+    }
+
+    return -1;
+}
+
+static bool has_input (const Matrix & m, Speaker speaker)
+{
+    for (int i = 0; i < m.in_channels; i ++)
+    {
+        if (speaker_at (m.in_channels, i) == speaker)
+            return true;
+    }
+
+    return false;
+}
+
+/* Routes input channel i to the same output speaker if it exists, otherwise
+ * folds it into the nearest ones with the ITU-R BS.775 coefficients (center
+ * and surrounds at -3 dB, LFE at -6 dB into the fronts). */
+static void route (const Matrix & m, int i, Speaker speaker, float gain)
+{
+    int o = find_output (m, speaker);
+    if (o >= 0)
+    {
+        m.gains[i * m.stride + o] += gain;
+        return;
+    }
+
+    const float h = M_SQRT1_2;
+
+    switch (speaker)
+    {
+    case FL:
+    case FR:
+        route (m, i, FC, gain * h);
+        break;
+    case FC:
+        /* a mono source goes to both speakers at full level */
+        if (m.in_channels > 1)
+            gain *= h;
+
+        route (m, i, FL, gain);
+        route (m, i, FR, gain);
+        break;
+    case LFE:
+        route (m, i, FL, gain * 0.5f);
+        route (m, i, FR, gain * 0.5f);
+        break;
+    case BL:
+    case BR:
+    case SL:
+    case SR:
+    {
+        bool left = (speaker == BL || speaker == SL);
+        Speaker other = (speaker == BL) ? SL : (speaker == BR) ? SR :
+         (speaker == SL) ? BL : BR;
+
+        if (find_output (m, other) >= 0)
+            route (m, i, other, gain);
+        else
+            route (m, i, left ? FL : FR, gain * h);
+        break;
+    }
+    case BC:
+        route (m, i, BL, gain * h);
+        route (m, i, BR, gain * h);
+        break;
+    case OTHER:
+        break;
+    }
+}
+
+void channel_matrix_default (int in_channels, int out_channels, float * matrix, int stride)
+{
+    Matrix m = {matrix, stride, in_channels, out_channels};
+
+    memset (matrix, 0, sizeof (float) * in_channels * stride);
+
+    for (int i = 0; i < in_channels; i ++)
+    {
+        Speaker speaker = speaker_at (in_channels, i);
+
+        if (speaker != OTHER)
+            route (m, i, speaker, 1);
+        else if (i < out_channels && speaker_at (out_channels, i) == OTHER)
+            matrix[i * stride + i] = 1;
+    }
+
+    /* when upmixing plain stereo to a surround layout, copy the front
+     * channels to the rear */
+    if (has_input (m, FL) && has_input (m, FR) && ! has_input (m, BL) &&
+     ! has_input (m, SL) && ! has_input (m, BC))
+    {
+        int bl = find_output (m, BL), br = find_output (m, BR);
+        if (bl < 0 || br < 0)
+            bl = find_output (m, SL), br = find_output (m, SR);
+
+        if (bl >= 0 && br >= 0)
+        {
+            for (int i = 0; i < in_channels; i ++)
+            {
+                Speaker speaker = speaker_at (in_channels, i);
+
+                if (speaker == FL)
+                    matrix[i * stride + bl] += 1;
+                else if (speaker == FR)
+                    matrix[i * stride + br] += 1;
+            }
+        }
+    }
+
+    /* scale down any output that could otherwise clip */
+    for (int o = 0; o < out_channels; o ++)
+    {
+        float sum = 0;
+        for (int i = 0; i < in_channels; i ++)
+            sum += matrix[i * stride + o];
+
+        if (sum > 1)
+        {
+            for (int i = 0; i < in_channels; i ++)
+                matrix[i * stride + o] /= sum;
+        }
+    }
+}
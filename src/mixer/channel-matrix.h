@@ -0,0 +1,29 @@
+/*
+ * channel-matrix.h
+ * Copyright 2011-2012 John Lindgren and Michał Lipski
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions, and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions, and the following disclaimer in the documentation
+ *    provided with the distribution.
+ *
+ * This software is provided "as is" and without any warranty, express or
+ * implied. In no event shall the authors be liable for any damages arising from
+ * the use of this software.
+ */
+
+#ifndef MIXER_CHANNEL_MATRIX_H
+#define MIXER_CHANNEL_MATRIX_H
+
+// Fills in the default mixing matrix from in_channels to out_channels, as
+// used by both the channel mixer and crossfade.  matrix[i * stride + o] is
+// the gain from input channel i to output channel o; the first in_channels
+// rows of stride entries are overwritten, unused entries with zero.
+void channel_matrix_default (int in_channels, int out_channels, float * matrix, int stride);
+
+#endif
@@ -17,21 +17,34 @@
  * the use of this software.
  */
 
-/* TODO: implement more surround converters.
-         There should be more options for in * out cases (for example,
-         the user may wish to mix stereo up to quadro but keep 5.1 as-is,
-         rather than downmixing 5.1 to quadro). A possible design might
-         be a choice of output channels for each input channel count that
-         we care about. */
+/* TODO: The custom matrices cover any in * out case, but the output channel
+         count is still a single setting, so the user cannot, for example,
+         mix stereo up to quadro but keep 5.1 as-is.  A possible design might
+         be to let each custom matrix pick the output channel count for its
+         input channel count. */
 
 
+#include <math.h>
 #include <stdlib.h>
+#include <string.h>
 
+#if defined (__SSE__)
+#include <xmmintrin.h>
+#elif defined (__ARM_NEON) || defined (__ARM_NEON__)
+#include <arm_neon.h>
+#endif
+
+#include <libfauxdcore/audstrings.h>
 #include <libfauxdcore/i18n.h>
 #include <libfauxdcore/runtime.h>
 #include <libfauxdcore/plugin.h>
 #include <libfauxdcore/preferences.h>
 
+#include "channel-matrix.h"
+
+/* output channels, rounded up to whole vectors */
+#define PADDED_CHANNELS ((AUD_MAX_CHANNELS + 3) & ~3)
+
 class ChannelMixer : public EffectPlugin
 {
 public:
@@ -59,186 +72,241 @@ public:
 
 EXPORT ChannelMixer aud_plugin_instance;
 
-typedef Index<float> & (* Converter) (Index<float> & data);
+typedef void (* MixFunc) (const float * get, float * set, int frames);
 
+static int input_channels, output_channels;
+static MixFunc mix_func;
 static Index<float> mixer_buf;
 
-static Index<float> & mono_to_stereo (Index<float> & data)
-{
-    int frames = data.len ();
-    mixer_buf.resize (2 * frames);
+/* matrix[i][o] is the gain from input channel i to output channel o; the
+ * unused entries are kept at zero so that whole vectors can be used */
+alignas (16) static float matrix[AUD_MAX_CHANNELS][PADDED_CHANNELS];
 
-    float * get = data.begin ();
-    float * set = mixer_buf.begin ();
+/* User matrices are given as "in:out=c,c,...;in:out=c,c,..." with the
+ * coefficients listed one output channel at a time, so that "2:1=0.5,0.5"
+ * is a plain stereo to mono downmix. */
+static bool set_custom_matrix ()
+{
+    String custom = aud_get_str ("mixer", "custom_matrices");
+    int count = input_channels * output_channels;
 
-    while (frames --)
+    for (const String & entry : str_list_to_index (custom, ";"))
     {
-        float val = * get ++;
-        * set ++ = val;
-        * set ++ = val;
+        Index<String> parts = str_list_to_index (entry, ":=");
+        if (parts.len () != 3 || str_to_int (parts[0]) != input_channels ||
+         str_to_int (parts[1]) != output_channels)
+            continue;
+
+        double coeffs[AUD_MAX_CHANNELS * AUD_MAX_CHANNELS];
+        if (! str_to_double_array (parts[2], coeffs, count))
+        {
+            AUDERR ("Invalid %d to %d channel matrix: expected %d coefficients.\n",
+             input_channels, output_channels, count);
+            return false;
+        }
+
+        for (int o = 0; o < output_channels; o ++)
+        {
+            for (int i = 0; i < input_channels; i ++)
+                matrix[i][o] = coeffs[o * input_channels + i];
+        }
+
+        return true;
     }
 
-    return mixer_buf;
+    return false;
 }
 
-static Index<float> & stereo_to_mono (Index<float> & data)
+static bool matrix_is_identity ()
 {
-    int frames = data.len () / 2;
-    mixer_buf.resize (frames);
-
-    float * get = data.begin ();
-    float * set = mixer_buf.begin ();
+    if (input_channels != output_channels)
+        return false;
 
-    while (frames --)
+    for (int i = 0; i < input_channels; i ++)
     {
-        float val = * get ++;
-        val += * get ++;
-        * set ++ = val / 2;
+        for (int o = 0; o < output_channels; o ++)
+        {
+            if (matrix[i][o] != ((i == o) ? 1 : 0))
+                return false;
+        }
     }
 
-    return mixer_buf;
+    return true;
 }
 
-static Index<float> & quadro_to_stereo (Index<float> & data)
+/* Mixes one frame at a time: the output frame is the sum of the matrix rows,
+ * each scaled by one input sample.  Instantiated with fixed channel counts
+ * for the common layouts so that the loops can be fully unrolled; IN and
+ * OUT are 0 for the generic version. */
+template<int IN, int OUT>
+static void mix (const float * get, float * set, int frames)
 {
-    int frames = data.len () / 4;
-    mixer_buf.resize (2 * frames);
+    const int in = IN ? IN : input_channels;
+    const int out = OUT ? OUT : output_channels;
 
-    float * get = data.begin ();
-    float * set = mixer_buf.begin ();
+#if defined (__SSE__)
+    const int vecs = (out + 3) / 4;
+    const int whole = out / 4;
 
     while (frames --)
     {
-        float front_left  = * get ++;
-        float front_right = * get ++;
-        float back_left   = * get ++;
-        float back_right  = * get ++;
-        * set ++ = front_left + (back_left * 0.7);
-        * set ++ = front_right + (back_right * 0.7);
+        __m128 acc[PADDED_CHANNELS / 4];
+
+        for (int v = 0; v < vecs; v ++)
+            acc[v] = _mm_setzero_ps ();
+
+        for (int i = 0; i < in; i ++)
+        {
+            __m128 x = _mm_set1_ps (get[i]);
+
+            for (int v = 0; v < vecs; v ++)
+                acc[v] = _mm_add_ps (acc[v], _mm_mul_ps (x, _mm_load_ps (matrix[i] + 4 * v)));
+        }
+
+        for (int v = 0; v < whole; v ++)
+            _mm_storeu_ps (set + 4 * v, acc[v]);
+
+        float * rest = set + 4 * whole;
+
+        switch (out & 3)
+        {
+        case 3:
+            _mm_storel_pi ((__m64 *) rest, acc[whole]);
+            _mm_store_ss (rest + 2, _mm_movehl_ps (acc[whole], acc[whole]));
+            break;
+        case 2:
+            _mm_storel_pi ((__m64 *) rest, acc[whole]);
+            break;
+        case 1:
+            _mm_store_ss (rest, acc[whole]);
+            break;
+        }
+
+        get += in;
+        set += out;
     }
-
-    return mixer_buf;
-}
-
-static Index<float> & stereo_to_quadro (Index<float> & data)
-{
-    int frames = data.len () / 2;
-    mixer_buf.resize (4 * frames);
-
-    float * get = data.begin ();
-    float * set = mixer_buf.begin ();
+#elif defined (__ARM_NEON) || defined (__ARM_NEON__)
+    const int vecs = (out + 3) / 4;
+    const int whole = out / 4;
 
     while (frames --)
     {
-        float left  = * get ++;
-        float right = * get ++;
-        * set ++ = left;   // front left
-        * set ++ = right;  // front right
-        * set ++ = left;   // rear left
-        * set ++ = right;  // rear right
+        float32x4_t acc[PADDED_CHANNELS / 4];
+
+        for (int v = 0; v < vecs; v ++)
+            acc[v] = vdupq_n_f32 (0);
+
+        for (int i = 0; i < in; i ++)
+        {
+            for (int v = 0; v < vecs; v ++)
+                acc[v] = vmlaq_n_f32 (acc[v], vld1q_f32 (matrix[i] + 4 * v), get[i]);
+        }
+
+        for (int v = 0; v < whole; v ++)
+            vst1q_f32 (set + 4 * v, acc[v]);
+
+        float * rest = set + 4 * whole;
+
+        switch (out & 3)
+        {
+        case 3:
+            vst1_f32 (rest, vget_low_f32 (acc[whole]));
+            vst1q_lane_f32 (rest + 2, acc[whole], 2);
+            break;
+        case 2:
+            vst1_f32 (rest, vget_low_f32 (acc[whole]));
+            break;
+        case 1:
+            vst1q_lane_f32 (rest, acc[whole], 0);
+            break;
+        }
+
+        get += in;
+        set += out;
     }
-
-    return mixer_buf;
-}
-
-static Index<float> & surround_5p1_to_stereo (Index<float> & data)
-{
-    int frames = data.len () / 6;
-    mixer_buf.resize (2 * frames);
-
-    float * get = data.begin ();
-    float * set = mixer_buf.begin ();
-
+#else
     while (frames --)
     {
-        float front_left  = * get ++;
-        float front_right = * get ++;
-        float center = * get ++;
-        float lfe    = * get ++;
-        float rear_left   = * get ++;
-        float rear_right  = * get ++;
-        * set ++ = front_left + (center * 0.5) + (lfe * 0.5) + (rear_left * 0.5);
-        * set ++ = front_right + (center * 0.5) + (lfe * 0.5) + (rear_right * 0.5);
-    }
+        for (int o = 0; o < out; o ++)
+        {
+            float sum = 0;
+            for (int i = 0; i < in; i ++)
+                sum += get[i] * matrix[i][o];
 
-    return mixer_buf;
-}
+            set[o] = sum;
+        }
 
-/* 5 channels case. Quad + center channel */
-static Index<float> & quadro_5_to_stereo (Index<float> & data)
-{
-    int frames = data.len () / 5;
-    mixer_buf.resize (2 * frames);
+        get += in;
+        set += out;
+    }
+#endif
+}
 
-    float * get = data.begin ();
-    float * set = mixer_buf.begin ();
+static const struct {
+    int in, out;
+    MixFunc func;
+} mix_funcs[] = {
+    {1, 2, mix<1, 2>},
+    {2, 1, mix<2, 1>},
+    {2, 4, mix<2, 4>},
+    {2, 6, mix<2, 6>},
+    {2, 8, mix<2, 8>},
+    {4, 2, mix<4, 2>},
+    {5, 2, mix<5, 2>},
+    {6, 2, mix<6, 2>},
+    {6, 8, mix<6, 8>},
+    {8, 2, mix<8, 2>},
+    {8, 6, mix<8, 6>}
+};
 
-    while (frames --)
+static MixFunc get_mix_func (int in, int out)
+{
+    for (auto & f : mix_funcs)
     {
-        float front_left  = * get ++;
-        float front_right = * get ++;
-        float center = * get ++;
-        float rear_left   = * get ++;
-        float rear_right  = * get ++;
-        * set ++ = front_left + (center * 0.5) + rear_left;
-        * set ++ = front_right + (center * 0.5) + rear_right;
+        if (f.in == in && f.out == out)
+            return f.func;
     }
 
-    return mixer_buf;
-}
-
-static Converter get_converter (int in, int out)
-{
-    if (in == 1 && out == 2)
-        return mono_to_stereo;
-    if (in == 2 && out == 1)
-        return stereo_to_mono;
-    if (in == 2 && out == 4)
-        return stereo_to_quadro;
-    if (in == 4 && out == 2)
-        return quadro_to_stereo;
-    if (in == 5 && out == 2)
-        return quadro_5_to_stereo;
-    if (in == 6 && out == 2)
-        return surround_5p1_to_stereo;
-
-    return nullptr;
+    return mix<0, 0>;
 }
 
-static int input_channels, output_channels;
-
 void ChannelMixer::start (int & channels, int & rate)
 {
     input_channels = channels;
-    output_channels = aud_get_int ("mixer", "channels");
+    output_channels = aud::clamp (aud_get_int ("mixer", "channels"), 1, AUD_MAX_CHANNELS);
 
-    if (input_channels == output_channels)
-        return;
+    memset (matrix, 0, sizeof matrix);
+
+    if (! aud_get_bool ("mixer", "use_custom") || ! set_custom_matrix ())
+        channel_matrix_default (input_channels, output_channels, matrix[0], PADDED_CHANNELS);
 
-    if (! get_converter (input_channels, output_channels))
+    if (matrix_is_identity ())
     {
-        AUDERR ("Converting %d to %d channels is not implemented.\n",
-         input_channels, output_channels);
+        mix_func = nullptr;
         return;
     }
 
+    mix_func = get_mix_func (input_channels, output_channels);
     channels = output_channels;
 }
 
 Index<float> & ChannelMixer::process (Index<float> & data)
 {
-    if (input_channels == output_channels)
+    if (! mix_func)
         return data;
 
-    Converter converter = get_converter (input_channels, output_channels);
-    if (converter)
-        return converter (data);
+    int frames = data.len () / input_channels;
+    mixer_buf.resize (frames * output_channels);
 
-    return data;
+    mix_func (data.begin (), mixer_buf.begin (), frames);
+
+    return mixer_buf;
 }
 
 const char * const ChannelMixer::defaults[] = {
  "channels", "2",
+ "use_custom", "FALSE",
+ "custom_matrices", "",
   nullptr};
 
 bool ChannelMixer::init ()
@@ -260,7 +328,17 @@ const PreferencesWidget ChannelMixer::widgets[] = {
     WidgetLabel (N_("<b>Channel Mixer</b>")),
     WidgetSpin (N_("Output channels:"),
         WidgetInt ("mixer", "channels"),
-        {1, AUD_MAX_CHANNELS, 1})
+        {1, AUD_MAX_CHANNELS, 1}),
+    WidgetLabel (N_("<b>Mixing Matrix</b>")),
+    WidgetCheck (N_("Use custom coefficients"),
+        WidgetBool ("mixer", "use_custom")),
+    WidgetEntry (N_("Matrices:"),
+        WidgetString ("mixer", "custom_matrices"),
+        {false},
+        WIDGET_CHILD),
+    WidgetLabel (N_("Format: in:out=c,c,...;in:out=... with the coefficients\n"
+                    "listed one output channel at a time (2:1=0.5,0.5)."),
+        WIDGET_CHILD)
 };
 
 const PluginPreferences ChannelMixer::prefs = {{widgets}};
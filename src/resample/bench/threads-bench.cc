@@ -0,0 +1,100 @@
+/*
+ * Sample Rate Converter Plugin for Audacious - multi-threading benchmark
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions, and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions, and the following disclaimer in the documentation
+ *    provided with the distribution.
+ *
+ * This software is provided "as is" and without any warranty, express or
+ * implied. In no event shall the authors be liable for any damages arising from
+ * the use of this software.
+ */
+
+/* Not part of the plugin build.  Runs the plugin (compiled in directly) over
+ * ten seconds of synthetic audio from 44.1 to 192 kHz for each method,
+ * channel count and "threads" setting, and prints the real-time factor:
+ * seconds of input processed per second of wall-clock time.  Build it with
+ * "make bench" in the plugin directory (after configure, since it needs
+ * config.h) and run bench/threads-bench.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "../resample.cc"
+
+#define SECONDS 10
+#define BLOCK 4096
+#define IN_RATE 44100
+#define OUT_RATE 192000
+
+static const int methods[] = {SRC_SINC_FASTEST, SRC_SINC_MEDIUM_QUALITY, SRC_SINC_BEST_QUALITY};
+static const int channel_counts[] = {2, 6, 8};
+static const int thread_counts[] = {1, 2, 4, 8};
+
+static double now_secs ()
+{
+    struct timespec ts;
+    clock_gettime (CLOCK_MONOTONIC, & ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double run (int method, int chans, int threads)
+{
+    aud_set_int ("resample", "method", method);
+    aud_set_int ("resample", "threads", threads);
+
+    int ch = chans, rate = IN_RATE;
+    aud_plugin_instance.start (ch, rate);
+
+    Index<float> data;
+    data.resize (BLOCK * chans);
+
+    double busy = 0;
+
+    for (int64_t frame = 0; frame < (int64_t) SECONDS * IN_RATE; frame += BLOCK)
+    {
+        for (int i = 0; i < BLOCK; i ++)
+        {
+            for (int c = 0; c < chans; c ++)
+                data[i * chans + c] = 0.5 * sin (2 * M_PI * (440 + 110 * c) * (frame + i) / IN_RATE);
+        }
+
+        double start = now_secs ();
+        aud_plugin_instance.process (data);
+        busy += now_secs () - start;
+    }
+
+    aud_plugin_instance.flush (true);
+
+    return (busy > 0) ? SECONDS / busy : 0;
+}
+
+int main ()
+{
+    aud_plugin_instance.init ();
+    aud_set_bool ("resample", "use-mappings", false);
+    aud_set_int ("resample", "default-rate", OUT_RATE);
+
+    printf ("%-24s %5s %7s %10s\n", "method", "chans", "threads", "RTF");
+
+    for (int method : methods)
+    {
+        for (int chans : channel_counts)
+        {
+            for (int threads : thread_counts)
+                printf ("%-24s %5d %7d %10.1f\n", src_get_name (method), chans, threads,
+                 run (method, chans, threads));
+        }
+    }
+
+    aud_plugin_instance.cleanup ();
+    return 0;
+}
@@ -17,6 +17,9 @@
  * the use of this software.
  */
 
+#include <pthread.h>
+#include <string.h>
+#include <unistd.h>
 #include <samplerate.h>
 
 #include <libfauxdcore/i18n.h>
@@ -28,6 +31,7 @@
 #define MIN_RATE 8000
 #define MAX_RATE 192000
 #define RATE_STEP 50
+#define MAX_THREADS 16
 
 #define RESAMPLE_ERROR(e) AUDERR ("%s\n", src_strerror (e))
 
@@ -70,6 +74,7 @@ const char * const Resampler::defaults[] = {
  "method", aud::numeric_string<SRC_SINC_FASTEST>::str,
  "default-rate", "44100",
  "use-mappings", "FALSE",
+ "threads", "1",
  "8000", "48000",
  "16000", "48000",
  "22050", "44100",
@@ -87,6 +92,226 @@ static int stored_channels;
 static double ratio;
 static Index<float> buffer;
 
+/* For high channel counts, a single SRC_STATE at the higher quality settings
+ * may not keep up in real time.  In multi-threaded mode the channels are
+ * split into contiguous groups, each with its own SRC_STATE.  The effect
+ * thread resamples the first group itself while a pool of worker threads
+ * handles the rest; the results are then interleaved again.  Every group
+ * sees the same input length and ratio, so all of them produce the same
+ * number of output frames. */
+struct ChannelGroup {
+    SRC_STATE * state;
+    int first, channels;
+    Index<float> in, out;
+    long frames_gen;
+    int error;
+    int generation;
+    pthread_t thread;
+};
+
+static ChannelGroup groups[MAX_THREADS];
+static int n_groups;
+
+static pthread_mutex_t pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t work_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t done_cond = PTHREAD_COND_INITIALIZER;
+static bool pool_quit;
+static int job_generation;
+static int job_pending;
+
+/* current job, written by the effect thread before job_generation changes */
+static const float * job_data;
+static int job_frames;
+static bool job_finish;
+
+static void resample_group (ChannelGroup & g)
+{
+    g.in.resize (job_frames * g.channels);
+    g.out.resize (((int) (job_frames * ratio) + 256) * g.channels);
+
+    const float * src = job_data + g.first;
+    float * dest = g.in.begin ();
+
+    for (int f = 0; f < job_frames; f ++)
+    {
+        for (int c = 0; c < g.channels; c ++)
+            dest[c] = src[c];
+
+        src += stored_channels;
+        dest += g.channels;
+    }
+
+    SRC_DATA d = SRC_DATA ();
+
+    d.data_in = g.in.begin ();
+    d.input_frames = job_frames;
+    d.data_out = g.out.begin ();
+    d.output_frames = g.out.len () / g.channels;
+    d.src_ratio = ratio;
+    d.end_of_input = job_finish;
+
+    g.error = src_process (g.state, & d);
+    g.frames_gen = g.error ? 0 : d.output_frames_gen;
+}
+
+static void * group_worker (void * arg)
+{
+    ChannelGroup & g = * (ChannelGroup *) arg;
+
+    pthread_mutex_lock (& pool_mutex);
+
+    while (true)
+    {
+        while (! pool_quit && g.generation == job_generation)
+            pthread_cond_wait (& work_cond, & pool_mutex);
+
+        if (pool_quit)
+            break;
+
+        g.generation = job_generation;
+        pthread_mutex_unlock (& pool_mutex);
+
+        resample_group (g);
+
+        pthread_mutex_lock (& pool_mutex);
+        if (! (-- job_pending))
+            pthread_cond_signal (& done_cond);
+    }
+
+    pthread_mutex_unlock (& pool_mutex);
+    return nullptr;
+}
+
+static void destroy_groups ()
+{
+    pthread_mutex_lock (& pool_mutex);
+    pool_quit = true;
+    pthread_cond_broadcast (& work_cond);
+    pthread_mutex_unlock (& pool_mutex);
+
+    for (int i = 1; i < n_groups; i ++)
+        pthread_join (groups[i].thread, nullptr);
+
+    for (int i = 0; i < n_groups; i ++)
+    {
+        src_delete (groups[i].state);
+        groups[i].state = nullptr;
+        groups[i].in.clear ();
+        groups[i].out.clear ();
+    }
+
+    n_groups = 0;
+    pool_quit = false;
+}
+
+static bool create_groups (int method, int channels, int threads)
+{
+    int count = aud::min (threads, channels);
+
+    for (int i = 0; i < count; i ++)
+    {
+        ChannelGroup & g = groups[i];
+
+        /* spread any remainder over the first groups */
+        g.first = channels * i / count;
+        g.channels = channels * (i + 1) / count - g.first;
+
+        int error;
+        if ((g.state = src_new (method, g.channels, & error)) == nullptr)
+        {
+            RESAMPLE_ERROR (error);
+
+            while (i --)
+            {
+                src_delete (groups[i].state);
+                groups[i].state = nullptr;
+            }
+
+            return false;
+        }
+    }
+
+    n_groups = count;
+
+    /* group 0 is handled by the effect thread itself */
+    for (int i = 1; i < count; i ++)
+    {
+        groups[i].generation = job_generation;
+
+        int error = pthread_create (& groups[i].thread, nullptr, group_worker, & groups[i]);
+        if (error)
+        {
+            AUDERR ("Failed to start resampling thread: %s.\n", strerror (error));
+
+            for (int j = i; j < count; j ++)
+            {
+                src_delete (groups[j].state);
+                groups[j].state = nullptr;
+            }
+
+            n_groups = i;
+            destroy_groups ();
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static Index<float> & resample_groups (Index<float> & data, bool finish)
+{
+    pthread_mutex_lock (& pool_mutex);
+
+    job_data = data.begin ();
+    job_frames = data.len () / stored_channels;
+    job_finish = finish;
+    job_generation ++;
+    job_pending = n_groups - 1;
+
+    pthread_cond_broadcast (& work_cond);
+    pthread_mutex_unlock (& pool_mutex);
+
+    resample_group (groups[0]);
+
+    pthread_mutex_lock (& pool_mutex);
+    while (job_pending)
+        pthread_cond_wait (& done_cond, & pool_mutex);
+    pthread_mutex_unlock (& pool_mutex);
+
+    long frames = groups[0].frames_gen;
+
+    for (int i = 0; i < n_groups; i ++)
+    {
+        if (groups[i].error)
+        {
+            RESAMPLE_ERROR (groups[i].error);
+            return data;
+        }
+
+        frames = aud::min (frames, groups[i].frames_gen);
+    }
+
+    buffer.resize (stored_channels * frames);
+
+    for (int i = 0; i < n_groups; i ++)
+    {
+        const ChannelGroup & g = groups[i];
+        const float * src = g.out.begin ();
+        float * dest = buffer.begin () + g.first;
+
+        for (long f = 0; f < frames; f ++)
+        {
+            for (int c = 0; c < g.channels; c ++)
+                dest[c] = src[c];
+
+            src += g.channels;
+            dest += stored_channels;
+        }
+    }
+
+    return buffer;
+}
+
 bool Resampler::init ()
 {
     aud_config_set_defaults ("resample", defaults);
@@ -101,6 +326,7 @@ void Resampler::cleanup ()
         state = nullptr;
     }
 
+    destroy_groups ();
     buffer.clear ();
 }
 
@@ -112,6 +338,8 @@ void Resampler::start (int & channels, int & rate)
         state = nullptr;
     }
 
+    destroy_groups ();
+
     int new_rate = 0;
 
     if (aud_get_bool ("resample", "use-mappings"))
@@ -126,12 +354,26 @@ void Resampler::start (int & channels, int & rate)
         return;
 
     int method = aud_get_int ("resample", "method");
-    int error;
+    int threads = aud_get_int ("resample", "threads");
+
+    if (threads <= 0)
+        threads = sysconf (_SC_NPROCESSORS_ONLN);
 
-    if ((state = src_new (method, channels, & error)) == nullptr)
+    threads = aud::clamp (threads, 1, MAX_THREADS);
+
+    if (threads > 1 && channels > 1)
     {
-        RESAMPLE_ERROR (error);
-        return;
+        if (! create_groups (method, channels, threads))
+            return;
+    }
+    else
+    {
+        int error;
+        if ((state = src_new (method, channels, & error)) == nullptr)
+        {
+            RESAMPLE_ERROR (error);
+            return;
+        }
     }
 
     stored_channels = channels;
@@ -141,9 +383,19 @@ void Resampler::start (int & channels, int & rate)
 
 Index<float> & Resampler::resample (Index<float> & data, bool finish)
 {
-    if (! state || ! data.len ())
+    if ((! state && ! n_groups) || ! data.len ())
         return data;
 
+    if (n_groups)
+    {
+        Index<float> & out = resample_groups (data, finish);
+
+        if (finish)
+            flush (true);
+
+        return out;
+    }
+
     buffer.resize ((int) (data.len () * ratio) + 256);
 
     SRC_DATA d = SRC_DATA ();
@@ -176,6 +428,12 @@ bool Resampler::flush (bool force)
     if (state && (error = src_reset (state)))
         RESAMPLE_ERROR (error);
 
+    for (int i = 0; i < n_groups; i ++)
+    {
+        if ((error = src_reset (groups[i].state)))
+            RESAMPLE_ERROR (error);
+    }
+
     return true;
 }
 
@@ -199,6 +457,9 @@ const PreferencesWidget Resampler::widgets[] = {
     WidgetSpin (N_("Rate:"),
         WidgetInt ("resample", "default-rate"),
         {MIN_RATE, MAX_RATE, RATE_STEP, N_("Hz")}),
+    WidgetSpin (N_("Threads:"),
+        WidgetInt ("resample", "threads"),
+        {0, MAX_THREADS, 1, N_("(0 = automatic)")}),
     WidgetLabel (N_("<b>Rate Mappings</b>")),
     WidgetCheck (N_("Use rate mappings"),
         WidgetBool ("resample", "use-mappings")),
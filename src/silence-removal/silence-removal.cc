@@ -25,7 +25,15 @@
 
 #include <math.h>
 
+#if defined (__SSE__)
+#include <xmmintrin.h>
+#elif defined (__ARM_NEON) || defined (__ARM_NEON__)
+#include <arm_neon.h>
+#endif
+
 #define MAX_BUFFER_SECS  10
+#define MAX_KEEP_MS  5000
+#define RMS_WINDOW_MS  50
 
 class SilenceRemoval : public EffectPlugin
 {
@@ -54,38 +62,98 @@ public:
 
 EXPORT SilenceRemoval aud_plugin_instance;
 
+static void update_params ();
+
 const char SilenceRemoval::about[] =
  N_("Silence Removal Plugin for Audacious\n"
     "Copyright 2014 John Lindgren");
 
 const char * const SilenceRemoval::defaults[] = {
     "threshold", "-40",
+    "use_rms", "FALSE",
+    "keep_leading", "0",
+    "keep_trailing", "0",
     nullptr
 };
 
 const PreferencesWidget SilenceRemoval::widgets[] = {
     WidgetLabel (N_("<b>Silence Removal</b>")),
     WidgetSpin (N_("Threshold:"),
-        WidgetInt ("silence-removal", "threshold"),
-        {-60, -20, 1, N_("dB")})
+        WidgetInt ("silence-removal", "threshold", update_params),
+        {-60, -20, 1, N_("dB")}),
+    WidgetCheck (N_("Compare average (RMS) level, so that noise counts as silence"),
+        WidgetBool ("silence-removal", "use_rms", update_params)),
+    WidgetSpin (N_("Keep leading silence:"),
+        WidgetInt ("silence-removal", "keep_leading", update_params),
+        {0, MAX_KEEP_MS, 100, N_("ms")}),
+    WidgetSpin (N_("Keep trailing silence:"),
+        WidgetInt ("silence-removal", "keep_trailing", update_params),
+        {0, MAX_KEEP_MS, 100, N_("ms")})
 };
 
 const PluginPreferences SilenceRemoval::prefs = {{widgets}};
 
 static RingBuf<float> buffer;
 static Index<float> output;
-static int current_channels;
+static int current_channels, current_rate;
 static bool initial_silence;
 
+/* settings, cached so that they are not looked up for every block */
+static int cur_threshold, cur_keep_leading, cur_keep_trailing;
+static bool cur_use_rms;
+static bool params_changed;
+
+static float threshold;
+static bool use_rms;
+static int rms_window;
+static int keep_leading, keep_trailing;
+
+/* the last keep_leading frames of the initial silence */
+static RingBuf<float> leading;
+
+/* trailing silence still to be passed through before holding back the rest */
+static int trailing_left;
+
+static void update_params ()
+{
+    cur_threshold = aud_get_int ("silence-removal", "threshold");
+    cur_use_rms = aud_get_bool ("silence-removal", "use_rms");
+    cur_keep_leading = aud_get_int ("silence-removal", "keep_leading");
+    cur_keep_trailing = aud_get_int ("silence-removal", "keep_trailing");
+
+    __atomic_store_n (& params_changed, true, __ATOMIC_RELEASE);
+}
+
+static void setup_params ()
+{
+    threshold = powf (10.0f, cur_threshold / 20.0f);
+    use_rms = cur_use_rms;
+    rms_window = aud::max (1, aud::rescale (RMS_WINDOW_MS, 1000, current_rate));
+
+    int keep_ms = aud::clamp (cur_keep_leading, 0, MAX_KEEP_MS);
+    keep_leading = aud::rescale (keep_ms, 1000, current_rate);
+
+    keep_ms = aud::clamp (cur_keep_trailing, 0, MAX_KEEP_MS);
+    keep_trailing = aud::rescale (keep_ms, 1000, current_rate);
+
+    if (leading.size () != keep_leading * current_channels)
+    {
+        leading.destroy ();
+        leading.alloc (keep_leading * current_channels);
+    }
+}
+
 bool SilenceRemoval::init ()
 {
     aud_config_set_defaults ("silence-removal", defaults);
+    update_params ();
     return true;
 }
 
 void SilenceRemoval::cleanup ()
 {
     buffer.destroy ();
+    leading.destroy ();
     output.clear ();
 }
 
@@ -96,19 +164,184 @@ void SilenceRemoval::start (int & channels, int & rate)
     output.resize (0);
 
     current_channels = channels;
+    current_rate = rate;
     initial_silence = true;
+
+    __atomic_store_n (& params_changed, false, __ATOMIC_RELAXED);
+    leading.destroy ();
+    setup_params ();
+}
+
+/* index of the first sample in data louder than the threshold, or len */
+static int find_first_peak (const float * data, int len)
+{
+    int i = 0;
+
+#if defined (__SSE__)
+    __m128 sign = _mm_set1_ps (-0.0f);
+    __m128 thresh = _mm_set1_ps (threshold);
+
+    for (; i + 4 <= len; i += 4)
+    {
+        __m128 mag = _mm_andnot_ps (sign, _mm_loadu_ps (data + i));
+        if (_mm_movemask_ps (_mm_cmpgt_ps (mag, thresh)))
+            break;
+    }
+#elif defined (__ARM_NEON) || defined (__ARM_NEON__)
+    float32x4_t thresh = vdupq_n_f32 (threshold);
+
+    for (; i + 4 <= len; i += 4)
+    {
+        uint32x4_t loud = vcagtq_f32 (vld1q_f32 (data + i), thresh);
+        uint32x2_t any = vorr_u32 (vget_low_u32 (loud), vget_high_u32 (loud));
+        if (vget_lane_u32 (vpmax_u32 (any, any), 0))
+            break;
+    }
+#endif
+
+    for (; i < len; i ++)
+    {
+        if (fabsf (data[i]) > threshold)
+            break;
+    }
+
+    return i;
+}
+
+/* index just past the last sample in data louder than the threshold, or 0 */
+static int find_last_peak (const float * data, int len)
+{
+    int i = len;
+
+#if defined (__SSE__)
+    __m128 sign = _mm_set1_ps (-0.0f);
+    __m128 thresh = _mm_set1_ps (threshold);
+
+    for (; i >= 4; i -= 4)
+    {
+        __m128 mag = _mm_andnot_ps (sign, _mm_loadu_ps (data + i - 4));
+        if (_mm_movemask_ps (_mm_cmpgt_ps (mag, thresh)))
+            break;
+    }
+#elif defined (__ARM_NEON) || defined (__ARM_NEON__)
+    float32x4_t thresh = vdupq_n_f32 (threshold);
+
+    for (; i >= 4; i -= 4)
+    {
+        uint32x4_t loud = vcagtq_f32 (vld1q_f32 (data + i - 4), thresh);
+        uint32x2_t any = vorr_u32 (vget_low_u32 (loud), vget_high_u32 (loud));
+        if (vget_lane_u32 (vpmax_u32 (any, any), 0))
+            break;
+    }
+#endif
+
+    for (; i > 0; i --)
+    {
+        if (fabsf (data[i - 1]) > threshold)
+            break;
+    }
+
+    return i;
+}
+
+static float sum_squares (const float * data, int len)
+{
+    float sum = 0;
+    int i = 0;
+
+#if defined (__SSE__)
+    __m128 acc = _mm_setzero_ps ();
+
+    for (; i + 4 <= len; i += 4)
+    {
+        __m128 x = _mm_loadu_ps (data + i);
+        acc = _mm_add_ps (acc, _mm_mul_ps (x, x));
+    }
+
+    float part[4];
+    _mm_storeu_ps (part, acc);
+    sum = (part[0] + part[1]) + (part[2] + part[3]);
+#elif defined (__ARM_NEON) || defined (__ARM_NEON__)
+    float32x4_t acc = vdupq_n_f32 (0);
+
+    for (; i + 4 <= len; i += 4)
+    {
+        float32x4_t x = vld1q_f32 (data + i);
+        acc = vmlaq_f32 (acc, x, x);
+    }
+
+    float32x2_t pair = vadd_f32 (vget_low_f32 (acc), vget_high_f32 (acc));
+    sum = vget_lane_f32 (vpadd_f32 (pair, pair), 0);
+#endif
+
+    for (; i < len; i ++)
+        sum += data[i] * data[i];
+
+    return sum;
+}
+
+static bool window_is_loud (const float * data, int frames, int window)
+{
+    int begin = window * rms_window;
+    int len = aud::min (rms_window, frames - begin) * current_channels;
+
+    return sum_squares (data + begin * current_channels, len) > threshold * threshold * len;
 }
 
-static float * align_to_frame (float * begin, float * sample, bool align_to_end)
+/* Finds the first and last non-silent frames in data, returning false if
+ * there are none.  last is exclusive.  In RMS mode, whole windows are
+ * compared instead of single samples. */
+static bool find_sound (const float * data, int frames, int & first, int & last)
 {
-    if (! sample)
-        return nullptr;
+    if (use_rms)
+    {
+        int windows = (frames + rms_window - 1) / rms_window;
+        int w = 0;
+
+        while (w < windows && ! window_is_loud (data, frames, w))
+            w ++;
+
+        if (w == windows)
+            return false;
 
-    int offset = sample - begin;
-    if (align_to_end)
-        offset += current_channels;
+        first = w * rms_window;
+
+        w = windows - 1;
+        while (! window_is_loud (data, frames, w))
+            w --;
+
+        last = aud::min ((w + 1) * rms_window, frames);
+        return true;
+    }
 
-    return begin + (offset - offset % current_channels);
+    int len = frames * current_channels;
+    int i = find_first_peak (data, len);
+
+    if (i == len)
+        return false;
+
+    first = i / current_channels;
+    last = (find_last_peak (data, len) + current_channels - 1) / current_channels;
+    return true;
+}
+
+static void save_leading (const float * data, int len)
+{
+    int max = leading.size ();
+    if (! max)
+        return;
+
+    if (len > max)
+    {
+        data += len - max;
+        len = max;
+    }
+
+    int over = leading.len () + len - max;
+    if (over > 0)
+        leading.discard (over);
+
+    leading.copy_in (data, len);
 }
 
 static void buffer_with_overflow (const float * data, int len)
@@ -133,51 +366,76 @@ static void buffer_with_overflow (const float * data, int len)
 
 Index<float> & SilenceRemoval::process (Index<float> & data)
 {
-    const int threshold_db = aud_get_int ("silence-removal", "threshold");
-    const float threshold = powf (10.0f, threshold_db / 20.0f);
+    if (__atomic_exchange_n (& params_changed, false, __ATOMIC_ACQUIRE))
+        setup_params ();
+
+    const int channels = current_channels;
+    int frames = data.len () / channels;
 
-    float * first_sample = nullptr;
-    float * last_sample = nullptr;
+    int first, last;
+    int begin = 0, end;
+    int lead_len = 0;
+    bool release = false;
 
-    for (float & sample : data)
+    if (find_sound (data.begin (), frames, first, last))
     {
-        if (sample > threshold || sample < -threshold)
+        if (initial_silence)
         {
-            if (! first_sample)
-                first_sample = & sample;
+            /* keep up to keep_leading frames of silence, partly from this
+             * block and partly from the saved initial silence */
+            begin = aud::max (0, first - keep_leading);
+            lead_len = aud::min (leading.len (), (keep_leading - (first - begin)) * channels);
+            leading.discard (leading.len () - lead_len);
 
-            last_sample = & sample;
+            initial_silence = false;
         }
-    }
 
-    first_sample = align_to_frame (data.begin (), first_sample, false);
-    last_sample = align_to_frame (data.begin (), last_sample, true);
+        end = aud::min (frames, last + keep_trailing);
+        trailing_left = keep_trailing - (end - last);
 
-    output.resize (0);
+        /* non-silence: let through any saved silence from previous calls */
+        release = true;
+    }
+    else if (initial_silence)
+    {
+        save_leading (data.begin (), data.len ());
+        data.resize (0);
+        return data;
+    }
+    else
+    {
+        end = aud::min (frames, trailing_left);
+        trailing_left -= end;
+    }
+
+    int tail = (frames - end) * channels;
 
-    if (first_sample)
+    /* Common case: nothing saved comes before this block, so the audio is
+     * kept in place and only the trailing silence is copied out. */
+    if (! lead_len && ! (release && buffer.len ()) &&
+     buffer.len () + tail <= buffer.size ())
     {
-        /* do not skip leading silence if non-silence has been seen */
-        if (! initial_silence)
-            first_sample = data.begin ();
+        buffer.copy_in (data.begin () + end * channels, tail);
+        data.resize (end * channels);
+
+        if (begin)
+            data.remove (0, begin * channels);
+
+        return data;
+    }
 
-        initial_silence = false;
+    output.resize (0);
 
-        /* copy any saved silence from previous call */
+    if (release)
         buffer.move_out (output, -1, -1);
 
-        /* copy non-silent portion */
-        output.insert (first_sample, -1, last_sample - first_sample);
+    if (lead_len)
+        leading.move_out (output, -1, -1);
 
-        /* save trailing silence */
-        buffer_with_overflow (last_sample, data.end () - last_sample);
-    }
-    else
-    {
-        /* if non-silence has been seen, save entire silent chunk */
-        if (! initial_silence)
-            buffer_with_overflow (data.begin (), data.len ());
-    }
+    output.insert (data.begin () + begin * channels, -1, (end - begin) * channels);
+
+    /* save trailing silence */
+    buffer_with_overflow (data.begin () + end * channels, tail);
 
     return output;
 }
@@ -185,6 +443,7 @@ Index<float> & SilenceRemoval::process (Index<float> & data)
 bool SilenceRemoval::flush (bool force)
 {
     buffer.discard ();
+    leading.discard ();
     output.resize (0);
 
     initial_silence = true;
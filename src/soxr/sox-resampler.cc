@@ -23,6 +23,7 @@
 #include <stdlib.h>
 #include <soxr.h>
 
+#include <libfauxdcore/hook.h>
 #include <libfauxdcore/i18n.h>
 #include <libfauxdcore/runtime.h>
 #include <libfauxdcore/plugin.h>
@@ -32,6 +33,11 @@
 #define MAX_RATE 192000
 #define RATE_STEP 50
 
+/* variable-rate mode: playback speed range, and how long a change takes */
+#define MIN_SPEED 0.5
+#define MAX_SPEED 2.0
+#define SLEW_MS 100
+
 class SoXResampler : public EffectPlugin
 {
 public:
@@ -56,6 +62,7 @@ public:
     void start (int & channels, int & rate);
     Index<float> & process (Index<float> & data);
     bool flush (bool force);
+    int adjust_delay (int delay);
 };
 
 EXPORT SoXResampler aud_plugin_instance;
@@ -68,6 +75,8 @@ const char * const SoXResampler::defaults[] = {
     "allow_aliasing", "FALSE",
 #endif
     "use_steep_filter", "FALSE",
+    "variable_rate", "FALSE",
+    "speed", "1",
     nullptr
 };
 
@@ -75,19 +84,51 @@ static soxr_t soxr;
 static soxr_error_t error;
 static soxr_quality_spec_t q;
 static int stored_rate;
-static int target_rate;
+static int target_rate, stored_target_rate;
 static int stored_channels;
+static unsigned long stored_recipe;
 static double ratio;
 static Index<float> buffer;
 
+/* In variable-rate mode (SOXR_VR), the input/output ratio can be changed
+ * while running; soxr slews smoothly to the new ratio instead of being
+ * recreated.  The speed is normally set in the preferences, but another
+ * plugin (for example an output plugin correcting clock drift) can also set
+ * "speed" and call the "soxr set speed" hook. */
+static bool variable_rate;
+static double speed;
+static bool speed_changed;
+
+/* output frames held inside soxr after the last process() */
+static double soxr_pending;
+
+/* picked up by process() in the playback thread */
+static void set_speed (void *, void *)
+{
+    __atomic_store_n (& speed_changed, true, __ATOMIC_RELEASE);
+}
+
+static void speed_widget_changed ()
+{
+    hook_call ("soxr set speed", nullptr);
+}
+
+static double get_speed ()
+{
+    return aud::clamp (aud_get_double ("soxr", "speed"), MIN_SPEED, MAX_SPEED);
+}
+
 bool SoXResampler::init ()
 {
     aud_config_set_defaults ("soxr", defaults);
+    hook_associate ("soxr set speed", set_speed, nullptr);
     return true;
 }
 
 void SoXResampler::cleanup ()
 {
+    hook_dissociate ("soxr set speed", set_speed);
+
     soxr_delete (soxr);
     soxr = 0;
     buffer.clear ();
@@ -95,36 +136,72 @@ void SoXResampler::cleanup ()
 
 void SoXResampler::start (int & channels, int & rate)
 {
-    soxr_delete (soxr);
-    soxr = 0;
-
     target_rate = aud_get_int ("soxr", "rate");
     target_rate = aud::clamp (target_rate, MIN_RATE, MAX_RATE);
 
-    if (target_rate == rate)
-        return;
+    bool vr = aud_get_bool ("soxr", "variable_rate");
 
-    stored_rate = rate;
+    if (target_rate == rate && ! vr)
+    {
+        soxr_delete (soxr);
+        soxr = 0;
+        return;
+    }
 
-    int recipe = aud_get_int ("soxr", "quality");
+    unsigned long recipe = aud_get_int ("soxr", "quality");
     recipe |= aud_get_int ("soxr", "phase_response");
     recipe |= (aud_get_bool ("soxr", "use_steep_filter")) ? SOXR_STEEP_FILTER : 0;
 #ifdef SOXR_ALLOW_ALIASING
     recipe |= (aud_get_bool ("soxr", "allow_aliasing")) ? SOXR_ALLOW_ALIASING : 0;
 #endif
 
-    q = soxr_quality_spec (recipe, 0);
+    ratio = (double) target_rate / rate;
 
-    soxr = soxr_create (rate, target_rate, channels, & error, nullptr, & q, nullptr);
+    /* same settings as the last song: keep the resampler, just reset it */
+    if (soxr && rate == stored_rate && target_rate == stored_target_rate &&
+     channels == stored_channels && recipe == stored_recipe && vr == variable_rate)
+    {
+        flush (true);
+        rate = target_rate;
+        return;
+    }
+
+    soxr_delete (soxr);
+    soxr = 0;
+
+    stored_rate = rate;
+    stored_target_rate = target_rate;
+    stored_recipe = recipe;
+    variable_rate = vr;
+
+    if (variable_rate)
+    {
+        /* the io ratio (input/output) given here is the largest we will use */
+        q = soxr_quality_spec (recipe, SOXR_VR);
+        soxr = soxr_create (MAX_SPEED / ratio, 1, channels, & error, nullptr, & q, nullptr);
+
+        if (! error)
+        {
+            speed = get_speed ();
+            speed_changed = false;
+            error = soxr_set_io_ratio (soxr, speed / ratio, 0);
+        }
+    }
+    else
+    {
+        q = soxr_quality_spec (recipe, 0);
+        soxr = soxr_create (rate, target_rate, channels, & error, nullptr, & q, nullptr);
+    }
 
     if (error)
     {
         AUDERR ("%s\n", error);
+        soxr_delete (soxr);
+        soxr = 0;
         return;
     }
 
     stored_channels = channels;
-    ratio = (double) target_rate / rate;
     rate = target_rate;
 }
 
@@ -133,7 +210,27 @@ Index<float> & SoXResampler::process (Index<float> & data)
     if (! soxr)
          return data;
 
-    buffer.resize ((int) (data.len () * ratio) + 256);
+    double out_ratio = ratio;
+
+    if (variable_rate)
+    {
+        /* while slewing, the output may run at either speed */
+        double old_speed = speed;
+
+        if (__atomic_exchange_n (& speed_changed, false, __ATOMIC_ACQUIRE))
+        {
+            speed = get_speed ();
+            size_t slew = aud::rescale (SLEW_MS, 1000, target_rate);
+
+            error = soxr_set_io_ratio (soxr, speed / ratio, slew);
+            if (error)
+                AUDERR ("%s\n", error);
+        }
+
+        out_ratio = ratio / aud::min (old_speed, speed);
+    }
+
+    buffer.resize ((int) (data.len () * out_ratio) + 256 * stored_channels);
 
     size_t samples_done;
     error = soxr_process (soxr, data.begin (), data.len () / stored_channels,
@@ -146,18 +243,28 @@ Index<float> & SoXResampler::process (Index<float> & data)
     }
 
     buffer.resize (samples_done * stored_channels);
+    soxr_pending = soxr_delay (soxr);
 
     return buffer;
 }
 
+/* soxr_clear() resets the filter state but keeps the (expensive to build)
+ * filter tables, so seeking no longer recreates the resampler */
 bool SoXResampler::flush (bool force)
 {
     if (! soxr)
         return true;
 
-    soxr_delete (soxr);
+    error = soxr_clear (soxr);
+    soxr_pending = 0;
 
-    soxr = soxr_create (stored_rate, target_rate, stored_channels, & error, nullptr, & q, nullptr);
+    /* soxr_clear() also forgets the variable-rate ratio */
+    if (! error && variable_rate)
+    {
+        speed = get_speed ();
+        speed_changed = false;
+        error = soxr_set_io_ratio (soxr, speed / ratio, 0);
+    }
 
     if (error)
         AUDERR ("%s\n", error);
@@ -165,6 +272,18 @@ bool SoXResampler::flush (bool force)
     return true;
 }
 
+/* In variable-rate mode, whatever is queued after this plugin plays at the
+ * current speed, so it is scaled back to input time.  During the SLEW_MS it
+ * takes soxr to reach a new speed, the new speed is already assumed. */
+int SoXResampler::adjust_delay (int delay)
+{
+    if (! soxr)
+        return delay;
+
+    double ms = delay + soxr_pending * 1000 / target_rate;
+    return variable_rate ? ms * speed : ms;
+}
+
 const char SoXResampler::about[] =
  N_("SoX Resampler Plugin for Audacious\n"
     "Copyright 2013 Michał Lipski\n\n"
@@ -199,7 +318,13 @@ const PreferencesWidget SoXResampler::widgets[] = {
     WidgetCheck (N_("Use steep filter"), WidgetBool ("soxr", "use_steep_filter")),
     WidgetSpin (N_("Rate:"),
         WidgetInt ("soxr", "rate"),
-        {MIN_RATE, MAX_RATE, RATE_STEP, N_("Hz")})
+        {MIN_RATE, MAX_RATE, RATE_STEP, N_("Hz")}),
+    WidgetCheck (N_("Variable rate (adjustable speed)"),
+        WidgetBool ("soxr", "variable_rate")),
+    WidgetSpin (N_("Speed:"),
+        WidgetFloat ("soxr", "speed", speed_widget_changed, "soxr set speed"),
+        {MIN_SPEED, MAX_SPEED, 0.001},
+        WIDGET_CHILD)
 };
 
 const PluginPreferences SoXResampler::prefs = {{widgets}};
@@ -0,0 +1,114 @@
+/*
+ * Speed and Pitch effect plugin for Audacious - real-time factor benchmark
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions, and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions, and the following disclaimer in the documentation
+ *    provided with the distribution.
+ *
+ * This software is provided "as is" and without any warranty, express or
+ * implied. In no event shall the authors be liable for any damages arising from
+ * the use of this software.
+ */
+
+/* Not part of the plugin build.  Runs the plugin (compiled in directly) over
+ * ten seconds of synthetic audio for each method, speed, sample rate and
+ * channel count, and prints the real-time factor: seconds of input processed
+ * per second of CPU time, on one thread.  Anything above 1 keeps up.  Build it
+ * with "make bench" in the plugin directory (after configure, since it needs
+ * config.h; add -march=native to CXXFLAGS for the AVX/FMA paths) and run
+ * bench/rtf-bench.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "../speed-pitch.cc"
+
+#define SECONDS 10
+#define BLOCK 4096
+
+static const int rates[] = {44100, 48000, 96000, 192000};
+static const int channel_counts[] = {1, 2, 6, 8};
+static const double speeds[] = {0.75, 1.25};
+
+static double cpu_secs ()
+{
+    struct timespec ts;
+    clock_gettime (CLOCK_PROCESS_CPUTIME_ID, & ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* a chord with a click every 100 ms, so that WSOLA has something to align */
+static void fill (Index<float> & data, int64_t frame, int chans, int rate)
+{
+    data.resize (BLOCK * chans);
+
+    for (int i = 0; i < BLOCK; i ++)
+    {
+        double t = (double) (frame + i) / rate;
+        float click = ((frame + i) % (rate / 10) < 8) ? 0.5 : 0;
+
+        for (int c = 0; c < chans; c ++)
+            data[i * chans + c] = 0.2 * sin (2 * M_PI * 220 * t + c)
+             + 0.1 * sin (2 * M_PI * 277 * t) + 0.1 * sin (2 * M_PI * 330 * t) + click;
+    }
+}
+
+static double run (int method, double speed, int chans, int rate)
+{
+    aud_set_int (CFGSECT, "method", method);
+    aud_set_double (CFGSECT, "speed", speed);
+    update_params ();
+
+    int ch = chans, r = rate;
+    aud_plugin_instance.start (ch, r);
+
+    Index<float> data;
+    double busy = 0;
+
+    for (int64_t frame = 0; frame < (int64_t) SECONDS * rate; frame += BLOCK)
+    {
+        fill (data, frame, chans, rate);
+
+        double start = cpu_secs ();
+        aud_plugin_instance.process (data);
+        busy += cpu_secs () - start;
+    }
+
+    data.resize (0);
+    aud_plugin_instance.finish (data, true);
+
+    return (busy > 0) ? SECONDS / busy : 0;
+}
+
+int main ()
+{
+    aud_plugin_instance.init ();
+    aud_set_bool (CFGSECT, "decouple", true);
+    aud_set_double (CFGSECT, "pitch", 1);
+
+    printf ("%-8s %6s %7s %5s %10s\n", "method", "speed", "rate", "chans", "RTF");
+
+    for (int method : {METHOD_OLA, METHOD_WSOLA})
+    {
+        for (double speed : speeds)
+        {
+            for (int rate : rates)
+            {
+                for (int chans : channel_counts)
+                    printf ("%-8s %6.2f %7d %5d %10.1f\n", (method == METHOD_WSOLA) ? "wsola" : "ola",
+                     speed, rate, chans, run (method, speed, chans, rate));
+            }
+        }
+    }
+
+    aud_plugin_instance.cleanup ();
+    return 0;
+}
@@ -18,8 +18,18 @@
  */
 
 #include <math.h>
+#include <string.h>
+#include <utility>
 #include <samplerate.h>
 
+#if defined (__AVX__) || defined (__FMA__)
+#include <immintrin.h>
+#elif defined (__SSE__)
+#include <xmmintrin.h>
+#elif defined (__ARM_NEON) || defined (__ARM_NEON__)
+#include <arm_neon.h>
+#endif
+
 #include <libfauxdcore/hook.h>
 #include <libfauxdcore/i18n.h>
 #include <libfauxdcore/runtime.h>
@@ -35,6 +45,18 @@
 #define FREQ    10
 #define OVERLAP  3
 
+/* The high-quality method is WSOLA (waveform-similarity overlap-add): shorter
+ * windows, each of which is shifted by up to half the output interval from its
+ * nominal position so that it lines up with the natural continuation of the
+ * previous window.  This avoids the phase cancellation and smeared transients
+ * of plain overlap-add.  The best shift is found by cross-correlating a mono
+ * mixdown of the input, first decimated to about WSOLA_SEARCH_RATE (all shifts
+ * at once via FFT), then refined at the full rate around the best match. */
+#define METHOD_OLA    0
+#define METHOD_WSOLA  1
+#define WSOLA_FREQ   50
+#define WSOLA_SEARCH_RATE 11025
+
 #define CFGSECT "speed-pitch"
 #define MINSPEED 0.25
 #define MAXSPEED 2.0
@@ -77,65 +99,360 @@ private:
 
 EXPORT SpeedPitch aud_plugin_instance;
 
+/* A sliding sample buffer: the valid samples are mem[head] through mem[tail - 1].
+ * Consumed samples are dropped just by advancing head; the remainder is only
+ * moved back to the front when there is no room left at the end.  Once the
+ * buffer has grown to its working size, nothing is allocated and nothing is
+ * shifted per window (at most one short move per call). */
+struct SampleBuf
+{
+    Index<float> mem;
+    int head = 0, tail = 0;
+
+    int len () const
+        { return tail - head; }
+    float * begin ()
+        { return mem.begin () + head; }
+
+    void clear ()
+        { head = tail = 0; }
+
+    void discard (int n)
+    {
+        head += n;
+        if (head == tail)
+            head = tail = 0;
+    }
+
+    /* Makes room for n more samples, returning a pointer to the first one. */
+    float * reserve (int n)
+    {
+        if (tail + n > mem.len ())
+        {
+            int used = len ();
+            if (head)
+            {
+                memmove (mem.begin (), begin (), sizeof (float) * used);
+                head = 0;
+                tail = used;
+            }
+            if (tail + n > mem.len ())
+                mem.resize (aud::max (tail + n, 2 * mem.len ()));
+        }
+
+        return mem.begin () + tail;
+    }
+
+    void commit (int n)
+        { tail += n; }
+
+    void append_zeros (int n)
+    {
+        memset (reserve (n), 0, sizeof (float) * n);
+        tail += n;
+    }
+};
+
 static double semitones;
 static int curchans, currate;
 static SRC_STATE * srcstate;
 static int outstep, width;
 static Index<float> cosine;
-static Index<float> in, out;
+static SampleBuf in, out;
+static Index<float> pitched;
 static int src, dst;
 
-static void add_data (Index<float> & b, Index<float> & data, float ratio)
+static int method;              /* method the windows are currently set up for */
+static int tolerance;           /* WSOLA: max. shift of a window, in frames */
+static int seglen;              /* WSOLA: length of the stretch compared, in frames */
+static int decim;               /* WSOLA: decimation factor for the coarse search */
+static int fftsize;
+static Index<float> fft_re, fft_im, fft_cos, fft_sin;
+static Index<float> mono_a, mono_b;
+static int prev_actual;         /* WSOLA: where the last window was really copied from */
+static bool have_prev;
+
+/* Settings as of the last change, so that we don't have to look them up in the
+ * config database for every block of audio.  The widget callbacks and the
+ * "speed-pitch set ..." hooks only flag them as changed; process () reads them
+ * again on the playback thread, so they never change in the middle of a block. */
+static float cur_speed = 1, cur_pitch = 1;
+static bool cur_decouple = true;
+static int cur_method = METHOD_OLA;
+static bool params_changed;
+
+static void update_params (void * = nullptr, void * = nullptr)
 {
-    int oldlen = b.len ();
-    int inframes = data.len () / curchans;
-    int maxframes = (int) (inframes * ratio) + 256;
-    b.resize (oldlen + maxframes * curchans);
+    __atomic_store_n (& params_changed, true, __ATOMIC_RELEASE);
+}
+
+static void load_params ()
+{
+    cur_speed = aud_get_double (CFGSECT, "speed");
+    cur_pitch = aud_get_double (CFGSECT, "pitch");
+    cur_decouple = aud_get_bool (CFGSECT, "decouple");
+    cur_method = aud_get_int (CFGSECT, "method");
+}
+
+/* out[i] += in[i] * win[i] for 0 <= i < n (the overlap-add step). */
+static void overlap_add (float * out, const float * in, const float * win, int n)
+{
+    int i = 0;
+
+#if defined (__AVX__)
+    for (; i + 8 <= n; i += 8)
+    {
+        __m256 o = _mm256_loadu_ps (out + i);
+        __m256 x = _mm256_loadu_ps (in + i);
+        __m256 w = _mm256_loadu_ps (win + i);
+#ifdef __FMA__
+        o = _mm256_fmadd_ps (x, w, o);
+#else
+        o = _mm256_add_ps (o, _mm256_mul_ps (x, w));
+#endif
+        _mm256_storeu_ps (out + i, o);
+    }
+#endif
+
+#if defined (__SSE__)
+    for (; i + 4 <= n; i += 4)
+    {
+        __m128 o = _mm_loadu_ps (out + i);
+        __m128 x = _mm_loadu_ps (in + i);
+        __m128 w = _mm_loadu_ps (win + i);
+#ifdef __FMA__
+        o = _mm_fmadd_ps (x, w, o);
+#else
+        o = _mm_add_ps (o, _mm_mul_ps (x, w));
+#endif
+        _mm_storeu_ps (out + i, o);
+    }
+#elif defined (__ARM_NEON) || defined (__ARM_NEON__)
+    for (; i + 4 <= n; i += 4)
+    {
+        float32x4_t o = vld1q_f32 (out + i);
+        float32x4_t x = vld1q_f32 (in + i);
+        float32x4_t w = vld1q_f32 (win + i);
+#ifdef __aarch64__
+        o = vfmaq_f32 (o, x, w);
+#else
+        o = vmlaq_f32 (o, x, w);
+#endif
+        vst1q_f32 (out + i, o);
+    }
+#endif
+
+    for (; i < n; i ++)
+        out[i] += in[i] * win[i];
+}
+
+/* Resamples (interleaved) data by ratio into out, returning the number of
+ * samples written.  A ratio of 1 (no pitch change) is just a copy. */
+static int resample (const float * data, int samples, float * out, int maxsamples, float ratio)
+{
+    if (ratio == 1)
+    {
+        memcpy (out, data, sizeof (float) * samples);
+        return samples;
+    }
 
     SRC_DATA d = SRC_DATA ();
 
-    d.data_in = data.begin ();
-    d.input_frames = inframes;
-    d.data_out = & b[oldlen];
-    d.output_frames = maxframes;
+    d.data_in = data;
+    d.input_frames = samples / curchans;
+    d.data_out = out;
+    d.output_frames = maxsamples / curchans;
     d.src_ratio = ratio;
 
     src_process (srcstate, & d);
-    b.resize (oldlen + d.output_frames_gen * curchans);
+    return d.output_frames_gen * curchans;
 }
 
-bool SpeedPitch::flush (bool force)
+static int max_resampled (int samples, float ratio)
 {
-    src_reset (srcstate);
+    return (ratio == 1) ? samples : ((int) (samples / curchans * ratio) + 256) * curchans;
+}
 
-    in.resize (0);
-    out.resize (0);
+/* In-place radix-2 complex FFT of size fftsize (unscaled either way). */
+static void fft (float * re, float * im, bool inverse)
+{
+    int n = fftsize;
 
-    /* The source and destination pointers give the center of the next cosine
-     * window to be copied, relative to the current input and output buffers. */
-    src = dst = 0;
+    for (int i = 1, j = 0; i < n; i ++)
+    {
+        int bit = n >> 1;
+        for (; j & bit; bit >>= 1)
+            j ^= bit;
+        j ^= bit;
+
+        if (i < j)
+        {
+            std::swap (re[i], re[j]);
+            std::swap (im[i], im[j]);
+        }
+    }
 
-    /* The output buffer always extends right of the destination pointer by half
-     * the width of a cosine window. */
-    out.insert (0, width / 2);
+    for (int len = 2; len <= n; len <<= 1)
+    {
+        int half = len / 2;
+        int step = n / len;
+
+        for (int i = 0; i < n; i += len)
+        {
+            for (int k = 0; k < half; k ++)
+            {
+                float wr = fft_cos[k * step];
+                float wi = inverse ? fft_sin[k * step] : -fft_sin[k * step];
+                float * ar = re + i + k, * ai = im + i + k;
+                float * br = ar + half, * bi = ai + half;
+                float tr = * br * wr - * bi * wi;
+                float ti = * br * wi + * bi * wr;
+                * br = * ar - tr;
+                * bi = * ai - ti;
+                * ar += tr;
+                * ai += ti;
+            }
+        }
+    }
+}
 
-    return true;
+/* Sums all channels of frames start .. start + len * factor - 1 of the input,
+ * factor frames at a time, into len mono samples. */
+static void mixdown (int start, int len, int factor, float * mono)
+{
+    const float * f = in.begin () + start * curchans;
+
+    for (int k = 0; k < len; k ++)
+    {
+        float sum = 0;
+        for (int j = 0; j < factor * curchans; j ++)
+            sum += * f ++;
+        mono[k] = sum;
+    }
 }
 
-void SpeedPitch::start (int & chans, int & rate)
+/* Picks the lag (0 .. lags - 1) at which b best matches a (normalized cross-
+ * correlation), given the raw correlations corr[]. */
+static int best_lag (const float * corr, const float * b, int len, int lags)
 {
-    curchans = chans;
-    currate = rate;
+    double energy = 0;
+    for (int i = 0; i < len; i ++)
+        energy += b[i] * b[i];
+
+    int best = 0;
+    double best_score = -HUGE_VAL;
+
+    for (int lag = 0; lag < lags; lag ++)
+    {
+        double score = corr[lag] / sqrt (energy + 1e-9);
+        if (score > best_score)
+        {
+            best_score = score;
+            best = lag;
+        }
+
+        /* slide the energy window along */
+        if (lag + 1 < lags)
+        {
+            float leaving = b[lag], entering = b[lag + len];
+            energy = aud::max (energy + entering * entering - leaving * leaving, 0.0);
+        }
+    }
+
+    return best;
+}
+
+/* Returns the shift (in frames, -tolerance to +tolerance) from the nominal
+ * window center pos at which the input best continues the previously copied
+ * window, whose natural continuation is centered at nat.  The shift is limited
+ * so that the whole window is still in the buffer (where the unshifted one is),
+ * and is 0 if the stretch to compare with isn't in the buffer. */
+static int wsola_search (int pos, int nat)
+{
+    int frames = in.len () / curchans;
+    int half = seglen / 2;
+    int reach = width / 2 / curchans;
+
+    if (nat - half < 0 || nat + half > frames)
+        return 0;
+
+    int lo = aud::min (0, aud::max (-tolerance, reach - pos));
+    int hi = aud::max (0, aud::min (tolerance, frames - reach - pos));
+    if (lo == hi)
+        return 0;
+
+    /* Coarse search: decimated mono, template a in the real part and search
+     * region b in the imaginary part, so one FFT transforms both. */
+    int alen = seglen / decim;
+    int blen = (seglen + hi - lo) / decim;
+    int lags = blen - alen + 1;
+    float * re = fft_re.begin (), * im = fft_im.begin ();
+
+    memset (re, 0, sizeof (float) * fftsize);
+    memset (im, 0, sizeof (float) * fftsize);
+    mixdown (nat - half, alen, decim, re);
+    mixdown (pos + lo - half, blen, decim, im);
+    memcpy (mono_b.begin (), im, sizeof (float) * blen);
+
+    fft (re, im, false);
+
+    /* Unpack A and B (bins k and n - k together), then form conj (A) * B. */
+    for (int k = 0; k <= fftsize / 2; k ++)
+    {
+        int nk = (fftsize - k) & (fftsize - 1);
+        float xr = re[k], xi = im[k], yr = re[nk], yi = im[nk];
+
+        float ar = (xr + yr) / 2, ai = (xi - yi) / 2;    /* A[k] */
+        float br = (xi + yi) / 2, bi = (yr - xr) / 2;    /* B[k] */
+        float cr = ar * br + ai * bi, ci = ar * bi - ai * br;
+
+        re[k] = cr;
+        im[k] = ci;
+        /* The correlation of real signals is real, so the spectrum is
+         * conjugate-symmetric. */
+        re[nk] = cr;
+        im[nk] = -ci;
+    }
+
+    fft (re, im, true);
+
+    int shift = best_lag (re, mono_b.begin (), alen, lags) * decim + lo;
+    if (decim == 1)
+        return shift;
+
+    /* Fine search at the full rate, within one decimation step either side. */
+    lo = aud::max (shift - decim, lo);
+    hi = aud::min (shift + decim, hi);
+    float * a = mono_a.begin (), * b = mono_b.begin ();
+
+    mixdown (nat - half, seglen, 1, a);
+    mixdown (pos + lo - half, seglen + hi - lo, 1, b);
+
+    for (int lag = 0; lag <= hi - lo; lag ++)
+    {
+        double sum = 0;
+        for (int i = 0; i < seglen; i ++)
+            sum += a[i] * b[lag + i];
+        re[lag] = sum;
+    }
+
+    return lo + best_lag (re, b, seglen, hi - lo + 1);
+}
+
+/* Sets up the windows (and resampler) for the chosen method. */
+static void setup_method ()
+{
+    method = cur_method;
 
     if (srcstate)
         src_delete (srcstate);
 
-    srcstate = src_new (SRC_LINEAR, curchans, nullptr);
+    srcstate = src_new ((method == METHOD_WSOLA) ? SRC_SINC_FASTEST : SRC_LINEAR, curchans, nullptr);
 
     /* Calculate the width of the cosine window and the spacing interval for
      * output.  Make them both even numbers for convenience.  Note that the
      * cosine window is applied without deinterleaving the audio samples. */
-    outstep = ((currate / FREQ) & ~1) * curchans;
+    outstep = ((currate / ((method == METHOD_WSOLA) ? WSOLA_FREQ : FREQ)) & ~1) * curchans;
     width = outstep * OVERLAP;
 
     /* Generate the cosine window, scaled vertically to compensate for the
@@ -144,58 +461,164 @@ void SpeedPitch::start (int & chans, int & rate)
     for (int i = 0; i < width; i ++)
         cosine[i] = (1.0 - cos (2.0 * M_PI * i / width)) / OVERLAP;
 
+    tolerance = 0;
+    if (method != METHOD_WSOLA)
+        return;
+
+    /* Compare one output interval's worth, and let each window move up to half
+     * an interval either way. */
+    seglen = outstep / curchans;
+    tolerance = seglen / 2;
+    decim = aud::max (currate / WSOLA_SEARCH_RATE, 1);
+
+    for (fftsize = 2; fftsize < (seglen + 2 * tolerance) / decim; fftsize <<= 1)
+        ;
+
+    fft_re.resize (fftsize);
+    fft_im.resize (fftsize);
+    fft_cos.resize (fftsize / 2);
+    fft_sin.resize (fftsize / 2);
+    for (int i = 0; i < fftsize / 2; i ++)
+    {
+        fft_cos[i] = cos (2.0 * M_PI * i / fftsize);
+        fft_sin[i] = sin (2.0 * M_PI * i / fftsize);
+    }
+
+    mono_a.resize (seglen);
+    mono_b.resize (aud::max (seglen + 2 * tolerance, fftsize));
+}
+
+bool SpeedPitch::flush (bool force)
+{
+    src_reset (srcstate);
+
+    in.clear ();
+    out.clear ();
+
+    /* The source and destination pointers give the center of the next cosine
+     * window to be copied, relative to the current input and output buffers. */
+    src = dst = 0;
+    have_prev = false;
+
+    /* The output buffer always extends right of the destination pointer by half
+     * the width of a cosine window. */
+    out.append_zeros (width / 2);
+
+    return true;
+}
+
+void SpeedPitch::start (int & chans, int & rate)
+{
+    curchans = chans;
+    currate = rate;
+
+    __atomic_store_n (& params_changed, false, __ATOMIC_RELAXED);
+    load_params ();
+    setup_method ();
     flush (true);
 }
 
 Index<float> & SpeedPitch::process (Index<float> & data, bool ending)
 {
-    const float * cosine_center = & cosine[width / 2];
-    float pitch = aud_get_double (CFGSECT, "pitch");
-    float speed = aud_get_double (CFGSECT, "speed");
+    if (__atomic_exchange_n (& params_changed, false, __ATOMIC_ACQUIRE))
+    {
+        bool was_bypassed = ((float) (1.0 / cur_pitch) == 1);
+        load_params ();
+
+        /* resample () bypasses the resampler at a pitch of 1, so whatever it
+         * still holds from before would be stale; start it over whenever the
+         * bypass turns on or off. */
+        if (((float) (1.0 / cur_pitch) == 1) != was_bypassed)
+            src_reset (srcstate);
+    }
 
-    /* Copy the passed audio to the input buffer, scaled to adjust pitch. */
-    add_data (in, data, 1.0 / pitch);
+    /* Switched methods?  Start over with the new windows. */
+    if (cur_method != method)
+    {
+        setup_method ();
+        flush (true);
+    }
 
-    if (! aud_get_bool (CFGSECT, "decouple"))
+    const float * cosine_center = & cosine[width / 2];
+    float ratio = 1.0 / cur_pitch;
+
+    if (! cur_decouple)
     {
-        data = std::move (in);
+        /* Just change the pitch (and speed along with it), swapping buffers with
+         * the caller instead of copying. */
+        if (ratio != 1)
+        {
+            pitched.resize (max_resampled (data.len (), ratio));
+            pitched.resize (resample (data.begin (), data.len (), pitched.begin (), pitched.len (), ratio));
+            std::swap (data, pitched);
+        }
         return data;
     }
 
+    /* Copy the passed audio to the input buffer, scaled to adjust pitch. */
+    int maxsamples = max_resampled (data.len (), ratio);
+    in.commit (resample (data.begin (), data.len (), in.reserve (maxsamples), maxsamples, ratio));
+
     /* Calculate the spacing interval for input. */
-    int instep = (int) round ((outstep / curchans) * speed / pitch) * curchans;
+    int instep = aud::max ((int) round ((outstep / curchans) * cur_speed / cur_pitch), 1) * curchans;
 
-    /* Stop copying half a window's width before the end of the input buffer (or
-     * right up to the end of the buffer if the song is ending). */
-    int stop = in.len () - (ending ? 0 : width / 2);
+    /* Stop copying half a window's width (plus the WSOLA search tolerance)
+     * before the end of the input buffer (or right up to the end of the buffer
+     * if the song is ending). */
+    int stop = in.len () - (ending ? 0 : width / 2 + tolerance * curchans);
+
+    /* Make room for all the windows up front. */
+    if (src <= stop)
+        out.reserve (((stop - src) / instep + 1) * outstep);
 
     while (src <= stop)
     {
+        /* Where to really copy the window from (WSOLA may shift it a bit). */
+        int actual = src;
+        if (method == METHOD_WSOLA)
+        {
+            if (have_prev)
+                actual += wsola_search (src / curchans, (prev_actual + outstep) / curchans) * curchans;
+
+            prev_actual = actual;
+            have_prev = true;
+        }
+
         /* Truncate the window to avoid overflows if necessary. */
-        int begin = aud::max (-(width / 2), aud::max (-src, -dst));
-        int end = aud::min (width / 2, aud::min (in.len () - src, out.len () - dst));
+        int begin = aud::max (-(width / 2), aud::max (-actual, -dst));
+        int end = aud::min (width / 2, aud::min (in.len () - actual, out.len () - dst));
 
-        for (int i = begin; i < end; i ++)
-            out[dst + i] += in[src + i] * cosine_center[i];
+        if (end > begin)
+            overlap_add (out.begin () + dst + begin, in.begin () + actual + begin,
+             cosine_center + begin, end - begin);
 
         src += instep;
         dst += outstep;
 
-        out.insert (-1, outstep);
+        out.append_zeros (outstep);
     }
 
-    /* Discard input up to half a window's width before the source pointer (or
-     * right up to the previous source pointer if the song is ending. */
-    int seek = aud::clamp (0, src - (ending ? instep : width / 2), in.len ());
-    in.remove (0, seek);
-    src -= seek;
+    /* Discard input up to half a window's width (plus the WSOLA search
+     * tolerance, since the next window may be taken from that far left) before
+     * the source pointer (or right up to the previous source pointer if the
+     * song is ending. */
+    int seek = src - (ending ? instep : width / 2 + tolerance * curchans);
 
-    data.resize (0);
+    /* (WSOLA also needs to keep what the next window will be compared with.) */
+    if (method == METHOD_WSOLA && have_prev)
+        seek = aud::min (seek, prev_actual + outstep - seglen / 2 * curchans);
+
+    seek = aud::clamp (0, seek, in.len ());
+    in.discard (seek);
+    src -= seek;
+    prev_actual -= seek;
 
     /* Return output up to half a window's width before the destination pointer
      * (or right up to the previous destination pointer if the song is ending). */
     int ret = aud::clamp (0, dst - (ending ? outstep : width / 2), out.len ());
-    data.move_from (out, 0, 0, ret, true, true);
+    data.resize (ret);
+    memcpy (data.begin (), out.begin (), sizeof (float) * ret);
+    out.discard (ret);
     dst -= ret;
 
     return data;
@@ -203,15 +626,14 @@ Index<float> & SpeedPitch::process (Index<float> & data, bool ending)
 
 int SpeedPitch::adjust_delay (int delay)
 {
-    if (! aud_get_bool (CFGSECT, "decouple"))
+    if (! cur_decouple)
         return delay;
 
     float samples_to_ms = 1000.0 / (curchans * currate);
-    float speed = aud_get_double (CFGSECT, "speed");
     int in_samples = in.len () - src;
     int out_samples = dst;
 
-    return (delay + in_samples * samples_to_ms) * speed + out_samples * samples_to_ms;
+    return (delay + in_samples * samples_to_ms) * cur_speed + out_samples * samples_to_ms;
 }
 
 static void sync_speed ()
@@ -221,6 +643,18 @@ static void sync_speed ()
         aud_set_double (CFGSECT, "speed", aud_get_double (CFGSECT, "pitch"));
         hook_call ("speed-pitch set speed", nullptr);
     }
+
+    update_params ();
+}
+
+static void method_changed ()
+{
+    update_params ();
+}
+
+static void speed_changed ()
+{
+    hook_call ("speed-pitch set speed", nullptr);
 }
 
 static void pitch_changed ()
@@ -241,6 +675,7 @@ const char * const SpeedPitch::defaults[] = {
  "decouple", "TRUE",
  "speed", "1",
  "pitch", "1",
+ "method", "0",
  nullptr};
 
 const PreferencesWidget SpeedPitch::widgets[] = {
@@ -248,9 +683,14 @@ const PreferencesWidget SpeedPitch::widgets[] = {
     WidgetCheck (N_("Decouple from pitch"),
         WidgetBool (CFGSECT, "decouple", sync_speed)),
     WidgetSpin (N_("Multiplier:"),
-        WidgetFloat (CFGSECT, "speed", nullptr, "speed-pitch set speed"),
+        WidgetFloat (CFGSECT, "speed", speed_changed, "speed-pitch set speed"),
         {MINSPEED, MAXSPEED, 0.05},
         WIDGET_CHILD),
+    WidgetLabel (N_("<b>Method</b>")),
+    WidgetRadio (N_("Overlap-add (fastest)"),
+        WidgetInt (CFGSECT, "method", method_changed), {METHOD_OLA}),
+    WidgetRadio (N_("WSOLA (better quality, fewer artifacts)"),
+        WidgetInt (CFGSECT, "method", method_changed), {METHOD_WSOLA}),
     WidgetLabel (N_("<b>Pitch</b>")),
     WidgetSpin (nullptr,
         WidgetFloat (semitones, semitones_changed, "speed-pitch set semitones"),
@@ -267,17 +707,33 @@ bool SpeedPitch::init ()
 {
     aud_config_set_defaults (CFGSECT, defaults);
     pitch_changed ();
+
+    hook_associate ("speed-pitch set speed", update_params, nullptr);
+    hook_associate ("speed-pitch set pitch", update_params, nullptr);
+
     return true;
 }
 
 void SpeedPitch::cleanup ()
 {
+    hook_dissociate ("speed-pitch set speed", update_params);
+    hook_dissociate ("speed-pitch set pitch", update_params);
+
     if (srcstate)
         src_delete (srcstate);
 
     srcstate = nullptr;
 
     cosine.clear ();
+    in.mem.clear ();
     in.clear ();
+    out.mem.clear ();
     out.clear ();
+    pitched.clear ();
+    fft_re.clear ();
+    fft_im.clear ();
+    fft_cos.clear ();
+    fft_sin.clear ();
+    mono_a.clear ();
+    mono_b.clear ();
 }
@@ -0,0 +1,57 @@
+/* Audacious - Cross-platform multimedia player
+ * Copyright (C) 2005-2022  Audacious development team
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ *
+ */
+
+#ifndef __VORBIS_REPLAYGAIN_H
+#define __VORBIS_REPLAYGAIN_H
+
+/* Shared by the Vorbis and FLAC plugins, which both write ReplayGain values
+ * as Vorbis comments. */
+
+#include <math.h>
+#include <stdint.h>
+
+#include <libfauxdcore/audstrings.h>
+
+/* Formats a ReplayGain value (gain in dB with two decimals, or linear peak
+ * with six) without depending on the locale. */
+static inline StringBuf gain_to_str (int value, int unit, bool is_gain)
+{
+    int scale = is_gain ? 100 : 1000000;
+    int64_t scaled = llround ((double) value * scale / unit);
+    int64_t magnitude = (scaled < 0) ? - scaled : scaled;
+
+    return str_printf ("%s%d.%0*d%s", (scaled < 0) ? "-" : "",
+     (int) (magnitude / scale), is_gain ? 2 : 6, (int) (magnitude % scale),
+     is_gain ? " dB" : "");
+}
+
+/* Whether an existing ReplayGain comment already holds value, to the precision
+ * gain_to_str () would write it with.  Tag saves that don't change the values
+ * then leave the comment as it was. */
+static inline bool gain_str_matches (const char * str, int value, int unit, bool is_gain)
+{
+    if (! str)
+        return false;
+
+    int scale = is_gain ? 100 : 1000000;
+    return llround (str_to_double (str) * scale) == llround ((double) value * scale / unit);
+}
+
+#endif
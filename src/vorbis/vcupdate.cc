@@ -37,6 +37,7 @@
 
 #include "vorbis.h"
 #include "vcedit.h"
+#include "replaygain.h"
 
 typedef SimpleHash<String, String> Dictionary;
 
@@ -97,6 +98,24 @@ static void insert_int_tuple_field_to_dictionary (const Tuple & tuple,
         dict.remove (String (key));
 }
 
+/* ReplayGain values are only replaced when the tuple has different ones (e.g.
+ * after a loudness scan), never removed. */
+static void insert_gain_tuple_field_to_dictionary (const Tuple & tuple,
+ Tuple::Field field, Tuple::Field unit_field, Dictionary & dict, const char * key)
+{
+    int unit = tuple.get_int (unit_field);
+    bool is_gain = (unit_field == Tuple::GainDivisor);
+
+    if (! tuple.is_set (field) || unit <= 0)
+        return;
+
+    String * cur = dict.lookup (String (key));
+    if (cur && gain_str_matches (* cur, tuple.get_int (field), unit, is_gain))
+        return;
+
+    dict.add (String (key), String (gain_to_str (tuple.get_int (field), unit, is_gain)));
+}
+
 /* JWT:  EMULATE: $>kid3-cli -c 'set picture:"<imagefid>" "front cover"' <songfile.ogg>
    SEE:  https://xiph.org/flac/format.html#metadata_block_picture
 */
@@ -175,6 +194,11 @@ bool VorbisPlugin::write_tuple (const char * filename, VFSFile & file, const Tup
     insert_str_tuple_field_to_dictionary (tuple, Tuple::CatalogNum, dict, "CATALOGNUMBER");
     insert_str_tuple_field_to_dictionary (tuple, Tuple::Performer, dict, "PERFORMER");
 
+    insert_gain_tuple_field_to_dictionary (tuple, Tuple::TrackGain, Tuple::GainDivisor, dict, "REPLAYGAIN_TRACK_GAIN");
+    insert_gain_tuple_field_to_dictionary (tuple, Tuple::TrackPeak, Tuple::PeakDivisor, dict, "REPLAYGAIN_TRACK_PEAK");
+    insert_gain_tuple_field_to_dictionary (tuple, Tuple::AlbumGain, Tuple::GainDivisor, dict, "REPLAYGAIN_ALBUM_GAIN");
+    insert_gain_tuple_field_to_dictionary (tuple, Tuple::AlbumPeak, Tuple::PeakDivisor, dict, "REPLAYGAIN_ALBUM_PEAK");
+
     String comment = tuple.get_str (Tuple::Comment);
     bool wrote_art = false;
     if (comment && comment[0] && ! strncmp ((const char *) comment, "file://", 7)